@@ -24,10 +24,10 @@
 
 #include <stdint.h>
 #include <avr/io.h>
-#include <util/delay.h>
 
 //#define USE_RS485_RTS 1
 #include "msg_processor.h"
+#include "ticks.h"
 
 
 //  a140808       ATmega32
@@ -64,9 +64,10 @@
 //                   (inverted logic)                     current state               new state
 #define WRITE_DIGITAL_OUTPUTS_MASKED(b, m)  WRITE_DIGITAL_OUTPUTS( (READ_DIGITAL_OUTPUTS & ~(m)) | ((b) & (m)) )
 //                   (inverted logic)
-#define CLEAR_DIGITAL_OUTPUT_BIT(b)   PORTA |=  (1 << ( ((b)<5) ? (4-(b)) : ((b)-1) ))
-#define SET_DIGITAL_OUTPUT_BIT(b)     PORTA &= ~(1 << ( ((b)<5) ? (4-(b)) : ((b)-1) ))
-#define TOGGLE_DIGITAL_OUTPUT_BIT(b)  PORTA ^=  (1 << ( ((b)<5) ? (4-(b)) : ((b)-1) ))
+#define CLEAR_DIGITAL_OUTPUT_BIT(b)   PORTA |=  DIGITAL_OUTPUT_MASK_PINS(_BV(b))
+#define SET_DIGITAL_OUTPUT_BIT(b)     PORTA &= ~DIGITAL_OUTPUT_MASK_PINS(_BV(b))
+//                   PORTA pins behind a register mask, bit n of REG_OUTPUT_1 is relay n+1
+#define DIGITAL_OUTPUT_MASK_PINS(m)   ( ((m) & 0xf0) | (((m) & 0x08) >> 3) | (((m) & 0x04) >> 1) | (((m) & 0x02) << 1) | (((m) & 0x01) << 3) )
 // 1-based relay num to bit decoder
 //#define RELAY_NUM_TO_BIT(b)  (1 << (((b)<5) ? (4-(b)) : ((b)-1)))
 #define IS_DIGITAL_OUTPUT_BIT_SET(x)  (_BV(x) == (READ_DIGITAL_OUTPUTS & _BV(x)))
@@ -89,6 +90,126 @@ struct Subscription
 static Subscription s_input;
 static Subscription s_output;
 
+// the output subscription is scanned on this tick budget rather than on
+// every wakeup of the main loop
+#define SUBSCRIPTION_SCAN_MS  10
+static uint16_t s_lastScan = 0;
+
+//
+// inputs are sampled from the 1ms tick and debounced with 2 bit vertical
+// counters, bit n of s_vc0/s_vc1 is the counter for input n so all 8
+// inputs step together in a handful of instructions. an input changes
+// state after reading the new state on 4 samples in a row.
+//
+// each input is sampled every (debounce ms / 4) ticks, which makes the
+// debounce time per input configurable through REG_DEBOUNCE_1 to
+// REG_DEBOUNCE_8 (rounded down to a multiple of 4ms, 4ms minimum)
+//
+#define DEBOUNCE_DEFAULT_MS  20
+static uint8_t s_debounceMs[8];     // REG_DEBOUNCE_x as written
+static uint8_t s_samplePeriod[8];   // ticks between samples
+static uint8_t s_sampleCount[8];    // ticks until the next sample
+static uint8_t s_vc0 = 0xff;        // vertical counter, low bits
+static uint8_t s_vc1 = 0xff;        // vertical counter, high bits
+static volatile uint8_t s_inputs = 0;          // debounced input state
+static volatile bool s_inputsChanged = false;  // s_inputs changed since on_poll() looked
+
+
+////////////////////////////////////////
+static void set_debounce(const uint8_t p_input, const uint8_t p_debounceMs)
+{
+    s_debounceMs[p_input] = p_debounceMs;
+    s_samplePeriod[p_input] = ((p_debounceMs < 8) ? 1 : (p_debounceMs >> 2));
+}
+
+////////////////////////////////////////
+// timer isr, see ticks.h
+void ticks::on_tick(void)
+{
+    uint8_t clock = 0;
+    for(uint8_t i=0; i<8; ++i)
+    {
+        if(--s_sampleCount[i] == 0)
+        {
+            s_sampleCount[i] = s_samplePeriod[i];
+            clock |= _BV(i);
+        }
+    }
+    if(0 == clock)
+    {
+        return;
+    }
+
+    // step the counters of the sampled inputs, inputs that read the same
+    // as the debounced state reset theirs, the rest count down and
+    // change state when their counter rolls over
+    const uint8_t delta = ((READ_DIGITAL_INPUTS ^ s_inputs) & clock);
+    const uint8_t vc0 = ~(s_vc0 & delta);
+    const uint8_t vc1 = (vc0 ^ (s_vc1 & delta));
+    s_vc0 = ((s_vc0 & ~clock) | (vc0 & clock));
+    s_vc1 = ((s_vc1 & ~clock) | (vc1 & clock));
+
+    const uint8_t toggle = (delta & vc0 & vc1);
+    if(0 != toggle)
+    {
+        s_inputs ^= toggle;
+        s_inputsChanged = true;
+    }
+}
+
+//
+// relay pulses run off the 1ms tick rather than blocking the message
+// pump, each relay has its own deadline so all 8 can pulse at once.
+// relays are numbered by their REG_OUTPUT_1 bit, as the mask writes are.
+// deadlines are start + duration compared with wrapping subtraction,
+// which holds for any 16 bit duration.
+//
+struct Pulse
+{
+    uint16_t m_start;       // tick the pulse began
+    uint16_t m_durationMs;  // how long to hold it
+};
+static Pulse s_pulse[8];
+static uint8_t s_pulseActive = 0;  // one bit per relay with a pulse running
+
+
+////////////////////////////////////////
+static void start_pulse(const uint8_t p_bit, const uint16_t p_durationMs)
+{
+    if(0 == p_durationMs)
+    {
+        return;
+    }
+
+    // a new pulse on a relay that is already pulsing extends it
+    if(0 == (s_pulseActive & _BV(p_bit)))
+    {
+        PORTA ^= DIGITAL_OUTPUT_MASK_PINS(_BV(p_bit));
+        s_pulseActive |= _BV(p_bit);
+    }
+    s_pulse[p_bit].m_start = ticks::get();
+    s_pulse[p_bit].m_durationMs = p_durationMs;
+}
+
+////////////////////////////////////////
+static void service_pulses(void)
+{
+    if(0 == s_pulseActive)
+    {
+        return;
+    }
+
+    const uint16_t now = ticks::get();
+    for(uint8_t bit=0; bit<8; ++bit)
+    {
+        if((0 != (s_pulseActive & _BV(bit))) && ((uint16_t)(now - s_pulse[bit].m_start) >= s_pulse[bit].m_durationMs))
+        {
+            PORTA ^= DIGITAL_OUTPUT_MASK_PINS(_BV(bit));
+            s_pulseActive &= ~_BV(bit);
+        }
+    }
+}
+
 
 ////////////////////////////////////////
 void avr_init(void)
@@ -107,6 +228,14 @@ void avr_init(void)
     DDRC  &= 0x03;  // set ddr  c.2 to  c.7 to logic 0 (input)
     DDRD  &= 0x5f;  // set ddr  d.5 and d.7 to logic 0 (input)
 
+    // debouncing starts from the current input state
+    for(uint8_t i=0; i<8; ++i)
+    {
+        set_debounce(i, DEBOUNCE_DEFAULT_MS);
+        s_sampleCount[i] = 1;
+    }
+    s_inputs = READ_DIGITAL_INPUTS;
+
     // configure A140808 outputs
     //  Relay 1       PORTA.3
     //  Relay 2       PORTA.2
@@ -118,22 +247,37 @@ void avr_init(void)
     //  Relay 8       PORTA.7
     PORTA = 0xff;  // set port a to logic 1 (relays off)
     DDRA |= 0xff;  // set ddr  a to logic 1 (output)
+
+    // 1ms tick for the pulse scheduler, counts once interrupts are enabled
+    ticks::init();
 }
 
 ////////////////////////////////////////
 void on_poll(MsgProcessor& p_mp)
 {
     // our timeslice
-    if(s_input.m_isSubscribed)
+    service_pulses();
+
+    // the timer isr flags debounced input changes
+    if(s_inputsChanged)
     {
-        const uint8_t inputs = READ_DIGITAL_INPUTS;
-        if(inputs != s_input.m_value)
+        s_inputsChanged = false;
+        const uint8_t inputs = s_inputs;
+        if(s_input.m_isSubscribed && (inputs != s_input.m_value))
         {
             // value changed
             s_input.m_value = inputs;
             p_mp.dispatch_subscribe_register(REG_INPUT_1, inputs);
         }
     }
+
+    const uint16_t now = ticks::get();
+    if((uint16_t)(now - s_lastScan) < SUBSCRIPTION_SCAN_MS)
+    {
+        return;
+    }
+    s_lastScan = now;
+
     if(s_output.m_isSubscribed)
     {
         const uint8_t outputs = READ_DIGITAL_OUTPUTS;
@@ -160,7 +304,7 @@ void on_read_register(MsgProcessor& p_mp, const uint8_t p_registerAddress)
     {
         case REG_INPUT_1:
         {
-            const uint8_t inputs = READ_DIGITAL_INPUTS;
+            const uint8_t inputs = s_inputs;
             p_mp.dispatch_write_register(REG_INPUT_1, inputs);
             break;
         }
@@ -170,6 +314,12 @@ void on_read_register(MsgProcessor& p_mp, const uint8_t p_registerAddress)
             p_mp.dispatch_write_register(REG_OUTPUT_1, outputs);
             break;
         }
+        case REG_DEBOUNCE_1: case REG_DEBOUNCE_1 + 1: case REG_DEBOUNCE_1 + 2: case REG_DEBOUNCE_1 + 3:
+        case REG_DEBOUNCE_1 + 4: case REG_DEBOUNCE_1 + 5: case REG_DEBOUNCE_1 + 6: case REG_DEBOUNCE_8:
+        {
+            p_mp.dispatch_write_register(p_registerAddress, s_debounceMs[p_registerAddress - REG_DEBOUNCE_1]);
+            break;
+        }
         default:
         {
             p_mp.dispatch_write_register(REG_ERR_UNKNOWN);
@@ -185,9 +335,19 @@ void on_write_register(MsgProcessor& p_mp, const uint8_t p_registerAddress, cons
     {
         case REG_OUTPUT_1:
         {
+            // an explicit write to a relay wins over a pulse still running
+            // on it, otherwise the end of the pulse would toggle it back
+            s_pulseActive &= ~p_mask;
             WRITE_DIGITAL_OUTPUTS_MASKED(p_value, p_mask);
             break;
         }
+        case REG_DEBOUNCE_1: case REG_DEBOUNCE_1 + 1: case REG_DEBOUNCE_1 + 2: case REG_DEBOUNCE_1 + 3:
+        case REG_DEBOUNCE_1 + 4: case REG_DEBOUNCE_1 + 5: case REG_DEBOUNCE_1 + 6: case REG_DEBOUNCE_8:
+        {
+            const uint8_t input = (p_registerAddress - REG_DEBOUNCE_1);
+            set_debounce(input, ((s_debounceMs[input] & ~p_mask) | (p_value & p_mask)));
+            break;
+        }
         default:
         {
             break;
@@ -202,6 +362,7 @@ void on_write_register_bit(MsgProcessor& p_mp, const uint8_t p_registerAddress,
     {
         case REG_OUTPUT_1:
         {
+            s_pulseActive &= ~_BV(p_bit);
             if(p_state)
             {
                 SET_DIGITAL_OUTPUT_BIT(p_bit);
@@ -220,16 +381,14 @@ void on_write_register_bit(MsgProcessor& p_mp, const uint8_t p_registerAddress,
 }
 
 ////////////////////////////////////////
-void on_pulse_register_bit(MsgProcessor& p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const uint8_t p_durationMs)
+void on_pulse_register_bit(MsgProcessor& p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const uint16_t p_durationMs)
 {
     switch(p_registerAddress)
     {
         case REG_OUTPUT_1:
         {
-            // p_duration is in milli-seconds
-            TOGGLE_DIGITAL_OUTPUT_BIT(p_bit);
-            for(uint8_t i=p_durationMs; i>0; --i) _delay_ms(1);
-            TOGGLE_DIGITAL_OUTPUT_BIT(p_bit);
+            // p_duration is in milli-seconds, on_poll() ends the pulse
+            start_pulse(p_bit, p_durationMs);
             break;
         }
         default:
@@ -246,7 +405,7 @@ void on_subscribe_register(MsgProcessor& p_mp, const uint8_t p_registerAddress,
     {
         case REG_INPUT_1:
         {
-            const uint8_t inputs = READ_DIGITAL_INPUTS;
+            const uint8_t inputs = s_inputs;
             s_input.m_isSubscribed = !p_cancel;
             s_input.m_value = p_cancel ? 0 : inputs;
             p_mp.dispatch_subscribe_register(REG_INPUT_1, inputs, p_cancel);
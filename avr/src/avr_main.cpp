@@ -21,13 +21,17 @@
 //
 
 #include <avr/interrupt.h>
-#include <util/delay.h>
+#include <avr/sleep.h>
 #include <avr/io.h>
 
 #include "msg_processor.h"
+#include "events.h"
 
 void avr_init(void);  // from avr_impl.cpp
 
+// see events.h
+volatile uint8_t g_events = 0;
+
 ////////////////////////////////////////
 FUSES =
 {
@@ -75,14 +79,30 @@ int main(void)
 
     // enable global interrupts
     // http://winavr.scienceprog.com/avr-gcc-tutorial/interrupt-driven-avr-usart-communication.html
-    //set_sleep_mode(SLEEP_MODE_IDLE);
+    // idle keeps the usart and timer 0 running, either one wakes us
+    set_sleep_mode(SLEEP_MODE_IDLE);
     sei();
 
     for(;;)
     {
-        // check for new messages
-        mp.poll();
-        _delay_ms(100);
+        // sleep until an isr posts an event, sei() takes effect after
+        // the next instruction so nothing can slip in before sleep_cpu()
+        cli();
+        if(0 == g_events)
+        {
+            sleep_enable();
+            sei();
+            sleep_cpu();
+            sleep_disable();
+        }
+        sei();
+
+        // new frames (EVENT_RX) or the 1ms tick (EVENT_TICK), poll()
+        // drains every queued frame and on_poll() handles the timed work
+        if(0 != events::take())
+        {
+            mp.poll();
+        }
     }
 
     return(0);
@@ -0,0 +1,55 @@
+//
+// Copyright 2015 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including,
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#include <stdint.h>
+
+#include "crc16.h"
+
+
+// expand a generator over a run of table indexes
+#define CRC16_R4(f, n)    f(n), f((n) + 1), f((n) + 2), f((n) + 3)
+#define CRC16_R16(f, n)   CRC16_R4(f, n), CRC16_R4(f, (n) + 4), CRC16_R4(f, (n) + 8), CRC16_R4(f, (n) + 12)
+#define CRC16_R64(f, n)   CRC16_R16(f, n), CRC16_R16(f, (n) + 16), CRC16_R16(f, (n) + 32), CRC16_R16(f, (n) + 48)
+#define CRC16_R256(f)     CRC16_R64(f, 0), CRC16_R64(f, 64), CRC16_R64(f, 128), CRC16_R64(f, 192)
+
+#define CRC16_NIBBLE(n)   crc16_entry(n, 4)
+#define CRC16_BYTE(n)     crc16_entry(n)
+#define CRC16_SLICE1(n)   crc16_slice(n, 1)
+#define CRC16_SLICE2(n)   crc16_slice(n, 2)
+#define CRC16_SLICE3(n)   crc16_slice(n, 3)
+
+
+#if defined(CRC16_USE_NIBBLE)
+const uint16_t g_crc16_table[16] PROGMEM =
+{
+    CRC16_R16(CRC16_NIBBLE, 0)
+};
+#elif defined(CRC16_USE_SLICE4)
+const uint16_t g_crc16_table[4][256] PROGMEM =
+{
+    { CRC16_R256(CRC16_BYTE) },
+    { CRC16_R256(CRC16_SLICE1) },
+    { CRC16_R256(CRC16_SLICE2) },
+    { CRC16_R256(CRC16_SLICE3) },
+};
+#else
+const uint16_t g_crc16_table[256] PROGMEM =
+{
+    CRC16_R256(CRC16_BYTE)
+};
+#endif
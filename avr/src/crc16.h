@@ -0,0 +1,124 @@
+//
+// Copyright 2015 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including,
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#ifndef __crc16_h__
+#define __crc16_h__
+
+#include <stdint.h>
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#define CRC16_READ(p)  pgm_read_word(p)
+#else
+#define PROGMEM
+#define CRC16_READ(p)  (*(p))
+#endif // __AVR__
+
+
+//
+// crc16, reflected poly 0xa001 (same results as the bitwise update_crc16
+// this replaces), table driven with the tables generated at compile time
+//
+// variants, pick one at build time:
+//   CRC16_USE_NIBBLE  16 entry table, 32 bytes, two lookups per byte
+//   CRC16_USE_TABLE   256 entry table, 512 bytes, one lookup per byte
+//   CRC16_USE_SLICE4  4 x 256 entry tables, 2k, four bytes per step in
+//                     crc16_update_block()
+//
+// the avr defaults to CRC16_USE_TABLE with the table in flash, host
+// builds default to CRC16_USE_SLICE4
+//
+#if !defined(CRC16_USE_NIBBLE) && !defined(CRC16_USE_TABLE) && !defined(CRC16_USE_SLICE4)
+#ifdef __AVR__
+#define CRC16_USE_TABLE
+#else
+#define CRC16_USE_SLICE4
+#endif // __AVR__
+#endif
+
+
+////////////////////////////////////////
+// one bit of the bitwise algorithm
+constexpr uint16_t crc16_step(const uint16_t p_crc)
+{
+    return((0 == (p_crc & 0x0001)) ? (p_crc >> 1) : ((p_crc >> 1) ^ 0xa001));
+}
+
+////////////////////////////////////////
+// table entry for p_val, 8 steps for a byte table, 4 for a nibble table
+constexpr uint16_t crc16_entry(const uint16_t p_val, const uint8_t p_steps=8)
+{
+    return((0 == p_steps) ? p_val : crc16_entry(crc16_step(p_val), p_steps - 1));
+}
+
+////////////////////////////////////////
+// slice table entry, the crc of byte p_val followed by p_slice zero bytes
+constexpr uint16_t crc16_slice(const uint16_t p_val, const uint8_t p_slice)
+{
+    return((0 == p_slice) ? crc16_entry(p_val) :
+        ((crc16_slice(p_val, p_slice - 1) >> 8) ^ crc16_entry(crc16_slice(p_val, p_slice - 1) & 0xff)));
+}
+
+static_assert(0xc0c1 == crc16_entry(0x01), "crc16 table generator is broken");
+static_assert(0xcc01 == crc16_entry(0x01, 4), "crc16 nibble table generator is broken");
+
+
+#if defined(CRC16_USE_NIBBLE)
+extern const uint16_t g_crc16_table[16] PROGMEM;
+#elif defined(CRC16_USE_SLICE4)
+extern const uint16_t g_crc16_table[4][256] PROGMEM;
+#else
+extern const uint16_t g_crc16_table[256] PROGMEM;
+#endif
+
+
+////////////////////////////////////////
+inline uint16_t crc16_update(const uint16_t p_crc, const uint8_t p_ch)
+{
+#if defined(CRC16_USE_NIBBLE)
+    uint16_t crc = p_crc;
+    crc = ((crc >> 4) ^ CRC16_READ(&g_crc16_table[(crc ^ p_ch) & 0x0f]));
+    crc = ((crc >> 4) ^ CRC16_READ(&g_crc16_table[(crc ^ (p_ch >> 4)) & 0x0f]));
+    return(crc);
+#elif defined(CRC16_USE_SLICE4)
+    return((p_crc >> 8) ^ CRC16_READ(&g_crc16_table[0][(p_crc ^ p_ch) & 0xff]));
+#else
+    return((p_crc >> 8) ^ CRC16_READ(&g_crc16_table[(p_crc ^ p_ch) & 0xff]));
+#endif
+}
+
+////////////////////////////////////////
+inline uint16_t crc16_update_block(const uint16_t p_crc, const uint8_t* p_data, uint8_t p_len)
+{
+    uint16_t crc = p_crc;
+#if defined(CRC16_USE_SLICE4)
+    for(; p_len >= 4; p_len -= 4, p_data += 4)
+    {
+        crc ^= (p_data[0] | ((uint16_t)p_data[1] << 8));
+        crc = (CRC16_READ(&g_crc16_table[3][crc & 0xff]) ^ CRC16_READ(&g_crc16_table[2][crc >> 8]) ^
+               CRC16_READ(&g_crc16_table[1][p_data[2]])  ^ CRC16_READ(&g_crc16_table[0][p_data[3]]));
+    }
+#endif
+    for(; p_len > 0; --p_len, ++p_data)
+    {
+        crc = crc16_update(crc, *p_data);
+    }
+    return(crc);
+}
+
+#endif // __crc16_h__
@@ -0,0 +1,69 @@
+//
+// Copyright 2015 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including,
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#ifndef __events_h__
+#define __events_h__
+
+#include <stdint.h>
+#include <util/atomic.h>
+
+
+//
+// wakeup events for the main loop
+//
+// the isrs post an event bit and main() sleeps until one is pending, the
+// check and the sleep happen with interrupts off so an event posted in
+// between still wakes the loop. interrupts that do not post (the usart
+// data register empty isr) wake the cpu but main() goes straight back
+// to sleep.
+//
+#define EVENT_RX    0x01  // usart rx complete isr queued a byte
+#define EVENT_TICK  0x02  // timer 0 1ms tick
+
+
+// defined in avr_main.cpp
+extern volatile uint8_t g_events;
+
+
+////////////////////////////////////////////////////////////
+namespace events
+{
+
+////////////////////////////////////////
+// from isr context only, interrupts are already off
+inline void post(const uint8_t p_event)
+{
+    g_events |= p_event;
+}
+
+////////////////////////////////////////
+// take and clear the pending events
+inline uint8_t take(void)
+{
+    uint8_t events;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        events = g_events;
+        g_events = 0;
+    }
+    return(events);
+}
+
+} // namespace events
+
+#endif // __events_h__
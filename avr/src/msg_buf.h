@@ -20,6 +20,7 @@
 #define __msg_buf_h__
 
 #include "ring_buffer.h"
+#include "crc16.h"
 
 
 //
@@ -35,7 +36,7 @@
 //   cccc     = crc of bytes 1-8 (hex 0-9, a-f)
 //   ]        = end message
 //
-#define RING_BUF_COUNT 14
+#define RING_BUF_COUNT 16  // 14 rounded up to a power of two for RingBuffer
 
 
 // error codes
@@ -52,13 +53,41 @@
 #define ISHEXCH(ch)  (((ch)>='0' && (ch)<='9') || ((ch)>='A' && (ch)<='F') || ((ch)>='a' && (ch)<='f'))
 
 
+//
+// binary message format, negotiated with MSG_SET_FRAMING and sent 8N1
+// to be valid, we need at least 8 bytes
+//
+// | E | x | x | x | x | c | c | E |
+// +---+---+---+---+---+---+---+---+
+// | 0 | 1 | 2 | 3 | 4 | 5 | 6 | 7 |
+//
+//   E        = begin message (SLIP_END)
+//   xxxx     = message payload, 4 bytes
+//   cc       = crc of bytes 1-4, low byte first
+//   E        = end message (SLIP_END)
+//
+//   payload and crc bytes equal to SLIP_END or SLIP_ESC are sent as
+//   SLIP_ESC SLIP_ESC_END or SLIP_ESC SLIP_ESC_ESC (rfc 1055 slip), so
+//   a frame is 8 to 14 bytes on the wire. the leading SLIP_END lets the
+//   receiver drop whatever came before the frame, see msg_parser.h
+//
+#define FRAMING_HEX      0x00
+#define FRAMING_SLIP     0x01
+
+#define SLIP_END         0xC0
+#define SLIP_ESC         0xDB
+#define SLIP_ESC_END     0xDC
+#define SLIP_ESC_ESC     0xDD
+#define SLIP_MIN_COUNT   8
+
+
 
 ////////////////////////////////////////////////////////////
-class MsgBuf : public RingBuffer
+class MsgBuf : public RingBuffer<RING_BUF_COUNT>
 {
 public:
     ////////////////////////////////////////
-    MsgBuf(void) : RingBuffer(RING_BUF_COUNT)
+    MsgBuf(void)
     {
     }
 
@@ -75,7 +104,7 @@ public:
         p_val2 = 0;
         p_val3 = 0;
 
-        if(S_OK != validate())
+        if((S_OK != validate()) || (MSG_BEGIN_CHAR != at(0)))
         {
             return(false);
         }
@@ -91,19 +120,22 @@ public:
     ////////////////////////////////////////
     void set_bytes(const uint8_t p_val0, const uint8_t p_val1, const uint8_t p_val2, const uint8_t p_val3)
     {
+        const uint8_t payload[8] =
+        {
+            DEC2HEX((p_val0>>4) & 0x0f), DEC2HEX(p_val0 & 0x0f),
+            DEC2HEX((p_val1>>4) & 0x0f), DEC2HEX(p_val1 & 0x0f),
+            DEC2HEX((p_val2>>4) & 0x0f), DEC2HEX(p_val2 & 0x0f),
+            DEC2HEX((p_val3>>4) & 0x0f), DEC2HEX(p_val3 & 0x0f),
+        };
+
         clear();
         push_back(MSG_BEGIN_CHAR);                  // byte  0
+        for(uint8_t i=0; i<sizeof(payload); ++i)
+        {
+            push_back(payload[i]);                  // bytes 1-8
+        }
 
-        push_back(DEC2HEX((p_val0>>4) & 0x0f));     // byte  1
-        push_back(DEC2HEX( p_val0     & 0x0f));     // byte  2
-        push_back(DEC2HEX((p_val1>>4) & 0x0f));     // byte  3
-        push_back(DEC2HEX( p_val1     & 0x0f));     // byte  4
-        push_back(DEC2HEX((p_val2>>4) & 0x0f));     // byte  5
-        push_back(DEC2HEX( p_val2     & 0x0f));     // byte  6
-        push_back(DEC2HEX((p_val3>>4) & 0x0f));     // byte  7
-        push_back(DEC2HEX( p_val3     & 0x0f));     // byte  8
-
-        const uint16_t crc = compute_crc();
+        const uint16_t crc = crc16_update_block(0xffff, payload, sizeof(payload));
         push_back(DEC2HEX((crc  >>12) & 0x0f));     // byte  9
         push_back(DEC2HEX((crc  >> 8) & 0x0f));     // byte 10
         push_back(DEC2HEX((crc  >> 4) & 0x0f));     // byte 11
@@ -112,9 +144,32 @@ public:
         push_back(MSG_END_CHAR);                    // byte 13
     }
 
+    ////////////////////////////////////////
+    void set_slip_bytes(const uint8_t p_val0, const uint8_t p_val1, const uint8_t p_val2, const uint8_t p_val3)
+    {
+        const uint8_t payload[4] = { p_val0, p_val1, p_val2, p_val3 };
+        const uint16_t crc = crc16_update_block(0xffff, payload, sizeof(payload));
+
+        clear();
+        push_back(SLIP_END);                        // byte  0
+        push_back_slip(p_val0);                     // byte  1
+        push_back_slip(p_val1);                     // byte  2
+        push_back_slip(p_val2);                     // byte  3
+        push_back_slip(p_val3);                     // byte  4
+        push_back_slip( crc       & 0xff);          // byte  5
+        push_back_slip((crc >> 8) & 0xff);          // byte  6
+        push_back(SLIP_END);                        // byte  7
+    }
+
     ////////////////////////////////////////
     uint8_t validate(void) const
     {
+        if(!empty() && (SLIP_END == at(0)))
+        {
+            // binary frame, see set_slip_bytes()
+            return(((size() < SLIP_MIN_COUNT) || (SLIP_END != at(size() - 1))) ? E_BAD_FRAME : S_OK);
+        }
+
         // to be valid, we need 14 chars
         if(size() < 14)
         {
@@ -137,21 +192,32 @@ public:
         return(S_OK);
     }
 
+    ////////////////////////////////////////
+    static uint16_t update_crc16(const uint16_t p_crc, const uint8_t p_ch)
+    {
+        return(crc16_update(p_crc, p_ch));
+    }
+
 private:
     ////////////////////////////////////////
-    uint16_t update_crc16(const uint16_t p_crc, const uint8_t p_ch) const
+    void push_back_slip(const uint8_t p_val)
     {
-        uint16_t crc = (p_crc ^ (uint16_t)p_ch);
-        crc = ((0 == (crc & 0x0001)) ? (crc >> 1) : ((crc >> 1) ^ 0xa001));
-        crc = ((0 == (crc & 0x0001)) ? (crc >> 1) : ((crc >> 1) ^ 0xa001));
-        crc = ((0 == (crc & 0x0001)) ? (crc >> 1) : ((crc >> 1) ^ 0xa001));
-        crc = ((0 == (crc & 0x0001)) ? (crc >> 1) : ((crc >> 1) ^ 0xa001));
-        crc = ((0 == (crc & 0x0001)) ? (crc >> 1) : ((crc >> 1) ^ 0xa001));
-        crc = ((0 == (crc & 0x0001)) ? (crc >> 1) : ((crc >> 1) ^ 0xa001));
-        crc = ((0 == (crc & 0x0001)) ? (crc >> 1) : ((crc >> 1) ^ 0xa001));
-        crc = ((0 == (crc & 0x0001)) ? (crc >> 1) : ((crc >> 1) ^ 0xa001));
-        return(crc);
+        if(SLIP_END == p_val)
+        {
+            push_back(SLIP_ESC);
+            push_back(SLIP_ESC_END);
+        }
+        else if(SLIP_ESC == p_val)
+        {
+            push_back(SLIP_ESC);
+            push_back(SLIP_ESC_ESC);
+        }
+        else
+        {
+            push_back(p_val);
+        }
     }
+
     ////////////////////////////////////////
     uint16_t get_crc(void) const
     {
@@ -166,14 +232,10 @@ private:
     {
         // crc of bytes 1-8
         uint16_t crc = 0xffff;
-        crc = update_crc16(crc, at(1));
-        crc = update_crc16(crc, at(2));
-        crc = update_crc16(crc, at(3));
-        crc = update_crc16(crc, at(4));
-        crc = update_crc16(crc, at(5));
-        crc = update_crc16(crc, at(6));
-        crc = update_crc16(crc, at(7));
-        crc = update_crc16(crc, at(8));
+        for(uint8_t i=1; i<9; ++i)
+        {
+            crc = crc16_update(crc, at(i));
+        }
         return(crc);
     }
 };
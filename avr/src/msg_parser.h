@@ -0,0 +1,329 @@
+//
+// Copyright 2015 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including,
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#ifndef __msg_parser_h__
+#define __msg_parser_h__
+
+#include <stdint.h>
+
+#include "msg_buf.h"
+
+
+//
+// incremental frame parser
+//
+// chars are fed one at a time as they arrive, see msg_buf.h for the
+// frame format. the parser hunts for the begin char, decodes the
+// payload and updates the crc as each char comes in, so the crc is
+// computed once per frame rather than once per received char.
+//
+// a frame is rejected on the first char that cannot belong to it and
+// a begin char always restarts the frame, so the parser resynchronizes
+// on its own after line noise or a partial frame.
+//
+//  index 0      hunting for '['
+//  index 1-8    payload chars
+//  index 9-12   crc chars
+//  index 13     expecting ']'
+//
+// with FRAMING_SLIP the same parser decodes binary frames instead, the
+// index then counts unescaped bytes since the last SLIP_END:
+//
+//  index 0-3    payload bytes
+//  index 4-5    crc bytes
+//  SLIP_END     completes the frame when index is 6
+//
+// every binary frame starts with a SLIP_END as well, so after a bad
+// frame (and right after switching to FRAMING_SLIP) the parser discards
+// bytes up to the next SLIP_END rather than counting each one as another
+// bad frame.
+//
+// the hex decoder keeps running under FRAMING_SLIP. a binary frame never
+// goes 14 bytes without a SLIP_END ('@' once the top bit is masked off),
+// so a whole hex frame with a good crc means the other end went back to
+// hex. the parser then switches itself to FRAMING_HEX and returns that
+// frame, the caller notices framing() changed and sets the port up to
+// match. hex chars are masked to 7 bits so the ones read as 8N1 decode.
+//
+// consecutive bad frames are counted so the caller can tell when the
+// other end is no longer speaking the negotiated framing.
+//
+
+
+////////////////////////////////////////////////////////////
+class MsgParser
+{
+public:
+    ////////////////////////////////////////
+    MsgParser(void)
+      : m_framing(FRAMING_HEX), m_badCount(0)
+    {
+        reset();
+    }
+
+    ////////////////////////////////////////
+    void reset(void)
+    {
+        m_hex.m_index = 0;
+        m_slip.m_index = 0;
+        m_escape = false;
+        m_hunting = (FRAMING_SLIP == m_framing);
+        m_complete = false;
+    }
+
+    ////////////////////////////////////////
+    // FRAMING_HEX or FRAMING_SLIP
+    void set_framing(const uint8_t p_framing)
+    {
+        m_framing = p_framing;
+        m_badCount = 0;
+        reset();
+    }
+
+    ////////////////////////////////////////
+    uint8_t framing(void) const
+    {
+        return(m_framing);
+    }
+
+    ////////////////////////////////////////
+    // number of bad frames since the last good one
+    uint8_t bad_count(void) const
+    {
+        return(m_badCount);
+    }
+
+    ////////////////////////////////////////
+    // returns
+    //   S_OK                 a whole frame has been decoded, see get_bytes()
+    //   S_INCOMPLETE_BUFFER  more chars are needed
+    //   E_BAD_FRAME          the frame was malformed and has been dropped
+    //   E_BAD_CRC            the frame crc did not match and has been dropped
+    int8_t push(const uint8_t p_ch)
+    {
+        int8_t rc = push_hex(p_ch & 0x7f);
+        if(FRAMING_SLIP == m_framing)
+        {
+            if(S_OK == rc)
+            {
+                // the other end is back on hex
+                set_framing(FRAMING_HEX);
+            }
+            else
+            {
+                // hex errors are expected here, binary ones count
+                rc = push_slip(p_ch);
+            }
+        }
+
+        m_complete = (S_OK == rc);
+        if(S_OK == rc)
+        {
+            m_badCount = 0;
+        }
+        else if((rc < 0) && (m_badCount < 0xff))
+        {
+            ++m_badCount;
+        }
+        return(rc);
+    }
+
+    ////////////////////////////////////////
+    // valid after push() returns S_OK and until the next char is pushed
+    bool get_bytes(uint8_t& p_val0, uint8_t& p_val1, uint8_t& p_val2, uint8_t& p_val3) const
+    {
+        if(!m_complete)
+        {
+            p_val0 = 0;
+            p_val1 = 0;
+            p_val2 = 0;
+            p_val3 = 0;
+            return(false);
+        }
+
+        const Frame& frame = ((FRAMING_SLIP == m_framing) ? m_slip : m_hex);
+        p_val0 = frame.m_bytes[0];
+        p_val1 = frame.m_bytes[1];
+        p_val2 = frame.m_bytes[2];
+        p_val3 = frame.m_bytes[3];
+        return(true);
+    }
+
+private:
+    // one decoder's state
+    struct Frame
+    {
+        uint8_t  m_index;     // position of the next char in the frame, 0 while hunting
+        uint16_t m_crc;       // running crc of the payload chars
+        uint16_t m_rxCrc;     // crc decoded from the frame
+        uint8_t  m_bytes[4];  // decoded payload
+    };
+
+    uint8_t  m_framing;   // FRAMING_HEX or FRAMING_SLIP
+    uint8_t  m_badCount;  // consecutive bad frames
+    bool     m_escape;    // slip: the previous byte was SLIP_ESC
+    bool     m_hunting;   // slip: discarding up to the next SLIP_END
+    bool     m_complete;  // the current framing's decoder holds a whole validated frame
+    Frame    m_hex;       // hex decoder, runs under both framings
+    Frame    m_slip;      // binary decoder
+
+    ////////////////////////////////////////
+    int8_t push_hex(const uint8_t p_ch)
+    {
+        if(MSG_BEGIN_CHAR == p_ch)
+        {
+            // always resync on a begin char
+            m_hex.m_index = 1;
+            m_hex.m_crc = 0xffff;
+            m_hex.m_rxCrc = 0;
+            return(S_INCOMPLETE_BUFFER);
+        }
+
+        if(0 == m_hex.m_index)
+        {
+            // hunting, discard
+            return(S_INCOMPLETE_BUFFER);
+        }
+
+        if(m_hex.m_index < 13)
+        {
+            if(!ISHEXCH(p_ch))
+            {
+                m_hex.m_index = 0;
+                return(E_BAD_FRAME);
+            }
+
+            const uint8_t nibble = HEX2DEC(p_ch);
+            if(m_hex.m_index < 9)
+            {
+                // payload: bytes 1-8
+                m_hex.m_crc = MsgBuf::update_crc16(m_hex.m_crc, p_ch);
+                uint8_t& val = m_hex.m_bytes[(m_hex.m_index - 1) >> 1];
+                val = ((m_hex.m_index & 0x01) ? (nibble << 4) : (val | nibble));
+            }
+            else
+            {
+                // crc: bytes 9-12
+                m_hex.m_rxCrc = ((m_hex.m_rxCrc << 4) | nibble);
+            }
+            ++m_hex.m_index;
+            return(S_INCOMPLETE_BUFFER);
+        }
+
+        // byte 13
+        m_hex.m_index = 0;
+        if(MSG_END_CHAR != p_ch)
+        {
+            return(E_BAD_FRAME);
+        }
+        if(m_hex.m_rxCrc != m_hex.m_crc)
+        {
+            return(E_BAD_CRC);
+        }
+        return(S_OK);
+    }
+
+    ////////////////////////////////////////
+    int8_t push_slip(const uint8_t p_ch)
+    {
+        if(SLIP_END == p_ch)
+        {
+            const uint8_t count = (m_hunting ? 0 : m_slip.m_index);
+            m_slip.m_index = 0;
+            m_escape = false;
+            m_hunting = false;
+            if(0 == count)
+            {
+                // the start of a frame or the end of a discarded one
+                return(S_INCOMPLETE_BUFFER);
+            }
+            if(6 != count)
+            {
+                return(E_BAD_FRAME);
+            }
+            if(m_slip.m_rxCrc != m_slip.m_crc)
+            {
+                return(E_BAD_CRC);
+            }
+            return(S_OK);
+        }
+
+        if(m_hunting)
+        {
+            // discard up to the next SLIP_END
+            return(S_INCOMPLETE_BUFFER);
+        }
+
+        uint8_t val = p_ch;
+        if(m_escape)
+        {
+            m_escape = false;
+            if(SLIP_ESC_END == p_ch)
+            {
+                val = SLIP_END;
+            }
+            else if(SLIP_ESC_ESC == p_ch)
+            {
+                val = SLIP_ESC;
+            }
+            else
+            {
+                m_hunting = true;
+                return(E_BAD_FRAME);
+            }
+        }
+        else if(SLIP_ESC == p_ch)
+        {
+            m_escape = true;
+            return(S_INCOMPLETE_BUFFER);
+        }
+
+        if(0 == m_slip.m_index)
+        {
+            m_slip.m_crc = 0xffff;
+            m_slip.m_rxCrc = 0;
+        }
+
+        if(m_slip.m_index < 4)
+        {
+            // payload: bytes 0-3
+            m_slip.m_crc = MsgBuf::update_crc16(m_slip.m_crc, val);
+            m_slip.m_bytes[m_slip.m_index] = val;
+        }
+        else if(4 == m_slip.m_index)
+        {
+            // crc: byte 4, low byte
+            m_slip.m_rxCrc = val;
+        }
+        else if(5 == m_slip.m_index)
+        {
+            // crc: byte 5, high byte
+            m_slip.m_rxCrc |= ((uint16_t)val << 8);
+        }
+        else
+        {
+            // too long, drop the rest of it
+            m_hunting = true;
+            return(E_BAD_FRAME);
+        }
+        ++m_slip.m_index;
+        return(S_INCOMPLETE_BUFFER);
+    }
+};
+
+#endif // __msg_parser_h__
@@ -20,22 +20,34 @@
 #define __msg_processor_h__
 
 #include "msg_buf.h"
+#include "msg_parser.h"
 #include "serial.h"
 
 
 // top level messages
 #define MSG_PING                 0x01
 #define MSG_PONG                 0x02
+#define MSG_SET_FRAMING          0x03
 #define MSG_READ_REGISTER        0x11
 #define MSG_WRITE_REGISTER       0x21
 #define MSG_WRITE_REGISTER_BIT   0x31
 #define MSG_PULSE_REGISTER_BIT   0x41
+#define MSG_PULSE_OUTPUT_BIT     0x42
+#define MSG_PULSE_OUTPUT_MASK    0x43
 #define MSG_SUBSCRIBE_REGISTER   0x51
 // register defs
 #define REG_ERR_UNKNOWN          0x9F
 #define REG_INPUT_1              0xA1
+#define REG_DEBOUNCE_1           0xB1  // debounce ms for input 1, through
+#define REG_DEBOUNCE_8           0xB8  // REG_DEBOUNCE_8 for input 8
 #define REG_OUTPUT_1             0xD1
 
+// MSG_SET_FRAMING param2
+#define FRAMING_REQUEST          0x00
+#define FRAMING_ACK              0x01
+// consecutive bad frames before falling back to FRAMING_HEX
+#define FRAMING_FALLBACK_COUNT   4
+
 
 // event callbacks, impl by avr_impl.cpp right now
 class MsgProcessor;
@@ -44,7 +56,7 @@ void on_pong(MsgProcessor& p_mp, const uint8_t p_param1, const uint8_t p_param2,
 void on_read_register(MsgProcessor& p_mp, const uint8_t p_registerAddress);
 void on_write_register(MsgProcessor& p_mp, const uint8_t p_registerAddress, const uint8_t p_value, const uint8_t p_mask);
 void on_write_register_bit(MsgProcessor& p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const bool p_state);
-void on_pulse_register_bit(MsgProcessor& p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const uint8_t p_durationMs);
+void on_pulse_register_bit(MsgProcessor& p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const uint16_t p_durationMs);
 void on_subscribe_register(MsgProcessor& p_mp, const uint8_t p_registerAddress, const uint8_t p_value, const bool p_cancel);
 
 
@@ -55,6 +67,7 @@ class MsgProcessor
 public:
     ////////////////////////////////////////
     MsgProcessor(void)
+      : m_framing(FRAMING_HEX)
     {
     }
 
@@ -78,6 +91,20 @@ public:
         return(dispatch_message(MSG_PING, p_param1, p_param2, p_param3));
     }
 
+    ////////////////////////////////////////
+    // ask the other end to switch to FRAMING_HEX or FRAMING_SLIP, both
+    // ends switch once the ack has gone out in the old framing
+    bool dispatch_set_framing(const uint8_t p_framing)
+    {
+        return(dispatch_message(MSG_SET_FRAMING, p_framing, FRAMING_REQUEST, 0x00));
+    }
+
+    ////////////////////////////////////////
+    uint8_t framing(void) const
+    {
+        return(m_framing);
+    }
+
     ////////////////////////////////////////
     bool dispatch_read_register(const uint8_t p_registerAddress)
     {
@@ -110,6 +137,24 @@ public:
         return(dispatch_message(MSG_PULSE_REGISTER_BIT, p_registerAddress, p_bit, p_durationMs));
     }
 
+    ////////////////////////////////////////
+    // pulse a REG_OUTPUT_1 bit for up to 65,535ms
+    bool dispatch_pulse_output_bit(const uint8_t p_bit, const uint16_t p_durationMs)
+    {
+        if(p_bit > 0x07)
+        {
+            return(false);
+        }
+        return(dispatch_message(MSG_PULSE_OUTPUT_BIT, p_bit, (uint8_t)(p_durationMs >> 8), (uint8_t)p_durationMs));
+    }
+
+    ////////////////////////////////////////
+    // pulse every REG_OUTPUT_1 bit in p_mask at once for up to 65,535ms
+    bool dispatch_pulse_output_mask(const uint8_t p_mask, const uint16_t p_durationMs)
+    {
+        return(dispatch_message(MSG_PULSE_OUTPUT_MASK, p_mask, (uint8_t)(p_durationMs >> 8), (uint8_t)p_durationMs));
+    }
+
     ////////////////////////////////////////
     bool dispatch_subscribe_register(const uint8_t p_registerAddress, const uint8_t p_value=0, const bool p_cancel=false)
     {
@@ -119,25 +164,46 @@ public:
     ////////////////////////////////////////
     bool dispatch_message(const uint8_t p_type, const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3)
     {
-        m_msgBuf.set_bytes(p_type, p_param1, p_param2, p_param3);
+        if(FRAMING_SLIP == m_framing)
+        {
+            m_msgBuf.set_slip_bytes(p_type, p_param1, p_param2, p_param3);
+        }
+        else
+        {
+            m_msgBuf.set_bytes(p_type, p_param1, p_param2, p_param3);
+        }
         return(m_serialPort.write(m_msgBuf));
     }
 
     ////////////////////////////////////////
     void poll(void)
     {
-        if(m_serialPort.read(m_msgBuf))
+        // handle every frame that has arrived since the last poll
+        while(m_serialPort.read(m_msgParser))
         {
+            if(m_msgParser.framing() != m_framing)
+            {
+                // the parser caught a hex frame among the binary ones, the
+                // other end went back to hex, what follows in the ring is
+                // hex too so only the port changes
+                m_framing = m_msgParser.framing();
+                m_serialPort.set_parity(FRAMING_HEX == m_framing);
+            }
+
             uint8_t type;
             uint8_t param1;
             uint8_t param2;
             uint8_t param3;
-            if(!m_msgBuf.get_bytes(type, param1, param2, param3))
+            if(m_msgParser.get_bytes(type, param1, param2, param3))
             {
-                return;
+                process_message(type, param1, param2, param3);
             }
+        }
 
-            process_message(type, param1, param2, param3);
+        if((FRAMING_HEX != m_framing) && (m_msgParser.bad_count() >= FRAMING_FALLBACK_COUNT))
+        {
+            // the other end is not speaking binary, it was probably reset
+            set_framing(FRAMING_HEX);
         }
 
         on_poll(*this);
@@ -145,7 +211,26 @@ public:
 
 private:
     MsgBuf m_msgBuf;
+    MsgParser m_msgParser;
     SerialPort m_serialPort;
+    uint8_t m_framing;  // what the port is set up for, the parser can run ahead
+
+    ////////////////////////////////////////
+    // hex frames go out as E71, binary frames need all 8 data bits
+    void set_framing(const uint8_t p_framing)
+    {
+        if(p_framing == m_framing)
+        {
+            return;
+        }
+        m_framing = p_framing;
+        m_serialPort.set_parity(FRAMING_HEX == p_framing);
+
+        // whatever is still in the rx ring (the '\n' after a hex request)
+        // arrived in the old framing
+        m_serialPort.purge();
+        m_msgParser.set_framing(p_framing);
+    }
 
     ////////////////////////////////////////
     void process_message(const uint8_t p_type, const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3)
@@ -164,6 +249,24 @@ private:
                 break;
             }
 
+            case MSG_SET_FRAMING:
+            {
+                // param1: framing (FRAMING_HEX, FRAMING_SLIP)
+                // param2: FRAMING_REQUEST or FRAMING_ACK
+                if(FRAMING_REQUEST == p_param2)
+                {
+                    // ack in the current framing, then switch
+                    const uint8_t framing = ((FRAMING_SLIP == p_param1) ? FRAMING_SLIP : FRAMING_HEX);
+                    dispatch_message(MSG_SET_FRAMING, framing, FRAMING_ACK, 0x00);
+                    set_framing(framing);
+                }
+                else if((FRAMING_HEX == p_param1) || (FRAMING_SLIP == p_param1))
+                {
+                    set_framing(p_param1);
+                }
+                break;
+            }
+
             case MSG_READ_REGISTER:
             {
                 // param1: register address (0-255)
@@ -200,7 +303,7 @@ private:
                 // param1: register address (0-255)
                 // param2: bit num (0-7)
                 // param3: duration  (0-255ms)
-                // void on_pulse_register_bit(MsgProcessor& p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const bool p_duration);
+                // void on_pulse_register_bit(MsgProcessor& p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const uint16_t p_durationMs);
                 if(p_param2 < 0x08)
                 {
                     on_pulse_register_bit(*this, p_param1, p_param2, p_param3);
@@ -208,6 +311,37 @@ private:
                 break;
             }
 
+            case MSG_PULSE_OUTPUT_BIT:
+            {
+                // param1: bit num (0-7) of REG_OUTPUT_1
+                // param2: duration high byte
+                // param3: duration low byte  (0-65,535ms)
+                // void on_pulse_register_bit(MsgProcessor& p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const uint16_t p_durationMs);
+                if(p_param1 < 0x08)
+                {
+                    on_pulse_register_bit(*this, REG_OUTPUT_1, p_param1, (((uint16_t)p_param2 << 8) | p_param3));
+                }
+                break;
+            }
+
+            case MSG_PULSE_OUTPUT_MASK:
+            {
+                // param1: bit mask of REG_OUTPUT_1
+                // param2: duration high byte
+                // param3: duration low byte  (0-65,535ms)
+                // void on_pulse_register_bit(MsgProcessor& p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const uint16_t p_durationMs);
+                // pulses do not block, so every bit starts in this one frame
+                const uint16_t durationMs = (((uint16_t)p_param2 << 8) | p_param3);
+                for(uint8_t bit=0; bit<8; ++bit)
+                {
+                    if(0 != (p_param1 & (1 << bit)))
+                    {
+                        on_pulse_register_bit(*this, REG_OUTPUT_1, bit, durationMs);
+                    }
+                }
+                break;
+            }
+
             case MSG_SUBSCRIBE_REGISTER:
             {
                 // param1: register address (0-255)
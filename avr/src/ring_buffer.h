@@ -20,163 +20,178 @@
 #define __ring_buffer_h__
 
 #include <stdint.h>
-#include <stdlib.h>
 
 
-////////////////////////////////////////////////////////////
+//
+// single producer, single consumer ring buffer
+//
+// the producer only writes m_head and the consumer only writes m_tail,
+// so an isr on one side and the main loop on the other never share a
+// read-modify-write. both indexes run freely and wrap naturally, the
+// slot is the index masked by the capacity, so the capacity must be a
+// power of two no bigger than half the index range.
+//
+// producer side: push_back(), push()
+// consumer side: pop_front(), pop(), peek(), consume(), at(), clear()
+//
+template<uint16_t N, typename IndexT=uint8_t>
 class RingBuffer
 {
-public:
-    ////////////////////////////////////////
-    RingBuffer(const uint8_t p_capacity)
-      : m_buff(0), m_end(0), m_first(0), m_last(0), m_size(0)
-    {
-        m_buff = (uint8_t*)::malloc(p_capacity);
-        if(0 != m_buff)
-        {
-            m_end = (m_buff + p_capacity);
-            m_first = m_last = m_buff;
-        }
-    }
+    static_assert((N > 0) && (0 == (N & (N - 1))), "ring buffer capacity must be a power of two");
+    static_assert(N <= ((IndexT)~(IndexT)0 / 2 + 1), "ring buffer index type is too small for the capacity");
+#ifdef __AVR__
+    static_assert(1 == sizeof(IndexT), "the avr can only load and store a single byte index atomically");
+#endif
 
+public:
     ////////////////////////////////////////
-    ~RingBuffer(void)
+    RingBuffer(void)
+      : m_head(0), m_tail(0)
     {
-        if(0 != m_buff)
-        {
-            ::free(m_buff);
-            m_buff = 0;
-        }
-        m_end = 0;
-        m_first = 0;
-        m_last = 0;
-        m_size = 0;
     }
 
     ////////////////////////////////////////
+    // consumer side, drops everything currently buffered
     void clear(void)
     {
-        m_first = m_last = m_buff;
-        m_size = 0;
+        store(m_tail, load(m_head));
     }
 
     ////////////////////////////////////////
-    uint8_t size(void) const
+    IndexT size(void) const
     {
-        return(m_size);
+        return((IndexT)(load(m_head) - load(m_tail)));
     }
 
     ////////////////////////////////////////
     bool empty(void) const
     {
-        return(0 == m_size);
+        return(load(m_head) == load(m_tail));
     }
 
     ////////////////////////////////////////
     bool full(void) const
     {
-        return(capacity() == m_size);
+        return(N == size());
     }
 
     ////////////////////////////////////////
-    uint8_t capacity(void) const
+    IndexT capacity(void) const
     {
-        return(m_end - m_buff);
+        return(N);
     }
 
     ////////////////////////////////////////
-    void push_back(const uint8_t p_item)
+    // returns false and drops the item if the buffer is full
+    bool push_back(const uint8_t p_item)
     {
-        if(full())
+        const IndexT head = m_head;
+        if(N == (IndexT)(head - load(m_tail)))
         {
-            if(empty())
-            {
-                return;  // no capacity
-            }
-            *m_last = p_item;
-            increment(m_last);
-            m_first = m_last;
+            return(false);
         }
-        else
+        m_buff[head & MASK] = p_item;
+        store(m_head, (IndexT)(head + 1));
+        return(true);
+    }
+
+    ////////////////////////////////////////
+    // returns the number of items pushed, less than p_len if it filled up
+    IndexT push(const uint8_t* p_data, const IndexT p_len)
+    {
+        const IndexT head = m_head;
+        const IndexT room = (IndexT)(N - (IndexT)(head - load(m_tail)));
+        const IndexT len = ((p_len < room) ? p_len : room);
+        for(IndexT i=0; i<len; ++i)
         {
-            *m_last = p_item;
-            increment(m_last);
-            ++m_size;
+            m_buff[(IndexT)(head + i) & MASK] = p_data[i];
         }
+        store(m_head, (IndexT)(head + len));
+        return(len);
     }
 
     ////////////////////////////////////////
     uint8_t pop_front(void)
     {
-        if(empty())
+        const IndexT tail = m_tail;
+        if(load(m_head) == tail)
         {
             return(0); // error
         }
-        const uint8_t item = *m_first;
-        increment(m_first);
-        --m_size;
+        const uint8_t item = m_buff[tail & MASK];
+        store(m_tail, (IndexT)(tail + 1));
         return(item);
     }
 
     ////////////////////////////////////////
-    uint8_t pop_back(void)
+    // returns the number of items copied out
+    IndexT pop(uint8_t* p_data, const IndexT p_len)
     {
-        if(empty())
+        const IndexT tail = m_tail;
+        const IndexT avail = (IndexT)(load(m_head) - tail);
+        const IndexT len = ((p_len < avail) ? p_len : avail);
+        for(IndexT i=0; i<len; ++i)
         {
-            return(0); // error
+            p_data[i] = m_buff[(IndexT)(tail + i) & MASK];
         }
-        decrement(m_last);
-        --m_size;
-        return(*m_last);
+        store(m_tail, (IndexT)(tail + len));
+        return(len);
     }
 
     ////////////////////////////////////////
-    uint8_t operator[](const uint8_t p_index) const
+    // points p_data at the oldest items and returns how many of them are
+    // contiguous, call consume() once they have been used
+    IndexT peek(const uint8_t*& p_data) const
     {
-        if(p_index >= m_size)
-        {
-            return(0); // error
-        }
+        const IndexT tail = m_tail;
+        const IndexT avail = (IndexT)(load(m_head) - tail);
+        const IndexT toEnd = (IndexT)(N - (tail & MASK));
+        p_data = &m_buff[tail & MASK];
+        return((avail < toEnd) ? avail : toEnd);
+    }
 
-        if(p_index < (m_end - m_first))
+    ////////////////////////////////////////
+    void consume(const IndexT p_count)
+    {
+        store(m_tail, (IndexT)(m_tail + p_count));
+    }
+
+    ////////////////////////////////////////
+    uint8_t operator[](const IndexT p_index) const
+    {
+        if(p_index >= size())
         {
-            return(*(m_first + p_index));
+            return(0); // error
         }
-        return(*(m_first + (p_index - capacity())));
-//        return(*(m_first + (p_index < (m_end - m_first) ? p_index : p_index - capacity())));
+        return(m_buff[(IndexT)(m_tail + p_index) & MASK]);
     }
 
     ////////////////////////////////////////
-    uint8_t at(const uint8_t p_index) const
+    uint8_t at(const IndexT p_index) const
     {
         return((*this)[p_index]);
     }
 
 
 private:
-    uint8_t* m_buff;  // the internal buffer used for storing elements in the ring buffer
-    uint8_t* m_end;   // the internal buffer's end (end of the storage space)
-    uint8_t* m_first; // the virtual beginning of the ring buffer
-    uint8_t* m_last;  // the virtual end of the ring buffer (one behind the last element)
-    uint8_t m_size;   // the number of items currently stored in the ring buffer
+    static const IndexT MASK = (IndexT)(N - 1);
+
+    IndexT  m_head;     // producer index, one past the newest item
+    IndexT  m_tail;     // consumer index, the oldest item
+    uint8_t m_buff[N];  // storage, indexed by (index & MASK)
 
-    // increment the pointer
-    void increment(uint8_t*& p_ptr) const
+    ////////////////////////////////////////
+    // acquire, pairs with the release in store() on the other side
+    static IndexT load(const IndexT& p_index)
     {
-        if(++p_ptr == m_end)
-        {
-            p_ptr = m_buff;
-        }
+        return(__atomic_load_n(&p_index, __ATOMIC_ACQUIRE));
     }
 
-    // decrement the pointer
-    void decrement(uint8_t*& p_ptr) const
+    ////////////////////////////////////////
+    // release, the item is written before the index that publishes it
+    static void store(IndexT& p_index, const IndexT p_value)
     {
-        if(p_ptr == m_buff)
-        {
-            p_ptr = m_end;
-        }
-        --p_ptr;
+        __atomic_store_n(&p_index, p_value, __ATOMIC_RELEASE);
     }
 };
 
@@ -19,10 +19,18 @@
 #include <stdint.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <util/atomic.h>
 
 #include "serial.h"
+#include "events.h"
 #include "ring_buffer.h"
 #include "msg_buf.h"
+#include "msg_parser.h"
+
+
+// frames are queued here by write() and fed to UDR by the data register
+// empty isr, so write() only waits when the ring is full
+RingBuffer<64> s_tx_buffer;
 
 
 // The Transmit Complete (TXCn) Flag bit is set one when the entire frame in the Transmit Shift
@@ -63,20 +71,37 @@ inline void rts_low(void)
 //ISR(SIG_USART_TRANS)
 ISR(USART_TXC_vect)
 {
-    rts_low();
+    // TXC only fires once UDR and the shift register are both empty, but
+    // write() may have queued more since the udre isr ran dry
+    if(s_tx_buffer.empty())
+    {
+        rts_low();
+    }
 }
 #endif // USE_RS485_RTS
 
 
-// TODO?
+////////////////////////////////////////
 // usart data register empty - see UDRIE
 //SIGNAL(USART_UDRE_vect)
 //ISR(SIG_USART_DATA)
-//ISR(USART_UDRE_vect)
+ISR(USART_UDRE_vect)
+{
+    if(s_tx_buffer.empty())
+    {
+        // nothing left to send, stop until write() queues more
+        UCSRB &= ~_BV(UDRIE);
+        return;
+    }
+    UDR = s_tx_buffer.pop_front();
+}
+
+// set by write(), cleared by flush() once the last frame is out
+static bool s_txPending = false;
 
 ////////////////////////////////////////
 // usart rx complete - see RXCIE
-RingBuffer s_rx_buffer(128);
+RingBuffer<128> s_rx_buffer;
 //SIGNAL(USART_RX_vect)
 //ISR(SIG_USART_RECV)
 ISR(USART_RXC_vect)
@@ -85,6 +110,7 @@ ISR(USART_RXC_vect)
     if(bit_is_clear(UCSRA, PE))
     {
         s_rx_buffer.push_back(c);
+        events::post(EVENT_RX);
     }
 }
 
@@ -138,7 +164,7 @@ bool SerialPort::init(const char* /*p_device */, const uint16_t p_baud, const bo
     //   see rts_init() below
     // ---
     // bit 5 – UDRIE: USART Data Register Empty Interrupt Enable
-    //   TODO?
+    //   enabled by write() while s_tx_buffer has data
     // ---
     // bit 4 – RXEN: Receiver Enable
     ucsrb |= _BV(RXEN);
@@ -210,29 +236,88 @@ bool SerialPort::init(const char* /*p_device */, const uint16_t p_baud, const bo
 ////////////////////////////////////////
 void SerialPort::close(void)
 {
+    flush();
+
     #ifdef USE_RS485_RTS
     rts_uninit();
     #endif // USE_RS485_RTS
 
-    // disable transmitter (TXEN)
-    UCSRB &= ~_BV(TXEN);
+    // disable transmitter (TXEN) and data register empty interrupt (UDRIE)
+    UCSRB &= ~(_BV(TXEN) | _BV(UDRIE));
 
     // disable receiver (RXEN) and rx complete interrupt (RXCIE)
     UCSRB &= ~(_BV(RXEN) | _BV(RXCIE));
 }
 
 ////////////////////////////////////////
-bool SerialPort::read(MsgBuf& p_msgBuf) const
+// change the frame format without touching the baud rate
+// the tx shift register is drained first so the last frame (usually
+// the framing ack) does not go out half in the old format
+// p_parity
+//   false: N81 (none, 8 data, 1 stop)
+//   true:  E71 (even, 7 data, 1 stop)
+bool SerialPort::set_parity(const bool p_parity) const
 {
-    while(!s_rx_buffer.empty())
+    flush();
+
+    // see init() for the UCSRC bits
+    if(p_parity)
+    {
+        UCSRC = (_BV(URSEL) | _BV(UPM1) | _BV(UCSZ1));  // even parity, 7 data
+    }
+    else
     {
-        const uint8_t val = s_rx_buffer.pop_front();
-        p_msgBuf.push_back(val);
-        if(S_OK == p_msgBuf.validate())
+        UCSRC = (_BV(URSEL) | _BV(UCSZ1) | _BV(UCSZ0));  // no parity, 8 data
+    }
+    return(true);
+}
+
+////////////////////////////////////////
+// wait for everything queued by write() to leave the tx shift register
+void SerialPort::flush(void) const
+{
+    if(!s_txPending)
+    {
+        return;
+    }
+
+    while(!s_tx_buffer.empty());
+
+    #ifdef USE_RS485_RTS
+    // the tx complete isr clears TXC, wait for it to drop rts instead
+    while(bit_is_set(RTS_PORT, RTS_PIN));
+    #else
+    while(bit_is_clear(UCSRA, TXC));
+    #endif // USE_RS485_RTS
+
+    s_txPending = false;
+}
+
+////////////////////////////////////////
+// drop everything received but not parsed yet
+void SerialPort::purge(void) const
+{
+    s_rx_buffer.clear();
+}
+
+////////////////////////////////////////
+bool SerialPort::read(MsgParser& p_msgParser) const
+{
+    // parse straight out of the ring, the isr keeps appending meanwhile
+    const uint8_t* data;
+    uint8_t len;
+    while((len = s_rx_buffer.peek(data)) > 0)
+    {
+        for(uint8_t i=0; i<len; ++i)
         {
-            // have a message
-            return(true);
+            if(S_OK == p_msgParser.push(data[i]))
+            {
+                // have a message, the rest is parsed next time
+                s_rx_buffer.consume(i + 1);
+                return(true);
+            }
         }
+        s_rx_buffer.consume(len);
     }
     return(false);
 }
@@ -245,14 +330,27 @@ bool SerialPort::write(MsgBuf& p_msgBuf) const
         return(false);
     }
 
-    #ifdef USE_RS485_RTS
-    rts_high();
-    #endif // USE_RS485_RTS
+    // clear TXC (write one) so flush() can tell when this frame is out,
+    // the error flags in UCSRA must be written as zero
+    UCSRA = ((UCSRA & (_BV(U2X) | _BV(MPCM))) | _BV(TXC));
+    s_txPending = true;
 
     for(uint8_t i=0, imax=p_msgBuf.size(); i<imax; ++i)
     {
-        while(!(UCSRA & _BV(UDRE)));
-        UDR = p_msgBuf[i];
+        // only spins while the ring is full, the udre isr makes room
+        while(!s_tx_buffer.push_back(p_msgBuf[i]));
+
+        // both are read-modify-write on registers the isrs also change
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+        {
+            #ifdef USE_RS485_RTS
+            // raised after the push so a late tx complete isr from the
+            // previous frame sees a non-empty ring and leaves it alone
+            rts_high();
+            #endif // USE_RS485_RTS
+
+            UCSRB |= _BV(UDRIE);
+        }
     }
     return(true);
 }
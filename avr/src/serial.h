@@ -20,6 +20,7 @@
 #define __serial_port_h__
 
 #include "msg_buf.h"
+#include "msg_parser.h"
 
 
 ////////////////////////////////////////////////////////////
@@ -34,7 +35,10 @@ public:
     //   true:  E71 (even, 7 data, 1 stop)
     bool init(const char* p_device, const uint16_t p_baud, const bool p_parity);
     void close(void);
-    bool read(MsgBuf& p_msgBuf) const;
+    bool set_parity(const bool p_parity) const;
+    void flush(void) const;
+    void purge(void) const;
+    bool read(MsgParser& p_msgParser) const;
     bool write(MsgBuf& p_msgBuf) const;
 };
 
@@ -0,0 +1,255 @@
+//
+// Copyright 2015 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including,
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// the processor side as the avr builds it, the avr-libc headers come
+// from ./host
+#include "../avr_impl.cpp"
+
+
+//
+// host test of the relay pulses in avr_impl.cpp, run with make check
+//
+// frames go through msg_processor.h and serial.cpp over a pty as in
+// msg_processor_test, the timer isr is called by hand to step the 1ms
+// tick, and PORTA is checked against the relay map in avr_impl.cpp.
+// the relays are active low, a pin reads 0 while its relay is on.
+//
+
+static int s_failures = 0;
+
+#define CHECK(cond) do { if(!(cond)) { ::printf("FAIL: %s %d - %s\n", __FILE__, __LINE__, #cond); ++s_failures; } } while(0)
+
+// the ATmega32 registers, see host/avr/io.h
+volatile uint8_t PINC = 0;
+volatile uint8_t PIND = 0;
+volatile uint8_t PORTA = 0;
+volatile uint8_t PORTC = 0;
+volatile uint8_t PORTD = 0;
+volatile uint8_t DDRA = 0;
+volatile uint8_t DDRC = 0;
+volatile uint8_t DDRD = 0;
+volatile uint8_t TCCR0 = 0;
+volatile uint8_t TCNT0 = 0;
+volatile uint8_t OCR0 = 0;
+volatile uint8_t TIMSK = 0;
+
+// normally avr_main.cpp
+volatile uint8_t g_events = 0;
+
+
+////////////////////////////////////////
+static void send(const int p_fd, const uint8_t p_type, const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3)
+{
+    MsgBuf buf;
+    buf.set_bytes(p_type, p_param1, p_param2, p_param3);
+    uint8_t out[32];
+    uint8_t len = 0;
+    for(uint8_t i=0; i<buf.size(); ++i)
+    {
+        out[len++] = buf[i];
+    }
+    out[len++] = '\n';
+    CHECK(len == ::write(p_fd, out, len));
+}
+
+////////////////////////////////////////
+// let the processor take what was sent, the answers are not looked at
+static void deliver(const int p_fd, MsgProcessor& p_mp)
+{
+    for(uint32_t i=0; i<5; ++i)
+    {
+        ::usleep(1000);
+        p_mp.poll();
+        uint8_t buf[256];
+        while(::read(p_fd, buf, sizeof(buf)) > 0)
+        {
+        }
+    }
+}
+
+////////////////////////////////////////
+// p_ms ticks of the timer, each followed by the main loop's wakeup
+static void run(MsgProcessor& p_mp, const uint16_t p_ms)
+{
+    for(uint16_t i=0; i<p_ms; ++i)
+    {
+        ticks::TIMER0_COMP_vect();
+        on_poll(p_mp);
+    }
+}
+
+////////////////////////////////////////
+static void pulse_mask(const int p_fd, MsgProcessor& p_mp, const uint8_t p_mask, const uint16_t p_durationMs)
+{
+    send(p_fd, MSG_PULSE_OUTPUT_MASK, p_mask, (uint8_t)(p_durationMs >> 8), (uint8_t)p_durationMs);
+    deliver(p_fd, p_mp);
+}
+
+////////////////////////////////////////
+static void all_off(const int p_fd, MsgProcessor& p_mp)
+{
+    send(p_fd, MSG_WRITE_REGISTER, REG_OUTPUT_1, 0x00, 0xff);
+    deliver(p_fd, p_mp);
+    CHECK(0xff == PORTA);
+}
+
+
+//
+// tests
+//
+
+////////////////////////////////////////
+// o0 and o5 are relay 1 on PORTA.3 and relay 6 on PORTA.5
+static void test_pulse_0x21(const int p_fd, MsgProcessor& p_mp)
+{
+    all_off(p_fd, p_mp);
+    pulse_mask(p_fd, p_mp, 0x21, 100);
+    CHECK(0xd7 == PORTA);
+    CHECK(0x21 == READ_DIGITAL_OUTPUTS);
+    run(p_mp, 99);
+    CHECK(0xd7 == PORTA);
+    run(p_mp, 1);
+    CHECK(0xff == PORTA);
+    run(p_mp, 100);
+    CHECK(0xff == PORTA);
+}
+
+////////////////////////////////////////
+// every relay closes for the pulse and opens at its end, PORTA.7 too
+static void test_pulse_0xff(const int p_fd, MsgProcessor& p_mp)
+{
+    all_off(p_fd, p_mp);
+    pulse_mask(p_fd, p_mp, 0xff, 250);
+    CHECK(0x00 == PORTA);
+    CHECK(0xff == READ_DIGITAL_OUTPUTS);
+    run(p_mp, 249);
+    CHECK(0x00 == PORTA);
+    run(p_mp, 1);
+    CHECK(0xff == PORTA);
+}
+
+////////////////////////////////////////
+// each relay keeps its own deadline, a later mask with a shorter width
+// ends first and a repeat extends the running pulse
+static void test_pulse_overlap(const int p_fd, MsgProcessor& p_mp)
+{
+    all_off(p_fd, p_mp);
+    pulse_mask(p_fd, p_mp, 0x01, 100);
+    run(p_mp, 10);
+    pulse_mask(p_fd, p_mp, 0x80, 20);
+    CHECK(0x77 == PORTA);
+    run(p_mp, 20);
+    CHECK(0xf7 == PORTA);
+    pulse_mask(p_fd, p_mp, 0x01, 100);
+    run(p_mp, 99);
+    CHECK(0xf7 == PORTA);
+    run(p_mp, 1);
+    CHECK(0xff == PORTA);
+}
+
+////////////////////////////////////////
+// a masked write cancels the pulses on the bits it writes and no others
+static void test_write_cancels(const int p_fd, MsgProcessor& p_mp)
+{
+    // o0 held on by a write during its pulse stays on after it
+    all_off(p_fd, p_mp);
+    pulse_mask(p_fd, p_mp, 0x01, 100);
+    run(p_mp, 10);
+    send(p_fd, MSG_WRITE_REGISTER, REG_OUTPUT_1, 0x01, 0x01);
+    deliver(p_fd, p_mp);
+    run(p_mp, 200);
+    CHECK(0xf7 == PORTA);
+
+    // a write to o0 leaves the pulse on o3 (PORTA.0) running to its end
+    all_off(p_fd, p_mp);
+    pulse_mask(p_fd, p_mp, 0x08, 100);
+    CHECK(0xfe == PORTA);
+    send(p_fd, MSG_WRITE_REGISTER, REG_OUTPUT_1, 0x01, 0x01);
+    deliver(p_fd, p_mp);
+    CHECK(0xf6 == PORTA);
+    run(p_mp, 100);
+    CHECK(0xf7 == PORTA);
+}
+
+////////////////////////////////////////
+// a bit write drives the relay of that register bit and cancels only
+// its pulse
+static void test_write_bit_cancels(const int p_fd, MsgProcessor& p_mp)
+{
+    all_off(p_fd, p_mp);
+    send(p_fd, MSG_WRITE_REGISTER_BIT, REG_OUTPUT_1, 0, 1);
+    deliver(p_fd, p_mp);
+    CHECK(0xf7 == PORTA);
+    send(p_fd, MSG_WRITE_REGISTER_BIT, REG_OUTPUT_1, 7, 1);
+    deliver(p_fd, p_mp);
+    CHECK(0x77 == PORTA);
+
+    // o5 written off mid pulse, o0 still ends on its own deadline
+    all_off(p_fd, p_mp);
+    pulse_mask(p_fd, p_mp, 0x21, 100);
+    run(p_mp, 10);
+    send(p_fd, MSG_WRITE_REGISTER_BIT, REG_OUTPUT_1, 5, 0);
+    deliver(p_fd, p_mp);
+    CHECK(0xf7 == PORTA);
+    run(p_mp, 89);
+    CHECK(0xf7 == PORTA);
+    run(p_mp, 1);
+    CHECK(0xff == PORTA);
+
+    // o5 written on mid pulse stays on, o0 is not cancelled with it
+    pulse_mask(p_fd, p_mp, 0x21, 100);
+    send(p_fd, MSG_WRITE_REGISTER_BIT, REG_OUTPUT_1, 5, 1);
+    deliver(p_fd, p_mp);
+    run(p_mp, 100);
+    CHECK(0xdf == PORTA);
+}
+
+////////////////////////////////////////
+int main(const int p_argc, const char** p_argv)
+{
+    const int fd = ::posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if((fd < 0) || (0 != ::grantpt(fd)) || (0 != ::unlockpt(fd)))
+    {
+        ::printf("no pty\n");
+        return(EXIT_FAILURE);
+    }
+
+    MsgProcessor mp;
+    if(!mp.init(::ptsname(fd), 57600, true))
+    {
+        ::printf("init failed\n");
+        return(EXIT_FAILURE);
+    }
+    avr_init();
+
+    test_pulse_0x21(fd, mp);
+    test_pulse_0xff(fd, mp);
+    test_pulse_overlap(fd, mp);
+    test_write_cancels(fd, mp);
+    test_write_bit_cancels(fd, mp);
+
+    ::close(fd);
+    ::printf("%s\n", ((0 == s_failures) ? "ok" : "FAILED"));
+    return((0 == s_failures) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
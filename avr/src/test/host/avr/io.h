@@ -0,0 +1,51 @@
+//
+// Copyright 2015 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including,
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#ifndef __host_avr_io_h__
+#define __host_avr_io_h__
+
+#include <stdint.h>
+
+
+//
+// host stand-in for avr-libc's <avr/io.h>, just the ATmega32 registers
+// and bits avr_impl.cpp and ticks.h touch. the registers are plain
+// bytes, defined by the test that includes avr_impl.cpp
+//
+
+#define _BV(b)  (1 << (b))
+
+extern volatile uint8_t PINC;
+extern volatile uint8_t PIND;
+extern volatile uint8_t PORTA;
+extern volatile uint8_t PORTC;
+extern volatile uint8_t PORTD;
+extern volatile uint8_t DDRA;
+extern volatile uint8_t DDRC;
+extern volatile uint8_t DDRD;
+extern volatile uint8_t TCCR0;
+extern volatile uint8_t TCNT0;
+extern volatile uint8_t OCR0;
+extern volatile uint8_t TIMSK;
+
+#define CS00   0
+#define CS01   1
+#define OCIE0  1
+#define WGM01  3
+
+#endif // __host_avr_io_h__
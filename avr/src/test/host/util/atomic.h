@@ -0,0 +1,31 @@
+//
+// Copyright 2015 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including,
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#ifndef __host_util_atomic_h__
+#define __host_util_atomic_h__
+
+
+//
+// host stand-in for avr-libc's <util/atomic.h>, the test is single
+// threaded so the block just runs once
+//
+
+#define ATOMIC_RESTORESTATE  0
+#define ATOMIC_BLOCK(type)   for(int __done = (type); !__done; __done = 1)
+
+#endif // __host_util_atomic_h__
@@ -0,0 +1,235 @@
+//
+// Copyright 2015 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including,
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../msg_processor.h"
+
+
+//
+// host benchmark of command to actuation latency, run with make bench
+//
+// there is no avr simulator here, so this measures the shape of the main
+// loop rather than the avr itself: msg_processor.h and the host
+// serial.cpp run in a thread under each loop policy, the bridge end of
+// a pty writes a write-register command at a random moment, and the
+// time until on_write_register() runs is the latency. the policies:
+//
+//   poll 100ms  the original loop, mp.poll() then _delay_ms(100)
+//   poll 1ms    the same with the 1ms delay
+//   event       sleep until rx, the host stand-in for SLEEP_MODE_IDLE
+//               woken by the rx complete isr (poll() on the pty)
+//
+// a pty has no baud rate, so the ~2.6ms a hex frame (14 chars and a
+// newline) spends on the wire at 57,600 E71 is not included, it is the
+// same for every policy.
+// parse and dispatch run at host speed, not at 16MHz.
+//
+
+#define SAMPLES 40
+
+enum { POLICY_POLL_100MS, POLICY_POLL_1MS, POLICY_EVENT };
+
+static volatile int s_policy = POLICY_EVENT;
+static volatile bool s_running = true;
+static volatile uint64_t s_actuatedNs = 0;
+static int s_wakeFd = -1;  // second fd on the pty, readable when rx is waiting
+
+
+////////////////////////////////////////
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec);
+}
+
+////////////////////////////////////////
+void on_poll(MsgProcessor& p_mp)
+{
+}
+
+////////////////////////////////////////
+void on_pong(MsgProcessor& p_mp, const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3)
+{
+}
+
+////////////////////////////////////////
+void on_read_register(MsgProcessor& p_mp, const uint8_t p_registerAddress)
+{
+}
+
+////////////////////////////////////////
+// the actuation
+void on_write_register(MsgProcessor& p_mp, const uint8_t p_registerAddress, const uint8_t p_value, const uint8_t p_mask)
+{
+    __atomic_store_n(&s_actuatedNs, now_ns(), __ATOMIC_RELEASE);
+}
+
+////////////////////////////////////////
+void on_write_register_bit(MsgProcessor& p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const bool p_state)
+{
+}
+
+////////////////////////////////////////
+void on_pulse_register_bit(MsgProcessor& p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const uint16_t p_durationMs)
+{
+}
+
+////////////////////////////////////////
+void on_subscribe_register(MsgProcessor& p_mp, const uint8_t p_registerAddress, const uint8_t p_value, const bool p_cancel)
+{
+}
+
+////////////////////////////////////////
+// the avr main loop
+static void* avr_loop(void* p_arg)
+{
+    MsgProcessor& mp = *(MsgProcessor*)p_arg;
+    while(s_running)
+    {
+        switch(s_policy)
+        {
+            case POLICY_POLL_100MS:
+            {
+                mp.poll();
+                ::usleep(100000);
+                break;
+            }
+            case POLICY_POLL_1MS:
+            {
+                mp.poll();
+                ::usleep(1000);
+                break;
+            }
+            default:
+            {
+                // the timeout only lets the loop see s_running
+                struct pollfd fds = { s_wakeFd, POLLIN, 0 };
+                ::poll(&fds, 1, 100);
+                mp.poll();
+                break;
+            }
+        }
+    }
+    return(0);
+}
+
+////////////////////////////////////////
+static int compare_u32(const void* p_a, const void* p_b)
+{
+    const uint32_t a = *(const uint32_t*)p_a;
+    const uint32_t b = *(const uint32_t*)p_b;
+    return((a > b) - (a < b));
+}
+
+////////////////////////////////////////
+static void run_policy(const int p_fd, const int p_policy, const char* p_name)
+{
+    s_policy = p_policy;
+    ::usleep(150000);  // let a 100ms sleep from the previous policy run out
+
+    uint32_t latencyUs[SAMPLES];
+    uint32_t count = 0;
+    for(uint32_t i=0; i<SAMPLES; ++i)
+    {
+        // a random moment in the loop's cycle
+        ::usleep(20000 + (::rand() % 100000));
+
+        MsgBuf buf;
+        buf.set_bytes(MSG_WRITE_REGISTER, REG_OUTPUT_1, (uint8_t)i, 0xff);
+        uint8_t frame[32];
+        uint8_t len = 0;
+        for(; len<buf.size(); ++len)
+        {
+            frame[len] = buf[len];
+        }
+        frame[len++] = '\n';
+
+        __atomic_store_n(&s_actuatedNs, 0, __ATOMIC_RELEASE);
+        const uint64_t sentNs = now_ns();
+        if(len != ::write(p_fd, frame, len))
+        {
+            continue;
+        }
+
+        uint64_t actuatedNs = 0;
+        while((0 == (actuatedNs = __atomic_load_n(&s_actuatedNs, __ATOMIC_ACQUIRE))) && ((now_ns() - sentNs) < 500000000ULL))
+        {
+            ::usleep(50);
+        }
+        if(0 != actuatedNs)
+        {
+            latencyUs[count++] = (uint32_t)((actuatedNs - sentNs) / 1000);
+        }
+    }
+
+    if(0 == count)
+    {
+        ::printf("%-12s no command was actuated\n", p_name);
+        return;
+    }
+    uint64_t sum = 0;
+    for(uint32_t i=0; i<count; ++i)
+    {
+        sum += latencyUs[i];
+    }
+    ::qsort(latencyUs, count, sizeof(latencyUs[0]), compare_u32);
+    ::printf("%-12s %2u/%u commands  avg %6.2fms  p50 %6.2fms  p90 %6.2fms  max %6.2fms\n", p_name, count, SAMPLES,
+        (sum / 1000.0 / count), (latencyUs[count / 2] / 1000.0), (latencyUs[(count * 9) / 10] / 1000.0), (latencyUs[count - 1] / 1000.0));
+}
+
+////////////////////////////////////////
+int main(const int p_argc, const char** p_argv)
+{
+    const int fd = ::posix_openpt(O_RDWR | O_NOCTTY);
+    if((fd < 0) || (0 != ::grantpt(fd)) || (0 != ::unlockpt(fd)))
+    {
+        ::printf("no pty\n");
+        return(EXIT_FAILURE);
+    }
+
+    MsgProcessor mp;
+    if(!mp.init(::ptsname(fd), 57600, true))
+    {
+        ::printf("init failed\n");
+        return(EXIT_FAILURE);
+    }
+    s_wakeFd = ::open(::ptsname(fd), O_RDONLY | O_NOCTTY | O_NONBLOCK);
+
+    ::srand(1);
+    pthread_t thread;
+    ::pthread_create(&thread, 0, avr_loop, &mp);
+
+    run_policy(fd, POLICY_POLL_100MS, "poll 100ms");
+    run_policy(fd, POLICY_POLL_1MS, "poll 1ms");
+    run_policy(fd, POLICY_EVENT, "event");
+
+    s_running = false;
+    ::pthread_join(thread, 0);
+    ::close(s_wakeFd);
+    ::close(fd);
+    return(EXIT_SUCCESS);
+}
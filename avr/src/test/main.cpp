@@ -68,7 +68,7 @@ void on_write_register_bit(MsgProcessor& p_mp, const uint8_t p_registerAddress,
 }
 
 ////////////////////////////////////////
-void on_pulse_register_bit(MsgProcessor& p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const uint8_t p_durationMs)
+void on_pulse_register_bit(MsgProcessor& p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const uint16_t p_durationMs)
 {
     ::printf("\non_pulse_register_bit - addr: [0x%x]  bit: [0x%d]  duration: [%dms]\n", p_registerAddress, p_bit, p_durationMs);
     ::printf("\nA140808>");
@@ -162,6 +162,17 @@ bool do_command(MsgProcessor& p_mp, const std::string& p_command)
         return(true);
     }
 
+    if(0 == ::strcmp("framing hex", p_command.c_str()))
+    {
+        p_mp.dispatch_set_framing(FRAMING_HEX);
+        return(true);
+    }
+    if(0 == ::strcmp("framing slip", p_command.c_str()))
+    {
+        p_mp.dispatch_set_framing(FRAMING_SLIP);
+        return(true);
+    }
+
     if(0 == ::strcmp("sub in", p_command.c_str()))
     {
         p_mp.dispatch_subscribe_register(REG_INPUT_1);
@@ -263,6 +274,52 @@ bool do_command(MsgProcessor& p_mp, const std::string& p_command)
         return(true);  // valid command
     }
 
+    // pulse output bit, 16 bit duration
+    else if(('p' == p_command[0]) && ('l' == p_command[1]))
+    {
+        if(param1 > 7)
+        {
+            ::printf("bit number must be 0-7 - invalid value: [%d]\n\n", param1);
+            return(false);  // error
+        }
+
+        const std::string::size_type pos = p_command.rfind(' ');
+        const unsigned long durationMs = ::strtoul(p_command.substr(pos+1).c_str(), NULL, 0);
+        if(durationMs > 0xffff)
+        {
+            ::printf("duration must be 0-65535 - invalid value: [%lu]\n\n", durationMs);
+            return(false);  // error
+        }
+
+        ::printf("pulsing output bit - bit: [%d] duration: [%lu ms]\n\n", param1, durationMs);
+        if(!p_mp.dispatch_pulse_output_bit(param1, (uint16_t)durationMs))
+        {
+            ::printf("failed to send pulse output bit\n\n");
+            return(false);  // error
+        }
+        return(true);  // valid command
+    }
+
+    // pulse output mask, every bit at once with a 16 bit duration
+    else if(('p' == p_command[0]) && ('m' == p_command[1]))
+    {
+        const std::string::size_type pos = p_command.rfind(' ');
+        const unsigned long durationMs = ::strtoul(p_command.substr(pos+1).c_str(), NULL, 0);
+        if(durationMs > 0xffff)
+        {
+            ::printf("duration must be 0-65535 - invalid value: [%lu]\n\n", durationMs);
+            return(false);  // error
+        }
+
+        ::printf("pulsing output mask - mask: [0x%02x] duration: [%lu ms]\n\n", param1, durationMs);
+        if(!p_mp.dispatch_pulse_output_mask(param1, (uint16_t)durationMs))
+        {
+            ::printf("failed to send pulse output mask\n\n");
+            return(false);  // error
+        }
+        return(true);  // valid command
+    }
+
     return(false);  // unknown command
 }
 
@@ -298,9 +355,13 @@ bool scan_keyboard(keyboard& p_kb, MsgProcessor& p_mp)
                     ::printf("sub out               - subscribe outputs\n");
                     ::printf("sub out cancel        - cancel subscribe outputs\n");
                     ::printf("ping [p1] [p2] [p3]   - ping the avr [optional values]\n");
+                    ::printf("framing hex           - switch to ascii hex frames (E71)\n");
+                    ::printf("framing slip          - switch to binary slip frames (N81)\n");
                     ::printf("wr <value> <mask>     - write register\n");
                     ::printf("wb <bit> <bool>       - write bit\n");
                     ::printf("pb <bit> <delay ms>   - pulse bit state for delay ms\n");
+                    ::printf("pl <bit> <delay ms>   - pulse bit state for up to 65535 ms\n");
+                    ::printf("pm <mask> <delay ms>  - pulse all bits in mask for up to 65535 ms\n");
                     ::printf("exit                  - quit this application\n");
                     ::printf("\n");
                     command.clear();
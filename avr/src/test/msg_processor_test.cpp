@@ -0,0 +1,258 @@
+//
+// Copyright 2015 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including,
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../msg_processor.h"
+
+
+//
+// host test of the framing switch in msg_processor.h, run with make check
+//
+// the processor talks through serial.cpp to a pty, the test plays the
+// bridge on the other end. a pty passes all 8 bits whatever the parity
+// and linux will not set one up as E71, so the tcsetattr errors printed
+// along the way are expected.
+//
+
+static int s_failures = 0;
+
+#define CHECK(cond) do { if(!(cond)) { ::printf("FAIL: %s %d - %s\n", __FILE__, __LINE__, #cond); ++s_failures; } } while(0)
+
+static uint32_t s_subscribes = 0;
+
+
+////////////////////////////////////////
+void on_poll(MsgProcessor& p_mp)
+{
+}
+
+////////////////////////////////////////
+void on_pong(MsgProcessor& p_mp, const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3)
+{
+}
+
+////////////////////////////////////////
+void on_read_register(MsgProcessor& p_mp, const uint8_t p_registerAddress)
+{
+}
+
+////////////////////////////////////////
+void on_write_register(MsgProcessor& p_mp, const uint8_t p_registerAddress, const uint8_t p_value, const uint8_t p_mask)
+{
+}
+
+////////////////////////////////////////
+void on_write_register_bit(MsgProcessor& p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const bool p_state)
+{
+}
+
+////////////////////////////////////////
+void on_pulse_register_bit(MsgProcessor& p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const uint16_t p_durationMs)
+{
+}
+
+////////////////////////////////////////
+void on_subscribe_register(MsgProcessor& p_mp, const uint8_t p_registerAddress, const uint8_t p_value, const bool p_cancel)
+{
+    // answer like avr_impl.cpp does
+    ++s_subscribes;
+    p_mp.dispatch_subscribe_register(p_registerAddress, 0x5a, p_cancel);
+}
+
+
+//
+// the bridge end
+//
+
+struct Bridge
+{
+    int m_fd;
+    uint8_t m_out[512];  // queued by send(), written by flush()
+    uint32_t m_outLen;
+    MsgParser m_parser;  // decodes what the processor sends
+    uint32_t m_count;    // frames decoded
+    uint8_t m_types[32];
+};
+
+////////////////////////////////////////
+static void bridge_send(Bridge& p_br, const uint8_t p_framing, const uint8_t p_type, const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3)
+{
+    MsgBuf buf;
+    if(FRAMING_SLIP == p_framing)
+    {
+        buf.set_slip_bytes(p_type, p_param1, p_param2, p_param3);
+    }
+    else
+    {
+        buf.set_bytes(p_type, p_param1, p_param2, p_param3);
+    }
+    for(uint8_t i=0; i<buf.size(); ++i)
+    {
+        p_br.m_out[p_br.m_outLen++] = buf[i];
+    }
+    if(FRAMING_HEX == p_framing)
+    {
+        // the bridge follows hex frames with a newline
+        p_br.m_out[p_br.m_outLen++] = '\n';
+    }
+}
+
+////////////////////////////////////////
+static void bridge_send_raw(Bridge& p_br, const char* p_data)
+{
+    while('\0' != *p_data)
+    {
+        p_br.m_out[p_br.m_outLen++] = (uint8_t)*p_data++;
+    }
+}
+
+////////////////////////////////////////
+// everything queued goes out in one write, so it all sits in the
+// processor's rx buffer by the time it polls
+static void bridge_flush(Bridge& p_br)
+{
+    CHECK(p_br.m_outLen == (uint32_t)::write(p_br.m_fd, p_br.m_out, p_br.m_outLen));
+    p_br.m_outLen = 0;
+}
+
+////////////////////////////////////////
+// let the processor handle what was sent, then decode its answers in
+// p_framing, returns the number of frames that came back
+static uint32_t bridge_run(Bridge& p_br, MsgProcessor& p_mp, const uint8_t p_framing)
+{
+    p_br.m_parser.set_framing(p_framing);
+    p_br.m_count = 0;
+    for(uint32_t i=0; i<20; ++i)
+    {
+        ::usleep(1000);
+        p_mp.poll();
+
+        uint8_t buf[256];
+        const ssize_t len = ::read(p_br.m_fd, buf, sizeof(buf));
+        for(ssize_t j=0; j<len; ++j)
+        {
+            uint8_t type;
+            uint8_t param1;
+            uint8_t param2;
+            uint8_t param3;
+            if((S_OK == p_br.m_parser.push(buf[j])) && p_br.m_parser.get_bytes(type, param1, param2, param3) && (p_br.m_count < sizeof(p_br.m_types)))
+            {
+                p_br.m_types[p_br.m_count++] = type;
+            }
+        }
+    }
+    return(p_br.m_count);
+}
+
+
+//
+// tests
+//
+
+////////////////////////////////////////
+// the old bridge sent the subscribes right behind the framing request,
+// and the newline after it is always there: none of it may count
+// against the new framing
+static void test_switch_to_slip(Bridge& p_br, MsgProcessor& p_mp)
+{
+    bridge_send(p_br, FRAMING_HEX, MSG_PING, 1, 2, 3);
+    bridge_send(p_br, FRAMING_HEX, MSG_SET_FRAMING, FRAMING_SLIP, FRAMING_REQUEST, 0x00);
+    bridge_send(p_br, FRAMING_HEX, MSG_SUBSCRIBE_REGISTER, REG_INPUT_1, 0x00, 0x00);
+    bridge_send(p_br, FRAMING_HEX, MSG_SUBSCRIBE_REGISTER, REG_OUTPUT_1, 0x00, 0x00);
+    bridge_flush(p_br);
+    CHECK(2 == bridge_run(p_br, p_mp, FRAMING_HEX));
+    CHECK((MSG_PONG == p_br.m_types[0]) && (MSG_SET_FRAMING == p_br.m_types[1]));
+    CHECK(FRAMING_SLIP == p_mp.framing());
+    CHECK(0 == s_subscribes);
+
+    // the same subscribes in binary, with line noise in front of them
+    // that arrived after the switch
+    for(uint32_t i=0; i<FRAMING_FALLBACK_COUNT; ++i)
+    {
+        bridge_send_raw(p_br, "\n\n");
+        bridge_send(p_br, FRAMING_SLIP, MSG_SUBSCRIBE_REGISTER, REG_INPUT_1, 0x00, 0x00);
+    }
+    bridge_flush(p_br);
+    CHECK(FRAMING_FALLBACK_COUNT == bridge_run(p_br, p_mp, FRAMING_SLIP));
+    CHECK(FRAMING_FALLBACK_COUNT == s_subscribes);
+    CHECK(FRAMING_SLIP == p_mp.framing());
+}
+
+////////////////////////////////////////
+// the bridge restarted and talks hex again, the processor follows on the
+// first hex frame and answers it
+static void test_bridge_back_to_hex(Bridge& p_br, MsgProcessor& p_mp)
+{
+    bridge_send(p_br, FRAMING_HEX, MSG_PING, 4, 5, 6);
+    bridge_send(p_br, FRAMING_HEX, MSG_SUBSCRIBE_REGISTER, REG_OUTPUT_1, 0x00, 0x00);
+    bridge_flush(p_br);
+    CHECK(2 == bridge_run(p_br, p_mp, FRAMING_HEX));
+    CHECK((MSG_PONG == p_br.m_types[0]) && (MSG_SUBSCRIBE_REGISTER == p_br.m_types[1]));
+    CHECK(FRAMING_HEX == p_mp.framing());
+}
+
+////////////////////////////////////////
+// garbage that never reaches a hex frame still ends binary framing after
+// FRAMING_FALLBACK_COUNT broken frames
+static void test_bad_frames(Bridge& p_br, MsgProcessor& p_mp)
+{
+    bridge_send(p_br, FRAMING_HEX, MSG_SET_FRAMING, FRAMING_SLIP, FRAMING_REQUEST, 0x00);
+    bridge_flush(p_br);
+    CHECK(1 == bridge_run(p_br, p_mp, FRAMING_HEX));
+    CHECK(FRAMING_SLIP == p_mp.framing());
+
+    for(uint32_t i=0; i<FRAMING_FALLBACK_COUNT; ++i)
+    {
+        bridge_send_raw(p_br, "\xc0\x01\x02\x03\xc0");
+    }
+    bridge_flush(p_br);
+    CHECK(0 == bridge_run(p_br, p_mp, FRAMING_SLIP));
+    CHECK(FRAMING_HEX == p_mp.framing());
+}
+
+////////////////////////////////////////
+int main(const int p_argc, const char** p_argv)
+{
+    Bridge br = Bridge();
+    br.m_fd = ::posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if((br.m_fd < 0) || (0 != ::grantpt(br.m_fd)) || (0 != ::unlockpt(br.m_fd)))
+    {
+        ::printf("no pty\n");
+        return(EXIT_FAILURE);
+    }
+
+    MsgProcessor mp;
+    if(!mp.init(::ptsname(br.m_fd), 57600, true))
+    {
+        ::printf("init failed\n");
+        return(EXIT_FAILURE);
+    }
+
+    test_switch_to_slip(br, mp);
+    test_bridge_back_to_hex(br, mp);
+    test_bad_frames(br, mp);
+
+    ::close(br.m_fd);
+    ::printf("%s\n", ((0 == s_failures) ? "ok" : "FAILED"));
+    return((0 == s_failures) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
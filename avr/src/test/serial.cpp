@@ -18,6 +18,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -27,9 +28,16 @@
 #include "../serial.h"
 #include "../ring_buffer.h"
 #include "../msg_buf.h"
+#include "../msg_parser.h"
 
 static int s_fd = -1;
 
+// bytes are read in bulk and fed to the parser from here, anything left
+// after a complete frame is kept for the next read()
+static uint8_t s_rxBuf[256];
+static size_t s_rxPos = 0;
+static size_t s_rxLen = 0;
+
 ////////////////////////////////////////
 speed_t parse_baudrate(uint32_t p_requested)
 {
@@ -191,7 +199,9 @@ bool SerialPort::init(const char* p_device, const uint16_t p_baud, const bool p_
     // local modes
     tio.c_lflag = 0;
 
-//    tio.c_cc[VMIN] = 1;
+    // reads return whatever is buffered without waiting
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
 
     // clean the modem line and activate the settings for the port
     ::tcflush(s_fd, TCIOFLUSH);
@@ -208,17 +218,91 @@ void SerialPort::close(void)
         ::close(s_fd);
         s_fd = -1;
     }
+    s_rxPos = 0;
+    s_rxLen = 0;
 }
 
 ////////////////////////////////////////
-bool SerialPort::read(MsgBuf& p_msgBuf) const
+// change the frame format without touching the baud rate
+// p_parity
+//   false: N81 (none, 8 data, 1 stop)
+//   true:  E71 (even, 7 data, 1 stop)
+bool SerialPort::set_parity(const bool p_parity) const
+{
+    flush();
+
+    struct termios tio;
+    if(0 != ::tcgetattr(s_fd, &tio))
+    {
+        ::perror("tcgetattr");
+        return(false);
+    }
+
+    tio.c_cflag &= ~(CSIZE | PARENB);
+    if(p_parity)
+    {
+        tio.c_cflag |= (CS7 | PARENB);
+    }
+    else
+    {
+        tio.c_cflag |= CS8;
+    }
+
+    if(0 != ::tcsetattr(s_fd, TCSANOW, &tio))
+    {
+        ::perror("tcsetattr");
+        return(false);
+    }
+    return(true);
+}
+
+////////////////////////////////////////
+// wait for all written output to be transmitted
+void SerialPort::flush(void) const
+{
+    if(s_fd > -1)
+    {
+        ::tcdrain(s_fd);
+    }
+}
+
+////////////////////////////////////////
+// drop everything received but not parsed yet
+void SerialPort::purge(void) const
+{
+    s_rxPos = 0;
+    s_rxLen = 0;
+    if(s_fd > -1)
+    {
+        ::tcflush(s_fd, TCIFLUSH);
+    }
+}
+
+////////////////////////////////////////
+bool SerialPort::read(MsgParser& p_msgParser) const
 {
     for(;;)
     {
-        uint8_t val = 0;
-        const ssize_t bytesRead = ::read(s_fd, &val, 1);
+        while(s_rxPos < s_rxLen)
+        {
+            if(S_OK == p_msgParser.push(s_rxBuf[s_rxPos++]))
+            {
+                // have a message
+                return(true);
+            }
+        }
+
+        const ssize_t bytesRead = ::read(s_fd, s_rxBuf, sizeof(s_rxBuf));
+        s_rxPos = 0;
+        s_rxLen = 0;
         if(bytesRead < 0)
         {
+            if((EAGAIN == errno) || (EWOULDBLOCK == errno) || (EINTR == errno))
+            {
+                // no data available
+                break;
+            }
+
             // error
             perror("serial read error");
             return(false);
@@ -229,13 +313,7 @@ bool SerialPort::read(MsgBuf& p_msgBuf) const
             // no data available
             break;
         }
-
-        p_msgBuf.push_back(val);
-        if(S_OK == p_msgBuf.validate())
-        {
-            // have a message
-            return(true);
-        }
+        s_rxLen = bytesRead;
     }
     return(false);
 }
@@ -21,22 +21,37 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <util/atomic.h>
+
+#include "events.h"
+
+
+//
+// 1ms system tick from timer 0 on the ATmega32
+//
+// the ISR is defined here, so include this header from one translation
+// unit only (avr_impl.cpp)
+//
 
 
 ////////////////////////////////////////////////////////////
 namespace ticks
 {
 
+// callback event, runs in the timer isr once per tick
+void on_tick(void);
+
 namespace
 {
     volatile uint16_t s_ticks = 0;  // 65,536ms = ~65 seconds
 
     ////////////////////////////////////////
-    SIGNAL(TIMER0_COMPA_vect)
+    ISR(TIMER0_COMP_vect)
     {
-        // reset the count value of the timer
-        TCNT0 = 0x00;
+        // CTC mode, the timer clears itself on the compare match
         ++s_ticks;
+        on_tick();
+        events::post(EVENT_TICK);
     }
 } // anonymous namespace
 
@@ -44,7 +59,13 @@ namespace
 ////////////////////////////////////////
 inline uint16_t get(void)
 {
-    return(s_ticks);
+    // the 16 bit count is two loads on the avr, keep the ISR out between them
+    uint16_t ticks;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+    {
+        ticks = s_ticks;
+    }
+    return(ticks);
 }
 
 
@@ -56,20 +77,19 @@ inline void delay(const uint16_t p_delayMs)
 
 
 ////////////////////////////////////////
-void init(void)
+inline void init(void)
 {
-    TCCR0A = 0x00;
-    TCCR0B = _BV(WGM01);  // timer 0 Clear Timer on Compare match (CTC) mode
+    TCCR0 = _BV(WGM01);  // timer 0 Clear Timer on Compare match (CTC) mode
 
     // reset the count value of the timer
     TCNT0 = 0x00;
 
-    // output compare register A (OCR0A)
-    // interrupt fires when this counter value is met
-    OCR0A = 0xFA;  // 1 ms using a 1/64 prescaler: 16MHz/64/250 = 250,000/250 = 1000
+    // output compare register (OCR0)
+    // interrupt fires when this counter value is met, the counter runs 0 to OCR0 inclusive
+    OCR0 = 0xF9;  // 1 ms using a 1/64 prescaler: 16MHz/64/250 = 250,000/250 = 1000
 
-    // enable timer/counter 0 compareA match interrupt enable
-    TIMSK0 |= _BV(OCIE0A);
+    // enable timer/counter 0 compare match interrupt
+    TIMSK |= _BV(OCIE0);
 
     // CS02 CS01 CS00  Description
     //   0    0    0   No clock source (Timer/Counter stopped)
@@ -82,7 +102,7 @@ void init(void)
     //   1    1    1   External clock source on T0 pin. Clock on rising edge.
     //
     // prescaler = 64
-    TCCR0B |= (_BV(CS01) | _BV(CS00));
+    TCCR0 |= (_BV(CS01) | _BV(CS00));
 }
 
 } // namespace ticks
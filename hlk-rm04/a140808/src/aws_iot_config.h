@@ -34,9 +34,13 @@
 // =================================================
 
 // MQTT PubSub
+#ifdef LOW_MEMORY_PROFILE
+#define AWS_IOT_MQTT_TX_BUF_LEN 512            ///< low memory build (make LOW_MEMORY=1), the largest publish is a ~250 byte report plus its topic
+#else
 #define AWS_IOT_MQTT_TX_BUF_LEN 1024           ///< Any time a message is sent out through the MQTT layer. The message is copied into this buffer anytime a publish is done. This will also be used in the case of Thing Shadow
-#define AWS_IOT_MQTT_RX_BUF_LEN 1024           ///< Any message that comes into the device should be less than this buffer size. If a received message is bigger than this buffer size the message will be dropped.
-#define AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS 5  ///< Maximum number of topic filters the MQTT client can handle at any given time. This should be increased appropriately when using Thing Shadow
+#endif
+#define AWS_IOT_MQTT_RX_BUF_LEN 1024           ///< Any message that comes into the device should be less than this buffer size. If a received message is bigger than this buffer size the message will be dropped. update/accepted with its metadata is ~750 bytes, so this stays in the low memory build
+#define AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS 34 ///< Maximum number of topic filters the MQTT client can handle at any given time. 4 per board (delta, pulse, update/accepted, update/rejected) for GATEWAY_MAX_BOARDS plus spare
 
 // Thing Shadow specific configs
 #define SHADOW_MAX_SIZE_OF_RX_BUFFER AWS_IOT_MQTT_RX_BUF_LEN+1 ///< Maximum size of the SHADOW buffer to store the received Shadow message
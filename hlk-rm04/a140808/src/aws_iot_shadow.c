@@ -19,16 +19,23 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "aws_iot_config.h"
 
-#include <jsmn.h>
 #include <aws_iot_log.h>
 #include <aws_iot_version.h>
 //#include <aws_iot_mqtt_client_interface.h>
 #include <aws_iot_shadow_interface.h>
 
+#include "util.h"
+#include "config.h"
 #include "msg_proc.h"
+#include "shadow_json.h"
+#include "outbox.h"
+#include "phase.h"
+#include "network_mbedtls.h"
+#include "aws_iot_shadow.h"
 
 
 //
@@ -63,8 +70,9 @@
 // 3) delta is triggered by cloud:
 //     received delta message: {"o1":1,"o2":1,"o3":1}
 //
-// 4) commit delta state then report it:
-//     {"state":{"reported":{"o1":1,"o2":1,"o3":1}}}
+// 4) commit delta state then report the whole state (see shadow_doc.h):
+//     {"state":{"reported":{"i0":0,"i1":0,"i2":0,"i3":0,"i4":0,"i5":0,"i6":0,"i7":0,
+//                           "o0":0,"o1":1,"o2":1,"o3":1,"o4":0,"o5":0,"o6":0,"o7":0}}}
 //
 // NOTE: It appears that there is no concept of a read-only shadow state.
 //       Special care will need to be taken to never write a 'desired'
@@ -74,159 +82,61 @@
 //       'desired' state to the cloud?
 //
 
-const char *mqtt_thing_name = NULL;
+// gateway mode
+// ~~~~~~~~~~~~
+// every board's thing shares the one tls connection. the sdk's delta
+// registration only covers the thing named at connect, so each thing
+// subscribes to its own delta topic and the "state" object is pulled
+// out here, see shadow_register_thing().
+//
+
 AWS_IoT_Client mqttClient;
 
 /*
  * @note The delta message is always sent on the "state" key in the json
  * @note Any time messages are bigger than AWS_IOT_MQTT_RX_BUF_LEN the underlying MQTT library will ignore it. The maximum size of the message that can be received is limited to the AWS_IOT_MQTT_RX_BUF_LEN
  */
-bool messageArrivedOnDelta = false;
-char stringToEchoDelta[SHADOW_MAX_SIZE_OF_RX_BUFFER];
-jsonStruct_t deltaObject;
-
-
-/**
- * @brief This function builds a full Shadow expected JSON document by putting the data in the reported section
- *
- * @param pJsonDocument Buffer to be filled up with the JSON data
- * @param maxSizeOfJsonDocument maximum size of the buffer that could be used to fill
- * @param pReceivedDeltaData This is the data that will be embedded in the reported section of the JSON document
- * @param lengthDelta Length of the data
- */
-bool build_report_json(char *pJsonDocument, size_t maxSizeOfJsonDocument, const char *pReceivedDeltaData, uint32_t lengthDelta)
-{
-    if(NULL == pJsonDocument) {
-        IOT_ERROR("build_report_json: json document is null");
-        return false;
-    }
-
-    char tempClientTokenBuffer[MAX_SIZE_CLIENT_TOKEN_CLIENT_SEQUENCE];
-    if(aws_iot_fill_with_client_token(tempClientTokenBuffer, MAX_SIZE_CLIENT_TOKEN_CLIENT_SEQUENCE) != SUCCESS) {
-        IOT_ERROR("build_report_json: call to aws_iot_fill_with_client_token failed");
-        return false;
-    }
-
-    int32_t ret = snprintf(pJsonDocument, maxSizeOfJsonDocument, "{\"state\":{\"reported\":%.*s}, \"clientToken\":\"%s\"}", lengthDelta, pReceivedDeltaData, tempClientTokenBuffer);
-    if(ret >= maxSizeOfJsonDocument || ret < 0) {
-        IOT_ERROR("build_report_json: call to snprintf failed (ret: %d)", ret);
-        return false;
-    }
+struct shadow_thing *things[GATEWAY_MAX_BOARDS];
+int thing_count = 0;
 
-    return true;
-}
+// reports made while the connection is down wait in the outbox, after a
+// reconnect only the latest per thing is sent
+static struct ob_context outbox;
+static bool shadow_online = false;
+static uint64_t drain_start_ms = 0;  // when the connection came back or a send failed
+static uint32_t drain_ms_last = 0;   // reconnect until the outbox was empty
+static uint32_t drain_ms_max = 0;
+static uint64_t forced_reconnect_ms = 0;  // last shadow_reconnect() that tried, 0 if none
 
 
 ////////////////////////////////////////
-IoT_Error_t parse_json_delta(const char *json, uint32_t json_len,
-                             uint8_t *input_vals, uint8_t *input_mask,
-                             uint8_t *output_vals, uint8_t *output_mask)
+static uint64_t now_ms(void)
 {
-    *input_vals = 0;
-    *input_mask = 0;
-    *output_vals = 0;
-    *output_mask = 0;
-
-    jsmn_parser parser;
-    jsmn_init(&parser);
-
-    jsmntok_t tokens[MAX_JSON_TOKEN_EXPECTED];
-
-    int32_t token_count = jsmn_parse(&parser, json, json_len, tokens, sizeof(tokens) / sizeof(tokens[0]));
-    if(token_count < 0) {
-        IOT_ERROR("failed to parse json - rc: %d", token_count);
-        return(FAILURE);
-    }
-
-    jsmntok_t *tok = tokens;
-    if( (JSMN_ARRAY  != tok->type) &&
-        (JSMN_OBJECT != tok->type) ) {
-        IOT_ERROR("top-level json element must be an array or an object");
-        return(FAILURE);
-    }
-
-    IOT_DEBUG("json doc: %.*s", json_len, json);
-    IOT_DEBUG("token count: %d", token_count);
-
-    // the array/object should be in key:val form
-    // odd elements are keys, evens are values
-    //
-    // json doc: {"o1":0, "o3":0, "o5":1}
-    // token count: 7
-    // token 0) type: 1  range: 0 - 24  size: 3
-    // token 1) type: 3  range: 2 - 4  size: 1
-    // token 2) type: 4  range: 6 - 7  size: 0
-    // token 3) type: 3  range: 10 - 12  size: 1
-    // token 4) type: 4  range: 14 - 15  size: 0
-    // token 5) type: 3  range: 18 - 20  size: 1
-    // token 6) type: 4  range: 22 - 23  size: 0
-    const int kv_count = tok->size;
-    if((token_count-1) != (kv_count*2)) {
-        IOT_ERROR("json array/object not in key/value format");
-        return(FAILURE);
-    }
-
-    for(int i=0; i<kv_count; ++i) {
-        jsmntok_t *key = ++tok;
-        if(JSMN_STRING != key->type) {
-            IOT_ERROR("element is not a key");
-            return(FAILURE);
-        }
-
-        jsmntok_t *val = ++tok;
-        if(JSMN_PRIMITIVE != val->type) {
-            IOT_ERROR("value is not a primitive");
-            return(FAILURE);
-        }
-
-        const int key_len = (key->end - key->start);
-        if(2 != key_len) {
-            IOT_ERROR("key is not two chars");
-            return(FAILURE);
-        }
-
-        const int val_len = (val->end - val->start);
-        if(1 != val_len) {
-            IOT_ERROR("value is not one char");
-            return(FAILURE);
-        }
-
-        // look for input/output
-        const char op = json[key->start];
-        uint8_t bit_num = (json[key->start + 1] - '0');
-        uint8_t bit_val = (json[val->start]=='0' ? 0 : 1);
-        switch(op) {
-            case 'i':
-                IOT_DEBUG("found input num: %d val: %d", bit_num, bit_val);
-                *input_vals |= (bit_val << bit_num);
-                *input_mask |= (1 << bit_num);
-                break;
-            case 'o':
-                IOT_DEBUG("found output num: %d val: %d", bit_num, bit_val);
-                *output_vals |= (bit_val << bit_num);
-                *output_mask |= (1 << bit_num);
-                break;
-            default:
-                IOT_WARN("skipping key [%.*s]", key_len, json+key->start);
-                break;
-        }
-    }
-
-    return(SUCCESS);
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000));
 }
 
 
 ////////////////////////////////////////
-void delta_callback(const char *pJsonValueBuffer, uint32_t valueLength, jsonStruct_t *pJsonStruct)
+void delta_callback(AWS_IoT_Client *pClient, char *topicName, uint16_t topicNameLen, IoT_Publish_Message_Params *params, void *pData)
 {
-    IOT_UNUSED(pJsonStruct);
+    IOT_UNUSED(pClient);
+    IOT_UNUSED(topicName);
+    IOT_UNUSED(topicNameLen);
 
-    IOT_DEBUG("received delta message: %.*s", valueLength, pJsonValueBuffer);
+    struct shadow_thing *thing = (struct shadow_thing*)pData;
 
-    if(build_report_json(stringToEchoDelta, SHADOW_MAX_SIZE_OF_RX_BUFFER, pJsonValueBuffer, valueLength)) {
-        messageArrivedOnDelta = true;
+    // the delta is always sent on the "state" key
+    const char *pJsonValueBuffer = NULL;
+    uint32_t valueLength = 0;
+    if(!find_json_object((const char*)params->payload, (uint32_t)params->payloadLen, "state", &pJsonValueBuffer, &valueLength)) {
+        IOT_ERROR("%s: delta message has no state object", thing->thing_name);
+        return;
     }
 
+    IOT_DEBUG("%s: received delta message: %.*s", thing->thing_name, valueLength, pJsonValueBuffer);
+
     uint8_t input_vals = 0;
     uint8_t input_mask = 0;
     uint8_t output_vals = 0;
@@ -237,30 +147,32 @@ void delta_callback(const char *pJsonValueBuffer, uint32_t valueLength, jsonStru
         return;
     }
 
-    bool brc = mp_dispatch_write_register(REG_OUTPUT_1, output_vals, output_mask);
-    if(!brc) {
-        IOT_ERROR("failed to write register: mp_dispatch_write_register");
-    }
+    // merged with anything still pending, a later delta wins per key,
+    // shadow_poll() writes and reports the lot once the yield returns.
+    // inputs are read only, the report answers them with the real state
+    thing->desired_vals = ((thing->desired_vals & ~output_mask) | (output_vals & output_mask));
+    thing->desired_mask |= output_mask;
+    thing->delta_report = true;
+    ++thing->delta_events;
 }
 
 
 ////////////////////////////////////////
 void update_status_callback(const char *pThingName, ShadowActions_t action, Shadow_Ack_Status_t status, const char *pReceivedJsonDocument, void *pContextData)
 {
-    IOT_UNUSED(pThingName);
     IOT_UNUSED(action);
     IOT_UNUSED(pReceivedJsonDocument);
     IOT_UNUSED(pContextData);
 
     switch(status) {
         case SHADOW_ACK_TIMEOUT:
-            IOT_INFO("status> update timeout --");
+            IOT_INFO("status> %s update timeout --", pThingName);
             break;
         case SHADOW_ACK_REJECTED:
-            IOT_INFO("status> update rejected xx");
+            IOT_INFO("status> %s update rejected xx", pThingName);
             break;
         case SHADOW_ACK_ACCEPTED:
-            IOT_INFO("status> update accepted !!");
+            IOT_INFO("status> %s update accepted !!", pThingName);
             break;
         default:
             break;
@@ -269,89 +181,204 @@ void update_status_callback(const char *pThingName, ShadowActions_t action, Shad
 
 
 ////////////////////////////////////////
-void subscribe_callback(AWS_IoT_Client *pClient, char *topicName, uint16_t topicNameLen, IoT_Publish_Message_Params *params, void *pData) {
-    IOT_UNUSED(pData);
-    IOT_UNUSED(pClient);
-    IOT_DEBUG("\nSubscribe callback");
-    IOT_DEBUG("------------------");
-    IOT_DEBUG("  topic: %.*s", topicNameLen, topicName);
-    IOT_DEBUG("  payload: %.*s", (int)params->payloadLen, (const char*)params->payload);
+// the document is patched in place, published_* is what the shadow was
+// last sent
+IoT_Error_t send_state(struct shadow_thing *thing, const uint8_t input_vals, const uint8_t output_vals)
+{
+    char *report = sd_render(&thing->report, input_vals, output_vals);
+    IOT_DEBUG("%s: reporting: %s", thing->thing_name, report);
+    IoT_Error_t rc = aws_iot_shadow_update(&mqttClient, thing->thing_name, report, update_status_callback, NULL, 2, true);
+    if(SUCCESS != rc) {
+        IOT_INFO("%s: shadow update failed - rc = %d", thing->thing_name, rc);
+        return rc;
+    }
+
+    if(0 == thing->first_report_ms) {
+        thing->first_report_ms = max((uint32_t)(now_ms() - thing->init_ms), 1u);
+        IOT_INFO("%s: first report %u ms after startup", thing->thing_name, thing->first_report_ms);
+    }
+    thing->published = true;
+    thing->published_inputs = input_vals;
+    thing->published_outputs = output_vals;
+    return(SUCCESS);
+}
 
-    const char *json = (const char*)params->payload;
-    uint32_t json_len = (uint32_t)params->payloadLen;
 
-    jsmn_parser parser;
-    jsmn_init(&parser);
+////////////////////////////////////////
+static struct shadow_thing *find_thing(const char *thing_name)
+{
+    for(int i=0; i<thing_count; ++i) {
+        if(0 == strcmp(things[i]->thing_name, thing_name)) {
+            return(things[i]);
+        }
+    }
+    return(NULL);
+}
 
-    // {"p0","p1","p2","p3","p4","p5","p6","p7"}
-    jsmntok_t tokens[9];  // do not expect more than 8 values plus the surrounding structure
 
-    int32_t token_count = jsmn_parse(&parser, json, json_len, tokens, sizeof(tokens) / sizeof(tokens[0]));
-    if(token_count < 0) {
-        IOT_ERROR("failed to parse json - rc: %d", token_count);
+////////////////////////////////////////
+// send what the outbox holds, oldest first and collapsed to one report
+// per thing. a thing the avr has answered for is sent as it is now,
+// which is never older than its record. a send that fails leaves the
+// rest for the next call
+void drain_outbox(void)
+{
+    if(!shadow_online || (0 == ob_depth(&outbox))) {
         return;
     }
 
-    jsmntok_t *tok = tokens;
-    if( (JSMN_ARRAY  != tok->type) &&
-        (JSMN_OBJECT != tok->type) ) {
-        IOT_ERROR("top-level json element must be an array or an object");
-        return;
+    const uint32_t collapsed = ob_collapse(&outbox);
+    if(collapsed > 0) {
+        IOT_DEBUG("outbox: %u reports collapsed", collapsed);
     }
 
-    IOT_DEBUG("json doc: %.*s", json_len, json);
-    IOT_DEBUG("token count: %d", token_count);
+    struct ob_record rec;
+    while(ob_peek(&outbox, &rec)) {
+        struct shadow_thing *thing = find_thing(rec.thing);
+        if(NULL == thing) {
+            IOT_WARN("outbox: no thing %s, report dropped", rec.thing);
+            ob_pop(&outbox);
+            continue;
+        }
 
-    // only expecting pulse messages right now
-    uint8_t pulse_bits = 0;
-    const int elem_count = tok->size;
-    for(int i=0; i<elem_count; ++i) {
-        jsmntok_t *elem = ++tok;
-        if(JSMN_STRING != elem->type) {
-            IOT_ERROR("element is not a string");
-            return;
+        const bool live = rg_known(&thing->gate);
+        const uint8_t input_vals = (live ? thing->input_vals : rec.inputs);
+        const uint8_t output_vals = (live ? thing->output_vals : rec.outputs);
+        if(thing->published && (input_vals == thing->published_inputs) && (output_vals == thing->published_outputs)) {
+            ob_pop(&outbox);  // the shadow already has it
+            continue;
         }
 
-        const int elem_len = (elem->end - elem->start);
-        if(2 != elem_len) {
-            IOT_ERROR("element is not two chars");
+        if(SUCCESS != send_state(thing, input_vals, output_vals)) {
             return;
         }
+        ob_pop(&outbox);
+    }
 
-        const char op = json[elem->start];
-        if('p' != op) {
-            IOT_ERROR("operation is not 'p'");
-            return;
+    drain_ms_last = (uint32_t)(now_ms() - drain_start_ms);
+    drain_ms_max = max(drain_ms_max, drain_ms_last);
+    IOT_INFO("outbox drained in %u ms", drain_ms_last);
+}
+
+
+////////////////////////////////////////
+// report the whole board state. while the connection is down, or the
+// update cannot be sent, the report is queued in the outbox instead and
+// counts as reported
+IoT_Error_t publish_state(struct shadow_thing *thing)
+{
+    // anything already queued goes first
+    drain_outbox();
+    if(!shadow_online || (0 != ob_depth(&outbox)) ||
+       (SUCCESS != send_state(thing, thing->input_vals, thing->output_vals))) {
+        if(shadow_online && (0 == ob_depth(&outbox))) {
+            drain_start_ms = now_ms();  // the send failed, time the outage from here
+        }
+        if(!ob_push(&outbox, thing->thing_name, thing->input_vals, thing->output_vals)) {
+            return(FAILURE);
         }
-        uint8_t bit_num = (json[elem->start + 1] - '0');
-        pulse_bits |= (1 << bit_num);
+        ++thing->queued;
     }
 
-    // pulse_bits now contains a valid set of bits to pulse
-    // send a pulse to each requested bit
+    thing->reported = true;
+    thing->input_reported = thing->input_vals;
+    return(SUCCESS);
+}
+
+
+////////////////////////////////////////
+// one masked register write and one reported document for everything
+// the deltas since the last call asked for
+IoT_Error_t flush_deltas(struct shadow_thing *thing)
+{
+    if(0 != thing->desired_mask) {
+        if(!mp_dispatch_write_register(thing->mp, REG_OUTPUT_1, thing->desired_vals, thing->desired_mask)) {
+            // serial queue full, write and report on the next poll
+            IOT_ERROR("%s: failed to write register: mp_dispatch_write_register", thing->thing_name);
+            return(SUCCESS);
+        }
+        thing->output_vals = ((thing->output_vals & ~thing->desired_mask) | (thing->desired_vals & thing->desired_mask));
+        thing->desired_mask = 0;
+    }
+
+    // wait for the avr's first answer rather than report made up bits
+    if(!thing->delta_report || !rg_known(&thing->gate)) {
+        return(SUCCESS);
+    }
+
+    IoT_Error_t rc = publish_state(thing);
+    if(SUCCESS != rc) {
+        return rc;
+    }
+
+    thing->delta_report = false;
+    ++thing->delta_publishes;
+    return(SUCCESS);
+}
+
+
+////////////////////////////////////////
+void subscribe_callback(AWS_IoT_Client *pClient, char *topicName, uint16_t topicNameLen, IoT_Publish_Message_Params *params, void *pData) {
+    IOT_UNUSED(pClient);
+    struct shadow_thing *thing = (struct shadow_thing*)pData;
+    IOT_DEBUG("\nSubscribe callback");
+    IOT_DEBUG("------------------");
+    IOT_DEBUG("  topic: %.*s", topicNameLen, topicName);
+    IOT_DEBUG("  payload: %.*s", (int)params->payloadLen, (const char*)params->payload);
+
+    uint8_t pulse_bits = 0;
+    uint16_t durations_ms[8];
+    if(SUCCESS != parse_json_pulses((const char*)params->payload, (uint32_t)params->payloadLen, &pulse_bits, durations_ms)) {
+        return;
+    }
+
+    // pulse_bits now contains a valid set of bits to pulse. the avr runs
+    // every pulse in a mask frame at once, so one frame goes out per
+    // distinct width, all in one serial write
     for(uint8_t bit=0; bit<8; ++bit) {
-        if((pulse_bits >> bit) & 0x01) {
-            // pulse this bit
-            bool rc = mp_dispatch_pulse_register_bit(REG_OUTPUT_1, bit, 250);
-            if(!rc) {
-                IOT_ERROR("failed to pulse bit %d", bit);
-            }
-            else {
-                IOT_DEBUG("pulse sent to bit %d", bit);
+        if(0 == durations_ms[bit]) {
+            durations_ms[bit] = PULSE_DEFAULT_MS;
+        }
+    }
+    mp_begin_batch(thing->mp);
+    uint8_t remaining = pulse_bits;
+    for(uint8_t first=0; first<8; ++first) {
+        if(0 == ((remaining >> first) & 0x01)) {
+            continue;
+        }
+
+        // this bit and every later one with the same width
+        const uint16_t duration_ms = durations_ms[first];
+        uint8_t mask = 0;
+        for(uint8_t bit=first; bit<8; ++bit) {
+            if(((remaining >> bit) & 0x01) && (duration_ms == durations_ms[bit])) {
+                mask |= (1 << bit);
             }
         }
+        remaining &= ~mask;
+
+        bool rc = mp_dispatch_pulse_output_mask(thing->mp, mask, duration_ms);
+        if(!rc) {
+            IOT_ERROR("failed to pulse mask 0x%02x", mask);
+        }
+        else {
+            IOT_DEBUG("pulse sent to mask 0x%02x for %u ms", mask, duration_ms);
+        }
+    }
+    if(!mp_end_batch(thing->mp)) {
+        IOT_ERROR("failed to send pulse batch");
     }
 }
 
 
 ////////////////////////////////////////
-IoT_Error_t shadow_connect(const char *host_name, const uint16_t port, const char *thing_name, 
+// client_id names the mqtt session, things are added after connecting
+// with shadow_register_thing()
+IoT_Error_t shadow_connect(const char *host_name, const uint16_t port, const char *client_id,
                            const char *root_ca_path, const char *cert_path, const char *private_key_path)
 {
     IOT_INFO("\nAWS IoT SDK Version %d.%d.%d-%s", VERSION_MAJOR, VERSION_MINOR, VERSION_PATCH, VERSION_TAG);
 
-    mqtt_thing_name = thing_name;
-
     ShadowInitParameters_t sp = ShadowInitParametersDefault;
     IOT_DEBUG("connecting to: %s:%d", host_name, port);
     sp.pHost = (char*)host_name;
@@ -366,20 +393,34 @@ IoT_Error_t shadow_connect(const char *host_name, const uint16_t port, const cha
     sp.enableAutoReconnect = false;
     sp.disconnectHandler = NULL;
 
+    // parsed once here, every reconnect reuses them
+    IoT_Error_t rc = tls_load_credentials(root_ca_path, cert_path, private_key_path);
+    if(SUCCESS != rc) {
+        return rc;
+    }
+    ph_mark(PH_CREDENTIALS);
+
+    // reports queued by an earlier run go out once the things register
+    if(!ob_open(&outbox, OUTBOX_FILEPATH)) {
+        return(FAILURE);
+    }
+
     IOT_INFO("shadow init");
-    IoT_Error_t rc = aws_iot_shadow_init(&mqttClient, &sp);
+    rc = aws_iot_shadow_init(&mqttClient, &sp);
     if(SUCCESS != rc) {
         IOT_ERROR("shadow connect error: %d", rc);
         return rc;
     }
+    ph_mark(PH_SHADOW_INIT);
 
     ShadowConnectParameters_t scp = ShadowConnectParametersDefault;
-    scp.pMyThingName = (char*)mqtt_thing_name;
-    scp.pMqttClientId = (char*)mqtt_thing_name;
-    scp.mqttClientIdLen = (uint16_t)strlen(mqtt_thing_name);
+    scp.pMyThingName = (char*)client_id;
+    scp.pMqttClientId = (char*)client_id;
+    scp.mqttClientIdLen = (uint16_t)strlen(client_id);
 
     IOT_INFO("shadow connect...");
     rc = aws_iot_shadow_connect(&mqttClient, &scp);
+    ph_mark(PH_MQTT);  // what the tls wrapper did not mark
     if (SUCCESS != rc) {
         if(MQTT_REQUEST_TIMEOUT_ERROR == rc) {
             IOT_ERROR("aws_iot_shadow_connect error: MQTT_REQUEST_TIMEOUT_ERROR");
@@ -388,7 +429,7 @@ IoT_Error_t shadow_connect(const char *host_name, const uint16_t port, const cha
         }
         return rc;
     }
-    IOT_INFO("***  shadow connected - thing name: %s  ***\n\n", mqtt_thing_name);
+    IOT_INFO("***  shadow connected - client id: %s  ***\n\n", client_id);
 
     // enable auto-reconnect
     //   min, max, and backoff are set in aws_iot_config.h
@@ -399,21 +440,11 @@ IoT_Error_t shadow_connect(const char *host_name, const uint16_t port, const cha
         IOT_ERROR("failed to enable shadow autoreconnect - rc: %d", rc);
         return rc;
     }
+    ph_mark(PH_AUTORECONNECT);
 
-    // register for delta callbacks
-    IOT_DEBUG("registering for delta callbacks...");
-//    jsonStruct_t deltaObject;
-    deltaObject.pData = stringToEchoDelta;
-    deltaObject.pKey = "state";
-    deltaObject.type = SHADOW_JSON_OBJECT;
-    deltaObject.cb = delta_callback;
-
-    rc = aws_iot_shadow_register_delta(&mqttClient, &deltaObject);
-    if(SUCCESS != rc) {
-        IOT_ERROR("failed to register shadow delta callback - rc: %d", rc);
-        return rc;
-    }
-
+    thing_count = 0;
+    shadow_online = true;
+    drain_start_ms = now_ms();
     return(SUCCESS);
 }
 
@@ -428,47 +459,251 @@ IoT_Error_t shadow_disconnect(void)
         return rc;
     }
     IOT_INFO("shadow disconnected");
+    shadow_online = false;
+    ob_close(&outbox);
 
     return(SUCCESS);
 }
 
 
 ////////////////////////////////////////
-IoT_Error_t mqtt_subscribe(const char *topic)
+// connect again now rather than after the sdk's reconnect wait, for
+// when the local address the connection was bound to went away or an
+// address appeared while offline. the subscriptions are restored by
+// the sdk, reports wait in the outbox until shadow_poll() sees it back.
+// a flapping link gets at most one attempt per
+// AWS_IOT_MQTT_MIN_RECONNECT_WAIT_INTERVAL, the sdk's backoff does the rest
+IoT_Error_t shadow_reconnect(void)
 {
-    IOT_INFO("mqtt subscribe...");
+    const uint64_t now = now_ms();
+    if((0 != forced_reconnect_ms) && ((now - forced_reconnect_ms) < AWS_IOT_MQTT_MIN_RECONNECT_WAIT_INTERVAL)) {
+        IOT_DEBUG("shadow reconnect skipped, tried %u ms ago", (uint32_t)(now - forced_reconnect_ms));
+        return NETWORK_ATTEMPTING_RECONNECT;
+    }
+    forced_reconnect_ms = now;
+
+    IOT_INFO("shadow reconnecting now...");
+    ph_begin(PH_RECONNECT);
+    shadow_online = false;
+    if(aws_iot_mqtt_is_client_connected(&mqttClient)) {
+        // the disconnect packet may not get out, closing is what matters
+        aws_iot_mqtt_disconnect(&mqttClient);
+    }
+
+    IoT_Error_t rc = aws_iot_mqtt_attempt_reconnect(&mqttClient);
+    if(NETWORK_RECONNECTED == rc) {
+        IOT_INFO("shadow reconnected");
+    }
+    else if(NETWORK_ATTEMPTING_RECONNECT == rc) {
+        IOT_WARN("shadow reconnect failed, the sdk keeps retrying");
+    }
+    else {
+        IOT_ERROR("shadow reconnect error: %d", rc);
+    }
+    return rc;
+}
+
+
+////////////////////////////////////////
+// false while the connection is down and reports go to the outbox
+bool shadow_is_online(void)
+{
+    return(shadow_online);
+}
+
+
+////////////////////////////////////////
+// reset the thing's state before its board is opened, the avr's answers
+// can then be taken while the connection is still coming up
+IoT_Error_t shadow_init_thing(struct shadow_thing *thing)
+{
+    if(!sd_init(&thing->report, thing->thing_name)) {
+        IOT_ERROR("thing name too long: %s", thing->thing_name);
+        return(FAILURE);
+    }
+    rg_init(&thing->gate);
+    thing->reported = false;
+    thing->published = false;
+    thing->queued = 0;
+    thing->desired_mask = 0;
+    thing->delta_report = false;
+    thing->delta_events = 0;
+    thing->delta_publishes = 0;
+    thing->input_events = 0;
+    thing->input_publishes = 0;
+    thing->init_ms = now_ms();
+    thing->first_report_ms = 0;
+    int len = snprintf(thing->delta_topic, sizeof(thing->delta_topic), "$aws/things/%s/shadow/update/delta", thing->thing_name);
+    if((len < 0) || (len >= sizeof(thing->delta_topic))) {
+        IOT_ERROR("thing name too long: %s", thing->thing_name);
+        return(FAILURE);
+    }
+    return(SUCCESS);
+}
+
+
+////////////////////////////////////////
+// subscribe to the thing's delta and pulse topics, the sdk keeps
+// pointers to the topic strings so thing must outlive the connection.
+// thing has been through shadow_init_thing()
+IoT_Error_t shadow_register_thing(struct shadow_thing *thing)
+{
+    if(thing_count >= GATEWAY_MAX_BOARDS) {
+        IOT_ERROR("too many things, max: %d", GATEWAY_MAX_BOARDS);
+        return(FAILURE);
+    }
+
+    const uint16_t len = (uint16_t)strlen(thing->delta_topic);
+    IOT_INFO("registering thing: %s", thing->thing_name);
+    IoT_Error_t rc = aws_iot_mqtt_subscribe(&mqttClient, thing->delta_topic, len, QOS0, delta_callback, thing);
+    if(SUCCESS != rc) {
+        IOT_ERROR("failed to subscribe to shadow delta - rc: %d", rc);
+        return rc;
+    }
 
     // /topics/a140808/ak1w3b7g4
-    IoT_Error_t rc = aws_iot_mqtt_subscribe(&mqttClient, topic, strlen(topic), QOS0, subscribe_callback, NULL);
+    rc = aws_iot_mqtt_subscribe(&mqttClient, thing->topic, strlen(thing->topic), QOS0, subscribe_callback, thing);
     if(SUCCESS != rc) {
         IOT_ERROR("error subscribing: %d ", rc);
         return rc;
     }
 
+    things[thing_count++] = thing;
     return(SUCCESS);
 }
 
 
 ////////////////////////////////////////
-IoT_Error_t shadow_poll(void)
+// the avr reported its inputs, changes are coalesced over
+// get_input_coalesce_ms(), see report_gate.h
+void shadow_input_changed(struct shadow_thing *thing, const uint8_t input_vals)
+{
+    ++thing->input_events;
+    thing->input_vals = input_vals;
+    rg_input(&thing->gate, now_ms(), get_input_coalesce_ms());
+}
+
+
+////////////////////////////////////////
+// the avr reported its outputs, they go out with the next report
+void shadow_output_changed(struct shadow_thing *thing, const uint8_t output_vals)
+{
+    thing->output_vals = output_vals;
+    rg_output(&thing->gate, now_ms());
+}
+
+
+////////////////////////////////////////
+// poll() timeout until the next input report is due, -1 if none are
+int shadow_next_report_ms(void)
+{
+    int timeout = -1;
+    const uint64_t now = now_ms();
+    for(int i=0; i<thing_count; ++i) {
+        const int ms = rg_wait_ms(&things[i]->gate, now);
+        if((ms >= 0) && ((timeout < 0) || (ms < timeout))) {
+            timeout = ms;
+        }
+    }
+    return(timeout);
+}
+
+
+////////////////////////////////////////
+// publish the state of every thing whose input window has closed
+void shadow_report_inputs(void)
+{
+    const uint64_t now = now_ms();
+    for(int i=0; i<thing_count; ++i) {
+        struct shadow_thing *thing = things[i];
+        if(!rg_take(&thing->gate, now)) {
+            continue;
+        }
+
+        if(thing->reported && (thing->input_vals == thing->input_reported)) {
+            continue;  // the inputs settled back where they were
+        }
+
+        // the outputs are normally known by now, both answers are sent
+        // back to back at startup
+        if(!thing->gate.output_known || (SUCCESS != publish_state(thing))) {
+            // try again after another window
+            IOT_WARN("%s: input report deferred", thing->thing_name);
+            rg_defer(&thing->gate, now, max(get_input_coalesce_ms(), SHADOW_SERVICE_MS));
+            continue;
+        }
+
+        ++thing->input_publishes;
+    }
+}
+
+
+////////////////////////////////////////
+void shadow_log_stats(void)
+{
+    for(int i=0; i<thing_count; ++i) {
+        const struct shadow_thing *thing = things[i];
+        IOT_INFO("%s: input changes %u  shadow updates %u  deltas %u  delta reports %u  queued offline %u  first report %u ms", thing->thing_name,
+                 thing->input_events, thing->input_publishes, thing->delta_events, thing->delta_publishes, thing->queued, thing->first_report_ms);
+    }
+
+    struct ob_stats stats;
+    ob_get_stats(&outbox, &stats);
+    IOT_INFO("outbox: depth %u  high water %u  queued %u  collapsed %u  sent %u  recovered %u  drain %u ms  max drain %u ms",
+             stats.depth, stats.high_water, stats.queued, stats.collapsed, stats.sent, stats.recovered, drain_ms_last, drain_ms_max);
+    tls_log_stats();
+}
+
+
+////////////////////////////////////////
+// tls socket to wait on, -1 while disconnected
+int shadow_get_fd(void)
+{
+    return(mqttClient.networkStack.tlsDataParams.server_fd.fd);
+}
+
+
+////////////////////////////////////////
+// true if mbedtls has already read and decrypted data that shadow_poll()
+// has not consumed, the socket will not become readable for it
+bool shadow_has_pending(void)
+{
+    if(shadow_get_fd() < 0) {
+        return(false);
+    }
+    return(mbedtls_ssl_get_bytes_avail(&mqttClient.networkStack.tlsDataParams.ssl) > 0);
+}
+
+
+////////////////////////////////////////
+// run the sdk for up to timeout_ms, call when the socket is readable or
+// when keepalive, ack timeouts or reconnects may be due
+IoT_Error_t shadow_poll(const uint32_t timeout_ms)
 {
 //    IOT_DEBUG("shadow poll...");
 
-    IoT_Error_t rc = aws_iot_shadow_yield(&mqttClient, 200);
+    IoT_Error_t rc = aws_iot_shadow_yield(&mqttClient, timeout_ms);
     if(NETWORK_ATTEMPTING_RECONNECT == rc) {
         IOT_INFO("shadow reconnecting...");
+        ph_begin(PH_RECONNECT);  // once per outage, the retries add to it
+        shadow_online = false;  // reports wait in the outbox
         return rc;
     }
+    if(!shadow_online) {
+        ph_mark(PH_MQTT);
+        ph_end();
+        shadow_online = true;
+        drain_start_ms = now_ms();
+    }
 
-    if(messageArrivedOnDelta) {
-        IOT_INFO("----------------\nsending delta message back\n%s\n", stringToEchoDelta);
-        rc = aws_iot_shadow_update(&mqttClient, mqtt_thing_name, stringToEchoDelta, update_status_callback, NULL, 2, true);
+    // reports queued while the connection was down, then deltas that
+    // arrived during the yield
+    drain_outbox();
+    for(int i=0; i<thing_count; ++i) {
+        rc = flush_deltas(things[i]);
         if(SUCCESS != rc) {
-            IOT_INFO("shadow update failed - rc = %d", rc);
             return rc;
         }
-
-        messageArrivedOnDelta = false;
     }
 
     return(SUCCESS);
@@ -20,15 +20,67 @@
 #define __aws_iot_shadow_h__
 
 
+#include <stdbool.h>
+
+#include "aws_iot_config.h"
+#include "shadow_doc.h"
+#include "report_gate.h"
+
 #include <aws_iot_error.h>
 #include <aws_iot_mqtt_client.h>
 
 
-IoT_Error_t shadow_connect(const char *host_name, const uint16_t port, const char *thing_name,
+struct mp_context;
+
+// one per board, all things share the one mqtt connection
+struct shadow_thing {
+    const char *thing_name;
+    const char *topic;           // pulse requests, a140808/<thing_name>
+    struct mp_context *mp;       // the board this thing's deltas go to
+    char delta_topic[MAX_SHADOW_TOPIC_LENGTH_BYTES];
+
+    // board state, every report carries both masks whole
+    struct report_gate gate;     // answers seen and when the inputs are due
+    bool reported;               // input_reported holds what the shadow has
+    uint8_t input_vals;
+    uint8_t output_vals;         // from the avr, or as written for a delta
+    uint8_t input_reported;
+    struct shadow_doc report;
+    bool published;              // the shadow was sent published_*, not just queued
+    uint8_t published_inputs;
+    uint8_t published_outputs;
+    uint32_t queued;             // reports put in the outbox while offline
+    uint64_t init_ms;            // shadow_init_thing(), near process start
+    uint32_t first_report_ms;    // from init_ms to the first update sent, 0 until then
+
+    // deltas merged until the next shadow_poll(), a later delta wins per key
+    uint8_t desired_vals;
+    uint8_t desired_mask;        // not yet written to the avr
+    bool delta_report;           // the deltas still need a report
+    uint32_t delta_events;       // delta messages received
+    uint32_t delta_publishes;    // merged reports sent for them
+
+    // input changes, reported once gate says they are due
+    uint32_t input_events;       // changes received from the avr
+    uint32_t input_publishes;    // shadow updates sent for them
+};
+
+
+IoT_Error_t shadow_connect(const char *host_name, const uint16_t port, const char *client_id,
 						   const char *root_ca_path, const char *cert_path, const char *private_key_path);
 IoT_Error_t shadow_disconnect(void);
-IoT_Error_t mqtt_subscribe(const char *topic);
-IoT_Error_t shadow_poll(void);
+IoT_Error_t shadow_reconnect(void);
+bool shadow_is_online(void);
+IoT_Error_t shadow_init_thing(struct shadow_thing *thing);
+IoT_Error_t shadow_register_thing(struct shadow_thing *thing);
+int shadow_get_fd(void);
+bool shadow_has_pending(void);
+IoT_Error_t shadow_poll(const uint32_t timeout_ms);
+void shadow_input_changed(struct shadow_thing *thing, const uint8_t input_vals);
+void shadow_output_changed(struct shadow_thing *thing, const uint8_t output_vals);
+int shadow_next_report_ms(void);
+void shadow_report_inputs(void);
+void shadow_log_stats(void);
 
 
 #endif // __aws_iot_shadow_h__
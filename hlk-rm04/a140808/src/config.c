@@ -43,10 +43,21 @@ char iot_root_ca_path[_POSIX_PATH_MAX+1] = { 0 };
 char iot_cert_path[_POSIX_PATH_MAX+1] = { 0 };
 char iot_private_key_path[_POSIX_PATH_MAX+1] = { 0 };
 
+uint32_t input_coalesce_ms = INPUT_COALESCE_MS;
+
 // a140808/ak1w3b7g4
 #define MQTT_TOPIC_PREFIX "a140808/"
 char mqtt_subscribe_topic[sizeof(MQTT_TOPIC_PREFIX) + THING_NAME_SIZE];  // sizeof accounts for the term null
 
+// gateway mode, one entry per serial port, empty unless -g is given
+struct board_config {
+    char device[_POSIX_PATH_MAX+1];
+    char thing_name[THING_NAME_SIZE+1];
+    char mqtt_topic[sizeof(MQTT_TOPIC_PREFIX) + THING_NAME_SIZE];
+};
+struct board_config boards[GATEWAY_MAX_BOARDS];
+int board_count = 0;
+
 
 ////////////////////////////////////////
 int load_thing_name(char *buf, const size_t buflen)
@@ -229,6 +240,33 @@ int set_iot_private_key_path(const char *buf)
 }
 
 
+////////////////////////////////////////
+uint32_t get_input_coalesce_ms(void)
+{
+    return(input_coalesce_ms);
+}
+
+////////////////////////////////////////
+int set_input_coalesce_ms(const char *buf)
+{
+    if(is_str_empty(buf)) {
+        input_coalesce_ms = INPUT_COALESCE_MS;
+        return(SUCCESS);
+    }
+
+    const int ms = atoi(buf);
+    if((ms < 0) || (ms > INPUT_COALESCE_MAX_MS)) {
+        log_error("input coalesce window must be 0 - %d ms", INPUT_COALESCE_MAX_MS);
+        return(ERROR_INVALID_ARG);
+    }
+    input_coalesce_ms = (uint32_t)ms;
+
+    log_info("input coalesce window: %" PRIu32 "ms", input_coalesce_ms);
+
+    return(SUCCESS);
+}
+
+
 ////////////////////////////////////////
 const char* get_mqtt_topic(void)
 {
@@ -242,6 +280,119 @@ const char* get_mqtt_topic(void)
 }
 
 
+////////////////////////////////////////
+// gateway config, one board per line, '#' starts a comment:
+//
+//   # device     thing name
+//   /dev/ttyS1   ak1w3b7g4
+//   /dev/ttyS2   ak1w3b7g5
+//
+int load_gateway_config(const char *path)
+{
+    FILE *pfd = fopen(path, "r");
+    if(NULL == pfd) {
+        log_error("failed to open gateway config: [%s], err: [%s]", path, strerror(errno));
+        return(ERROR_FILE_NOT_FOUND);
+    }
+
+    int rc = SUCCESS;
+    int line_num = 0;
+    char line[_POSIX_PATH_MAX + THING_NAME_SIZE + 32];
+    board_count = 0;
+    while(NULL != fgets(line, sizeof(line), pfd)) {
+        ++line_num;
+        char *comment = strchr(line, '#');
+        if(NULL != comment) {
+            *comment = '\0';
+        }
+
+        char *save = NULL;
+        const char *device = strtok_r(line, " \t\r\n", &save);
+        if(NULL == device) {
+            continue;  // blank line
+        }
+        const char *name = strtok_r(NULL, " \t\r\n", &save);
+        if((NULL == name) || (NULL != strtok_r(NULL, " \t\r\n", &save))) {
+            log_error("gateway config line %d: expected <device> <thing name>", line_num);
+            rc = ERROR_INVALID_ARG;
+            break;
+        }
+        if((strlen(device) >= sizeof(boards[0].device)) || (strlen(name) > THING_NAME_SIZE)) {
+            log_error("gateway config line %d: device or thing name too long", line_num);
+            rc = ERROR_INSUFFICIENT_BUFFER;
+            break;
+        }
+        if(board_count >= GATEWAY_MAX_BOARDS) {
+            log_error("gateway config line %d: more than %d boards", line_num, GATEWAY_MAX_BOARDS);
+            rc = ERROR_INVALID_ARG;
+            break;
+        }
+
+        struct board_config *board = &boards[board_count];
+        strncpy(board->device, device, sizeof(board->device));
+        strncpy(board->thing_name, name, sizeof(board->thing_name));
+        snprintf(board->mqtt_topic, sizeof(board->mqtt_topic), MQTT_TOPIC_PREFIX "%s", name);
+        for(int i=0; i<board_count; ++i) {
+            if((0 == strcmp(boards[i].device, board->device)) || (0 == strcmp(boards[i].thing_name, board->thing_name))) {
+                log_error("gateway config line %d: duplicate device or thing name", line_num);
+                rc = ERROR_INVALID_ARG;
+                break;
+            }
+        }
+        if(SUCCESS != rc) {
+            break;
+        }
+        log_info("gateway board %d: %s -> %s", board_count, board->device, board->thing_name);
+        ++board_count;
+    }
+    fclose(pfd);
+
+    if((SUCCESS == rc) && (0 == board_count)) {
+        log_error("gateway config: [%s] lists no boards", path);
+        rc = ERROR_INVALID_ARG;
+    }
+    if(SUCCESS != rc) {
+        board_count = 0;
+    }
+    return(rc);
+}
+
+////////////////////////////////////////
+// without a gateway config there is one board, SERIAL_PORT, named by
+// the thing name in flash
+int get_board_count(void)
+{
+    return((board_count > 0) ? board_count : 1);
+}
+
+////////////////////////////////////////
+const char* get_board_device(const int index)
+{
+    if(0 == board_count) {
+        return((0 == index) ? SERIAL_PORT : NULL);
+    }
+    return(((index >= 0) && (index < board_count)) ? boards[index].device : NULL);
+}
+
+////////////////////////////////////////
+const char* get_board_thing_name(const int index)
+{
+    if(0 == board_count) {
+        return((0 == index) ? get_thing_name() : NULL);
+    }
+    return(((index >= 0) && (index < board_count)) ? boards[index].thing_name : NULL);
+}
+
+////////////////////////////////////////
+const char* get_board_mqtt_topic(const int index)
+{
+    if(0 == board_count) {
+        return((0 == index) ? get_mqtt_topic() : NULL);
+    }
+    return(((index >= 0) && (index < board_count)) ? boards[index].mqtt_topic : NULL);
+}
+
+
 ////////////////////////////////////////
 int get_ipv4_addresses(const char *delim, char *buf, size_t buflen)
 {
@@ -24,18 +24,44 @@
 
 
 #define APP_NAME                "a140808"
+#ifndef APP_VERSION
+#define APP_VERSION             "unknown"  // set by the makefile from git describe
+#endif
 #define PID_FILEPATH            "/var/run/" APP_NAME ".pid"
+#define OUTBOX_FILEPATH         "/var/run/" APP_NAME ".outbox"  // tmpfs, reports queued while offline
+#define TLS_SESSION_FILEPATH    "/var/run/" APP_NAME ".session" // tmpfs, last tls session for resuming
+#define QUERY_SOCKET_FILEPATH   "/var/run/" APP_NAME ".sock"    // phase timing summary, see query.h
+#define TLS_SESSION_PERSIST     true   // resume the tls session after a restart, not just a reconnect
 
 #define SERIAL_PORT             "/dev/ttyS1"
 #define SERIAL_BAUD             57600
 #define SERIAL_USE_E71          true
+#define SERIAL_USE_SLIP         false  // negotiate binary frames (8N1) after connecting
 
 #define HOST_DEFAULT_PORT       8883
 
+// tls record size asked of the server with the max fragment length
+// extension: 512, 1024, 2048 or 4096, 0 leaves it at the 16k default
+#ifdef LOW_MEMORY_PROFILE
+#define TLS_MAX_FRAG_LEN        1024
+#else
+#define TLS_MAX_FRAG_LEN        0
+#endif
+
+#define SHADOW_SERVICE_MS       1000  // sdk housekeeping interval: keepalive, ack timeouts, reconnects
+#define SHADOW_YIELD_MS         1     // sdk yield once the socket is readable, the sdk rejects 0
+
+#define INPUT_COALESCE_MS       50    // input changes within this window share one shadow update, see -w
+#define INPUT_COALESCE_MAX_MS   1000
+
+#define PULSE_DEFAULT_MS        250   // pulse width for a request that does not give one
+
 #define THING_NAME_OFFSET       0x400
 #define THING_NAME_FILEPATH     "/dev/mtd2"
 #define THING_NAME_SIZE         9  // ak1w3b7g4
 
+#define GATEWAY_MAX_BOARDS      8  // serial ports one process can drive, see load_gateway_config()
+
 
 const char* get_thing_name(void);
 
@@ -51,7 +77,17 @@ int set_iot_cert_path(const char *buf);
 const char* get_iot_private_key_path(void);
 int set_iot_private_key_path(const char *buf);
 
+uint32_t get_input_coalesce_ms(void);
+int set_input_coalesce_ms(const char *buf);
+
 const char* get_mqtt_topic(void);
+
+int load_gateway_config(const char *path);
+int get_board_count(void);
+const char* get_board_device(const int index);
+const char* get_board_thing_name(const int index);
+const char* get_board_mqtt_topic(const int index);
+
 int get_ipv4_addresses(const char *delim, char *buf, size_t buflen);
 
 
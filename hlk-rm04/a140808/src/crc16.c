@@ -0,0 +1,74 @@
+//
+// Copyright 2015-2017 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its 
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including, 
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR 
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any 
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#include <stdint.h>
+
+#include "crc16.h"
+
+
+#if defined(CRC16_USE_NIBBLE)
+uint16_t g_crc16_table[16];
+#elif defined(CRC16_USE_SLICE4)
+uint16_t g_crc16_table[4][256];
+#else
+uint16_t g_crc16_table[256];
+#endif
+
+
+////////////////////////////////////////
+// table entry for p_val, 8 steps for a byte table, 4 for a nibble table
+static uint16_t crc16_entry(uint16_t p_val, uint8_t p_steps)
+{
+    for(; p_steps > 0; --p_steps)
+    {
+        p_val = ((0 == (p_val & 0x0001)) ? (p_val >> 1) : ((p_val >> 1) ^ 0xa001));
+    }
+    return(p_val);
+}
+
+////////////////////////////////////////
+// runs before main() so the inline crc16_update() never sees an empty table
+__attribute__((constructor))
+static void crc16_init(void)
+{
+#if defined(CRC16_USE_NIBBLE)
+    for(uint16_t i=0; i<16; ++i)
+    {
+        g_crc16_table[i] = crc16_entry(i, 4);
+    }
+#elif defined(CRC16_USE_SLICE4)
+    for(uint16_t i=0; i<256; ++i)
+    {
+        g_crc16_table[0][i] = crc16_entry(i, 8);
+    }
+    // slice k: the crc of byte i followed by k zero bytes
+    for(uint16_t k=1; k<4; ++k)
+    {
+        for(uint16_t i=0; i<256; ++i)
+        {
+            const uint16_t prev = g_crc16_table[k - 1][i];
+            g_crc16_table[k][i] = ((prev >> 8) ^ g_crc16_table[0][prev & 0xff]);
+        }
+    }
+#else
+    for(uint16_t i=0; i<256; ++i)
+    {
+        g_crc16_table[i] = crc16_entry(i, 8);
+    }
+#endif
+}
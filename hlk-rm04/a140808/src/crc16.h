@@ -0,0 +1,85 @@
+//
+// Copyright 2015-2017 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its 
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including, 
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR 
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any 
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#ifndef __crc16_h__
+#define __crc16_h__
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+//
+// crc16, reflected poly 0xa001 (same results as the bitwise mb_update_crc16
+// this replaces), port of avr/src/crc16.h
+//
+// variants, pick one at build time:
+//   CRC16_USE_NIBBLE  16 entry table, 32 bytes, two lookups per byte
+//   CRC16_USE_TABLE   256 entry table, 512 bytes, one lookup per byte
+//   CRC16_USE_SLICE4  4 x 256 entry tables, 2k, four bytes per step in
+//                     crc16_update_block() (default)
+//
+// the tables are filled in by a constructor in crc16.c before main()
+//
+#if !defined(CRC16_USE_NIBBLE) && !defined(CRC16_USE_TABLE) && !defined(CRC16_USE_SLICE4)
+#define CRC16_USE_SLICE4
+#endif
+
+#if defined(CRC16_USE_NIBBLE)
+extern uint16_t g_crc16_table[16];
+#elif defined(CRC16_USE_SLICE4)
+extern uint16_t g_crc16_table[4][256];
+#else
+extern uint16_t g_crc16_table[256];
+#endif
+
+
+////////////////////////////////////////
+static inline uint16_t crc16_update(const uint16_t p_crc, const uint8_t p_ch)
+{
+#if defined(CRC16_USE_NIBBLE)
+    uint16_t crc = p_crc;
+    crc = ((crc >> 4) ^ g_crc16_table[(crc ^ p_ch) & 0x0f]);
+    crc = ((crc >> 4) ^ g_crc16_table[(crc ^ (p_ch >> 4)) & 0x0f]);
+    return(crc);
+#elif defined(CRC16_USE_SLICE4)
+    return((p_crc >> 8) ^ g_crc16_table[0][(p_crc ^ p_ch) & 0xff]);
+#else
+    return((p_crc >> 8) ^ g_crc16_table[(p_crc ^ p_ch) & 0xff]);
+#endif
+}
+
+////////////////////////////////////////
+static inline uint16_t crc16_update_block(const uint16_t p_crc, const uint8_t* p_data, size_t p_len)
+{
+    uint16_t crc = p_crc;
+#if defined(CRC16_USE_SLICE4)
+    for(; p_len >= 4; p_len -= 4, p_data += 4)
+    {
+        crc ^= (p_data[0] | ((uint16_t)p_data[1] << 8));
+        crc = (g_crc16_table[3][crc & 0xff] ^ g_crc16_table[2][crc >> 8] ^
+               g_crc16_table[1][p_data[2]]  ^ g_crc16_table[0][p_data[3]]);
+    }
+#endif
+    for(; p_len > 0; --p_len, ++p_data)
+    {
+        crc = crc16_update(crc, *p_data);
+    }
+    return(crc);
+}
+
+#endif // __crc16_h__
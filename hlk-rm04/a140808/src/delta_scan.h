@@ -0,0 +1,417 @@
+//
+// Copyright 2015-2017 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its 
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including, 
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR 
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any 
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#ifndef __delta_scan_h__
+#define __delta_scan_h__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+
+//
+// single pass scanners for the documents the bridge receives, no token
+// array and every read is bounds checked against the length given
+//
+//  ds_find_object()  the "state" object of a delta message
+//  ds_scan_bits()    {"o1":1,"i3":0,...}      keys i0-i7/o0-o7, values 0/1
+//  ds_scan_pulses()  {"p0":250,"p3"} or ["p0"] pulse requests, ms optional
+//
+// each returns false when the document is not in the shape it expects,
+// the caller then falls back to jsmn which decides whether it is valid.
+// for documents a scanner accepts the result is the same as the jsmn
+// path's.
+//
+
+struct ds_cursor
+{
+    const char* json;
+    uint32_t len;
+    uint32_t pos;
+};
+
+
+////////////////////////////////////////
+static inline void ds_skip_ws(struct ds_cursor* p_cur)
+{
+    while(p_cur->pos < p_cur->len)
+    {
+        const char ch = p_cur->json[p_cur->pos];
+        if((' ' != ch) && ('\t' != ch) && ('\r' != ch) && ('\n' != ch))
+        {
+            break;
+        }
+        ++p_cur->pos;
+    }
+}
+
+////////////////////////////////////////
+// true and advances past p_ch if it is the next char after white space
+static inline bool ds_expect(struct ds_cursor* p_cur, const char p_ch)
+{
+    ds_skip_ws(p_cur);
+    if((p_cur->pos < p_cur->len) && (p_ch == p_cur->json[p_cur->pos]))
+    {
+        ++p_cur->pos;
+        return(true);
+    }
+    return(false);
+}
+
+////////////////////////////////////////
+// a two char string such as "o1", nothing else is expected as a key
+static inline bool ds_key2(struct ds_cursor* p_cur, char* p_ch0, char* p_ch1)
+{
+    if(!ds_expect(p_cur, '"') || ((p_cur->pos + 3) > p_cur->len) || ('"' != p_cur->json[p_cur->pos + 2]))
+    {
+        return(false);
+    }
+    *p_ch0 = p_cur->json[p_cur->pos];
+    *p_ch1 = p_cur->json[p_cur->pos + 1];
+    p_cur->pos += 3;
+    return(('\\' != *p_ch0) && ('\\' != *p_ch1));
+}
+
+////////////////////////////////////////
+// true if only white space is left
+static inline bool ds_at_end(struct ds_cursor* p_cur)
+{
+    ds_skip_ws(p_cur);
+    return(p_cur->pos == p_cur->len);
+}
+
+////////////////////////////////////////
+// skip a string, the cursor is on its opening quote. strings with
+// escapes are left to jsmn
+static inline bool ds_skip_string(struct ds_cursor* p_cur)
+{
+    for(++p_cur->pos; p_cur->pos < p_cur->len; ++p_cur->pos)
+    {
+        const char ch = p_cur->json[p_cur->pos];
+        if('\\' == ch)
+        {
+            return(false);
+        }
+        if('"' == ch)
+        {
+            ++p_cur->pos;
+            return(true);
+        }
+    }
+    return(false);
+}
+
+////////////////////////////////////////
+// skip a value: a string, a number or literal, or an object or array
+// with everything nested in it
+static inline bool ds_skip_value(struct ds_cursor* p_cur)
+{
+    ds_skip_ws(p_cur);
+    if(p_cur->pos >= p_cur->len)
+    {
+        return(false);
+    }
+
+    const char first = p_cur->json[p_cur->pos];
+    if('"' == first)
+    {
+        return(ds_skip_string(p_cur));
+    }
+
+    if(('{' != first) && ('[' != first))
+    {
+        // 12, -1.5e3, true, null
+        const uint32_t start = p_cur->pos;
+        while(p_cur->pos < p_cur->len)
+        {
+            const char ch = p_cur->json[p_cur->pos];
+            if(!(((ch >= '0') && (ch <= '9')) || ((ch >= 'a') && (ch <= 'z')) || ((ch >= 'A') && (ch <= 'Z')) ||
+                 ('-' == ch) || ('+' == ch) || ('.' == ch)))
+            {
+                break;
+            }
+            ++p_cur->pos;
+        }
+        return(p_cur->pos > start);
+    }
+
+    // tokenized the way jsmn does, so the end found is the one jsmn
+    // would find. one bit per open container, set for an object
+    uint32_t stack = 0;
+    uint8_t depth = 0;
+    while(p_cur->pos < p_cur->len)
+    {
+        const char ch = p_cur->json[p_cur->pos];
+        if('"' == ch)
+        {
+            if(!ds_skip_string(p_cur))
+            {
+                return(false);
+            }
+        }
+        else if(('{' == ch) || ('[' == ch))
+        {
+            if(depth >= 32)
+            {
+                return(false);
+            }
+            stack = ((stack << 1) | ('{' == ch));
+            ++depth;
+            ++p_cur->pos;
+        }
+        else if(('}' == ch) || (']' == ch))
+        {
+            if((stack & 0x01) != ('}' == ch))
+            {
+                return(false);
+            }
+            stack >>= 1;
+            ++p_cur->pos;
+            if(0 == --depth)
+            {
+                return(true);
+            }
+        }
+        else if((' ' == ch) || ('\t' == ch) || ('\r' == ch) || ('\n' == ch) || (':' == ch) || (',' == ch))
+        {
+            ++p_cur->pos;
+        }
+        else
+        {
+            // a primitive runs to the next delimiter, quotes and braces included
+            for(; p_cur->pos < p_cur->len; ++p_cur->pos)
+            {
+                const uint8_t pch = (uint8_t)p_cur->json[p_cur->pos];
+                if((' ' == pch) || ('\t' == pch) || ('\r' == pch) || ('\n' == pch) ||
+                   (':' == pch) || (',' == pch) || (']' == pch) || ('}' == pch))
+                {
+                    break;
+                }
+                if((pch < 32) || (pch >= 127))
+                {
+                    return(false);
+                }
+            }
+        }
+    }
+    return(false);
+}
+
+////////////////////////////////////////
+// find the object value of top level key p_key, the object is returned
+// braces included. the whole document is checked, not just up to the key
+static inline bool ds_find_object(const char* p_json, const uint32_t p_len, const char* p_key,
+                                  const char** p_obj, uint32_t* p_objLen)
+{
+    struct ds_cursor cur = { p_json, p_len, 0 };
+    const size_t key_len = strlen(p_key);
+    const char* obj = NULL;
+    uint32_t obj_len = 0;
+    if(!ds_expect(&cur, '{'))
+    {
+        return(false);
+    }
+
+    if(!ds_expect(&cur, '}'))
+    {
+        do
+        {
+            ds_skip_ws(&cur);
+            if((cur.pos >= cur.len) || ('"' != cur.json[cur.pos]))
+            {
+                return(false);
+            }
+            const uint32_t key_start = (cur.pos + 1);
+            if(!ds_skip_string(&cur))
+            {
+                return(false);
+            }
+            const uint32_t key_end = (cur.pos - 1);  // closing quote
+            if(!ds_expect(&cur, ':'))
+            {
+                return(false);
+            }
+
+            ds_skip_ws(&cur);
+            const uint32_t val_start = cur.pos;
+            if(!ds_skip_value(&cur))
+            {
+                return(false);
+            }
+            if((NULL == obj) && (key_len == (key_end - key_start)) && (0 == memcmp(&cur.json[key_start], p_key, key_len)))
+            {
+                if('{' != cur.json[val_start])
+                {
+                    return(false);
+                }
+                obj = &cur.json[val_start];
+                obj_len = (cur.pos - val_start);
+            }
+        } while(ds_expect(&cur, ','));
+
+        if(!ds_expect(&cur, '}'))
+        {
+            return(false);
+        }
+    }
+    if((NULL == obj) || !ds_at_end(&cur))
+    {
+        return(false);
+    }
+
+    *p_obj = obj;
+    *p_objLen = obj_len;
+    return(true);
+}
+
+////////////////////////////////////////
+// {"o1":1,"i3":0} into value/mask pairs, an empty object is allowed
+static inline bool ds_scan_bits(const char* p_json, const uint32_t p_len,
+                                uint8_t* p_inputVals, uint8_t* p_inputMask,
+                                uint8_t* p_outputVals, uint8_t* p_outputMask)
+{
+    struct ds_cursor cur = { p_json, p_len, 0 };
+    uint8_t vals[2] = { 0, 0 };
+    uint8_t mask[2] = { 0, 0 };
+    if(!ds_expect(&cur, '{'))
+    {
+        return(false);
+    }
+
+    if(!ds_expect(&cur, '}'))
+    {
+        do
+        {
+            char op;
+            char num;
+            if(!ds_key2(&cur, &op, &num) || !ds_expect(&cur, ':'))
+            {
+                return(false);
+            }
+            ds_skip_ws(&cur);
+            if((cur.pos >= cur.len) || (('o' != op) && ('i' != op)) || (num < '0') || (num > '7'))
+            {
+                return(false);
+            }
+            const char val = cur.json[cur.pos++];
+            if(('0' != val) && ('1' != val))
+            {
+                return(false);
+            }
+
+            const uint8_t side = (('o' == op) ? 1 : 0);
+            const uint8_t bit = (num - '0');
+            vals[side] |= (('1' == val) << bit);
+            mask[side] |= (1 << bit);
+        } while(ds_expect(&cur, ','));
+
+        if(!ds_expect(&cur, '}'))
+        {
+            return(false);
+        }
+    }
+    if(!ds_at_end(&cur))
+    {
+        return(false);
+    }
+
+    *p_inputVals = vals[0];
+    *p_inputMask = mask[0];
+    *p_outputVals = vals[1];
+    *p_outputMask = mask[1];
+    return(true);
+}
+
+////////////////////////////////////////
+// a pulse width of 1-65535ms, digits only
+static inline bool ds_scan_ms(struct ds_cursor* p_cur, uint16_t* p_ms)
+{
+    ds_skip_ws(p_cur);
+    uint32_t ms = 0;
+    uint8_t digits = 0;
+    while((p_cur->pos < p_cur->len) && (p_cur->json[p_cur->pos] >= '0') && (p_cur->json[p_cur->pos] <= '9'))
+    {
+        if(++digits > 5)
+        {
+            return(false);
+        }
+        ms = ((ms * 10) + (p_cur->json[p_cur->pos++] - '0'));
+    }
+    if((0 == ms) || (ms > 0xffff))
+    {
+        return(false);
+    }
+    *p_ms = (uint16_t)ms;
+    return(true);
+}
+
+////////////////////////////////////////
+// {"p0":250,"p3"} or ["p0","p3"] into a mask, at most 8 entries. a
+// pulse width is only allowed in the object form, p_durationsMs gets
+// one per bit with 0 where none was given
+static inline bool ds_scan_pulses(const char* p_json, const uint32_t p_len, uint8_t* p_bits, uint16_t* p_durationsMs)
+{
+    struct ds_cursor cur = { p_json, p_len, 0 };
+    char close = '}';
+    if(!ds_expect(&cur, '{'))
+    {
+        if(!ds_expect(&cur, '['))
+        {
+            return(false);
+        }
+        close = ']';
+    }
+
+    uint8_t bits = 0;
+    uint8_t count = 0;
+    uint16_t durations[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    if(!ds_expect(&cur, close))
+    {
+        do
+        {
+            char op;
+            char num;
+            if((++count > 8) || !ds_key2(&cur, &op, &num) || ('p' != op) || (num < '0') || (num > '7'))
+            {
+                return(false);
+            }
+            const uint8_t bit = (num - '0');
+            bits |= (1 << bit);
+            durations[bit] = 0;
+            if(('}' == close) && ds_expect(&cur, ':') && !ds_scan_ms(&cur, &durations[bit]))
+            {
+                return(false);
+            }
+        } while(ds_expect(&cur, ','));
+
+        if(!ds_expect(&cur, close))
+        {
+            return(false);
+        }
+    }
+    if(!ds_at_end(&cur))
+    {
+        return(false);
+    }
+
+    *p_bits = bits;
+    memcpy(p_durationsMs, durations, sizeof(durations));
+    return(true);
+}
+
+#endif // __delta_scan_h__
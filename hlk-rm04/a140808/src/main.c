@@ -22,33 +22,167 @@
 #include <signal.h>
 #include <unistd.h> // _SC_OPEN_MAX, setsid
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/resource.h>
 
 #include "aws_iot_shadow.h"
+#include "network_mbedtls.h"
 
 #include "log.h"
 #include "error.h"
 #include "util.h"
 #include "config.h"
 #include "msg_proc.h"
+#include "netwatch.h"
+#include "phase.h"
+#include "query.h"
 
 
 static bool s_run = false;
 
+// one serial port and thing shadow per board, see load_gateway_config()
+static struct mp_context s_boards[GATEWAY_MAX_BOARDS];
+static struct shadow_thing s_things[GATEWAY_MAX_BOARDS];
+static int s_board_count = 0;
+
+// main loop wait set, PFD_BOARD+n is board n's serial thread event queue
+enum { PFD_SHADOW = 0, PFD_TIMER, PFD_NETWORK, PFD_QUERY, PFD_SIGNAL, PFD_BOARD, PFD_COUNT = PFD_BOARD + GATEWAY_MAX_BOARDS };
+
 
 ////////////////////////////////////////
-void sig_term(int signum)
+// peak resident size, compare against a LOW_MEMORY=1 build
+void log_memory(void)
 {
-    log_info("received SIGTERM, exiting...");
-    s_run = false;
-//    signal(signum, SIG_DFL);
+    struct rusage usage;
+    if(0 != getrusage(RUSAGE_SELF, &usage)) {
+        log_warn("getrusage error: [%s]", strerror(errno));
+        return;
+    }
+    log_info("peak rss %ld kB, mqtt buffers tx %d rx %d, tls record size %d", usage.ru_maxrss,
+             AWS_IOT_MQTT_TX_BUF_LEN, AWS_IOT_MQTT_RX_BUF_LEN, TLS_MAX_FRAG_LEN);
 }
 
+
 ////////////////////////////////////////
-void sig_hup(int signum)
+// SIGHUP, SIGUSR1, SIGINT and SIGTERM are blocked and read from the
+// returned signalfd instead, so a signal that arrives while the main
+// loop is busy is handled on its next pass rather than only when it
+// happens to interrupt poll(). call before the serial threads start,
+// they inherit the mask
+int open_signals(void)
 {
-    log_info("received SIGHUP");
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    if(0 != sigprocmask(SIG_BLOCK, &mask, NULL)) {
+        log_error("failed to block signals: [%s]", strerror(errno));
+        return(-1);
+    }
+
+    const int sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if(sfd < 0) {
+        log_error("failed to create signalfd: [%s]", strerror(errno));
+    }
+    return(sfd);
+}
+
+////////////////////////////////////////
+// handles every signal queued on sfd, clears s_run for SIGINT / SIGTERM
+void read_signals(const int sfd)
+{
+    struct signalfd_siginfo si;
+    while(sizeof(si) == read(sfd, &si, sizeof(si))) {
+        switch(si.ssi_signo) {
+        case SIGHUP:
+            log_info("received SIGHUP");
+            for(int i=0; i<s_board_count; ++i) {
+                mp_log_stats(&s_boards[i]);
+            }
+            shadow_log_stats();
+            log_memory();
+            break;
+
+        case SIGUSR1:
+            // certificates replaced on disk, picked up by the next reconnect
+            log_info("received SIGUSR1, credentials are parsed again on the next connect");
+            tls_reload_credentials();
+            break;
+
+        default:
+            log_info("received %s, exiting...", ((SIGINT == si.ssi_signo) ? "SIGINT" : "SIGTERM"));
+            s_run = false;
+            break;
+        }
+    }
+}
+
+
+////////////////////////////////////////
+// returns once a non loopback interface is up with an ipv4 address,
+// false if told to exit first. nfd wakes this as soon as dhcp assigns
+// one, without it the addresses are checked every 2 sec. the boards'
+// answers and signals on sfd are taken meanwhile
+bool wait_for_address(const int nfd, const int sfd, char *addrs, const size_t addrs_len)
+{
+    struct pollfd pfds[2 + GATEWAY_MAX_BOARDS];
+    pfds[0].fd = nfd;
+    pfds[0].events = POLLIN;
+    pfds[1].fd = sfd;
+    pfds[1].events = POLLIN;
+    for(int i=0; i<s_board_count; ++i) {
+        pfds[2 + i].fd = mp_get_fd(&s_boards[i]);
+        pfds[2 + i].events = POLLIN;
+    }
+
+    while(SUCCESS != get_ipv4_addresses("|", addrs, addrs_len)) {
+        log_info("waiting for an ip address...");
+        for(;;) {
+            const int n = poll(pfds, (nfds_t)(2 + s_board_count), ((nfd < 0) ? 2000 : -1));
+            if(n < 0) {
+                if(EINTR == errno) {
+                    continue;
+                }
+                log_error("address wait poll error: [%s]", strerror(errno));
+                return(false);
+            }
+            if(0 != (pfds[1].revents & POLLIN)) {
+                read_signals(sfd);
+            }
+            if(!s_run) {
+                return(false);
+            }
+            for(int i=0; i<s_board_count; ++i) {
+                if(0 != (pfds[2 + i].revents & POLLIN)) {
+                    mp_poll(&s_boards[i]);
+                }
+            }
+            if((0 == n) || (0 != (pfds[0].revents & POLLIN))) {
+                break;  // 2 sec up or the network changed, check again
+            }
+        }
+        if(nfd > -1) {
+            nw_read(nfd, 0);
+        }
+    }
+    return(true);
+}
+
+
+////////////////////////////////////////
+// stops each board's serial thread and closes its port
+void close_boards(void)
+{
+    for(int i=0; i<s_board_count; ++i) {
+        mp_close(&s_boards[i]);
+    }
+    s_board_count = 0;
 }
 
 
@@ -59,10 +193,12 @@ void sig_hup(int signum)
 //  -r <root ca path>
 //  -c <cert path>
 //  -k <private key path>
+//  -g <gateway config path>, one line per board: <device> <thing name>
+//  -w <input coalesce window ms>
 //
 int parse_args(int argc, char *const*argv) {
     int rc, opt;
-    while (-1 != (opt = getopt(argc, argv, ":h:p:c:k:r:"))) {
+    while (-1 != (opt = getopt(argc, argv, ":h:p:c:k:r:g:w:"))) {
         switch(opt) {
         case 'h':
             log_debug("parse_args host %s", optarg);
@@ -104,6 +240,22 @@ int parse_args(int argc, char *const*argv) {
                 return(rc);
             }
             break;
+        case 'g':
+            log_debug("parse_args gateway config path %s", optarg);
+            rc = load_gateway_config(optarg);
+            if(SUCCESS != rc) {
+                log_error("failed to load gateway config");
+                return(rc);
+            }
+            break;
+        case 'w':
+            log_debug("parse_args input coalesce window %s", optarg);
+            rc = set_input_coalesce_ms(optarg);
+            if(SUCCESS != rc) {
+                log_error("failed to set input coalesce window");
+                return(rc);
+            }
+            break;
         case ':':
             log_error("option -%c requires an argument.", optopt);
             return(ERROR_INVALID_ARG);
@@ -120,6 +272,8 @@ int parse_args(int argc, char *const*argv) {
 ////////////////////////////////////////
 int main(int argc, char *const*argv)
 {
+    ph_begin(PH_BOOT);
+
     int rc = parse_args(argc, argv);
     if(SUCCESS != rc) {
         log_error("failed to parse command line, rc = %d", rc);
@@ -142,11 +296,17 @@ int main(int argc, char *const*argv)
         log_error("private key path -k is required");
         return(EXIT_FAILURE);
     }
+    if(is_str_empty(get_board_thing_name(0))) {
+        log_error("no thing name, use -g or check " THING_NAME_FILEPATH);
+        return(EXIT_FAILURE);
+    }
+    ph_mark(PH_ARGS);
 
-    // signals
-    signal(SIGHUP,  sig_hup);
-    signal(SIGINT,  sig_term);
-    signal(SIGTERM, sig_term);
+    // signals, blocked from here on and read from sfd
+    const int sfd = open_signals();
+    if(sfd < 0) {
+        return(EXIT_FAILURE);
+    }
 
     // create leases and pid files as 0644
     umask(022);
@@ -169,58 +329,222 @@ int main(int argc, char *const*argv)
     }
     fprintf(pfd, "%d\n", getpid());
     fclose(pfd);
+    ph_mark(PH_PID_FILE);
 
     // app setup now complete
     // begin message processing
 
+    // open the boards first, the avrs answer with their inputs and
+    // outputs while the network and the tls handshake come up, so the
+    // first report is ready the moment the connection is
+    for(int i=0; i<get_board_count(); ++i) {
+        const char *device = get_board_device(i);
+        struct mp_context *mp = &s_boards[i];
+        struct shadow_thing *thing = &s_things[i];
+        thing->thing_name = get_board_thing_name(i);
+        thing->topic = get_board_mqtt_topic(i);
+        thing->mp = mp;
+        if(SUCCESS != shadow_init_thing(thing)) {
+            close_boards();
+            unlink(PID_FILEPATH);
+            return(EXIT_FAILURE);
+        }
+
+        if(!mp_init(mp, device, SERIAL_BAUD, SERIAL_USE_E71)) {
+            log_error("failed to open port: [%s]  baud: [%d]  parity: [%s]", device, SERIAL_BAUD, (SERIAL_USE_E71 ? "E71" : "N81"));
+            close_boards();
+            unlink(PID_FILEPATH);
+            return(EXIT_FAILURE);
+        }
+        mp->user = thing;
+        ++s_board_count;
+
+        if(!mp_dispatch_ping(mp, 0, 0, 0)) {
+            log_warn("%s: failed to ping the avr", device);
+        }
+        if(SERIAL_USE_SLIP && !mp_dispatch_set_framing(mp, FRAMING_SLIP)) {
+            log_warn("%s: failed to request binary framing, staying with hex", device);
+        }
+
+        // the avr answers with the current inputs and outputs, then sends
+        // every change. with slip requested these wait in the command
+        // queue until the avr acks the new framing
+        if(!mp_dispatch_subscribe_register(mp, REG_INPUT_1, 0, false) ||
+           !mp_dispatch_subscribe_register(mp, REG_OUTPUT_1, 0, false)) {
+            log_warn("%s: failed to subscribe to inputs and outputs", device);
+        }
+    }
+
+    ph_mark(PH_BOARDS);
+
+    // subscribed before the first check so an address assigned in between
+    // still wakes the wait
+    const int nfd = nw_open();
+    if(nfd < 0) {
+        log_warn("no netlink, polling for an ip address instead");
+    }
+
+    // a SIGTERM that arrived earlier is still queued on sfd and ends the
+    // wait or the first pass of the main loop
+    s_run = true;
     char addrs[64] = { 0 };
-    while(SUCCESS != get_ipv4_addresses("|", addrs, sizeof(addrs))) {
-        sleep_ms(2000); // check for an ip address every 2 sec
+    if(!wait_for_address(nfd, sfd, addrs, sizeof(addrs))) {
+        nw_close(nfd);
+        close(sfd);
+        close_boards();
+        unlink(PID_FILEPATH);
+        return(EXIT_SUCCESS);
     }
     addrs; // TODO: report addresses
+    ph_mark(PH_IP_WAIT);
 
-    // connect shadow
-    rc = shadow_connect(get_host_name(), get_host_port(), get_thing_name(),
+    // connect shadow, one tls connection carries every board's thing
+    rc = shadow_connect(get_host_name(), get_host_port(), get_board_thing_name(0),
                         get_iot_root_ca_path(), get_iot_cert_path(), get_iot_private_key_path());
     if(SUCCESS != rc) {
         log_error("shadow connect error: %d", rc);
+        close_boards();
         unlink(PID_FILEPATH);
         return(EXIT_FAILURE);
     }
     log_info("shadow connected");
 
-    // subscribe events
-    rc = mqtt_subscribe(get_mqtt_topic());
-    if(SUCCESS != rc) {
-        log_error("mqtt subscribe error: %d", rc);
-        unlink(PID_FILEPATH);
-        return(EXIT_FAILURE);
-    }
-    log_info("subscribed to thing topic: %s", get_mqtt_topic());
+    for(int i=0; i<s_board_count; ++i) {
+        struct shadow_thing *thing = &s_things[i];
+        rc = shadow_register_thing(thing);
+        if(SUCCESS != rc) {
+            log_error("mqtt subscribe error: %d", rc);
+            close_boards();
+            shadow_disconnect();
+            unlink(PID_FILEPATH);
+            return(EXIT_FAILURE);
+        }
+        log_info("board %s subscribed to thing topic: %s", s_boards[i].name, thing->topic);
 
-    // init the serial message processor
-    if(!mp_init(SERIAL_PORT, SERIAL_BAUD, SERIAL_USE_E71))
-    {
-        log_error("failed to open port: [%s]  baud: [%d]  parity: [%s]", SERIAL_PORT, SERIAL_BAUD, (SERIAL_USE_E71 ? "E71" : "N81"));
+        // answers that came in during the handshake, a board that has
+        // already answered is reported straight away
+        mp_poll(&s_boards[i]);
+    }
+    ph_mark(PH_SUBSCRIBE);
+    shadow_report_inputs();
+    ph_mark(PH_REPORT);
+    ph_end();
+
+    // no query socket is not fatal, only the timings cannot be asked for
+    const int qfd = qs_open(QUERY_SOCKET_FILEPATH);
+
+    // housekeeping timer, the sdk only needs to run on a schedule for
+    // keepalives, ack timeouts and reconnects
+    const int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(tfd < 0) {
+        log_error("failed to create timer: [%s]", strerror(errno));
+        close_boards();
         shadow_disconnect();
         unlink(PID_FILEPATH);
         return(EXIT_FAILURE);
     }
+    const struct itimerspec its = {
+        .it_interval = { .tv_sec = SHADOW_SERVICE_MS / 1000, .tv_nsec = (SHADOW_SERVICE_MS % 1000) * 1000000L },
+        .it_value    = { .tv_sec = SHADOW_SERVICE_MS / 1000, .tv_nsec = (SHADOW_SERVICE_MS % 1000) * 1000000L },
+    };
+    timerfd_settime(tfd, 0, &its, NULL);
+
+    struct pollfd pfds[PFD_COUNT] = {
+        [PFD_SHADOW]  = { .fd = -1,  .events = POLLIN },
+        [PFD_TIMER]   = { .fd = tfd, .events = POLLIN },
+        [PFD_NETWORK] = { .fd = nfd, .events = POLLIN },
+        [PFD_QUERY]   = { .fd = qfd, .events = POLLIN },
+        [PFD_SIGNAL]  = { .fd = sfd, .events = POLLIN },
+    };
+    for(int i=0; i<s_board_count; ++i) {
+        pfds[PFD_BOARD + i].fd = mp_get_fd(&s_boards[i]);
+        pfds[PFD_BOARD + i].events = POLLIN;
+    }
+    const nfds_t pfd_count = (PFD_BOARD + s_board_count);
 
     // main loop
-    s_run = true;
+    // sleep until an avr sends something, the tls socket is readable, the
+    // housekeeping timer fires or a signal is queued
     while(s_run && (NETWORK_ATTEMPTING_RECONNECT == rc || NETWORK_RECONNECTED == rc || SUCCESS == rc)) {
-        rc = shadow_poll();
+        // the socket changes across reconnects, -1 is skipped by poll()
+        pfds[PFD_SHADOW].fd = shadow_get_fd();
+
+        // data already decrypted by mbedtls does not show up on the socket
+        const bool pending = shadow_has_pending();
+        if(poll(pfds, pfd_count, (pending ? 0 : shadow_next_report_ms())) < 0) {
+            if(EINTR == errno) {
+                continue;
+            }
+            log_error("main loop poll error: [%s]", strerror(errno));
+            break;
+        }
+
+        if(0 != (pfds[PFD_SIGNAL].revents & POLLIN)) {
+            read_signals(sfd);
+            if(!s_run) {
+                break;
+            }
+        }
+
+        // avr frames are handled as soon as the serial thread queues them
+        for(int i=0; i<s_board_count; ++i) {
+            if(0 != (pfds[PFD_BOARD + i].revents & POLLIN)) {
+                mp_poll(&s_boards[i]);
+            }
+        }
+
+        // a connection bound to a removed address would otherwise hang
+        // until tcp or the keepalive gives up, and an address appearing
+        // while offline need not wait out the reconnect backoff, as long
+        // as a running interface really has one now
+        if(0 != (pfds[PFD_NETWORK].revents & POLLIN)) {
+            const int changes = nw_read(nfd, nw_local_addr(shadow_get_fd()));
+            const bool added = ((0 != (changes & NW_ADDED)) && !shadow_is_online() &&
+                                (SUCCESS == get_ipv4_addresses("|", addrs, sizeof(addrs))));
+            if((0 != (changes & NW_LOST)) || added) {
+                rc = shadow_reconnect();
+                if((NETWORK_RECONNECTED == rc) || (NETWORK_ATTEMPTING_RECONNECT == rc)) {
+                    continue;  // poll the new socket, shadow_poll() brings it back online
+                }
+                break;
+            }
+        }
+
+        if(0 != (pfds[PFD_QUERY].revents & POLLIN)) {
+            qs_serve(qfd);
+        }
+
+        bool service = (pending || (0 != (pfds[PFD_SHADOW].revents & (POLLIN | POLLERR | POLLHUP))));
+        if(0 != (pfds[PFD_TIMER].revents & POLLIN)) {
+            uint64_t expirations;
+            if(read(tfd, &expirations, sizeof(expirations)) < 0) {
+                log_warn("timer read error: [%s]", strerror(errno));
+            }
+            service = true;
+        }
+        if(service) {
+            rc = shadow_poll(SHADOW_YIELD_MS);
+        }
+
+        // input changes whose coalesce window has closed
+        shadow_report_inputs();
     }
 
     if(SUCCESS != rc) {
         log_error("shadow poll error, exiting...: %d", rc);
     }
 
+    close(tfd);
+    close(sfd);
+    nw_close(nfd);
+    qs_close(qfd, QUERY_SOCKET_FILEPATH);
+
     // cleanup
     log_info(APP_NAME " process closing");
 
-    mp_close();
+    close_boards();
+    shadow_log_stats();
+    log_memory();
 
     rc = shadow_disconnect();
     unlink(PID_FILEPATH);
@@ -241,38 +565,46 @@ int main(int argc, char *const*argv)
 //
 
 ////////////////////////////////////////
-void mp_on_pong(const uint8_t param1, const uint8_t param2, const uint8_t param3)
+void mp_on_pong(struct mp_context* p_mp, const uint8_t param1, const uint8_t param2, const uint8_t param3)
 {
-    log_debug("mp_on_pong");
+    log_info("%s: avr answered ping", p_mp->name);
 }
 
 ////////////////////////////////////////
-void mp_on_read_register(const uint8_t registerAddress)
+void mp_on_read_register(struct mp_context* p_mp, const uint8_t registerAddress)
 {
-    log_debug("mp_on_read_register");
+    log_debug("%s: mp_on_read_register", p_mp->name);
 }
 
 ////////////////////////////////////////
-void mp_on_write_register(const uint8_t registerAddress, const uint8_t value, const uint8_t mask)
+void mp_on_write_register(struct mp_context* p_mp, const uint8_t registerAddress, const uint8_t value, const uint8_t mask)
 {
-    log_debug("mp_on_write_register");
+    log_debug("%s: mp_on_write_register", p_mp->name);
 }
 
 ////////////////////////////////////////
-void mp_on_write_register_bit(const uint8_t registerAddress, const uint8_t bit, const bool state)
+void mp_on_write_register_bit(struct mp_context* p_mp, const uint8_t registerAddress, const uint8_t bit, const bool state)
 {
-    log_debug("mp_on_write_register_bit");
+    log_debug("%s: mp_on_write_register_bit", p_mp->name);
 }
 
 ////////////////////////////////////////
-void mp_on_pulse_register_bit(const uint8_t registerAddress, const uint8_t bit, const uint8_t durationMs)
+void mp_on_pulse_register_bit(struct mp_context* p_mp, const uint8_t registerAddress, const uint8_t bit, const uint16_t durationMs)
 {
-    log_debug("mp_on_pulse_register_bit");
+    log_debug("%s: mp_on_pulse_register_bit", p_mp->name);
 }
 
 ////////////////////////////////////////
-void mp_on_subscribe_register(const uint8_t registerAddress, const uint8_t value, const bool cancel)
+void mp_on_subscribe_register(struct mp_context* p_mp, const uint8_t registerAddress, const uint8_t value, const bool cancel)
 {
-    log_debug("mp_on_subscribe_register");
+    log_debug("%s: mp_on_subscribe_register", p_mp->name);
+    if(cancel) {
+        return;
+    }
+    if(REG_INPUT_1 == registerAddress) {
+        shadow_input_changed((struct shadow_thing*)p_mp->user, value);
+    }
+    else if(REG_OUTPUT_1 == registerAddress) {
+        shadow_output_changed((struct shadow_thing*)p_mp->user, value);
+    }
 }
-
@@ -22,6 +22,7 @@
 #include <stdbool.h>
 
 #include "ring_buf.h"
+#include "crc16.h"
 
 
 //
@@ -53,7 +54,36 @@
 #define HEX2DEC(hx)  ((uint8_t)(((hx)>='0' && (hx)<='9') ? (hx)-'0' : (((hx)>='A' && (hx)<='F') ? (hx)-'A'+10 : (((hx)>='a' && (hx)<='f') ? (hx)-'a'+10 : 0))))
 #define ISHEXCH(ch)  (((ch)>='0' && (ch)<='9') || ((ch)>='A' && (ch)<='F') || ((ch)>='a' && (ch)<='f'))
 
+
+//
+// binary message format, negotiated with MSG_SET_FRAMING and sent 8N1
+// to be valid, we need at least 8 bytes
+//
+// | E | x | x | x | x | c | c | E |
+// +---+---+---+---+---+---+---+---+
+// | 0 | 1 | 2 | 3 | 4 | 5 | 6 | 7 |
+//
+//   E        = begin message (SLIP_END)
+//   xxxx     = message payload, 4 bytes
+//   cc       = crc of bytes 1-4, low byte first
+//   E        = end message (SLIP_END)
+//
+//   payload and crc bytes equal to SLIP_END or SLIP_ESC are sent as
+//   SLIP_ESC SLIP_ESC_END or SLIP_ESC SLIP_ESC_ESC (rfc 1055 slip), so
+//   a frame is 8 to 14 bytes on the wire. the leading SLIP_END lets the
+//   receiver drop whatever came before the frame, see msg_parser.h
+//
+#define FRAMING_HEX      0x00
+#define FRAMING_SLIP     0x01
+
+#define SLIP_END         0xC0
+#define SLIP_ESC         0xDB
+#define SLIP_ESC_END     0xDC
+#define SLIP_ESC_ESC     0xDD
+#define SLIP_MIN_COUNT   8
+
 static inline uint8_t mb_validate(struct ring_buf_data* p_pd);
+static inline uint16_t mb_update_crc16(const uint16_t p_crc, const uint8_t p_ch);
 static inline uint16_t mb_get_crc(struct ring_buf_data* p_pd);
 static inline uint16_t mb_compute_crc(struct ring_buf_data* p_pd);
 
@@ -78,7 +108,7 @@ static inline bool mb_get_bytes(struct ring_buf_data* p_pd, uint8_t* p_val0, uin
     *p_val2 = 0;
     *p_val3 = 0;
 
-    if(S_OK != mb_validate(p_pd))
+    if((S_OK != mb_validate(p_pd)) || (MSG_BEGIN_CHAR != rb_at(p_pd, 0)))
     {
         return(false);
     }
@@ -94,19 +124,22 @@ static inline bool mb_get_bytes(struct ring_buf_data* p_pd, uint8_t* p_val0, uin
 ////////////////////////////////////////
 static inline void mb_set_bytes(struct ring_buf_data* p_pd, const uint8_t p_val0, const uint8_t p_val1, const uint8_t p_val2, const uint8_t p_val3)
 {
+    const uint8_t payload[8] =
+    {
+        DEC2HEX((p_val0>>4) & 0x0f), DEC2HEX(p_val0 & 0x0f),
+        DEC2HEX((p_val1>>4) & 0x0f), DEC2HEX(p_val1 & 0x0f),
+        DEC2HEX((p_val2>>4) & 0x0f), DEC2HEX(p_val2 & 0x0f),
+        DEC2HEX((p_val3>>4) & 0x0f), DEC2HEX(p_val3 & 0x0f),
+    };
+
     rb_clear(p_pd);
     rb_push_back(p_pd, MSG_BEGIN_CHAR);                  // byte  0
+    for(uint8_t i=0; i<sizeof(payload); ++i)
+    {
+        rb_push_back(p_pd, payload[i]);                  // bytes 1-8
+    }
 
-    rb_push_back(p_pd, DEC2HEX((p_val0>>4) & 0x0f));     // byte  1
-    rb_push_back(p_pd, DEC2HEX( p_val0     & 0x0f));     // byte  2
-    rb_push_back(p_pd, DEC2HEX((p_val1>>4) & 0x0f));     // byte  3
-    rb_push_back(p_pd, DEC2HEX( p_val1     & 0x0f));     // byte  4
-    rb_push_back(p_pd, DEC2HEX((p_val2>>4) & 0x0f));     // byte  5
-    rb_push_back(p_pd, DEC2HEX( p_val2     & 0x0f));     // byte  6
-    rb_push_back(p_pd, DEC2HEX((p_val3>>4) & 0x0f));     // byte  7
-    rb_push_back(p_pd, DEC2HEX( p_val3     & 0x0f));     // byte  8
-
-    const uint16_t crc = mb_compute_crc(p_pd);
+    const uint16_t crc = crc16_update_block(0xffff, payload, sizeof(payload));
     rb_push_back(p_pd, DEC2HEX((crc  >>12) & 0x0f));     // byte  9
     rb_push_back(p_pd, DEC2HEX((crc  >> 8) & 0x0f));     // byte 10
     rb_push_back(p_pd, DEC2HEX((crc  >> 4) & 0x0f));     // byte 11
@@ -115,9 +148,51 @@ static inline void mb_set_bytes(struct ring_buf_data* p_pd, const uint8_t p_val0
     rb_push_back(p_pd, MSG_END_CHAR);                    // byte 13
 }
 
+////////////////////////////////////////
+static inline void mb_push_back_slip(struct ring_buf_data* p_pd, const uint8_t p_val)
+{
+    if(SLIP_END == p_val)
+    {
+        rb_push_back(p_pd, SLIP_ESC);
+        rb_push_back(p_pd, SLIP_ESC_END);
+    }
+    else if(SLIP_ESC == p_val)
+    {
+        rb_push_back(p_pd, SLIP_ESC);
+        rb_push_back(p_pd, SLIP_ESC_ESC);
+    }
+    else
+    {
+        rb_push_back(p_pd, p_val);
+    }
+}
+
+////////////////////////////////////////
+static inline void mb_set_slip_bytes(struct ring_buf_data* p_pd, const uint8_t p_val0, const uint8_t p_val1, const uint8_t p_val2, const uint8_t p_val3)
+{
+    const uint8_t payload[4] = { p_val0, p_val1, p_val2, p_val3 };
+    const uint16_t crc = crc16_update_block(0xffff, payload, sizeof(payload));
+
+    rb_clear(p_pd);
+    rb_push_back(p_pd, SLIP_END);                        // byte  0
+    mb_push_back_slip(p_pd, p_val0);                     // byte  1
+    mb_push_back_slip(p_pd, p_val1);                     // byte  2
+    mb_push_back_slip(p_pd, p_val2);                     // byte  3
+    mb_push_back_slip(p_pd, p_val3);                     // byte  4
+    mb_push_back_slip(p_pd,  crc       & 0xff);          // byte  5
+    mb_push_back_slip(p_pd, (crc >> 8) & 0xff);          // byte  6
+    rb_push_back(p_pd, SLIP_END);                        // byte  7
+}
+
 ////////////////////////////////////////
 static inline uint8_t mb_validate(struct ring_buf_data* p_pd)
 {
+    if(!rb_empty(p_pd) && (SLIP_END == rb_at(p_pd, 0)))
+    {
+        // binary frame, see mb_set_slip_bytes()
+        return(((rb_size(p_pd) < SLIP_MIN_COUNT) || (SLIP_END != rb_at(p_pd, rb_size(p_pd) - 1))) ? E_BAD_FRAME : S_OK);
+    }
+
     // to be valid, we need 14 chars
     if(rb_size(p_pd) < 14)
     {
@@ -143,16 +218,7 @@ static inline uint8_t mb_validate(struct ring_buf_data* p_pd)
 ////////////////////////////////////////
 static inline uint16_t mb_update_crc16(const uint16_t p_crc, const uint8_t p_ch)
 {
-    uint16_t crc = (p_crc ^ (uint16_t)p_ch);
-    crc = ((0 == (crc & 0x0001)) ? (crc >> 1) : ((crc >> 1) ^ 0xa001));
-    crc = ((0 == (crc & 0x0001)) ? (crc >> 1) : ((crc >> 1) ^ 0xa001));
-    crc = ((0 == (crc & 0x0001)) ? (crc >> 1) : ((crc >> 1) ^ 0xa001));
-    crc = ((0 == (crc & 0x0001)) ? (crc >> 1) : ((crc >> 1) ^ 0xa001));
-    crc = ((0 == (crc & 0x0001)) ? (crc >> 1) : ((crc >> 1) ^ 0xa001));
-    crc = ((0 == (crc & 0x0001)) ? (crc >> 1) : ((crc >> 1) ^ 0xa001));
-    crc = ((0 == (crc & 0x0001)) ? (crc >> 1) : ((crc >> 1) ^ 0xa001));
-    crc = ((0 == (crc & 0x0001)) ? (crc >> 1) : ((crc >> 1) ^ 0xa001));
-    return(crc);
+    return(crc16_update(p_crc, p_ch));
 }
 
 ////////////////////////////////////////
@@ -170,14 +236,10 @@ static inline uint16_t mb_compute_crc(struct ring_buf_data* p_pd)
 {
     // crc of bytes 1-8
     uint16_t crc = 0xffff;
-    crc = mb_update_crc16(crc, rb_at(p_pd, 1));
-    crc = mb_update_crc16(crc, rb_at(p_pd, 2));
-    crc = mb_update_crc16(crc, rb_at(p_pd, 3));
-    crc = mb_update_crc16(crc, rb_at(p_pd, 4));
-    crc = mb_update_crc16(crc, rb_at(p_pd, 5));
-    crc = mb_update_crc16(crc, rb_at(p_pd, 6));
-    crc = mb_update_crc16(crc, rb_at(p_pd, 7));
-    crc = mb_update_crc16(crc, rb_at(p_pd, 8));
+    for(uint8_t i=1; i<9; ++i)
+    {
+        crc = crc16_update(crc, rb_at(p_pd, i));
+    }
     return(crc);
 }
 
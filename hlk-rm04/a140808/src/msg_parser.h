@@ -0,0 +1,316 @@
+//
+// Copyright 2015-2017 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its 
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including, 
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR 
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any 
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#ifndef __msg_parser_h__
+#define __msg_parser_h__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "msg_buf.h"
+
+
+//
+// incremental frame parser, port of avr/src/msg_parser.h
+//
+// chars are fed one at a time as they arrive, see msg_buf.h for the
+// frame format. the parser hunts for the begin char, decodes the
+// payload and updates the crc as each char comes in, so the crc is
+// computed once per frame rather than once per received char.
+//
+// a frame is rejected on the first char that cannot belong to it and
+// a begin char always restarts the frame, so the parser resynchronizes
+// on its own after line noise or a partial frame.
+//
+//  index 0      hunting for '['
+//  index 1-8    payload chars
+//  index 9-12   crc chars
+//  index 13     expecting ']'
+//
+// with FRAMING_SLIP the same parser decodes binary frames instead, the
+// index then counts unescaped bytes since the last SLIP_END:
+//
+//  index 0-3    payload bytes
+//  index 4-5    crc bytes
+//  SLIP_END     completes the frame when index is 6
+//
+// every binary frame starts with a SLIP_END as well, so after a bad
+// frame (and right after switching to FRAMING_SLIP) the parser discards
+// bytes up to the next SLIP_END rather than counting each one as another
+// bad frame.
+//
+// the hex decoder keeps running under FRAMING_SLIP. a binary frame never
+// goes 14 bytes without a SLIP_END ('@' once the top bit is masked off),
+// so a whole hex frame with a good crc means the avr went back to hex.
+// the parser then switches itself to FRAMING_HEX and returns that frame,
+// the caller notices framing changed and sets the port up to match. hex
+// chars are masked to 7 bits so the ones read as 8N1 decode.
+//
+// consecutive bad frames are counted so the caller can tell when the
+// other end is no longer speaking the negotiated framing.
+//
+
+// one decoder's state
+struct msg_frame_data
+{
+    uint8_t  index;     // position of the next char in the frame, 0 while hunting
+    uint16_t crc;       // running crc of the payload chars
+    uint16_t rx_crc;    // crc decoded from the frame
+    uint8_t  bytes[4];  // decoded payload
+};
+
+struct msg_parser_data
+{
+    uint8_t  framing;   // FRAMING_HEX or FRAMING_SLIP
+    uint8_t  bad_count; // consecutive bad frames
+    bool     escape;    // slip: the previous byte was SLIP_ESC
+    bool     hunting;   // slip: discarding up to the next SLIP_END
+    bool     complete;  // the current framing's decoder holds a whole validated frame
+    struct msg_frame_data hex;   // hex decoder, runs under both framings
+    struct msg_frame_data slip;  // binary decoder
+};
+
+
+////////////////////////////////////////
+static inline void pr_reset(struct msg_parser_data* p_pd)
+{
+    p_pd->hex.index = 0;
+    p_pd->slip.index = 0;
+    p_pd->escape = false;
+    p_pd->hunting = (FRAMING_SLIP == p_pd->framing);
+    p_pd->complete = false;
+}
+
+////////////////////////////////////////
+static inline void pr_init(struct msg_parser_data* p_pd)
+{
+    p_pd->framing = FRAMING_HEX;
+    p_pd->bad_count = 0;
+    pr_reset(p_pd);
+}
+
+////////////////////////////////////////
+// FRAMING_HEX or FRAMING_SLIP
+static inline void pr_set_framing(struct msg_parser_data* p_pd, const uint8_t p_framing)
+{
+    p_pd->framing = p_framing;
+    p_pd->bad_count = 0;
+    pr_reset(p_pd);
+}
+
+////////////////////////////////////////
+static inline int8_t pr_push_hex(struct msg_frame_data* p_fd, const uint8_t p_ch)
+{
+    if(MSG_BEGIN_CHAR == p_ch)
+    {
+        // always resync on a begin char
+        p_fd->index = 1;
+        p_fd->crc = 0xffff;
+        p_fd->rx_crc = 0;
+        return(S_INCOMPLETE_BUFFER);
+    }
+
+    if(0 == p_fd->index)
+    {
+        // hunting, discard
+        return(S_INCOMPLETE_BUFFER);
+    }
+
+    if(p_fd->index < 13)
+    {
+        if(!ISHEXCH(p_ch))
+        {
+            p_fd->index = 0;
+            return(E_BAD_FRAME);
+        }
+
+        const uint8_t nibble = HEX2DEC(p_ch);
+        if(p_fd->index < 9)
+        {
+            // payload: bytes 1-8
+            p_fd->crc = mb_update_crc16(p_fd->crc, p_ch);
+            uint8_t* pval = &p_fd->bytes[(p_fd->index - 1) >> 1];
+            *pval = ((p_fd->index & 0x01) ? (nibble << 4) : (*pval | nibble));
+        }
+        else
+        {
+            // crc: bytes 9-12
+            p_fd->rx_crc = ((p_fd->rx_crc << 4) | nibble);
+        }
+        ++p_fd->index;
+        return(S_INCOMPLETE_BUFFER);
+    }
+
+    // byte 13
+    p_fd->index = 0;
+    if(MSG_END_CHAR != p_ch)
+    {
+        return(E_BAD_FRAME);
+    }
+    if(p_fd->rx_crc != p_fd->crc)
+    {
+        return(E_BAD_CRC);
+    }
+    return(S_OK);
+}
+
+////////////////////////////////////////
+static inline int8_t pr_push_slip(struct msg_parser_data* p_pd, const uint8_t p_ch)
+{
+    struct msg_frame_data* fd = &p_pd->slip;
+    if(SLIP_END == p_ch)
+    {
+        const uint8_t count = (p_pd->hunting ? 0 : fd->index);
+        fd->index = 0;
+        p_pd->escape = false;
+        p_pd->hunting = false;
+        if(0 == count)
+        {
+            // the start of a frame or the end of a discarded one
+            return(S_INCOMPLETE_BUFFER);
+        }
+        if(6 != count)
+        {
+            return(E_BAD_FRAME);
+        }
+        if(fd->rx_crc != fd->crc)
+        {
+            return(E_BAD_CRC);
+        }
+        return(S_OK);
+    }
+
+    if(p_pd->hunting)
+    {
+        // discard up to the next SLIP_END
+        return(S_INCOMPLETE_BUFFER);
+    }
+
+    uint8_t val = p_ch;
+    if(p_pd->escape)
+    {
+        p_pd->escape = false;
+        if(SLIP_ESC_END == p_ch)
+        {
+            val = SLIP_END;
+        }
+        else if(SLIP_ESC_ESC == p_ch)
+        {
+            val = SLIP_ESC;
+        }
+        else
+        {
+            p_pd->hunting = true;
+            return(E_BAD_FRAME);
+        }
+    }
+    else if(SLIP_ESC == p_ch)
+    {
+        p_pd->escape = true;
+        return(S_INCOMPLETE_BUFFER);
+    }
+
+    if(0 == fd->index)
+    {
+        fd->crc = 0xffff;
+        fd->rx_crc = 0;
+    }
+
+    if(fd->index < 4)
+    {
+        // payload: bytes 0-3
+        fd->crc = mb_update_crc16(fd->crc, val);
+        fd->bytes[fd->index] = val;
+    }
+    else if(4 == fd->index)
+    {
+        // crc: byte 4, low byte
+        fd->rx_crc = val;
+    }
+    else if(5 == fd->index)
+    {
+        // crc: byte 5, high byte
+        fd->rx_crc |= ((uint16_t)val << 8);
+    }
+    else
+    {
+        // too long, drop the rest of it
+        p_pd->hunting = true;
+        return(E_BAD_FRAME);
+    }
+    ++fd->index;
+    return(S_INCOMPLETE_BUFFER);
+}
+
+////////////////////////////////////////
+// returns
+//   S_OK                 a whole frame has been decoded, see pr_get_bytes()
+//   S_INCOMPLETE_BUFFER  more chars are needed
+//   E_BAD_FRAME          the frame was malformed and has been dropped
+//   E_BAD_CRC            the frame crc did not match and has been dropped
+static inline int8_t pr_push(struct msg_parser_data* p_pd, const uint8_t p_ch)
+{
+    int8_t rc = pr_push_hex(&p_pd->hex, (p_ch & 0x7f));
+    if(FRAMING_SLIP == p_pd->framing)
+    {
+        if(S_OK == rc)
+        {
+            // the avr is back on hex
+            pr_set_framing(p_pd, FRAMING_HEX);
+        }
+        else
+        {
+            // hex errors are expected here, binary ones count
+            rc = pr_push_slip(p_pd, p_ch);
+        }
+    }
+
+    p_pd->complete = (S_OK == rc);
+    if(S_OK == rc)
+    {
+        p_pd->bad_count = 0;
+    }
+    else if((rc < 0) && (p_pd->bad_count < 0xff))
+    {
+        ++p_pd->bad_count;
+    }
+    return(rc);
+}
+
+////////////////////////////////////////
+// valid after pr_push() returns S_OK and until the next char is pushed
+static inline bool pr_get_bytes(struct msg_parser_data* p_pd, uint8_t* p_val0, uint8_t* p_val1, uint8_t* p_val2, uint8_t* p_val3)
+{
+    if(!p_pd->complete)
+    {
+        *p_val0 = 0;
+        *p_val1 = 0;
+        *p_val2 = 0;
+        *p_val3 = 0;
+        return(false);
+    }
+
+    const struct msg_frame_data* fd = ((FRAMING_SLIP == p_pd->framing) ? &p_pd->slip : &p_pd->hex);
+    *p_val0 = fd->bytes[0];
+    *p_val1 = fd->bytes[1];
+    *p_val2 = fd->bytes[2];
+    *p_val3 = fd->bytes[3];
+    return(true);
+}
+
+#endif // __msg_parser_h__
@@ -16,126 +16,524 @@
 // Author: John Clark (johnc@restswitch.com)
 //
 
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+
+#include "log.h"
 #include "ring_buf.h"
 #include "msg_buf.h"
+#include "msg_parser.h"
+#include "msg_queue.h"
 #include "serial.h"
 #include "msg_proc.h"
 
-static struct ring_buf_data s_msg_buf = { 0 };
 
-void mp_process_message(const uint8_t p_type, const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3);
+//
+// the serial port is owned by its own thread so a slow write never
+// stalls the mqtt thread. mp_dispatch_*() queue command records for the
+// serial thread, which writes them out, and frames from the avr come
+// back as event records that mp_poll() hands to the mp_on_*()
+// callbacks on the mqtt thread. link level messages (ping, framing)
+// are answered on the serial thread without a round trip.
+//
+// commands queued behind a framing request stay in the queue until the
+// ack comes back (or FRAMING_ACK_TIMEOUT_MS passes), so they go out in
+// the framing the avr is actually using.
+//
+#define MP_CMD_QUEUE_DEPTH  64  // records, mqtt thread -> serial thread
+#define MP_EVT_QUEUE_DEPTH  64  // records, serial thread -> mqtt thread
+
+void mp_process_message(struct mp_context* p_mp, const uint8_t p_type, const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3);
+void mp_set_framing(struct mp_context* p_mp, const uint8_t p_framing);
+static void mp_release(struct mp_context* p_mp);
+static void* mp_thread(void* p_arg);
 
 
 ////////////////////////////////////////
 // p_parity
 //   false: N81 (none, 8 data, 1 stop)
 //   true:  E71 (even, 7 data, 1 stop)
-bool mp_init(const char* p_device, const uint16_t p_baud, const bool p_parity)
+// p_mp is zeroed here, set p_mp->user afterwards. on failure nothing is
+// left open and mp_close() is not needed
+bool mp_init(struct mp_context* p_mp, const char* p_device, const uint16_t p_baud, const bool p_parity)
+{
+    memset(p_mp, 0, sizeof(*p_mp));
+    p_mp->name = p_device;
+    p_mp->framing = FRAMING_HEX;
+    p_mp->serial.fd = -1;
+    p_mp->cmd_queue.efd = -1;
+    p_mp->evt_queue.efd = -1;
+
+    pr_init(&p_mp->msg_parser);
+    if(!mb_init(&p_mp->msg_buf) || !sp_init(&p_mp->serial, p_device, p_baud, p_parity) ||
+       !mq_init(&p_mp->cmd_queue, MP_CMD_QUEUE_DEPTH) || !mq_init(&p_mp->evt_queue, MP_EVT_QUEUE_DEPTH))
+    {
+        mp_release(p_mp);
+        return(false);
+    }
+
+    // signals are handled on the main thread
+    sigset_t all;
+    sigset_t old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    p_mp->thread_run = true;
+    const int rc = pthread_create(&p_mp->thread, NULL, mp_thread, p_mp);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if(0 != rc)
+    {
+        log_error("failed to start serial thread for %s: %d", p_device, rc);
+        p_mp->thread_run = false;
+        mp_release(p_mp);
+        return(false);
+    }
+    p_mp->thread_started = true;
+    return(true);
+}
+
+void mp_close(struct mp_context* p_mp)
+{
+    if(p_mp->thread_started)
+    {
+        __atomic_store_n(&p_mp->thread_run, false, __ATOMIC_RELEASE);
+        mq_signal(&p_mp->cmd_queue);
+        pthread_join(p_mp->thread, NULL);
+        p_mp->thread_started = false;
+    }
+
+    mp_log_stats(p_mp);
+    mp_release(p_mp);
+}
+
+////////////////////////////////////////
+// frees whatever mp_init() got as far as acquiring, safe to call twice
+static void mp_release(struct mp_context* p_mp)
 {
-    return(mb_init(&s_msg_buf) && sp_init(p_device, p_baud, p_parity));
+    mb_free(&p_mp->msg_buf);
+    sp_close(&p_mp->serial);
+    mq_free(&p_mp->cmd_queue);
+    mq_free(&p_mp->evt_queue);
 }
 
-void mp_close(void)
+////////////////////////////////////////
+// readable when mp_poll() has events to deliver
+int mp_get_fd(struct mp_context* p_mp)
 {
-    mb_free(&s_msg_buf);
-    sp_close();
+    return(mq_get_fd(&p_mp->evt_queue));
 }
 
 ////////////////////////////////////////
-bool mp_dispatch_ping(const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3)
+bool mp_dispatch_ping(struct mp_context* p_mp, const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3)
 {
-    return(mp_dispatch_message(MSG_PING, p_param1, p_param2, p_param3));
+    return(mp_dispatch_message(p_mp, MSG_PING, p_param1, p_param2, p_param3));
 }
 
 ////////////////////////////////////////
-bool mp_dispatch_read_register(const uint8_t p_registerAddress)
+// ask the avr to switch to FRAMING_HEX or FRAMING_SLIP, both ends switch
+// once the ack has gone out in the old framing
+bool mp_dispatch_set_framing(struct mp_context* p_mp, const uint8_t p_framing)
 {
-    return(mp_dispatch_message(MSG_READ_REGISTER, p_registerAddress, 0x00, 0x00));
+    return(mp_dispatch_message(p_mp, MSG_SET_FRAMING, p_framing, FRAMING_REQUEST, 0x00));
 }
 
 ////////////////////////////////////////
-bool mp_dispatch_write_register(const uint8_t p_registerAddress, const uint8_t p_value, const uint8_t p_mask)
+bool mp_dispatch_read_register(struct mp_context* p_mp, const uint8_t p_registerAddress)
 {
-    return(mp_dispatch_message(MSG_WRITE_REGISTER, p_registerAddress, p_value, p_mask));
+    return(mp_dispatch_message(p_mp, MSG_READ_REGISTER, p_registerAddress, 0x00, 0x00));
 }
 
 ////////////////////////////////////////
-bool mp_dispatch_write_register_bit(const uint8_t p_registerAddress, const uint8_t p_bit, const bool p_state)
+bool mp_dispatch_write_register(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_value, const uint8_t p_mask)
+{
+    return(mp_dispatch_message(p_mp, MSG_WRITE_REGISTER, p_registerAddress, p_value, p_mask));
+}
+
+////////////////////////////////////////
+bool mp_dispatch_write_register_bit(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const bool p_state)
+{
+    if(p_bit > 0x07)
+    {
+        return(false);
+    }
+    return(mp_dispatch_message(p_mp, MSG_WRITE_REGISTER_BIT, p_registerAddress, p_bit, (p_state ? 0xff : 0x00)));
+}
+
+////////////////////////////////////////
+bool mp_dispatch_pulse_register_bit(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const uint8_t p_durationMs)
 {
     if(p_bit > 0x07)
     {
         return(false);
     }
-    return(mp_dispatch_message(MSG_WRITE_REGISTER_BIT, p_registerAddress, p_bit, (p_state ? 0xff : 0x00)));
+    return(mp_dispatch_message(p_mp, MSG_PULSE_REGISTER_BIT, p_registerAddress, p_bit, p_durationMs));
 }
 
 ////////////////////////////////////////
-bool mp_dispatch_pulse_register_bit(const uint8_t p_registerAddress, const uint8_t p_bit, const uint8_t p_durationMs)
+// pulse a REG_OUTPUT_1 bit for up to 65,535ms
+bool mp_dispatch_pulse_output_bit(struct mp_context* p_mp, const uint8_t p_bit, const uint16_t p_durationMs)
 {
     if(p_bit > 0x07)
     {
         return(false);
     }
-    return(mp_dispatch_message(MSG_PULSE_REGISTER_BIT, p_registerAddress, p_bit, p_durationMs));
+    return(mp_dispatch_message(p_mp, MSG_PULSE_OUTPUT_BIT, p_bit, (uint8_t)(p_durationMs >> 8), (uint8_t)p_durationMs));
+}
+
+////////////////////////////////////////
+// pulse every REG_OUTPUT_1 bit in p_mask at once for up to 65,535ms
+bool mp_dispatch_pulse_output_mask(struct mp_context* p_mp, const uint8_t p_mask, const uint16_t p_durationMs)
+{
+    return(mp_dispatch_message(p_mp, MSG_PULSE_OUTPUT_MASK, p_mask, (uint8_t)(p_durationMs >> 8), (uint8_t)p_durationMs));
+}
+
+////////////////////////////////////////
+bool mp_dispatch_subscribe_register(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_value, const bool p_cancel)
+{
+    return(mp_dispatch_message(p_mp, MSG_SUBSCRIBE_REGISTER, p_registerAddress, p_value, p_cancel));
+}
+
+////////////////////////////////////////
+// queue a message for the serial thread, false if the queue is full
+bool mp_dispatch_message(struct mp_context* p_mp, const uint8_t p_type, const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3)
+{
+    if(!mq_push(&p_mp->cmd_queue, p_type, p_param1, p_param2, p_param3, (0 == p_mp->batch)))
+    {
+        log_warn("%s command queue full, dropping message type: 0x%02x", p_mp->name, p_type);
+        return(false);
+    }
+    return(true);
+}
+
+////////////////////////////////////////
+// messages dispatched until mp_end_batch() reach the serial thread
+// together and go out in a single write
+void mp_begin_batch(struct mp_context* p_mp)
+{
+    ++p_mp->batch;
+}
+
+////////////////////////////////////////
+bool mp_end_batch(struct mp_context* p_mp)
+{
+    if(p_mp->batch > 0)
+    {
+        --p_mp->batch;
+    }
+    if(0 == p_mp->batch)
+    {
+        mq_signal(&p_mp->cmd_queue);
+    }
+    return(true);
+}
+
+////////////////////////////////////////
+// mqtt thread, delivers every event the serial thread has queued since
+// the last call to the mp_on_*() callbacks
+void mp_poll(struct mp_context* p_mp)
+{
+    mq_clear_event(&p_mp->evt_queue);
+
+    struct mq_record rec;
+    while(mq_pop(&p_mp->evt_queue, &rec))
+    {
+        mq_delivered(&p_mp->evt_queue, &rec, mq_now_ns());
+        mp_process_message(p_mp, rec.type, rec.param1, rec.param2, rec.param3);
+    }
+}
+
+////////////////////////////////////////
+void mp_log_stats(struct mp_context* p_mp)
+{
+    struct sp_stats stats;
+    sp_get_stats(&p_mp->serial, &stats);
+    log_info("%s tx: %u frames in %u writes (%.2f writes per frame)", p_mp->name, stats.tx_frames, stats.tx_syscalls,
+        ((stats.tx_frames > 0) ? ((double)stats.tx_syscalls / stats.tx_frames) : 0.0));
+
+    struct mq_stats cmd;
+    struct mq_stats evt;
+    mq_get_stats(&p_mp->cmd_queue, &cmd);
+    mq_get_stats(&p_mp->evt_queue, &evt);
+    log_info("%s commands: depth %u (max %u/%u)  sent %u  dropped %u  queue to wire %uus avg, %uus max", p_mp->name,
+        cmd.depth, cmd.high_water, MP_CMD_QUEUE_DEPTH, cmd.delivered, cmd.drops, cmd.latency_avg_us, cmd.latency_max_us);
+    log_info("%s events: depth %u (max %u/%u)  delivered %u  dropped %u  queue to callback %uus avg, %uus max", p_mp->name,
+        evt.depth, evt.high_water, MP_EVT_QUEUE_DEPTH, evt.delivered, evt.drops, evt.latency_avg_us, evt.latency_max_us);
+}
+
+
+//
+// serial thread
+//
+
+////////////////////////////////////////
+static bool mp_send_message(struct mp_context* p_mp, const uint8_t p_type, const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3)
+{
+    if(FRAMING_SLIP == p_mp->framing)
+    {
+        mb_set_slip_bytes(&p_mp->msg_buf, p_type, p_param1, p_param2, p_param3);
+    }
+    else
+    {
+        mb_set_bytes(&p_mp->msg_buf, p_type, p_param1, p_param2, p_param3);
+    }
+    return(sp_write(&p_mp->serial, &p_mp->msg_buf));
+}
+
+////////////////////////////////////////
+// the avr answers these, the rest it just carries out
+static bool mp_expects_reply(const struct mq_record* p_rec)
+{
+    switch(p_rec->type)
+    {
+        case MSG_PING:
+        case MSG_READ_REGISTER:
+        case MSG_SUBSCRIBE_REGISTER:
+        {
+            return(true);
+        }
+        case MSG_SET_FRAMING:
+        {
+            return(FRAMING_REQUEST == p_rec->param2);
+        }
+        default:
+        {
+            return(false);
+        }
+    }
 }
 
 ////////////////////////////////////////
-bool mp_dispatch_subscribe_register(const uint8_t p_registerAddress, const uint8_t p_value, const bool p_cancel)
+// write out everything queued by mp_dispatch_message(), one write per
+// MP_CMD_QUEUE_DEPTH records at most. stops after a framing request, the
+// rest waits for the ack
+static void mp_send_commands(struct mp_context* p_mp)
 {
-    return(mp_dispatch_message(MSG_SUBSCRIBE_REGISTER, p_registerAddress, p_value, p_cancel));
+    mq_clear_event(&p_mp->cmd_queue);
+
+    struct mq_record recs[MP_CMD_QUEUE_DEPTH];
+    uint32_t count;
+    do
+    {
+        count = 0;
+        sp_begin_batch(&p_mp->serial);
+        while((count < MP_CMD_QUEUE_DEPTH) && (0 == p_mp->framing_sent_ns) && mq_pop(&p_mp->cmd_queue, &recs[count]))
+        {
+            const struct mq_record* rec = &recs[count];
+            if((FRAMING_SLIP == p_mp->framing) && mp_expects_reply(rec) && (++p_mp->unanswered > FRAMING_RETRY_COUNT))
+            {
+                // nothing has come back for a while, the avr may have gone
+                // back to hex without us seeing it. a hex frame switches it
+                // back if it is still on binary
+                log_warn("%s: %u requests unanswered, retrying with hex framing", p_mp->name, (p_mp->unanswered - 1));
+                mp_set_framing(p_mp, FRAMING_HEX);
+            }
+
+            mp_send_message(p_mp, rec->type, rec->param1, rec->param2, rec->param3);
+            if((MSG_SET_FRAMING == rec->type) && (FRAMING_REQUEST == rec->param2) && (rec->param1 != p_mp->framing))
+            {
+                p_mp->framing_sent_ns = mq_now_ns();
+            }
+            ++count;
+        }
+        sp_end_batch(&p_mp->serial);
+
+        const uint64_t now = mq_now_ns();
+        for(uint32_t i=0; i<count; ++i)
+        {
+            mq_delivered(&p_mp->cmd_queue, &recs[i], now);
+        }
+    } while((MP_CMD_QUEUE_DEPTH == count) && (0 == p_mp->framing_sent_ns));
 }
 
 ////////////////////////////////////////
-bool mp_dispatch_message(const uint8_t p_type, const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3)
+// answer link level messages here, returns false for the rest
+static bool mp_process_link_message(struct mp_context* p_mp, const uint8_t p_type, const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3)
 {
-    mb_set_bytes(&s_msg_buf, p_type, p_param1, p_param2, p_param3);
-    return(sp_write(&s_msg_buf));
+    switch(p_type)
+    {
+        case MSG_PING:
+        {
+            mp_send_message(p_mp, MSG_PONG, p_param1, p_param2, p_param3);
+            return(true);
+        }
+
+        case MSG_SET_FRAMING:
+        {
+            // param1: framing (FRAMING_HEX, FRAMING_SLIP)
+            // param2: FRAMING_REQUEST or FRAMING_ACK
+            if(FRAMING_REQUEST == p_param2)
+            {
+                // ack in the current framing, then switch
+                const uint8_t framing = ((FRAMING_SLIP == p_param1) ? FRAMING_SLIP : FRAMING_HEX);
+                mp_send_message(p_mp, MSG_SET_FRAMING, framing, FRAMING_ACK, 0x00);
+                mp_set_framing(p_mp, framing);
+            }
+            else if((FRAMING_HEX == p_param1) || (FRAMING_SLIP == p_param1))
+            {
+                mp_set_framing(p_mp, p_param1);
+                p_mp->framing_sent_ns = 0;
+            }
+            return(true);
+        }
+
+        default:
+        {
+            return(false);
+        }
+    }
 }
 
 ////////////////////////////////////////
-void mp_poll(void)
+// parse every frame that has arrived and queue it for mp_poll()
+static void mp_read_frames(struct mp_context* p_mp)
 {
-    if(sp_read(&s_msg_buf))
+    while(sp_read(&p_mp->serial, &p_mp->msg_parser))
     {
+        p_mp->unanswered = 0;
+        if(p_mp->msg_parser.framing != p_mp->framing)
+        {
+            // the parser caught a hex frame among the binary ones, the avr
+            // went back to hex (probably reset), what follows is hex too
+            // so only the port changes
+            log_warn("%s: avr is sending hex frames, falling back to hex framing", p_mp->name);
+            p_mp->framing = p_mp->msg_parser.framing;
+            sp_set_parity(&p_mp->serial, true);
+        }
+
         uint8_t type;
         uint8_t param1;
         uint8_t param2;
         uint8_t param3;
-        if(!mb_get_bytes(&s_msg_buf, &type, &param1, &param2, &param3))
+        if(pr_get_bytes(&p_mp->msg_parser, &type, &param1, &param2, &param3) &&
+           !mp_process_link_message(p_mp, type, param1, param2, param3) &&
+           !mq_push(&p_mp->evt_queue, type, param1, param2, param3, true))
         {
-            return;
+            log_warn("%s event queue full, dropping message type: 0x%02x", p_mp->name, type);
         }
+    }
 
-        mp_process_message(type, param1, param2, param3);
+    // bad_count is reset by every good frame
+    if((FRAMING_HEX != p_mp->framing) && (p_mp->msg_parser.bad_count >= FRAMING_FALLBACK_COUNT))
+    {
+        // the avr is not speaking binary, it was probably reset
+        log_warn("%s: %d bad frames, falling back to hex framing", p_mp->name, p_mp->msg_parser.bad_count);
+        mp_set_framing(p_mp, FRAMING_HEX);
     }
 }
 
 ////////////////////////////////////////
-void mp_process_message(const uint8_t p_type, const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3)
+static void* mp_thread(void* p_arg)
 {
-    switch(p_type)
+    struct mp_context* p_mp = (struct mp_context*)p_arg;
+
+    enum { PFD_SERIAL = 0, PFD_COMMANDS, PFD_COUNT };
+    struct pollfd pfds[PFD_COUNT] = {
+        [PFD_SERIAL]   = { .fd = sp_get_fd(&p_mp->serial),  .events = POLLIN },
+        [PFD_COMMANDS] = { .fd = mq_get_fd(&p_mp->cmd_queue), .events = POLLIN },
+    };
+
+    while(__atomic_load_n(&p_mp->thread_run, __ATOMIC_ACQUIRE))
     {
-        case MSG_PING:
+        // commands stay queued while a framing request waits for its ack
+        const bool held = (0 != p_mp->framing_sent_ns);
+        pfds[PFD_COMMANDS].fd = (held ? -1 : mq_get_fd(&p_mp->cmd_queue));
+        if(poll(pfds, PFD_COUNT, (held ? FRAMING_ACK_TIMEOUT_MS : -1)) < 0)
         {
-            mp_dispatch_message(MSG_PONG, p_param1, p_param2, p_param3);
+            if(EINTR == errno)
+            {
+                continue;
+            }
+            log_error("%s thread poll error: %d", p_mp->name, errno);
             break;
         }
 
+        if(0 != (pfds[PFD_SERIAL].revents & POLLIN))
+        {
+            mp_read_frames(p_mp);
+        }
+
+        if(0 != (pfds[PFD_SERIAL].revents & (POLLHUP | POLLERR | POLLNVAL)))
+        {
+            // the device went away (usb adapter unplugged), poll() would
+            // report it again straight away, so stop rather than spin.
+            // commands queued from here on are dropped once the queue fills
+            log_error("%s: serial port hung up or failed (revents 0x%x), closing it", p_mp->name, pfds[PFD_SERIAL].revents);
+            sp_close(&p_mp->serial);
+            return(NULL);
+        }
+
+        if(held)
+        {
+            if((0 != p_mp->framing_sent_ns) && ((mq_now_ns() - p_mp->framing_sent_ns) >= (FRAMING_ACK_TIMEOUT_MS * 1000000ULL)))
+            {
+                // the avr either never saw the request or switched and its
+                // ack was lost, our next hex frame brings it back in both cases
+                log_warn("%s: no framing ack, staying with %s framing", p_mp->name, ((FRAMING_SLIP == p_mp->framing) ? "slip" : "hex"));
+                p_mp->framing_sent_ns = 0;
+            }
+            if(0 == p_mp->framing_sent_ns)
+            {
+                // send what was held back
+                mp_send_commands(p_mp);
+            }
+        }
+        else if(0 != (pfds[PFD_COMMANDS].revents & POLLIN))
+        {
+            mp_send_commands(p_mp);
+        }
+    }
+
+    // anything still queued goes out before the port closes
+    p_mp->framing_sent_ns = 0;
+    mp_send_commands(p_mp);
+    return(NULL);
+}
+
+////////////////////////////////////////
+// hex frames go out as E71, binary frames need all 8 data bits
+void mp_set_framing(struct mp_context* p_mp, const uint8_t p_framing)
+{
+    if(p_framing == p_mp->framing)
+    {
+        return;
+    }
+    log_info("%s framing: %s", p_mp->name, ((FRAMING_SLIP == p_framing) ? "slip" : "hex"));
+    p_mp->framing = p_framing;
+    p_mp->unanswered = 0;
+    sp_set_parity(&p_mp->serial, FRAMING_HEX == p_framing);
+
+    // the rest of what has been read arrived in the old framing
+    sp_purge(&p_mp->serial);
+    pr_set_framing(&p_mp->msg_parser, p_framing);
+}
+
+
+//
+// mqtt thread
+//
+
+////////////////////////////////////////
+void mp_process_message(struct mp_context* p_mp, const uint8_t p_type, const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3)
+{
+    switch(p_type)
+    {
         case MSG_PONG:
         {
             // param1: ping value1 (0-255)
             // param2: ping value2 (0-255)
             // param3: ping value3 (0-255)
-            // void mp_on_pong(const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3);
-            mp_on_pong(p_param1, p_param2, p_param3);
+            // void mp_on_pong(struct mp_context* p_mp, const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3);
+            mp_on_pong(p_mp, p_param1, p_param2, p_param3);
             break;
         }
 
         case MSG_READ_REGISTER:
         {
             // param1: register address (0-255)
-            // void mp_on_read_register(const uint8_t p_registerAddress);
-            mp_on_read_register(p_param1);
+            // void mp_on_read_register(struct mp_context* p_mp, const uint8_t p_registerAddress);
+            mp_on_read_register(p_mp, p_param1);
             break;
         }
 
@@ -144,8 +542,8 @@ void mp_process_message(const uint8_t p_type, const uint8_t p_param1, const uint
             // param1: register address (0-255)
             // param2: value (0-255)
             // param3: mask (0-255)
-            // void mp_on_write_register(const uint8_t p_registerAddress, const uint8_t p_value, const uint8_t p_mask);
-            mp_on_write_register(p_param1, p_param2, p_param3);
+            // void mp_on_write_register(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_value, const uint8_t p_mask);
+            mp_on_write_register(p_mp, p_param1, p_param2, p_param3);
             break;
         }
 
@@ -154,10 +552,10 @@ void mp_process_message(const uint8_t p_type, const uint8_t p_param1, const uint
             // param1: register address (0-255)
             // param2: bit num (0-7)
             // param3: value (false, true)
-            // void mp_on_write_register_bit(const uint8_t p_registerAddress, const uint8_t p_bit, const bool p_state);
+            // void mp_on_write_register_bit(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const bool p_state);
             if(p_param2 < 0x08)
             {
-                mp_on_write_register_bit(p_param1, p_param2, (0x00 != p_param3));
+                mp_on_write_register_bit(p_mp, p_param1, p_param2, (0x00 != p_param3));
             }
             break;
         }
@@ -167,10 +565,40 @@ void mp_process_message(const uint8_t p_type, const uint8_t p_param1, const uint
             // param1: register address (0-255)
             // param2: bit num (0-7)
             // param3: duration  (0-255ms)
-            // void mp_on_pulse_register_bit(const uint8_t p_registerAddress, const uint8_t p_bit, const uint8_t p_durationMs);
+            // void mp_on_pulse_register_bit(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const uint16_t p_durationMs);
             if(p_param2 < 0x08)
             {
-                mp_on_pulse_register_bit(p_param1, p_param2, p_param3);
+                mp_on_pulse_register_bit(p_mp, p_param1, p_param2, p_param3);
+            }
+            break;
+        }
+
+        case MSG_PULSE_OUTPUT_BIT:
+        {
+            // param1: bit num (0-7) of REG_OUTPUT_1
+            // param2: duration high byte
+            // param3: duration low byte  (0-65,535ms)
+            // void mp_on_pulse_register_bit(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const uint16_t p_durationMs);
+            if(p_param1 < 0x08)
+            {
+                mp_on_pulse_register_bit(p_mp, REG_OUTPUT_1, p_param1, (((uint16_t)p_param2 << 8) | p_param3));
+            }
+            break;
+        }
+
+        case MSG_PULSE_OUTPUT_MASK:
+        {
+            // param1: bit mask of REG_OUTPUT_1
+            // param2: duration high byte
+            // param3: duration low byte  (0-65,535ms)
+            // void mp_on_pulse_register_bit(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const uint16_t p_durationMs);
+            const uint16_t durationMs = (((uint16_t)p_param2 << 8) | p_param3);
+            for(uint8_t bit=0; bit<8; ++bit)
+            {
+                if(0 != (p_param1 & (1 << bit)))
+                {
+                    mp_on_pulse_register_bit(p_mp, REG_OUTPUT_1, bit, durationMs);
+                }
             }
             break;
         }
@@ -180,8 +608,8 @@ void mp_process_message(const uint8_t p_type, const uint8_t p_param1, const uint
             // param1: register address (0-255)
             // param2: value (0-255)
             // param3: cancel (false, true)
-            // void mp_on_subscribe_register(const uint8_t p_registerAddress, const uint8_t p_value, const bool p_cancel);
-            mp_on_subscribe_register(p_param1, p_param2, (0x00 != p_param3));
+            // void mp_on_subscribe_register(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_value, const bool p_cancel);
+            mp_on_subscribe_register(p_mp, p_param1, p_param2, (0x00 != p_param3));
             break;
         }
 
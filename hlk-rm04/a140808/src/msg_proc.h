@@ -21,38 +21,92 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <pthread.h>
+
+#include "msg_buf.h"
+#include "msg_parser.h"
+#include "msg_queue.h"
+#include "serial.h"
 
 // top level messages
 #define MSG_PING                 0x01
 #define MSG_PONG                 0x02
+#define MSG_SET_FRAMING          0x03
 #define MSG_READ_REGISTER        0x11
 #define MSG_WRITE_REGISTER       0x21
 #define MSG_WRITE_REGISTER_BIT   0x31
 #define MSG_PULSE_REGISTER_BIT   0x41
+#define MSG_PULSE_OUTPUT_BIT     0x42
+#define MSG_PULSE_OUTPUT_MASK    0x43
 #define MSG_SUBSCRIBE_REGISTER   0x51
 // register defs
 #define REG_ERR_UNKNOWN          0x9F
 #define REG_INPUT_1              0xA1
+#define REG_DEBOUNCE_1           0xB1  // debounce ms for input 1, through
+#define REG_DEBOUNCE_8           0xB8  // REG_DEBOUNCE_8 for input 8
 #define REG_OUTPUT_1             0xD1
 
-// event callbacks, impl by avr_impl.cpp right now
-void mp_on_pong(const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3);
-void mp_on_read_register(const uint8_t p_registerAddress);
-void mp_on_write_register(const uint8_t p_registerAddress, const uint8_t p_value, const uint8_t p_mask);
-void mp_on_write_register_bit(const uint8_t p_registerAddress, const uint8_t p_bit, const bool p_state);
-void mp_on_pulse_register_bit(const uint8_t p_registerAddress, const uint8_t p_bit, const uint8_t p_durationMs);
-void mp_on_subscribe_register(const uint8_t p_registerAddress, const uint8_t p_value, const bool p_cancel);
+// MSG_SET_FRAMING param2
+#define FRAMING_REQUEST          0x00
+#define FRAMING_ACK              0x01
+// consecutive bad frames before falling back to FRAMING_HEX
+#define FRAMING_FALLBACK_COUNT   4
+// requests sent as FRAMING_SLIP without a frame coming back before the
+// next one goes out as FRAMING_HEX
+#define FRAMING_RETRY_COUNT      4
+// commands are held back this long at most waiting for FRAMING_ACK
+#define FRAMING_ACK_TIMEOUT_MS   500
+
+// one per board, the serial side is owned by the context's thread
+struct mp_context
+{
+    const char* name;  // device path, for logs
+    void* user;        // owner data, not touched by msg_proc.c
+
+    // serial thread
+    struct sp_context serial;
+    struct ring_buf_data msg_buf;
+    struct msg_parser_data msg_parser;
+    uint8_t framing;           // what the port is set up for, the parser can run ahead
+    uint8_t unanswered;        // requests sent as FRAMING_SLIP since the last frame came back
+    uint64_t framing_sent_ns;  // MSG_SET_FRAMING request waiting for its ack, 0 if none
+    pthread_t thread;
+    bool thread_started;
+    bool thread_run;
+
+    // between the threads
+    struct msg_queue cmd_queue;
+    struct msg_queue evt_queue;
+
+    // mqtt thread, mp_begin_batch() nesting
+    uint32_t batch;
+};
+
+// event callbacks, impl by main.c, called from mp_poll()
+void mp_on_pong(struct mp_context* p_mp, const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3);
+void mp_on_read_register(struct mp_context* p_mp, const uint8_t p_registerAddress);
+void mp_on_write_register(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_value, const uint8_t p_mask);
+void mp_on_write_register_bit(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const bool p_state);
+void mp_on_pulse_register_bit(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const uint16_t p_durationMs);
+void mp_on_subscribe_register(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_value, const bool p_cancel);
 
 //
-bool mp_init(const char* p_device, const uint16_t p_baud, const bool p_parity);
-void mp_close(void);
-bool mp_dispatch_ping(const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3);
-bool mp_dispatch_read_register(const uint8_t p_registerAddress);
-bool mp_dispatch_write_register(const uint8_t p_registerAddress, const uint8_t p_value, const uint8_t p_mask);
-bool mp_dispatch_write_register_bit(const uint8_t p_registerAddress, const uint8_t p_bit, const bool p_state);
-bool mp_dispatch_pulse_register_bit(const uint8_t p_registerAddress, const uint8_t p_bit, const uint8_t p_durationMs);
-bool mp_dispatch_subscribe_register(const uint8_t p_registerAddress, const uint8_t p_value, const bool p_cancel);
-bool mp_dispatch_message(const uint8_t p_type, const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3);
-void mp_poll(void);
+bool mp_init(struct mp_context* p_mp, const char* p_device, const uint16_t p_baud, const bool p_parity);
+void mp_close(struct mp_context* p_mp);
+int mp_get_fd(struct mp_context* p_mp);
+bool mp_dispatch_ping(struct mp_context* p_mp, const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3);
+bool mp_dispatch_set_framing(struct mp_context* p_mp, const uint8_t p_framing);
+bool mp_dispatch_read_register(struct mp_context* p_mp, const uint8_t p_registerAddress);
+bool mp_dispatch_write_register(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_value, const uint8_t p_mask);
+bool mp_dispatch_write_register_bit(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const bool p_state);
+bool mp_dispatch_pulse_register_bit(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const uint8_t p_durationMs);
+bool mp_dispatch_pulse_output_bit(struct mp_context* p_mp, const uint8_t p_bit, const uint16_t p_durationMs);
+bool mp_dispatch_pulse_output_mask(struct mp_context* p_mp, const uint8_t p_mask, const uint16_t p_durationMs);
+bool mp_dispatch_subscribe_register(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_value, const bool p_cancel);
+bool mp_dispatch_message(struct mp_context* p_mp, const uint8_t p_type, const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3);
+void mp_begin_batch(struct mp_context* p_mp);
+bool mp_end_batch(struct mp_context* p_mp);
+void mp_poll(struct mp_context* p_mp);
+void mp_log_stats(struct mp_context* p_mp);
 
 #endif // __msg_proc_h__
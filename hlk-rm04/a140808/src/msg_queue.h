@@ -0,0 +1,215 @@
+//
+// Copyright 2015-2017 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its 
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including, 
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR 
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any 
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#ifndef __msg_queue_h__
+#define __msg_queue_h__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "log.h"
+#include "ring_buf.h"
+
+
+//
+// bounded queue of fixed size message records between two threads
+//
+// records are copied through a ring_buf, so like the ring there is
+// exactly one producer thread and one consumer thread. the producer
+// signals an eventfd after each push (or once per batch), the consumer
+// waits on mq_get_fd() and calls mq_clear_event() before draining, so a
+// push that races with the drain always leaves the fd readable.
+//
+// producer side: mq_push(), mq_signal()
+// consumer side: mq_clear_event(), mq_pop(), mq_delivered()
+//
+struct mq_record
+{
+    uint8_t  type;
+    uint8_t  param1;
+    uint8_t  param2;
+    uint8_t  param3;
+    uint32_t reserved;
+    uint64_t stamp_ns;  // CLOCK_MONOTONIC when queued
+};
+
+struct mq_stats
+{
+    uint32_t depth;           // records queued right now
+    uint32_t high_water;      // deepest the queue has been
+    uint32_t drops;           // records refused because the queue was full
+    uint32_t delivered;       // records passed to mq_delivered()
+    uint32_t latency_avg_us;  // queued to delivered, moving average
+    uint32_t latency_max_us;  // queued to delivered, worst case
+};
+
+struct msg_queue
+{
+    struct ring_buf_data rb;
+    int efd;
+    // written by the producer
+    uint32_t high_water;
+    uint32_t drops;
+    // written by the consumer
+    uint32_t delivered;
+    uint32_t latency_avg_us;
+    uint32_t latency_max_us;
+};
+
+// counters are only written by one side, relaxed is enough for stats
+#define MQ_LOAD(p)      __atomic_load_n((p), __ATOMIC_RELAXED)
+#define MQ_STORE(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+
+
+////////////////////////////////////////
+static inline uint64_t mq_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec);
+}
+
+////////////////////////////////////////
+// p_depth: records, rounded up to a power of two
+static inline bool mq_init(struct msg_queue* p_mq, const uint32_t p_depth)
+{
+    memset(p_mq, 0, sizeof(*p_mq));
+    p_mq->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(p_mq->efd < 0)
+    {
+        log_error("eventfd failed: %d", errno);
+        return(false);
+    }
+    return(rb_init(&p_mq->rb, p_depth * sizeof(struct mq_record)));
+}
+
+////////////////////////////////////////
+static inline void mq_free(struct msg_queue* p_mq)
+{
+    rb_free(&p_mq->rb);
+    if(p_mq->efd > -1)
+    {
+        close(p_mq->efd);
+        p_mq->efd = -1;
+    }
+}
+
+////////////////////////////////////////
+// readable while records may be waiting
+static inline int mq_get_fd(struct msg_queue* p_mq)
+{
+    return(p_mq->efd);
+}
+
+////////////////////////////////////////
+// producer side, wake the consumer
+static inline void mq_signal(struct msg_queue* p_mq)
+{
+    const uint64_t one = 1;
+    if(write(p_mq->efd, &one, sizeof(one)) < 0)
+    {
+        // EAGAIN means the counter is saturated, the consumer is awake anyway
+    }
+}
+
+////////////////////////////////////////
+// producer side, returns false and counts a drop if the queue is full
+// p_signal: false to hold the wakeup for a later mq_signal()
+static inline bool mq_push(struct msg_queue* p_mq, const uint8_t p_type, const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3, const bool p_signal)
+{
+    const uint32_t used = rb_size(&p_mq->rb);
+    if((rb_capacity(&p_mq->rb) - used) < sizeof(struct mq_record))
+    {
+        MQ_STORE(&p_mq->drops, p_mq->drops + 1);
+        return(false);
+    }
+
+    const struct mq_record rec = { p_type, p_param1, p_param2, p_param3, 0, mq_now_ns() };
+    rb_set_data(&p_mq->rb, &rec, sizeof(rec));
+
+    const uint32_t depth = ((used / sizeof(struct mq_record)) + 1);
+    if(depth > p_mq->high_water)
+    {
+        MQ_STORE(&p_mq->high_water, depth);
+    }
+
+    if(p_signal)
+    {
+        mq_signal(p_mq);
+    }
+    return(true);
+}
+
+////////////////////////////////////////
+// consumer side, call before draining with mq_pop()
+static inline void mq_clear_event(struct msg_queue* p_mq)
+{
+    uint64_t count;
+    if(read(p_mq->efd, &count, sizeof(count)) < 0)
+    {
+        // EAGAIN, nothing was signalled
+    }
+}
+
+////////////////////////////////////////
+// consumer side
+static inline bool mq_pop(struct msg_queue* p_mq, struct mq_record* p_rec)
+{
+    if(rb_size(&p_mq->rb) < sizeof(struct mq_record))
+    {
+        return(false);
+    }
+    rb_get_data(&p_mq->rb, p_rec, sizeof(*p_rec));
+    return(true);
+}
+
+////////////////////////////////////////
+// consumer side, the record has reached its destination (the wire for
+// commands), p_now_ns from mq_now_ns()
+static inline void mq_delivered(struct msg_queue* p_mq, const struct mq_record* p_rec, const uint64_t p_now_ns)
+{
+    const uint32_t us = (uint32_t)((p_now_ns - p_rec->stamp_ns) / 1000);
+
+    // 1/8 weight moving average
+    const uint32_t avg = ((0 == p_mq->delivered) ? us : (uint32_t)(((uint64_t)p_mq->latency_avg_us * 7 + us) / 8));
+    MQ_STORE(&p_mq->latency_avg_us, avg);
+    if(us > p_mq->latency_max_us)
+    {
+        MQ_STORE(&p_mq->latency_max_us, us);
+    }
+    MQ_STORE(&p_mq->delivered, p_mq->delivered + 1);
+}
+
+////////////////////////////////////////
+// either side or a third thread
+static inline void mq_get_stats(struct msg_queue* p_mq, struct mq_stats* p_stats)
+{
+    p_stats->depth = (rb_size(&p_mq->rb) / sizeof(struct mq_record));
+    p_stats->high_water = MQ_LOAD(&p_mq->high_water);
+    p_stats->drops = MQ_LOAD(&p_mq->drops);
+    p_stats->delivered = MQ_LOAD(&p_mq->delivered);
+    p_stats->latency_avg_us = MQ_LOAD(&p_mq->latency_avg_us);
+    p_stats->latency_max_us = MQ_LOAD(&p_mq->latency_max_us);
+}
+
+#endif // __msg_queue_h__
@@ -0,0 +1,204 @@
+//
+// Copyright 2015-2017 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its 
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including, 
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR 
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any 
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "log.h"
+#include "netwatch.h"
+
+
+// links tracked by ifindex, higher ones fall back on ifi_change
+#define NW_MAX_LINKS  64
+
+static uint64_t s_running = 0;  // bit per ifindex, IFF_RUNNING last seen
+
+
+////////////////////////////////////////
+// the ifaddrmsg's own address, IFA_LOCAL on point to point links
+static uint32_t nw_msg_addr(struct nlmsghdr* p_nlh)
+{
+    uint32_t addr = 0;
+    struct ifaddrmsg* ifa = (struct ifaddrmsg*)NLMSG_DATA(p_nlh);
+    int len = IFA_PAYLOAD(p_nlh);
+    for(struct rtattr* rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+    {
+        if((IFA_LOCAL == rta->rta_type) || ((IFA_ADDRESS == rta->rta_type) && (0 == addr)))
+        {
+            memcpy(&addr, RTA_DATA(rta), sizeof(addr));
+        }
+    }
+    return(addr);
+}
+
+
+////////////////////////////////////////
+// true if the link is newly running. wireless links send RTM_NEWLINK
+// for every carrier, rate or stats change, and the kernel's own state
+// changes come with ifi_change 0, so the running links are tracked here
+static bool nw_link_came_up(struct nlmsghdr* p_nlh)
+{
+    const struct ifinfomsg* ifi = (const struct ifinfomsg*)NLMSG_DATA(p_nlh);
+    const bool running = ((RTM_NEWLINK == p_nlh->nlmsg_type) && (0 != (ifi->ifi_flags & IFF_RUNNING)));
+    if((ifi->ifi_index < 0) || (ifi->ifi_index >= NW_MAX_LINKS))
+    {
+        return(running && (0 != (ifi->ifi_change & IFF_RUNNING)));
+    }
+
+    const uint64_t bit = (1ULL << ifi->ifi_index);
+    const bool was_running = (0 != (s_running & bit));
+    s_running = (running ? (s_running | bit) : (s_running & ~bit));
+    return(running && !was_running);
+}
+
+
+////////////////////////////////////////
+// returns the netlink socket to poll for POLLIN, or -1
+int nw_open(void)
+{
+    const int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if(fd < 0)
+    {
+        log_error("nw_open:socket, err: [%s]", strerror(errno));
+        return(-1);
+    }
+
+    struct sockaddr_nl sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.nl_family = AF_NETLINK;
+    sa.nl_groups = (RTMGRP_LINK | RTMGRP_IPV4_IFADDR);
+    if(bind(fd, (struct sockaddr*)&sa, sizeof(sa)) < 0)
+    {
+        log_error("nw_open:bind, err: [%s]", strerror(errno));
+        close(fd);
+        return(-1);
+    }
+
+    return(fd);
+}
+
+
+////////////////////////////////////////
+void nw_close(const int p_fd)
+{
+    if(p_fd > -1)
+    {
+        close(p_fd);
+    }
+}
+
+
+////////////////////////////////////////
+// reads every queued event, p_bound_addr is the connection's local
+// address (network order, 0 if not connected)
+int nw_read(const int p_fd, const uint32_t p_bound_addr)
+{
+    int changes = NW_NONE;
+    char buf[4096] __attribute__((aligned(NLMSG_ALIGNTO)));
+
+    for(;;)
+    {
+        const ssize_t len = recv(p_fd, buf, sizeof(buf), 0);
+        if(len < 0)
+        {
+            if(ENOBUFS == errno)
+            {
+                // the kernel dropped events, the addresses are unknown
+                log_warn("netlink overrun, assuming the network changed");
+                changes |= (NW_ADDED | NW_LOST);
+                s_running = 0;
+                continue;
+            }
+            if((EAGAIN != errno) && (EWOULDBLOCK != errno) && (EINTR != errno))
+            {
+                log_error("nw_read:recv, err: [%s]", strerror(errno));
+            }
+            break;
+        }
+
+        int remaining = (int)len;
+        for(struct nlmsghdr* nlh = (struct nlmsghdr*)buf; NLMSG_OK(nlh, remaining); nlh = NLMSG_NEXT(nlh, remaining))
+        {
+            if((RTM_NEWLINK == nlh->nlmsg_type) || (RTM_DELLINK == nlh->nlmsg_type))
+            {
+                // a link coming up makes an address that was already
+                // there usable, the caller checks getifaddrs() again
+                if(nw_link_came_up(nlh))
+                {
+                    changes |= NW_ADDED;
+                }
+                continue;
+            }
+            if((RTM_NEWADDR != nlh->nlmsg_type) && (RTM_DELADDR != nlh->nlmsg_type))
+            {
+                continue;
+            }
+
+            const struct ifaddrmsg* ifa = (const struct ifaddrmsg*)NLMSG_DATA(nlh);
+            if((AF_INET != ifa->ifa_family) || (RT_SCOPE_HOST == ifa->ifa_scope))
+            {
+                continue;  // loopback
+            }
+
+            const uint32_t addr = nw_msg_addr(nlh);
+            struct in_addr in = { .s_addr = addr };
+            if(RTM_NEWADDR == nlh->nlmsg_type)
+            {
+                log_info("ip address added: %s", inet_ntoa(in));
+                changes |= NW_ADDED;
+            }
+            else
+            {
+                log_info("ip address removed: %s", inet_ntoa(in));
+                if((0 != p_bound_addr) && (addr == p_bound_addr))
+                {
+                    changes |= NW_LOST;
+                }
+            }
+        }
+    }
+
+    return(changes);
+}
+
+
+////////////////////////////////////////
+// local ipv4 address p_sock is bound to (network order), 0 if none
+uint32_t nw_local_addr(const int p_sock)
+{
+    if(p_sock < 0)
+    {
+        return(0);
+    }
+
+    struct sockaddr_in sa;
+    socklen_t sa_len = sizeof(sa);
+    if((0 != getsockname(p_sock, (struct sockaddr*)&sa, &sa_len)) || (AF_INET != sa.sin_family))
+    {
+        return(0);
+    }
+    return(sa.sin_addr.s_addr);
+}
@@ -0,0 +1,47 @@
+//
+// Copyright 2015-2017 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its 
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including, 
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR 
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any 
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#ifndef __netwatch_h__
+#define __netwatch_h__
+
+#include <stdint.h>
+
+
+//
+// rtnetlink watch of the ipv4 addresses and links, so the daemon can
+// connect the moment dhcp hands out an address and reconnect as soon
+// as the address its connection is bound to goes away, instead of
+// polling getifaddrs() or waiting for tcp to time out
+//
+// nw_open() subscribes before the caller checks the current addresses,
+// so nothing that changes in between is missed
+//
+
+// nw_read() results, or'd together
+#define NW_NONE    0x00
+#define NW_ADDED   0x01  // an ipv4 address was added or a link started running
+#define NW_LOST    0x02  // the bound address was removed, or events were lost
+
+
+int nw_open(void);
+void nw_close(const int p_fd);
+int nw_read(const int p_fd, const uint32_t p_bound_addr);
+uint32_t nw_local_addr(const int p_sock);
+
+
+#endif // __netwatch_h__
@@ -0,0 +1,656 @@
+//
+// Copyright 2015-2017 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its 
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including, 
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR 
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any 
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "aws_iot_config.h"
+
+#include <aws_iot_error.h>
+#include <aws_iot_log.h>
+#include <network_interface.h>
+#include <mbedtls/version.h>
+
+#include "util.h"
+#include "config.h"
+#include "phase.h"
+#include "network_mbedtls.h"
+
+
+//
+// stands in for the sdk's platform/linux/mbedtls/network_mbedtls_wrapper.c
+// (see Makefile), the Network interface is the same
+//
+// session resumption
+// ~~~~~~~~~~~~~~~~~~
+// the session of the last connection is offered on the next one. with a
+// ticket or session id the server skips the key exchange and certificate
+// checks, which on the router's mips cpu is most of a reconnect. a
+// server that declines the session does a full handshake in the same
+// connection, so nothing is lost by offering it.
+//
+// with TLS_SESSION_PERSIST the session is also kept in
+// TLS_SESSION_FILEPATH so a restarted process can resume it. mbedtls
+// can only serialize a session from 2.19 on, earlier versions keep it in
+// memory only.
+//
+// record size
+// ~~~~~~~~~~~
+// with TLS_MAX_FRAG_LEN set the max fragment length extension asks the
+// server for records no bigger than that. mbedtls sizes its record
+// buffers when libmbedtls is built (MBEDTLS_SSL_IN_CONTENT_LEN and
+// MBEDTLS_SSL_OUT_CONTENT_LEN, or MBEDTLS_SSL_MAX_CONTENT_LEN before
+// 2.12), so a low memory image builds it with those matching; from 2.23
+// MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH shrinks them to the negotiated size
+// after the handshake instead. a server that ignores the extension keeps
+// sending full size records, which only fit the full size buffers.
+//
+// credentials
+// ~~~~~~~~~~~
+// the root ca, device certificate and private key are parsed once, by
+// tls_load_credentials() at startup, and every connection uses the
+// parsed copies. the sdk's wrapper re-read and re-parsed the pem files
+// on each reconnect. tls_reload_credentials() has the next connect
+// parse them again, for certificates replaced on disk.
+//
+
+#ifndef IOT_SSL_READ_TIMEOUT
+#define IOT_SSL_READ_TIMEOUT    10  // ms, mbedtls_ssl_read() once connected
+#endif
+
+#if (MBEDTLS_VERSION_NUMBER >= 0x02130000)
+#define TLS_CAN_SAVE_SESSION
+#endif
+
+#define TLS_SESSION_MAGIC       0x31534c54  // "TLS1"
+#define TLS_SESSION_MAX         4096        // serialized session, the server certificate is most of it
+
+// the session file starts with the host it belongs to
+struct tls_session_header {
+    uint32_t magic;
+    uint16_t port;
+    uint16_t len;             // serialized session that follows
+    char host[128];
+};
+
+static mbedtls_ssl_session session;   // offered to the next connection
+static bool session_valid = false;
+
+// parsed once and shared by every connection
+static mbedtls_x509_crt cred_cacert;
+static mbedtls_x509_crt cred_clicert;
+static mbedtls_pk_context cred_pkey;
+static bool cred_loaded = false;
+static bool cred_stale = false;       // reparse on the next connect
+static char cred_paths[3][_POSIX_PATH_MAX];
+
+static struct tls_stats stats;
+
+
+////////////////////////////////////////
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000));
+}
+
+
+////////////////////////////////////////
+// drop the session, the next handshake is a full one
+static void session_forget(void)
+{
+    mbedtls_ssl_session_free(&session);
+    mbedtls_ssl_session_init(&session);
+    session_valid = false;
+    if(TLS_SESSION_PERSIST) {
+        unlink(TLS_SESSION_FILEPATH);
+    }
+}
+
+
+////////////////////////////////////////
+// pick up the session a previous process saved for this host
+static void session_load(const TLSConnectParams *params)
+{
+#ifdef TLS_CAN_SAVE_SESSION
+    if(!TLS_SESSION_PERSIST || session_valid) {
+        return;
+    }
+
+    const int fd = open(TLS_SESSION_FILEPATH, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return;
+    }
+    unsigned char buf[sizeof(struct tls_session_header) + TLS_SESSION_MAX];
+    const ssize_t len = read(fd, buf, sizeof(buf));
+    close(fd);
+
+    struct tls_session_header hdr;
+    if(len < (ssize_t)sizeof(hdr)) {
+        return;
+    }
+    memcpy(&hdr, buf, sizeof(hdr));
+    if((TLS_SESSION_MAGIC != hdr.magic) || (params->DestinationPort != hdr.port) ||
+       (len != (ssize_t)(sizeof(hdr) + hdr.len)) || (0 != strncmp(hdr.host, params->pDestinationURL, sizeof(hdr.host)))) {
+        return;
+    }
+    if(0 != mbedtls_ssl_session_load(&session, &buf[sizeof(hdr)], hdr.len)) {
+        IOT_WARN("tls session in " TLS_SESSION_FILEPATH " not usable");
+        session_forget();
+        return;
+    }
+    session_valid = true;
+    IOT_DEBUG("tls session loaded from " TLS_SESSION_FILEPATH);
+#else
+    IOT_UNUSED(params);
+#endif
+}
+
+
+////////////////////////////////////////
+// the session holds its master secret, so the file is 0600 and written
+// whole before it replaces the old one
+static void session_save(const TLSConnectParams *params)
+{
+#ifdef TLS_CAN_SAVE_SESSION
+    if(!TLS_SESSION_PERSIST) {
+        return;
+    }
+
+    struct tls_session_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    if(strlen(params->pDestinationURL) >= sizeof(hdr.host)) {
+        return;
+    }
+    unsigned char buf[sizeof(hdr) + TLS_SESSION_MAX];
+    size_t len = 0;
+    if(0 != mbedtls_ssl_session_save(&session, &buf[sizeof(hdr)], TLS_SESSION_MAX, &len)) {
+        IOT_WARN("tls session too big to save");
+        return;
+    }
+    hdr.magic = TLS_SESSION_MAGIC;
+    hdr.port = params->DestinationPort;
+    hdr.len = (uint16_t)len;
+    strncpy(hdr.host, params->pDestinationURL, sizeof(hdr.host) - 1);
+    memcpy(buf, &hdr, sizeof(hdr));
+    len += sizeof(hdr);
+
+    const int fd = open(TLS_SESSION_FILEPATH ".tmp", O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if(fd < 0) {
+        IOT_WARN("failed to save tls session: %s", strerror(errno));
+        return;
+    }
+    const bool ok = (write(fd, buf, len) == (ssize_t)len);
+    close(fd);
+    if(!ok || (0 != rename(TLS_SESSION_FILEPATH ".tmp", TLS_SESSION_FILEPATH))) {
+        IOT_WARN("failed to save tls session");
+        unlink(TLS_SESSION_FILEPATH ".tmp");
+    }
+#else
+    IOT_UNUSED(params);
+#endif
+}
+
+
+////////////////////////////////////////
+// TLS_MAX_FRAG_LEN as the extension's code
+static unsigned char max_frag_len_code(const int len)
+{
+    switch(len) {
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+        case 512:
+            return(MBEDTLS_SSL_MAX_FRAG_LEN_512);
+        case 1024:
+            return(MBEDTLS_SSL_MAX_FRAG_LEN_1024);
+        case 2048:
+            return(MBEDTLS_SSL_MAX_FRAG_LEN_2048);
+        case 4096:
+            return(MBEDTLS_SSL_MAX_FRAG_LEN_4096);
+#endif
+        default:
+            return(0);  // MBEDTLS_SSL_MAX_FRAG_LEN_NONE
+    }
+}
+
+
+////////////////////////////////////////
+static void free_credentials(void)
+{
+    mbedtls_x509_crt_free(&cred_cacert);
+    mbedtls_x509_crt_free(&cred_clicert);
+    mbedtls_pk_free(&cred_pkey);
+    cred_loaded = false;
+}
+
+
+////////////////////////////////////////
+// parse the pem files into the long lived copies every connection uses
+IoT_Error_t tls_load_credentials(const char *root_ca_path, const char *cert_path, const char *private_key_path)
+{
+    const char *paths[3] = { root_ca_path, cert_path, private_key_path };
+    for(int i=0; i<3; ++i) {
+        if(strlen(paths[i]) >= sizeof(cred_paths[i])) {
+            IOT_ERROR("credential path too long: %s", paths[i]);
+            return(FAILURE);
+        }
+    }
+
+    free_credentials();
+    mbedtls_x509_crt_init(&cred_cacert);
+    mbedtls_x509_crt_init(&cred_clicert);
+    mbedtls_pk_init(&cred_pkey);
+
+    const uint64_t start_ms = now_ms();
+    int ret = mbedtls_x509_crt_parse_file(&cred_cacert, root_ca_path);
+    if(ret < 0) {
+        IOT_ERROR("failed to parse root ca %s - ret: -0x%x", root_ca_path, -ret);
+        free_credentials();
+        return(NETWORK_X509_ROOT_CRT_PARSE_ERROR);
+    }
+    ret = mbedtls_x509_crt_parse_file(&cred_clicert, cert_path);
+    if(0 != ret) {
+        IOT_ERROR("failed to parse device certificate %s - ret: -0x%x", cert_path, -ret);
+        free_credentials();
+        return(NETWORK_X509_DEVICE_CRT_PARSE_ERROR);
+    }
+    ret = mbedtls_pk_parse_keyfile(&cred_pkey, private_key_path, "");
+    if(0 != ret) {
+        IOT_ERROR("failed to parse private key %s - ret: -0x%x", private_key_path, -ret);
+        free_credentials();
+        return(NETWORK_PK_PRIVATE_KEY_PARSE_ERROR);
+    }
+
+    for(int i=0; i<3; ++i) {
+        strcpy(cred_paths[i], paths[i]);
+    }
+    cred_loaded = true;
+    cred_stale = false;
+    ++stats.cred_loads;
+    stats.cred_ms = (uint32_t)(now_ms() - start_ms);
+    IOT_INFO("tls credentials parsed in %u ms", stats.cred_ms);
+    return(SUCCESS);
+}
+
+
+////////////////////////////////////////
+// the files changed on disk, the next connect parses them again and the
+// current connection keeps what it has
+void tls_reload_credentials(void)
+{
+    cred_stale = true;
+}
+
+
+////////////////////////////////////////
+static bool credentials_match(const TLSConnectParams *params)
+{
+    return(cred_loaded && !cred_stale &&
+           (0 == strcmp(cred_paths[0], params->pRootCALocation)) &&
+           (0 == strcmp(cred_paths[1], params->pDeviceCertLocation)) &&
+           (0 == strcmp(cred_paths[2], params->pDevicePrivateKeyLocation)));
+}
+
+
+////////////////////////////////////////
+static void set_connect_params(Network *pNetwork, char *pRootCALocation, char *pDeviceCertLocation,
+                               char *pDevicePrivateKeyLocation, char *pDestinationURL,
+                               uint16_t destinationPort, uint32_t timeout_ms, bool ServerVerificationFlag)
+{
+    pNetwork->tlsConnectParams.DestinationPort = destinationPort;
+    pNetwork->tlsConnectParams.pDestinationURL = pDestinationURL;
+    pNetwork->tlsConnectParams.pDeviceCertLocation = pDeviceCertLocation;
+    pNetwork->tlsConnectParams.pDevicePrivateKeyLocation = pDevicePrivateKeyLocation;
+    pNetwork->tlsConnectParams.pRootCALocation = pRootCALocation;
+    pNetwork->tlsConnectParams.timeout_ms = timeout_ms;
+    pNetwork->tlsConnectParams.ServerVerificationFlag = ServerVerificationFlag;
+}
+
+
+////////////////////////////////////////
+IoT_Error_t iot_tls_init(Network *pNetwork, char *pRootCALocation, char *pDeviceCertLocation,
+                         char *pDevicePrivateKeyLocation, char *pDestinationURL,
+                         uint16_t destinationPort, uint32_t timeout_ms, bool ServerVerificationFlag)
+{
+    set_connect_params(pNetwork, pRootCALocation, pDeviceCertLocation, pDevicePrivateKeyLocation,
+                       pDestinationURL, destinationPort, timeout_ms, ServerVerificationFlag);
+
+    pNetwork->connect = iot_tls_connect;
+    pNetwork->read = iot_tls_read;
+    pNetwork->write = iot_tls_write;
+    pNetwork->disconnect = iot_tls_disconnect;
+    pNetwork->isConnected = iot_tls_is_connected;
+    pNetwork->destroy = iot_tls_destroy;
+
+    pNetwork->tlsDataParams.flags = 0;
+
+    return(SUCCESS);
+}
+
+
+////////////////////////////////////////
+IoT_Error_t iot_tls_is_connected(Network *pNetwork)
+{
+    IOT_UNUSED(pNetwork);
+    // use this to add implementation which can check for physical layer disconnect
+    return(NETWORK_PHYSICAL_LAYER_CONNECTED);
+}
+
+
+////////////////////////////////////////
+// called by the sdk for the first connection and every reconnect, each
+// one is torn down again by iot_tls_destroy()
+IoT_Error_t iot_tls_connect(Network *pNetwork, TLSConnectParams *params)
+{
+    if(NULL == pNetwork) {
+        return(NULL_VALUE_ERROR);
+    }
+
+    if(NULL != params) {
+        set_connect_params(pNetwork, params->pRootCALocation, params->pDeviceCertLocation,
+                           params->pDevicePrivateKeyLocation, params->pDestinationURL,
+                           params->DestinationPort, params->timeout_ms, params->ServerVerificationFlag);
+    }
+
+    TLSConnectParams *cp = &pNetwork->tlsConnectParams;
+    TLSDataParams *tls = &pNetwork->tlsDataParams;
+    const char *pers = "aws_iot_tls_wrapper";
+    int ret = 0;
+
+    // up to here is the reconnect backoff, or the sdk's setup at boot
+    ph_attempt();
+    ph_mark(PH_WAIT);
+
+    // tls->cacert, clicert and pkey are left empty, the parsed
+    // credentials are shared instead
+    mbedtls_net_init(&tls->server_fd);
+    mbedtls_ssl_init(&tls->ssl);
+    mbedtls_ssl_config_init(&tls->conf);
+    mbedtls_ctr_drbg_init(&tls->ctr_drbg);
+    mbedtls_x509_crt_init(&tls->cacert);
+    mbedtls_x509_crt_init(&tls->clicert);
+    mbedtls_pk_init(&tls->pkey);
+
+    mbedtls_entropy_init(&tls->entropy);
+    ret = mbedtls_ctr_drbg_seed(&tls->ctr_drbg, mbedtls_entropy_func, &tls->entropy, (const unsigned char *)pers, strlen(pers));
+    if(0 != ret) {
+        IOT_ERROR("mbedtls_ctr_drbg_seed failed - ret: -0x%x", -ret);
+        return(NETWORK_MBEDTLS_ERR_CTR_DRBG_ENTROPY_SOURCE_FAILED);
+    }
+
+    ph_mark(PH_TLS);
+    if(credentials_match(cp)) {
+        ++stats.cred_reuses;
+    }
+    else {
+        IoT_Error_t rc = tls_load_credentials(cp->pRootCALocation, cp->pDeviceCertLocation, cp->pDevicePrivateKeyLocation);
+        if(SUCCESS != rc) {
+            return(rc);
+        }
+    }
+    ph_mark(PH_CREDENTIALS);
+
+    char port[6];
+    snprintf(port, sizeof(port), "%d", cp->DestinationPort);
+    IOT_DEBUG("connecting to %s:%s", cp->pDestinationURL, port);
+    ret = mbedtls_net_connect(&tls->server_fd, cp->pDestinationURL, port, MBEDTLS_NET_PROTO_TCP);
+    ph_mark(PH_TCP);
+    if(0 != ret) {
+        IOT_ERROR("failed to connect to %s:%s - ret: -0x%x", cp->pDestinationURL, port, -ret);
+        switch(ret) {
+            case MBEDTLS_ERR_NET_SOCKET_FAILED:
+                return(NETWORK_ERR_NET_SOCKET_FAILED);
+            case MBEDTLS_ERR_NET_UNKNOWN_HOST:
+                return(NETWORK_ERR_NET_UNKNOWN_HOST);
+            case MBEDTLS_ERR_NET_CONNECT_FAILED:
+            default:
+                return(NETWORK_ERR_NET_CONNECT_FAILED);
+        }
+    }
+
+    ret = mbedtls_net_set_block(&tls->server_fd);
+    if(0 != ret) {
+        IOT_ERROR("mbedtls_net_set_block failed - ret: -0x%x", -ret);
+        return(SSL_CONNECTION_ERROR);
+    }
+
+    ret = mbedtls_ssl_config_defaults(&tls->conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
+    if(0 != ret) {
+        IOT_ERROR("mbedtls_ssl_config_defaults failed - ret: -0x%x", -ret);
+        return(SSL_CONNECTION_ERROR);
+    }
+    mbedtls_ssl_conf_authmode(&tls->conf, (cp->ServerVerificationFlag ? MBEDTLS_SSL_VERIFY_REQUIRED : MBEDTLS_SSL_VERIFY_OPTIONAL));
+    mbedtls_ssl_conf_rng(&tls->conf, mbedtls_ctr_drbg_random, &tls->ctr_drbg);
+    mbedtls_ssl_conf_ca_chain(&tls->conf, &cred_cacert, NULL);
+    ret = mbedtls_ssl_conf_own_cert(&tls->conf, &cred_clicert, &cred_pkey);
+    if(0 != ret) {
+        IOT_ERROR("mbedtls_ssl_conf_own_cert failed - ret: -0x%x", -ret);
+        return(SSL_CONNECTION_ERROR);
+    }
+    mbedtls_ssl_conf_read_timeout(&tls->conf, cp->timeout_ms);
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+    mbedtls_ssl_conf_session_tickets(&tls->conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+    if(0 != TLS_MAX_FRAG_LEN) {
+        const unsigned char mfl = max_frag_len_code(TLS_MAX_FRAG_LEN);
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+        if((0 == mfl) || (0 != mbedtls_ssl_conf_max_frag_len(&tls->conf, mfl))) {
+#else
+        if(0 == mfl) {
+#endif
+            IOT_WARN("tls max fragment length %d not available, using the default", TLS_MAX_FRAG_LEN);
+        }
+    }
+
+    ret = mbedtls_ssl_setup(&tls->ssl, &tls->conf);
+    if(0 != ret) {
+        IOT_ERROR("mbedtls_ssl_setup failed - ret: -0x%x", -ret);
+        return(SSL_CONNECTION_ERROR);
+    }
+    ret = mbedtls_ssl_set_hostname(&tls->ssl, cp->pDestinationURL);
+    if(0 != ret) {
+        IOT_ERROR("mbedtls_ssl_set_hostname failed - ret: -0x%x", -ret);
+        return(SSL_CONNECTION_ERROR);
+    }
+    mbedtls_ssl_set_bio(&tls->ssl, &tls->server_fd, mbedtls_net_send, NULL, mbedtls_net_recv_timeout);
+
+    // offer the last session, a resumed handshake keeps its master secret
+    session_load(cp);
+    unsigned char offered_master[sizeof(session.master)];
+    bool offered = false;
+    if(session_valid) {
+        ret = mbedtls_ssl_set_session(&tls->ssl, &session);
+        if(0 == ret) {
+            memcpy(offered_master, session.master, sizeof(offered_master));
+            offered = true;
+        }
+        else {
+            IOT_WARN("tls session not offered - ret: -0x%x", -ret);
+            session_forget();
+        }
+    }
+
+    const uint64_t start_ms = now_ms();
+    while(0 != (ret = mbedtls_ssl_handshake(&tls->ssl))) {
+        if((MBEDTLS_ERR_SSL_WANT_READ != ret) && (MBEDTLS_ERR_SSL_WANT_WRITE != ret)) {
+            ++stats.failed;
+            ph_mark(PH_TLS);
+            IOT_ERROR("tls handshake failed - ret: -0x%x", -ret);
+            if(MBEDTLS_ERR_X509_CERT_VERIFY_FAILED == ret) {
+                IOT_ERROR("unable to verify the server's certificate, check the root ca");
+            }
+            if(offered) {
+                session_forget();  // start clean next time
+            }
+            return(SSL_CONNECTION_ERROR);
+        }
+    }
+    const uint32_t elapsed_ms = (uint32_t)(now_ms() - start_ms);
+    ph_mark(PH_TLS);
+
+    tls->flags = mbedtls_ssl_get_verify_result(&tls->ssl);
+    if(0 != tls->flags) {
+        char info[256];
+        mbedtls_x509_crt_verify_info(info, sizeof(info), "  ! ", tls->flags);
+        IOT_ERROR("server certificate verification failed:\n%s", info);
+        ++stats.failed;
+        session_forget();
+        return(SSL_CONNECTION_ERROR);
+    }
+
+    // keep this session for the next connection
+    bool resumed = false;
+    if(0 == mbedtls_ssl_get_session(&tls->ssl, &session)) {
+        session_valid = true;
+        resumed = (offered && (0 == memcmp(offered_master, session.master, sizeof(offered_master))));
+        session_save(cp);  // a resumed session may carry a new ticket
+    }
+    else {
+        session_forget();
+    }
+
+    if(resumed) {
+        ++stats.resumed;
+        stats.resumed_ms = elapsed_ms;
+    }
+    else {
+        ++stats.full;
+        stats.full_ms = elapsed_ms;
+    }
+    IOT_INFO("tls handshake %s in %u ms, %s", (resumed ? "resumed" : "full"), elapsed_ms, mbedtls_ssl_get_ciphersuite(&tls->ssl));
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+    stats.frag_len = (uint32_t)mbedtls_ssl_get_max_frag_len(&tls->ssl);
+#endif
+
+    mbedtls_ssl_conf_read_timeout(&tls->conf, IOT_SSL_READ_TIMEOUT);
+    return(SUCCESS);
+}
+
+
+////////////////////////////////////////
+IoT_Error_t iot_tls_write(Network *pNetwork, unsigned char *pMsg, size_t len, Timer *timer, size_t *written_len)
+{
+    mbedtls_ssl_context *ssl = &pNetwork->tlsDataParams.ssl;
+    size_t written = 0;
+
+    while((written < len) && !has_timer_expired(timer)) {
+        const int ret = mbedtls_ssl_write(ssl, pMsg + written, len - written);
+        if(ret > 0) {
+            written += ret;
+        }
+        else if((MBEDTLS_ERR_SSL_WANT_READ != ret) && (MBEDTLS_ERR_SSL_WANT_WRITE != ret)) {
+            IOT_ERROR("mbedtls_ssl_write failed - ret: -0x%x", -ret);
+            *written_len = written;
+            return(NETWORK_SSL_WRITE_ERROR);
+        }
+    }
+
+    *written_len = written;
+    if(written != len) {
+        return(NETWORK_SSL_WRITE_TIMEOUT_ERROR);
+    }
+    return(SUCCESS);
+}
+
+
+////////////////////////////////////////
+IoT_Error_t iot_tls_read(Network *pNetwork, unsigned char *pMsg, size_t len, Timer *timer, size_t *read_len)
+{
+    TLSDataParams *tls = &pNetwork->tlsDataParams;
+    size_t rx_len = 0;
+
+    // the read is tried at least once, the timer is checked after it
+    do {
+        mbedtls_ssl_conf_read_timeout(&tls->conf, max(left_ms(timer), 1u));
+        const int ret = mbedtls_ssl_read(&tls->ssl, pMsg + rx_len, len - rx_len);
+        if(ret > 0) {
+            rx_len += ret;
+        }
+        else if((0 == ret) || ((MBEDTLS_ERR_SSL_WANT_READ != ret) && (MBEDTLS_ERR_SSL_TIMEOUT != ret))) {
+            // 0 is the peer closing the connection
+            *read_len = rx_len;
+            return(NETWORK_SSL_READ_ERROR);
+        }
+    } while((rx_len < len) && !has_timer_expired(timer));
+
+    *read_len = rx_len;
+    if(rx_len == len) {
+        return(SUCCESS);
+    }
+    return((0 == rx_len) ? NETWORK_SSL_NOTHING_TO_READ : NETWORK_SSL_READ_TIMEOUT_ERROR);
+}
+
+
+////////////////////////////////////////
+IoT_Error_t iot_tls_disconnect(Network *pNetwork)
+{
+    mbedtls_ssl_context *ssl = &pNetwork->tlsDataParams.ssl;
+    int ret;
+    do {
+        ret = mbedtls_ssl_close_notify(ssl);
+    } while(MBEDTLS_ERR_SSL_WANT_WRITE == ret);
+
+    // any other error means the connection needs a reset, which is what
+    // disconnecting does anyway
+    return(SUCCESS);
+}
+
+
+////////////////////////////////////////
+// the kept session and the parsed credentials are not part of the
+// connection and outlive this
+IoT_Error_t iot_tls_destroy(Network *pNetwork)
+{
+    TLSDataParams *tls = &pNetwork->tlsDataParams;
+
+    mbedtls_net_free(&tls->server_fd);
+    mbedtls_x509_crt_free(&tls->clicert);
+    mbedtls_x509_crt_free(&tls->cacert);
+    mbedtls_pk_free(&tls->pkey);
+    mbedtls_ssl_free(&tls->ssl);
+    mbedtls_ssl_config_free(&tls->conf);
+    mbedtls_ctr_drbg_free(&tls->ctr_drbg);
+    mbedtls_entropy_free(&tls->entropy);
+
+    return(SUCCESS);
+}
+
+
+////////////////////////////////////////
+void tls_get_stats(struct tls_stats *out)
+{
+    memcpy(out, &stats, sizeof(*out));
+}
+
+
+////////////////////////////////////////
+void tls_log_stats(void)
+{
+    IOT_INFO("tls: full handshakes %u (last %u ms)  resumed %u (last %u ms)  failed %u",
+             stats.full, stats.full_ms, stats.resumed, stats.resumed_ms, stats.failed);
+    IOT_INFO("tls: credentials parsed %u times (last %u ms)  reused %u times, about %u ms saved",
+             stats.cred_loads, stats.cred_ms, stats.cred_reuses, stats.cred_reuses * stats.cred_ms);
+    IOT_INFO("tls: record size %u (asked for %d, 0 is the default)", stats.frag_len, TLS_MAX_FRAG_LEN);
+}
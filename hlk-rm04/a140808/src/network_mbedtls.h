@@ -0,0 +1,49 @@
+//
+// Copyright 2015-2017 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its 
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including, 
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR 
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any 
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#ifndef __network_mbedtls_h__
+#define __network_mbedtls_h__
+
+#include <stdint.h>
+
+#include <aws_iot_error.h>
+
+
+//
+// bridge side of network_mbedtls.c, the iot_tls_* functions the sdk
+// calls are declared by its network_interface.h
+//
+struct tls_stats {
+    uint32_t full;            // full handshakes
+    uint32_t resumed;         // abbreviated handshakes on an earlier session
+    uint32_t failed;          // handshakes that did not complete
+    uint32_t full_ms;         // how long the last of each took
+    uint32_t resumed_ms;
+    uint32_t cred_loads;      // times the pem files were parsed
+    uint32_t cred_reuses;     // connects that used the parsed copies instead
+    uint32_t cred_ms;         // how long the last parse took
+    uint32_t frag_len;        // record size in use on the last connect
+};
+
+IoT_Error_t tls_load_credentials(const char *root_ca_path, const char *cert_path, const char *private_key_path);
+void tls_reload_credentials(void);
+void tls_get_stats(struct tls_stats *out);
+void tls_log_stats(void);
+
+
+#endif // __network_mbedtls_h__
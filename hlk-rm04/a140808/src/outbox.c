@@ -0,0 +1,257 @@
+//
+// Copyright 2015-2017 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its 
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including, 
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR 
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any 
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "crc16.h"
+#include "outbox.h"
+
+#define OB_MAGIC    0x3142584f  // "OXB1"
+#define OB_VERSION  1
+
+#define OB_LOAD(p)      __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define OB_STORE(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+
+////////////////////////////////////////
+static inline struct ob_record* ob_slot(struct ob_context* p_ob, const uint32_t p_pos)
+{
+    return(&p_ob->records[p_pos % OB_SLOTS]);
+}
+
+////////////////////////////////////////
+static uint16_t ob_crc(const struct ob_record* p_record)
+{
+    return(crc16_update_block(0xffff, (const uint8_t*)p_record, offsetof(struct ob_record, crc)));
+}
+
+////////////////////////////////////////
+static void ob_update_depth(struct ob_context* p_ob)
+{
+    p_ob->stats.depth = ob_depth(p_ob);
+    if(p_ob->stats.depth > p_ob->stats.high_water)
+    {
+        p_ob->stats.high_water = p_ob->stats.depth;
+    }
+}
+
+
+////////////////////////////////////////
+// map p_path, creating it if needed, and pick up whatever an earlier
+// run left queued. if the file cannot be mapped the outbox still works
+// from anonymous memory, it just does not survive a restart
+bool ob_open(struct ob_context* p_ob, const char* p_path)
+{
+    memset(p_ob, 0, sizeof(*p_ob));
+    p_ob->map_size = (sizeof(struct ob_header) + (OB_SLOTS * sizeof(struct ob_record)));
+
+    void* map = MAP_FAILED;
+    const int fd = open(p_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(fd > -1)
+    {
+        struct stat st;
+        if((0 == fstat(fd, &st)) && ((st.st_size == p_ob->map_size) || (0 == ftruncate(fd, p_ob->map_size))))
+        {
+            map = mmap(NULL, p_ob->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+    }
+    if(MAP_FAILED != map)
+    {
+        p_ob->persistent = true;
+    }
+    else
+    {
+        log_warn("outbox %s not mapped, queued reports will not survive a restart: [%s]", p_path, strerror(errno));
+        map = mmap(NULL, p_ob->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(MAP_FAILED == map)
+        {
+            log_error("failed to allocate outbox: [%s]", strerror(errno));
+            return(false);
+        }
+    }
+    p_ob->header = (struct ob_header*)map;
+    p_ob->records = (struct ob_record*)(p_ob->header + 1);
+
+    struct ob_header* hdr = p_ob->header;
+    if((OB_MAGIC != hdr->magic) || (OB_VERSION != hdr->version) || (OB_SLOTS != hdr->slots) || ((hdr->head - hdr->tail) > OB_SLOTS))
+    {
+        // new file, or one from another layout
+        memset(map, 0, p_ob->map_size);
+        hdr->version = OB_VERSION;
+        hdr->slots = OB_SLOTS;
+        OB_STORE(&hdr->magic, OB_MAGIC);
+        return(true);
+    }
+
+    // a crash can leave a collapse half done, collapsing again sorts it out
+    ob_collapse(p_ob);
+    p_ob->stats.recovered = ob_depth(p_ob);
+    ob_update_depth(p_ob);
+    if(p_ob->stats.recovered > 0)
+    {
+        log_info("outbox %s: %u queued reports recovered", p_path, p_ob->stats.recovered);
+    }
+    return(true);
+}
+
+////////////////////////////////////////
+// whatever is still queued stays in the file for the next ob_open()
+void ob_close(struct ob_context* p_ob)
+{
+    if(NULL != p_ob->header)
+    {
+        munmap(p_ob->header, p_ob->map_size);
+        p_ob->header = NULL;
+        p_ob->records = NULL;
+    }
+}
+
+////////////////////////////////////////
+bool ob_push(struct ob_context* p_ob, const char* p_thing, const uint8_t p_inputs, const uint8_t p_outputs)
+{
+    const size_t thing_len = strlen(p_thing);
+    if(thing_len >= OB_THING_SIZE)
+    {
+        log_error("outbox thing name too long: %s", p_thing);
+        return(false);
+    }
+
+    if((ob_depth(p_ob) >= OB_SLOTS) && ((0 == ob_collapse(p_ob)) || (ob_depth(p_ob) >= OB_SLOTS)))
+    {
+        log_error("outbox full");
+        return(false);
+    }
+
+    // the record is complete before the head moves over it
+    struct ob_header* hdr = p_ob->header;
+    const uint32_t head = hdr->head;
+    struct ob_record* rec = ob_slot(p_ob, head);
+    memset(rec, 0, sizeof(*rec));
+    rec->seq = hdr->seq++;
+    rec->stamp = (uint32_t)time(NULL);
+    memcpy(rec->thing, p_thing, thing_len);
+    rec->inputs = p_inputs;
+    rec->outputs = p_outputs;
+    rec->crc = ob_crc(rec);
+    OB_STORE(&hdr->head, head + 1);
+
+    ++p_ob->stats.queued;
+    ob_update_depth(p_ob);
+    return(true);
+}
+
+////////////////////////////////////////
+// copy out the oldest record, records that fail their crc are skipped
+bool ob_peek(struct ob_context* p_ob, struct ob_record* p_record)
+{
+    struct ob_header* hdr = p_ob->header;
+    while(ob_depth(p_ob) > 0)
+    {
+        const struct ob_record* rec = ob_slot(p_ob, hdr->tail);
+        if(ob_crc(rec) == rec->crc)
+        {
+            memcpy(p_record, rec, sizeof(*p_record));
+            return(true);
+        }
+        log_warn("outbox record %u is damaged, skipped", hdr->tail);
+        OB_STORE(&hdr->tail, hdr->tail + 1);
+        ob_update_depth(p_ob);
+    }
+    return(false);
+}
+
+////////////////////////////////////////
+// the record from ob_peek() has been sent
+void ob_pop(struct ob_context* p_ob)
+{
+    struct ob_header* hdr = p_ob->header;
+    if(ob_depth(p_ob) > 0)
+    {
+        OB_STORE(&hdr->tail, hdr->tail + 1);
+        ++p_ob->stats.sent;
+        ob_update_depth(p_ob);
+    }
+}
+
+////////////////////////////////////////
+// keep only the latest record per thing, returns how many were dropped
+//
+// the kept records move up against the head in their original order,
+// working down from the head. a slot is only overwritten once the
+// record in it has been dropped or already moved, and the tail only
+// moves once every kept record is in place, so a crash part way through
+// leaves duplicates (collapsed again by the next ob_open()) but never
+// loses a kept record.
+uint32_t ob_collapse(struct ob_context* p_ob)
+{
+    struct ob_header* hdr = p_ob->header;
+    const uint32_t head = hdr->head;
+    const uint32_t tail = hdr->tail;
+    uint32_t keep = head;  // kept records are [keep, head)
+    uint32_t dropped = 0;
+
+    for(uint32_t pos = head; pos != tail; )
+    {
+        --pos;
+        const struct ob_record* rec = ob_slot(p_ob, pos);
+        bool drop = (ob_crc(rec) != rec->crc);
+        for(uint32_t k = keep; !drop && (k != head); ++k)
+        {
+            drop = (0 == strncmp(ob_slot(p_ob, k)->thing, rec->thing, OB_THING_SIZE));
+        }
+        if(drop)
+        {
+            ++dropped;
+            continue;
+        }
+
+        --keep;
+        if(keep != pos)
+        {
+            memcpy(ob_slot(p_ob, keep), rec, sizeof(*rec));
+        }
+    }
+    OB_STORE(&hdr->tail, keep);
+
+    p_ob->stats.collapsed += dropped;
+    ob_update_depth(p_ob);
+    return(dropped);
+}
+
+////////////////////////////////////////
+uint32_t ob_depth(struct ob_context* p_ob)
+{
+    return(OB_LOAD(&p_ob->header->head) - OB_LOAD(&p_ob->header->tail));
+}
+
+////////////////////////////////////////
+void ob_get_stats(struct ob_context* p_ob, struct ob_stats* p_stats)
+{
+    memcpy(p_stats, &p_ob->stats, sizeof(*p_stats));
+}
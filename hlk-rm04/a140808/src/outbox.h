@@ -0,0 +1,91 @@
+//
+// Copyright 2015-2017 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its 
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including, 
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR 
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any 
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#ifndef __outbox_h__
+#define __outbox_h__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+//
+// store and forward queue of shadow reports that could not be sent
+//
+// each record is a thing's whole board state, so only the latest one
+// per thing ever needs to go out. the ring lives in a file mapped from
+// tmpfs: a record is written and checked (crc16) before the head moves
+// past it, so after a crash ob_open() finds every record that was
+// completely queued and nothing half written.
+//
+// when the ring fills up it is collapsed to the latest record per thing
+// rather than dropping anything, see ob_collapse().
+//
+// one thread only, aws_iot_shadow.c owns the one outbox
+//
+#define OB_SLOTS       64
+#define OB_THING_SIZE  16  // thing name and its term null
+
+struct ob_record
+{
+    uint32_t seq;        // queue order, survives collapsing
+    uint32_t stamp;      // CLOCK_REALTIME seconds when queued
+    char     thing[OB_THING_SIZE];
+    uint8_t  inputs;
+    uint8_t  outputs;
+    uint16_t crc;        // everything above
+};
+
+struct ob_header
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t slots;
+    uint32_t head;       // next position to write, positions wrap at OB_SLOTS
+    uint32_t tail;       // oldest position not yet sent
+    uint32_t seq;        // next record seq
+};
+
+struct ob_stats
+{
+    uint32_t depth;      // records queued right now
+    uint32_t high_water; // deepest the queue has been
+    uint32_t queued;     // records passed to ob_push()
+    uint32_t collapsed;  // records dropped for a later one of the same thing
+    uint32_t sent;       // records passed to ob_pop()
+    uint32_t recovered;  // records found by ob_open()
+};
+
+struct ob_context
+{
+    struct ob_header* header;
+    struct ob_record* records;
+    size_t map_size;
+    bool persistent;     // false if the file could not be mapped
+    struct ob_stats stats;
+};
+
+bool ob_open(struct ob_context* p_ob, const char* p_path);
+void ob_close(struct ob_context* p_ob);
+bool ob_push(struct ob_context* p_ob, const char* p_thing, const uint8_t p_inputs, const uint8_t p_outputs);
+bool ob_peek(struct ob_context* p_ob, struct ob_record* p_record);
+void ob_pop(struct ob_context* p_ob);
+uint32_t ob_collapse(struct ob_context* p_ob);
+uint32_t ob_depth(struct ob_context* p_ob);
+void ob_get_stats(struct ob_context* p_ob, struct ob_stats* p_stats);
+
+#endif // __outbox_h__
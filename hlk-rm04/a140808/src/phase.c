@@ -0,0 +1,204 @@
+//
+// Copyright 2015-2017 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its 
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including, 
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR 
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any 
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "config.h"
+#include "phase.h"
+
+static const char* const s_phase_names[PH_COUNT] =
+{
+    "args", "pid_file", "boards", "ip_wait", "credentials", "shadow_init",
+    "wait", "tcp", "tls", "mqtt", "autoreconnect", "subscribe", "report"
+};
+static const char* const s_kind_names[PH_KIND_COUNT] = { "boot", "reconnect" };
+
+static struct ph_cycle s_history[PH_HISTORY];
+static uint32_t s_count = 0;       // cycles ended, s_history holds the last PH_HISTORY
+static uint32_t s_kind_count[PH_KIND_COUNT];
+static struct ph_cycle s_boot;     // kept after it leaves s_history
+static struct ph_cycle s_current;
+static bool s_active = false;
+static uint64_t s_mark_ms = 0;
+
+
+////////////////////////////////////////
+static uint64_t ph_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(((uint64_t)ts.tv_sec * 1000) + (ts.tv_nsec / 1000000));
+}
+
+
+////////////////////////////////////////
+// a begin while a cycle is open is ignored, a reconnect that fails and
+// is retried stays one cycle
+void ph_begin(const uint8_t p_kind)
+{
+    if(s_active)
+    {
+        return;
+    }
+    memset(&s_current, 0, sizeof(s_current));
+    s_current.seq = (s_count + 1);
+    s_current.kind = ((p_kind < PH_KIND_COUNT) ? p_kind : PH_RECONNECT);
+    s_current.start_ms = ph_now_ms();
+    s_mark_ms = s_current.start_ms;
+    s_active = true;
+}
+
+
+////////////////////////////////////////
+// charge the time since the last mark to p_phase
+void ph_mark(const uint8_t p_phase)
+{
+    if(!s_active || (p_phase >= PH_COUNT))
+    {
+        return;
+    }
+    const uint64_t now = ph_now_ms();
+    s_current.ms[p_phase] += (uint32_t)(now - s_mark_ms);
+    s_mark_ms = now;
+}
+
+
+////////////////////////////////////////
+void ph_attempt(void)
+{
+    if(s_active && (s_current.attempts < UINT8_MAX))
+    {
+        ++s_current.attempts;
+    }
+}
+
+
+////////////////////////////////////////
+// close the cycle, keep it and log it
+void ph_end(void)
+{
+    if(!s_active)
+    {
+        return;
+    }
+    s_current.total_ms = (uint32_t)(ph_now_ms() - s_current.start_ms);
+    s_history[s_count % PH_HISTORY] = s_current;
+    ++s_count;
+    ++s_kind_count[s_current.kind];
+    if(PH_BOOT == s_current.kind)
+    {
+        s_boot = s_current;
+    }
+    s_active = false;
+
+    char line[384];
+    ph_format(&s_current, line, sizeof(line));
+    log_info("%s", line);
+}
+
+
+////////////////////////////////////////
+bool ph_active(void)
+{
+    return(s_active);
+}
+
+
+////////////////////////////////////////
+// one cycle as a line of key=value pairs, no trailing newline
+size_t ph_format(const struct ph_cycle* p_cycle, char* p_buf, const size_t p_buflen)
+{
+    int len = snprintf(p_buf, p_buflen, "phases %s seq=%u version=%s total_ms=%u attempts=%u",
+                       s_kind_names[p_cycle->kind], p_cycle->seq, APP_VERSION, p_cycle->total_ms, p_cycle->attempts);
+    for(int i=0; (i < PH_COUNT) && (len > 0) && ((size_t)len < p_buflen); ++i)
+    {
+        len += snprintf(p_buf + len, p_buflen - len, " %s=%u", s_phase_names[i], p_cycle->ms[i]);
+    }
+    return((len < 0) ? 0 : (((size_t)len < p_buflen) ? (size_t)len : (p_buflen - 1)));
+}
+
+
+////////////////////////////////////////
+static size_t ph_append_line(const struct ph_cycle* p_cycle, char* p_buf, const size_t p_buflen, size_t p_len)
+{
+    p_len += ph_format(p_cycle, p_buf + p_len, p_buflen - p_len);
+    if((p_len + 1) < p_buflen)
+    {
+        p_buf[p_len++] = '\n';
+        p_buf[p_len] = '\0';
+    }
+    return(p_len);
+}
+
+
+////////////////////////////////////////
+// the boot cycle, the kept cycles oldest first, then per kind the
+// min/avg/max total of the kept ones
+size_t ph_summary(char* p_buf, const size_t p_buflen)
+{
+    size_t len = 0;
+    p_buf[0] = '\0';
+
+    const uint32_t first = ((s_count > PH_HISTORY) ? (s_count - PH_HISTORY) : 0);
+    if((first > 0) && (s_kind_count[PH_BOOT] > 0))
+    {
+        len = ph_append_line(&s_boot, p_buf, p_buflen, len);
+    }
+    for(uint32_t n=first; (n < s_count) && ((len + 1) < p_buflen); ++n)
+    {
+        len = ph_append_line(&s_history[n % PH_HISTORY], p_buf, p_buflen, len);
+    }
+
+    for(uint8_t kind=0; (kind < PH_KIND_COUNT) && ((len + 1) < p_buflen); ++kind)
+    {
+        uint32_t count = 0, min_ms = 0, max_ms = 0;
+        uint64_t sum_ms = 0;
+        for(uint32_t n=first; n<s_count; ++n)
+        {
+            const struct ph_cycle* cycle = &s_history[n % PH_HISTORY];
+            if(kind != cycle->kind)
+            {
+                continue;
+            }
+            min_ms = (((0 == count) || (cycle->total_ms < min_ms)) ? cycle->total_ms : min_ms);
+            max_ms = ((cycle->total_ms > max_ms) ? cycle->total_ms : max_ms);
+            sum_ms += cycle->total_ms;
+            ++count;
+        }
+        if((PH_BOOT == kind) && (0 == count) && (s_kind_count[PH_BOOT] > 0))
+        {
+            // one boot per process, it is out of the history by now
+            min_ms = max_ms = s_boot.total_ms;
+            sum_ms = s_boot.total_ms;
+            count = 1;
+        }
+        const int n = snprintf(p_buf + len, p_buflen - len, "summary %s version=%s cycles=%u kept=%u min_ms=%u avg_ms=%u max_ms=%u\n",
+                               s_kind_names[kind], APP_VERSION, s_kind_count[kind], count, min_ms,
+                               ((count > 0) ? (uint32_t)(sum_ms / count) : 0), max_ms);
+        if(n < 0)
+        {
+            break;
+        }
+        len = (((len + n) < p_buflen) ? (len + n) : (p_buflen - 1));
+    }
+
+    return(len);
+}
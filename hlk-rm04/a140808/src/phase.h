@@ -0,0 +1,85 @@
+//
+// Copyright 2015-2017 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its 
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including, 
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR 
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any 
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#ifndef __phase_h__
+#define __phase_h__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+
+//
+// where boot and reconnect time goes
+//
+// a cycle starts with ph_begin(), each ph_mark() charges the time since
+// the previous mark to a phase (repeated marks add up, so the failed
+// attempts of a reconnect are counted too) and ph_end() logs the cycle
+// as one line of key=value pairs. the last PH_HISTORY cycles are kept
+// for ph_summary(), served on QUERY_SOCKET_FILEPATH.
+//
+// main thread only, the tls wrapper marks from inside the sdk's connect
+//
+#define PH_HISTORY     8
+
+enum ph_phase
+{
+    PH_ARGS = 0,       // parse_args() and the option checks
+    PH_PID_FILE,
+    PH_BOARDS,         // mp_init() and the avr sync requests
+    PH_IP_WAIT,
+    PH_CREDENTIALS,    // tls_load_credentials()
+    PH_SHADOW_INIT,    // outbox and aws_iot_shadow_init()
+    PH_WAIT,           // up to the tcp connect, the sdk's backoff when reconnecting
+    PH_TCP,            // dns and tcp connect
+    PH_TLS,            // rng seed, tls config and handshake
+    PH_MQTT,           // mqtt connect, and the resubscribe when reconnecting
+    PH_AUTORECONNECT,  // aws_iot_shadow_set_autoreconnect_status()
+    PH_SUBSCRIBE,      // each thing's delta and pulse topics
+    PH_REPORT,         // the boards' first reports
+    PH_COUNT
+};
+
+enum ph_kind
+{
+    PH_BOOT = 0,
+    PH_RECONNECT,
+    PH_KIND_COUNT
+};
+
+struct ph_cycle
+{
+    uint32_t seq;          // cycles since the process started, from 1
+    uint8_t  kind;         // enum ph_kind
+    uint8_t  attempts;     // tcp connects tried
+    uint64_t start_ms;     // CLOCK_MONOTONIC
+    uint32_t total_ms;
+    uint32_t ms[PH_COUNT];
+};
+
+
+void ph_begin(const uint8_t p_kind);
+void ph_mark(const uint8_t p_phase);
+void ph_attempt(void);
+void ph_end(void);
+bool ph_active(void);
+size_t ph_format(const struct ph_cycle* p_cycle, char* p_buf, const size_t p_buflen);
+size_t ph_summary(char* p_buf, const size_t p_buflen);
+
+
+#endif // __phase_h__
@@ -0,0 +1,103 @@
+//
+// Copyright 2015-2017 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its 
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including, 
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR 
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any 
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "log.h"
+#include "phase.h"
+#include "query.h"
+
+#define QS_REPLY_SIZE  4096
+
+
+////////////////////////////////////////
+// returns the listening socket to poll for POLLIN, or -1
+int qs_open(const char* p_path)
+{
+    struct sockaddr_un sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    if(strlen(p_path) >= sizeof(sa.sun_path))
+    {
+        log_error("qs_open: socket path too long: [%s]", p_path);
+        return(-1);
+    }
+    strcpy(sa.sun_path, p_path);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0)
+    {
+        log_error("qs_open:socket, err: [%s]", strerror(errno));
+        return(-1);
+    }
+
+    // left behind by a run that did not exit cleanly
+    unlink(p_path);
+    if((bind(fd, (struct sockaddr*)&sa, sizeof(sa)) < 0) || (listen(fd, 4) < 0))
+    {
+        log_error("qs_open: [%s], err: [%s]", p_path, strerror(errno));
+        close(fd);
+        return(-1);
+    }
+
+    return(fd);
+}
+
+
+////////////////////////////////////////
+void qs_close(const int p_fd, const char* p_path)
+{
+    if(p_fd > -1)
+    {
+        close(p_fd);
+        unlink(p_path);
+    }
+}
+
+
+////////////////////////////////////////
+// answer every waiting client, the reply fits the socket buffer so a
+// slow reader cannot stall the main loop
+void qs_serve(const int p_fd)
+{
+    static char reply[QS_REPLY_SIZE];
+
+    for(;;)
+    {
+        const int cfd = accept(p_fd, NULL, NULL);
+        if(cfd < 0)
+        {
+            if((EAGAIN != errno) && (EWOULDBLOCK != errno) && (EINTR != errno))
+            {
+                log_warn("qs_serve:accept, err: [%s]", strerror(errno));
+            }
+            return;
+        }
+
+        const size_t len = ph_summary(reply, sizeof(reply));
+        if(send(cfd, reply, len, MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+        {
+            log_warn("qs_serve:send, err: [%s]", strerror(errno));
+        }
+        close(cfd);
+    }
+}
@@ -0,0 +1,36 @@
+//
+// Copyright 2015-2017 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its 
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including, 
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR 
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any 
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#ifndef __query_h__
+#define __query_h__
+
+
+//
+// local status query, a unix stream socket that writes the phase
+// timing summary (see phase.h) to each client and closes:
+//
+//   nc -U /var/run/a140808.sock
+//
+// polled from the main loop, qs_serve() never blocks
+//
+int qs_open(const char* p_path);
+void qs_close(const int p_fd, const char* p_path);
+void qs_serve(const int p_fd);
+
+
+#endif // __query_h__
@@ -0,0 +1,122 @@
+//
+// Copyright 2015-2017 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its 
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including, 
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR 
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any 
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#ifndef __report_gate_h__
+#define __report_gate_h__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+//
+// when a board's state may be reported, kept apart from the sdk so the
+// host benches run the same rule as aws_iot_shadow.c
+//
+// nothing is reported until the avr has answered both subscriptions.
+// the first input answer is the state, not an edge, and is due at once,
+// the first output answer releases an input report waiting on it. later
+// input changes open a coalesce window and only the value at its end is
+// reported, so a burst of edges costs one shadow update.
+//
+// times are CLOCK_MONOTONIC ms
+//
+struct report_gate
+{
+    bool     input_known;    // the avr has answered the subscriptions
+    bool     output_known;
+    bool     input_pending;  // an input report is waiting for input_due_ms
+    uint64_t input_due_ms;
+};
+
+
+////////////////////////////////////////
+static inline void rg_init(struct report_gate* p_rg)
+{
+    p_rg->input_known = false;
+    p_rg->output_known = false;
+    p_rg->input_pending = false;
+    p_rg->input_due_ms = 0;
+}
+
+////////////////////////////////////////
+// the avr reported its inputs
+static inline void rg_input(struct report_gate* p_rg, const uint64_t p_now, const uint32_t p_coalesceMs)
+{
+    if(!p_rg->input_known)
+    {
+        p_rg->input_pending = true;
+        p_rg->input_due_ms = p_now;
+    }
+    else if(!p_rg->input_pending)
+    {
+        p_rg->input_pending = true;
+        p_rg->input_due_ms = (p_now + p_coalesceMs);
+    }
+    p_rg->input_known = true;
+}
+
+////////////////////////////////////////
+// the avr reported its outputs
+static inline void rg_output(struct report_gate* p_rg, const uint64_t p_now)
+{
+    if(!p_rg->output_known && p_rg->input_pending)
+    {
+        p_rg->input_due_ms = p_now;
+    }
+    p_rg->output_known = true;
+}
+
+////////////////////////////////////////
+// both answers are in, a report carries real bits
+static inline bool rg_known(const struct report_gate* p_rg)
+{
+    return(p_rg->input_known && p_rg->output_known);
+}
+
+////////////////////////////////////////
+// ms until the input report is due, 0 if it is, -1 if none is waiting
+static inline int rg_wait_ms(const struct report_gate* p_rg, const uint64_t p_now)
+{
+    if(!p_rg->input_pending)
+    {
+        return(-1);
+    }
+    return((p_rg->input_due_ms > p_now) ? (int)(p_rg->input_due_ms - p_now) : 0);
+}
+
+////////////////////////////////////////
+// true and no longer pending if the input report is due
+static inline bool rg_take(struct report_gate* p_rg, const uint64_t p_now)
+{
+    if(!p_rg->input_pending || (p_rg->input_due_ms > p_now))
+    {
+        return(false);
+    }
+    p_rg->input_pending = false;
+    return(true);
+}
+
+////////////////////////////////////////
+// a taken report that could not go out, try again in p_ms
+static inline void rg_defer(struct report_gate* p_rg, const uint64_t p_now, const uint32_t p_ms)
+{
+    p_rg->input_pending = true;
+    p_rg->input_due_ms = (p_now + p_ms);
+}
+
+#endif // __report_gate_h__
@@ -22,39 +22,60 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "log.h"
 #include "util.h"
 
 
+//
+// single producer, single consumer ring buffer, port of avr/src/ring_buffer.h
+//
+// the producer only writes head and the consumer only writes tail, so a
+// producer thread and a consumer thread never share a read-modify-write.
+// both indexes run freely and wrap naturally, the slot is the index
+// masked by the capacity, which rb_init() rounds up to a power of two.
+//
+// producer side: rb_push_back(), rb_set_data()
+// consumer side: rb_pop_front(), rb_get_data(), rb_peek(), rb_consume(),
+//                rb_at(), rb_clear()
+//
 struct ring_buf_data
 {
     uint8_t* buff;   // the internal buffer used for storing elements in the ring buffer
-    uint8_t* end;    // the internal buffer's end (end of the storage space)
-    uint8_t* first;  // the virtual beginning of the ring buffer
-    uint8_t* last;   // the virtual end of the ring buffer (one behind the last element)
-    uint8_t  size;   // the number of items currently stored in the ring buffer
+    uint32_t mask;   // capacity - 1
+    uint32_t head;   // producer index, one past the newest item
+    uint32_t tail;   // consumer index, the oldest item
 };
 
+// acquire loads pair with release stores on the other side, the item is
+// always written before the index that publishes it
+#define RB_LOAD(p)      __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define RB_STORE(p, v)  __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
 
 ////////////////////////////////////////
-static inline bool rb_init(struct ring_buf_data* p_pd, const uint8_t p_capacity)
+static inline bool rb_init(struct ring_buf_data* p_pd, const uint32_t p_capacity)
 {
-    p_pd->end = 0;
-    p_pd->first = 0;
-    p_pd->last = 0;
-    p_pd->size = 0;
+    p_pd->mask = 0;
+    p_pd->head = 0;
+    p_pd->tail = 0;
+
+    // round up to a power of two
+    uint32_t capacity = 1;
+    while(capacity < p_capacity)
+    {
+        capacity <<= 1;
+    }
 
-    p_pd->buff = (uint8_t*)malloc(p_capacity);
+    p_pd->buff = (uint8_t*)malloc(capacity);
     if(0 == p_pd->buff)
     {
         // critical error
-        log_error("malloc failed for capacity: [%d]", p_capacity);
+        log_error("malloc failed for capacity: [%u]", capacity);
         return(false);
     }
-
-    p_pd->end = (p_pd->buff + p_capacity);
-    p_pd->first = p_pd->last = p_pd->buff;
+    p_pd->mask = (capacity - 1);
 
     return(true);
 }
@@ -62,10 +83,9 @@ static inline bool rb_init(struct ring_buf_data* p_pd, const uint8_t p_capacity)
 ////////////////////////////////////////
 static inline void rb_free(struct ring_buf_data* p_pd)
 {
-    p_pd->end = 0;
-    p_pd->first = 0;
-    p_pd->last = 0;
-    p_pd->size = 0;
+    p_pd->mask = 0;
+    p_pd->head = 0;
+    p_pd->tail = 0;
 
     if(0 != p_pd->buff)
     {
@@ -75,128 +95,125 @@ static inline void rb_free(struct ring_buf_data* p_pd)
 }
 
 ////////////////////////////////////////
+// consumer side, drops everything currently buffered
 static inline void rb_clear(struct ring_buf_data* p_pd)
 {
-    p_pd->first = p_pd->last = p_pd->buff;
-    p_pd->size = 0;
+    RB_STORE(&p_pd->tail, RB_LOAD(&p_pd->head));
 }
 
 ////////////////////////////////////////
-static inline uint8_t rb_size(struct ring_buf_data* p_pd)
+static inline uint32_t rb_size(struct ring_buf_data* p_pd)
 {
-    return(p_pd->size);
+    return(RB_LOAD(&p_pd->head) - RB_LOAD(&p_pd->tail));
 }
 
 ////////////////////////////////////////
 static inline bool rb_empty(struct ring_buf_data* p_pd)
 {
-    return(p_pd->size < 1);
+    return(RB_LOAD(&p_pd->head) == RB_LOAD(&p_pd->tail));
 }
 
 ////////////////////////////////////////
-static inline uint8_t rb_capacity(struct ring_buf_data* p_pd)
+static inline uint32_t rb_capacity(struct ring_buf_data* p_pd)
 {
-    return(p_pd->end - p_pd->buff);
+    return((0 == p_pd->buff) ? 0 : (p_pd->mask + 1));
 }
 
 ////////////////////////////////////////
 static inline bool rb_full(struct ring_buf_data* p_pd)
 {
-    return(rb_capacity(p_pd) == p_pd->size);
+    return(rb_capacity(p_pd) == rb_size(p_pd));
 }
 
 ////////////////////////////////////////
-static inline void rb_push_back(struct ring_buf_data* p_pd, const uint8_t p_item)
+// returns false and drops the item if the buffer is full
+static inline bool rb_push_back(struct ring_buf_data* p_pd, const uint8_t p_item)
 {
-    if(rb_full(p_pd))
-    {
-        if(rb_empty(p_pd))
-        {
-            return;  // no capacity
-        }
-        *p_pd->last = p_item;
-        // increment
-        if(++p_pd->last == p_pd->end) p_pd->last = p_pd->buff;
-        p_pd->first = p_pd->last;
-    }
-    else
+    const uint32_t head = p_pd->head;
+    if(rb_capacity(p_pd) == (head - RB_LOAD(&p_pd->tail)))
     {
-        *p_pd->last = p_item;
-        // increment
-        if(++p_pd->last == p_pd->end) p_pd->last = p_pd->buff;
-        ++p_pd->size;
+        return(false);
     }
+    p_pd->buff[head & p_pd->mask] = p_item;
+    RB_STORE(&p_pd->head, head + 1);
+    return(true);
 }
 
 ////////////////////////////////////////
 static inline uint8_t rb_pop_front(struct ring_buf_data* p_pd)
 {
-    if(rb_empty(p_pd))
+    const uint32_t tail = p_pd->tail;
+    if(RB_LOAD(&p_pd->head) == tail)
     {
         return(0); // error (or no such data)
     }
-    const uint8_t item = *p_pd->first;
-    // increment
-    if(++p_pd->first == p_pd->end) p_pd->first = p_pd->buff;
-    --p_pd->size;
+    const uint8_t item = p_pd->buff[tail & p_pd->mask];
+    RB_STORE(&p_pd->tail, tail + 1);
     return(item);
 }
 
 ////////////////////////////////////////
-static inline uint8_t rb_pop_back(struct ring_buf_data* p_pd)
+// points p_data at the oldest items and returns how many of them are
+// contiguous, call rb_consume() once they have been used
+static inline uint32_t rb_peek(struct ring_buf_data* p_pd, const uint8_t** p_data)
 {
-    if(rb_empty(p_pd))
-    {
-        return(0); // error (or no such data)
-    }
-    // decrement
-    if(p_pd->last == p_pd->buff) p_pd->last = p_pd->end;
-    --p_pd->last;
+    const uint32_t tail = p_pd->tail;
+    const uint32_t avail = (RB_LOAD(&p_pd->head) - tail);
+    const uint32_t toEnd = (rb_capacity(p_pd) - (tail & p_pd->mask));
+    *p_data = &p_pd->buff[tail & p_pd->mask];
+    return(min(avail, toEnd));
+}
 
-    --p_pd->size;
-    return(*p_pd->last);
+////////////////////////////////////////
+static inline void rb_consume(struct ring_buf_data* p_pd, const uint32_t p_count)
+{
+    RB_STORE(&p_pd->tail, p_pd->tail + p_count);
 }
 
 ////////////////////////////////////////
-static inline uint8_t rb_at(struct ring_buf_data* p_pd, const uint8_t p_index)
+static inline uint8_t rb_at(struct ring_buf_data* p_pd, const uint32_t p_index)
 {
-    if(p_index >= p_pd->size)
+    if(p_index >= rb_size(p_pd))
     {
         return(0); // error
     }
-
-    if(p_index < (p_pd->end - p_pd->first))
-    {
-        return(*(p_pd->first + p_index));
-    }
-    return(*(p_pd->first + (p_index - rb_capacity(p_pd))));
+    return(p_pd->buff[(p_pd->tail + p_index) & p_pd->mask]);
 }
 
 ////////////////////////////////////////
-static inline void rb_set_data(struct ring_buf_data* p_pd, const void* p_data, const uint8_t p_len)
+// bulk push, returns the number of bytes copied in (will ignore overflow)
+static inline uint32_t rb_set_data(struct ring_buf_data* p_pd, const void* p_data, const uint32_t p_len)
 {
     const uint8_t* pdata = (const uint8_t*)p_data;
+    const uint32_t head = p_pd->head;
+    const uint32_t room = (rb_capacity(p_pd) - (head - RB_LOAD(&p_pd->tail)));
+    const uint32_t len = min(p_len, room);
 
-    // copy the whole buffer (will ignore overflow)
-    for(uint8_t i=0; i<p_len; ++i)
-    {
-        const uint8_t b = pdata[i];
-        rb_push_back(p_pd, b);
-    }
+    // at most two spans, up to the end of the buffer and from the start
+    const uint32_t slot = (head & p_pd->mask);
+    const uint32_t first = min(len, rb_capacity(p_pd) - slot);
+    memcpy(&p_pd->buff[slot], pdata, first);
+    memcpy(p_pd->buff, pdata + first, len - first);
+
+    RB_STORE(&p_pd->head, head + len);
+    return(len);
 }
 
 ////////////////////////////////////////
-static inline uint8_t rb_get_data(struct ring_buf_data* p_pd, void* p_data, const uint8_t p_len)
+// bulk pop, returns the number of bytes copied out
+static inline uint32_t rb_get_data(struct ring_buf_data* p_pd, void* p_data, const uint32_t p_len)
 {
     uint8_t* pdata = (uint8_t*)p_data;
+    const uint32_t tail = p_pd->tail;
+    const uint32_t len = min(RB_LOAD(&p_pd->head) - tail, p_len);
 
-    // copy as much as we can
-    const uint8_t len = min(p_pd->size, p_len);
-    for(uint8_t i=0; i<len; ++i)
-    {
-        pdata[i] = rb_pop_front(p_pd);
-    }
+    // at most two spans, up to the end of the buffer and from the start
+    const uint32_t slot = (tail & p_pd->mask);
+    const uint32_t first = min(len, rb_capacity(p_pd) - slot);
+    memcpy(pdata, &p_pd->buff[slot], first);
+    memcpy(pdata + first, p_pd->buff, len - first);
 
+    RB_STORE(&p_pd->tail, tail + len);
     return(len);
 }
 
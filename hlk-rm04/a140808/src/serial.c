@@ -17,6 +17,8 @@
 //
 
 #include <stdio.h>
+#include <errno.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -27,19 +29,21 @@
 #include "util.h"
 #include "serial.h"
 
-static int s_fd = -1;
+#define SP_TX_TIMEOUT   1000  // ms to wait for the port to drain
+
+static bool sp_flush(struct sp_context* p_sp);
 
 speed_t sp_parse_baudrate(uint32_t p_requested);
 
 
 ////////////////////////////////////////
-// p_device: ignored
+// p_sp must be zeroed with fd set to -1 before the first sp_init()
 // p_parity
 //   false: N81 (none, 8 data, 1 stop)
 //   true:  E71 (even, 7 data, 1 stop)
-bool sp_init(const char* p_device, const uint16_t p_baud, const bool p_parity)
+bool sp_init(struct sp_context* p_sp, const char* p_device, const uint16_t p_baud, const bool p_parity)
 {
-    sp_close();
+    sp_close(p_sp);
     log_info("opening %s at %d baud, %s", p_device, p_baud, (p_parity ? "E71" : "N81"));
 
     const speed_t baudrate = sp_parse_baudrate(p_baud);
@@ -50,8 +54,8 @@ bool sp_init(const char* p_device, const uint16_t p_baud, const bool p_parity)
     }
 
     // open serial device for reading and writing and not as controlling tty so we don't get killed by CTRL-C
-    s_fd = open(p_device, O_RDWR | O_NOCTTY | O_NDELAY);
-    if(s_fd < 0)
+    p_sp->fd = open(p_device, O_RDWR | O_NOCTTY | O_NDELAY);
+    if(p_sp->fd < 0)
     {
         log_error("failed to open device: %s", p_device);
         return(false);
@@ -77,34 +81,119 @@ bool sp_init(const char* p_device, const uint16_t p_baud, const bool p_parity)
     // local modes
     tio.c_lflag = 0;
 
+    // reads return whatever is buffered without waiting, the caller polls the fd
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+
     // clean the modem line and activate the settings for the port
-    tcflush(s_fd, TCIOFLUSH);
-    tcsetattr(s_fd, TCSANOW, &tio);
+    tcflush(p_sp->fd, TCIOFLUSH);
+    tcsetattr(p_sp->fd, TCSANOW, &tio);
 
     return(true);
 }
 
 ////////////////////////////////////////
-void sp_close(void)
+void sp_close(struct sp_context* p_sp)
 {
-    if(s_fd > -1)
+    if(p_sp->fd > -1)
+    {
+        sp_flush(p_sp);
+    }
+    p_sp->tx_len = 0;
+    p_sp->tx_batch = 0;
+
+    if(p_sp->fd > -1)
     {
-        close(s_fd);
-        s_fd = -1;
+        close(p_sp->fd);
+        p_sp->fd = -1;
     }
+    p_sp->rx_pos = 0;
+    p_sp->rx_len = 0;
+}
+
+////////////////////////////////////////
+int sp_get_fd(struct sp_context* p_sp)
+{
+    return(p_sp->fd);
 }
 
 ////////////////////////////////////////
-bool sp_read(struct ring_buf_data* p_pd)
+// change the frame format without touching the baud rate
+// p_parity
+//   false: N81 (none, 8 data, 1 stop)
+//   true:  E71 (even, 7 data, 1 stop)
+bool sp_set_parity(struct sp_context* p_sp, const bool p_parity)
+{
+    log_info("switching serial port to %s", (p_parity ? "E71" : "N81"));
+
+    // let the last frame (usually the framing ack) go out in the old format
+    sp_flush(p_sp);
+    tcdrain(p_sp->fd);
+
+    struct termios tio;
+    if(0 != tcgetattr(p_sp->fd, &tio))
+    {
+        log_error("failed to read serial port settings");
+        return(false);
+    }
+
+    tio.c_cflag &= ~(CSIZE | PARENB);
+    if(p_parity)
+    {
+        tio.c_cflag |= (CS7 | PARENB);
+    }
+    else
+    {
+        tio.c_cflag |= CS8;
+    }
+
+    if(0 != tcsetattr(p_sp->fd, TCSANOW, &tio))
+    {
+        log_error("failed to apply serial port settings");
+        return(false);
+    }
+    return(true);
+}
+
+////////////////////////////////////////
+// drop what has been read but not parsed yet. the driver buffer is left
+// alone, it may already hold frames sent in the new framing and the
+// parser discards the stale bytes in front of them
+void sp_purge(struct sp_context* p_sp)
+{
+    p_sp->rx_pos = 0;
+    p_sp->rx_len = 0;
+}
+
+////////////////////////////////////////
+// returns true when a frame is complete, call again until it returns
+// false to drain everything that has been read
+bool sp_read(struct sp_context* p_sp, struct msg_parser_data* p_pd)
 {
     for(;;)
     {
-        uint8_t val = 0;
-        const ssize_t bytesRead = read(s_fd, &val, 1);
+        while(p_sp->rx_pos < p_sp->rx_len)
+        {
+            if(S_OK == pr_push(p_pd, p_sp->rx_buf[p_sp->rx_pos++]))
+            {
+                // have a message
+                return(true);
+            }
+        }
+
+        const ssize_t bytesRead = read(p_sp->fd, p_sp->rx_buf, sizeof(p_sp->rx_buf));
+        p_sp->rx_pos = 0;
+        p_sp->rx_len = 0;
         if(bytesRead < 0)
         {
+            if((EAGAIN == errno) || (EWOULDBLOCK == errno) || (EINTR == errno))
+            {
+                // no data available
+                break;
+            }
+
             // error
-            log_error("serial read error");
+            log_error("serial read error: %d", errno);
             return(false);
         }
 
@@ -113,21 +202,15 @@ bool sp_read(struct ring_buf_data* p_pd)
             // no data available
             break;
         }
-
-        rb_push_back(p_pd, val);
-        if(S_OK == mb_validate(p_pd))
-        {
-            // have a message
-            return(true);
-        }
+        p_sp->rx_len = (size_t)bytesRead;
     }
     return(false);
 }
 
 ////////////////////////////////////////
-bool sp_write(struct ring_buf_data* p_pd)
+// queue a frame, it is sent right away unless a batch is open
+bool sp_write(struct sp_context* p_sp, struct ring_buf_data* p_pd)
 {
-    log_debug("sp_write");
     if(S_OK != mb_validate(p_pd))
     {
         // message is not valid
@@ -135,27 +218,112 @@ bool sp_write(struct ring_buf_data* p_pd)
         return(false);
     }
 
-    log_debug("send: -->");
-    for(uint8_t i=0, imax=rb_size(p_pd); i<imax; ++i)
+    // room for the frame plus the trailing newline
+    const uint8_t frameLen = rb_size(p_pd);
+    if((p_sp->tx_len + frameLen + 1) > sizeof(p_sp->tx_buf))
     {
-        const uint8_t val = rb_at(p_pd, i);
-        const ssize_t bytesWritten = write(s_fd, &val, 1);
-        if(1 != bytesWritten)
+        if(!sp_flush(p_sp))
         {
-            // error
-            log_error("serial write error");
             return(false);
         }
-        log_debug("%c", val);
     }
-    log_debug("<--");
 
-    // TODO: bug in atmega32 code requires an extra byte to be sent for now
-    write(s_fd, "\n", 1);
+    uint8_t* frame = &p_sp->tx_buf[p_sp->tx_len];
+    for(uint8_t i=0; i<frameLen; ++i)
+    {
+        frame[i] = rb_at(p_pd, i);
+    }
+    p_sp->tx_len += frameLen;
+
+    if(MSG_END_CHAR == frame[frameLen - 1])
+    {
+        log_debug("send: %.*s", frameLen, (const char*)frame);
+
+        // TODO: bug in atmega32 code requires an extra byte to be sent for now
+        // binary frames end with SLIP_END, which the avr side already treats
+        // as a frame boundary
+        p_sp->tx_buf[p_sp->tx_len++] = '\n';
+    }
+    else
+    {
+        log_debug("send: %d byte binary frame", frameLen);
+    }
+    __atomic_fetch_add(&p_sp->stats.tx_frames, 1, __ATOMIC_RELAXED);
 
+    if(0 == p_sp->tx_batch)
+    {
+        return(sp_flush(p_sp));
+    }
     return(true);
 }
 
+////////////////////////////////////////
+// hold frames written by sp_write() until the matching sp_end_batch(),
+// batches nest
+void sp_begin_batch(struct sp_context* p_sp)
+{
+    ++p_sp->tx_batch;
+}
+
+////////////////////////////////////////
+bool sp_end_batch(struct sp_context* p_sp)
+{
+    if(p_sp->tx_batch > 0)
+    {
+        --p_sp->tx_batch;
+    }
+    return((0 == p_sp->tx_batch) ? sp_flush(p_sp) : true);
+}
+
+////////////////////////////////////////
+void sp_get_stats(struct sp_context* p_sp, struct sp_stats* p_stats)
+{
+    // written by the serial thread
+    p_stats->tx_frames = __atomic_load_n(&p_sp->stats.tx_frames, __ATOMIC_RELAXED);
+    p_stats->tx_syscalls = __atomic_load_n(&p_sp->stats.tx_syscalls, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////
+// send everything queued by sp_write(), picking up after partial writes
+// and waiting for the port when the driver buffer is full
+static bool sp_flush(struct sp_context* p_sp)
+{
+    size_t sent = 0;
+    while(sent < p_sp->tx_len)
+    {
+        const ssize_t bytesWritten = write(p_sp->fd, &p_sp->tx_buf[sent], (p_sp->tx_len - sent));
+        __atomic_fetch_add(&p_sp->stats.tx_syscalls, 1, __ATOMIC_RELAXED);
+        if(bytesWritten > 0)
+        {
+            sent += (size_t)bytesWritten;
+            continue;
+        }
+
+        if((bytesWritten < 0) && (EINTR == errno))
+        {
+            continue;
+        }
+        if((bytesWritten < 0) && (EAGAIN != errno) && (EWOULDBLOCK != errno))
+        {
+            // error
+            log_error("serial write error: %d", errno);
+            break;
+        }
+
+        // driver buffer is full, wait for room
+        struct pollfd pfd = { .fd = p_sp->fd, .events = POLLOUT };
+        if(poll(&pfd, 1, SP_TX_TIMEOUT) <= 0)
+        {
+            log_error("serial write timed out");
+            break;
+        }
+    }
+
+    const bool ok = (sent == p_sp->tx_len);
+    p_sp->tx_len = 0;
+    return(ok);
+}
+
 
 ////////////////////////////////////////
 speed_t sp_parse_baudrate(uint32_t p_requested)
@@ -24,11 +24,47 @@
 
 #include "ring_buf.h"
 #include "msg_buf.h"
+#include "msg_parser.h"
 
 
-bool sp_init(const char* p_device, const uint16_t p_baud, const bool p_parity);
-void sp_close(void);
-bool sp_read(struct ring_buf_data* p_pd);
-bool sp_write(struct ring_buf_data* p_pd);
+struct sp_stats
+{
+    uint32_t tx_frames;    // frames passed to sp_write()
+    uint32_t tx_syscalls;  // write() calls used to send them
+};
+
+#define SP_RX_BUF_SIZE  256
+#define SP_TX_BUF_SIZE  512
+
+// one per serial port
+struct sp_context
+{
+    int fd;
+
+    // bytes are read in bulk and fed to the parser from here, anything
+    // left after a complete frame is kept for the next sp_read()
+    uint8_t rx_buf[SP_RX_BUF_SIZE];
+    size_t rx_pos;
+    size_t rx_len;
+
+    // frames are encoded here and sent with one write(), between
+    // sp_begin_batch() and sp_end_batch() several frames share that write
+    uint8_t tx_buf[SP_TX_BUF_SIZE];
+    size_t tx_len;
+    uint8_t tx_batch;
+
+    struct sp_stats stats;
+};
+
+bool sp_init(struct sp_context* p_sp, const char* p_device, const uint16_t p_baud, const bool p_parity);
+void sp_close(struct sp_context* p_sp);
+bool sp_set_parity(struct sp_context* p_sp, const bool p_parity);
+void sp_purge(struct sp_context* p_sp);
+int sp_get_fd(struct sp_context* p_sp);
+bool sp_read(struct sp_context* p_sp, struct msg_parser_data* p_pd);
+bool sp_write(struct sp_context* p_sp, struct ring_buf_data* p_pd);
+void sp_begin_batch(struct sp_context* p_sp);
+bool sp_end_batch(struct sp_context* p_sp);
+void sp_get_stats(struct sp_context* p_sp, struct sp_stats* p_stats);
 
 #endif // __serial_port_h__
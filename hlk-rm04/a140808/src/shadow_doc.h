@@ -0,0 +1,150 @@
+//
+// Copyright 2015-2017 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its 
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including, 
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR 
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any 
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#ifndef __shadow_doc_h__
+#define __shadow_doc_h__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+
+//
+// reported shadow document for a board, the whole state is two 8 bit
+// masks so every report has the same shape:
+//
+//   {"state":{"reported":{"i0":0,...,"i7":0,"o0":0,...,"o7":0}},"clientToken":"<thing>-00000000"}
+//
+// the document is rendered once by sd_init(). sd_render() then patches
+// the digits of the bits that changed since the last render and the
+// hex sequence at the end of the client token, the length never
+// changes. every report carries the full state, so a lost or rejected
+// update is repaired by the next one.
+//
+#define SD_DOC_SIZE       192
+#define SD_KEY_STRIDE     7   // "i0":0,
+#define SD_TOKEN_DIGITS   8
+
+struct shadow_doc
+{
+    char     buf[SD_DOC_SIZE];
+    uint16_t len;
+    uint16_t input_pos;   // digit of "i0"
+    uint16_t output_pos;  // digit of "o0"
+    uint16_t token_pos;   // first digit of the sequence
+    uint8_t  inputs;      // values rendered in buf
+    uint8_t  outputs;
+    uint32_t seq;         // client token sequence
+};
+
+
+////////////////////////////////////////
+// p_tokenPrefix keeps the client tokens of different things apart,
+// false if it does not fit
+static inline bool sd_init(struct shadow_doc* p_sd, const char* p_tokenPrefix)
+{
+    static const char head[] = "{\"state\":{\"reported\":{";
+    static const char tail[] = "}},\"clientToken\":\"";
+
+    size_t len = 0;
+    memcpy(p_sd->buf, head, sizeof(head) - 1);
+    len += (sizeof(head) - 1);
+    for(uint8_t key=0; key<16; ++key)
+    {
+        char* pkey = &p_sd->buf[len];
+        pkey[0] = '"';
+        pkey[1] = ((key < 8) ? 'i' : 'o');
+        pkey[2] = ('0' + (key & 0x07));
+        pkey[3] = '"';
+        pkey[4] = ':';
+        pkey[5] = '0';
+        pkey[6] = ',';
+        len += SD_KEY_STRIDE;
+    }
+    --len;  // no comma after o7
+
+    const size_t prefix_len = strlen(p_tokenPrefix);
+    if((len + (sizeof(tail) - 1) + prefix_len + 1 + SD_TOKEN_DIGITS + 3) > sizeof(p_sd->buf))
+    {
+        return(false);
+    }
+    memcpy(&p_sd->buf[len], tail, sizeof(tail) - 1);
+    len += (sizeof(tail) - 1);
+    memcpy(&p_sd->buf[len], p_tokenPrefix, prefix_len);
+    len += prefix_len;
+    p_sd->buf[len++] = '-';
+    p_sd->token_pos = len;
+    memset(&p_sd->buf[len], '0', SD_TOKEN_DIGITS);
+    len += SD_TOKEN_DIGITS;
+    p_sd->buf[len++] = '"';
+    p_sd->buf[len++] = '}';
+    p_sd->buf[len] = '\0';
+
+    p_sd->len = len;
+    p_sd->input_pos = ((sizeof(head) - 1) + 5);
+    p_sd->output_pos = (p_sd->input_pos + (8 * SD_KEY_STRIDE));
+    p_sd->inputs = 0;
+    p_sd->outputs = 0;
+    p_sd->seq = 0;
+    return(true);
+}
+
+////////////////////////////////////////
+static inline void sd_patch_bits(char* p_digits, const uint8_t p_vals, uint8_t p_changed)
+{
+    for(uint8_t bit=0; 0 != p_changed; ++bit, p_changed >>= 1)
+    {
+        if(0 != (p_changed & 0x01))
+        {
+            p_digits[bit * SD_KEY_STRIDE] = (((p_vals >> bit) & 0x01) ? '1' : '0');
+        }
+    }
+}
+
+////////////////////////////////////////
+// returns the null terminated document, sd_length() bytes long, with a
+// new client token
+static inline char* sd_render(struct shadow_doc* p_sd, const uint8_t p_inputs, const uint8_t p_outputs)
+{
+    sd_patch_bits(&p_sd->buf[p_sd->input_pos], p_inputs, (p_inputs ^ p_sd->inputs));
+    sd_patch_bits(&p_sd->buf[p_sd->output_pos], p_outputs, (p_outputs ^ p_sd->outputs));
+    p_sd->inputs = p_inputs;
+    p_sd->outputs = p_outputs;
+
+    // bump the hex sequence, only the nibbles that changed are written,
+    // usually just the last one
+    static const char hex[] = "0123456789abcdef";
+    uint32_t changed = (p_sd->seq ^ (p_sd->seq + 1));
+    uint32_t seq = ++p_sd->seq;
+    char* pdigit = &p_sd->buf[p_sd->token_pos + SD_TOKEN_DIGITS - 1];
+    for(; 0 != changed; changed >>= 4, seq >>= 4)
+    {
+        *pdigit-- = hex[seq & 0x0f];
+    }
+
+    return(p_sd->buf);
+}
+
+////////////////////////////////////////
+static inline uint16_t sd_length(const struct shadow_doc* p_sd)
+{
+    return(p_sd->len);
+}
+
+#endif // __shadow_doc_h__
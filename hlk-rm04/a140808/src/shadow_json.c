@@ -0,0 +1,305 @@
+//
+// Copyright 2015-2017 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its 
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including, 
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR 
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any 
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "aws_iot_config.h"
+
+#include <jsmn.h>
+#include <aws_iot_log.h>
+
+#include "delta_scan.h"
+#include "shadow_json.h"
+
+
+////////////////////////////////////////
+IoT_Error_t parse_json_delta(const char *json, uint32_t json_len,
+                             uint8_t *input_vals, uint8_t *input_mask,
+                             uint8_t *output_vals, uint8_t *output_mask)
+{
+    // the usual {"o1":1,...} shape is scanned without tokenizing
+    if(ds_scan_bits(json, json_len, input_vals, input_mask, output_vals, output_mask)) {
+        IOT_DEBUG("json doc: %.*s", json_len, json);
+        return(SUCCESS);
+    }
+
+    return(parse_json_delta_tokens(json, json_len, input_vals, input_mask, output_vals, output_mask));
+}
+
+
+////////////////////////////////////////
+IoT_Error_t parse_json_delta_tokens(const char *json, uint32_t json_len,
+                                    uint8_t *input_vals, uint8_t *input_mask,
+                                    uint8_t *output_vals, uint8_t *output_mask)
+{
+    *input_vals = 0;
+    *input_mask = 0;
+    *output_vals = 0;
+    *output_mask = 0;
+
+    jsmn_parser parser;
+    jsmn_init(&parser);
+
+    jsmntok_t tokens[MAX_JSON_TOKEN_EXPECTED];
+
+    int32_t token_count = jsmn_parse(&parser, json, json_len, tokens, sizeof(tokens) / sizeof(tokens[0]));
+    if(token_count < 0) {
+        IOT_ERROR("failed to parse json - rc: %d", token_count);
+        return(FAILURE);
+    }
+
+    jsmntok_t *tok = tokens;
+    if( (JSMN_ARRAY  != tok->type) &&
+        (JSMN_OBJECT != tok->type) ) {
+        IOT_ERROR("top-level json element must be an array or an object");
+        return(FAILURE);
+    }
+
+    IOT_DEBUG("json doc: %.*s", json_len, json);
+    IOT_DEBUG("token count: %d", token_count);
+
+    // the array/object should be in key:val form
+    // odd elements are keys, evens are values
+    //
+    // json doc: {"o1":0, "o3":0, "o5":1}
+    // token count: 7
+    // token 0) type: 1  range: 0 - 24  size: 3
+    // token 1) type: 3  range: 2 - 4  size: 1
+    // token 2) type: 4  range: 6 - 7  size: 0
+    // token 3) type: 3  range: 10 - 12  size: 1
+    // token 4) type: 4  range: 14 - 15  size: 0
+    // token 5) type: 3  range: 18 - 20  size: 1
+    // token 6) type: 4  range: 22 - 23  size: 0
+    const int kv_count = tok->size;
+    if((token_count-1) != (kv_count*2)) {
+        IOT_ERROR("json array/object not in key/value format");
+        return(FAILURE);
+    }
+
+    for(int i=0; i<kv_count; ++i) {
+        jsmntok_t *key = ++tok;
+        if(JSMN_STRING != key->type) {
+            IOT_ERROR("element is not a key");
+            return(FAILURE);
+        }
+
+        jsmntok_t *val = ++tok;
+        if(JSMN_PRIMITIVE != val->type) {
+            IOT_ERROR("value is not a primitive");
+            return(FAILURE);
+        }
+
+        const int key_len = (key->end - key->start);
+        if(2 != key_len) {
+            IOT_ERROR("key is not two chars");
+            return(FAILURE);
+        }
+
+        const int val_len = (val->end - val->start);
+        if(1 != val_len) {
+            IOT_ERROR("value is not one char");
+            return(FAILURE);
+        }
+
+        // look for input/output
+        const char op = json[key->start];
+        uint8_t bit_num = (json[key->start + 1] - '0');
+        if(bit_num > 7) {
+            IOT_WARN("skipping key [%.*s]", key_len, json+key->start);
+            continue;
+        }
+        uint8_t bit_val = (json[val->start]=='0' ? 0 : 1);
+        switch(op) {
+            case 'i':
+                IOT_DEBUG("found input num: %d val: %d", bit_num, bit_val);
+                *input_vals |= (bit_val << bit_num);
+                *input_mask |= (1 << bit_num);
+                break;
+            case 'o':
+                IOT_DEBUG("found output num: %d val: %d", bit_num, bit_val);
+                *output_vals |= (bit_val << bit_num);
+                *output_mask |= (1 << bit_num);
+                break;
+            default:
+                IOT_WARN("skipping key [%.*s]", key_len, json+key->start);
+                break;
+        }
+    }
+
+    return(SUCCESS);
+}
+
+
+////////////////////////////////////////
+// find the value of a top level key, true if it is an object
+bool find_json_object(const char *json, uint32_t json_len, const char *key,
+                      const char **obj, uint32_t *obj_len)
+{
+    if(ds_find_object(json, json_len, key, obj, obj_len)) {
+        return(true);
+    }
+
+    return(find_json_object_tokens(json, json_len, key, obj, obj_len));
+}
+
+
+////////////////////////////////////////
+bool find_json_object_tokens(const char *json, uint32_t json_len, const char *key,
+                             const char **obj, uint32_t *obj_len)
+{
+    jsmn_parser parser;
+    jsmn_init(&parser);
+
+    jsmntok_t tokens[MAX_JSON_TOKEN_EXPECTED];
+
+    int32_t token_count = jsmn_parse(&parser, json, json_len, tokens, sizeof(tokens) / sizeof(tokens[0]));
+    if((token_count < 1) || (JSMN_OBJECT != tokens[0].type)) {
+        IOT_ERROR("failed to parse json object - rc: %d", token_count);
+        return(false);
+    }
+
+    const int key_len = strlen(key);
+    int i = 1;
+    for(int kv=0; (kv < tokens[0].size) && ((i + 1) < token_count); ++kv) {
+        const jsmntok_t *k = &tokens[i];
+        const jsmntok_t *v = &tokens[i + 1];
+        if((JSMN_STRING == k->type) && (key_len == (k->end - k->start)) &&
+           (0 == strncmp(json + k->start, key, key_len))) {
+            if(JSMN_OBJECT != v->type) {
+                return(false);
+            }
+            *obj = (json + v->start);
+            *obj_len = (uint32_t)(v->end - v->start);
+            return(true);
+        }
+
+        // skip the value and everything nested in it
+        for(i += 2; (i < token_count) && (tokens[i].start < v->end); ++i);
+    }
+
+    return(false);
+}
+
+
+////////////////////////////////////////
+// {"p0":250,"p3":1000} pulses each bit for its own ms, a bit with no
+// width given ({"p0","p3"} or ["p0","p3"]) gets PULSE_DEFAULT_MS
+IoT_Error_t parse_json_pulses(const char *json, uint32_t json_len, uint8_t *pulse_bits, uint16_t *durations_ms)
+{
+    // the usual {"p0","p1"} shape is scanned without tokenizing
+    if(ds_scan_pulses(json, json_len, pulse_bits, durations_ms)) {
+        IOT_DEBUG("json doc: %.*s", json_len, json);
+        return(SUCCESS);
+    }
+
+    return(parse_json_pulses_tokens(json, json_len, pulse_bits, durations_ms));
+}
+
+
+////////////////////////////////////////
+IoT_Error_t parse_json_pulses_tokens(const char *json, uint32_t json_len, uint8_t *pulse_bits, uint16_t *durations_ms)
+{
+    *pulse_bits = 0;
+    memset(durations_ms, 0, 8 * sizeof(*durations_ms));
+
+    jsmn_parser parser;
+    jsmn_init(&parser);
+
+    // {"p0":65535,"p1":65535,"p2":65535,"p3":65535,"p4":65535,"p5":65535,"p6":65535,"p7":65535}
+    jsmntok_t tokens[17];  // do not expect more than 8 keys and 8 values plus the surrounding structure
+
+    int32_t token_count = jsmn_parse(&parser, json, json_len, tokens, sizeof(tokens) / sizeof(tokens[0]));
+    if(token_count < 0) {
+        IOT_ERROR("failed to parse json - rc: %d", token_count);
+        return(FAILURE);
+    }
+
+    jsmntok_t *tok = tokens;
+    if( (JSMN_ARRAY  != tok->type) &&
+        (JSMN_OBJECT != tok->type) ) {
+        IOT_ERROR("top-level json element must be an array or an object");
+        return(FAILURE);
+    }
+
+    IOT_DEBUG("json doc: %.*s", json_len, json);
+    IOT_DEBUG("token count: %d", token_count);
+
+    // only expecting pulse messages right now
+    const bool is_object = (JSMN_OBJECT == tok->type);
+    const int elem_count = tok->size;
+    if(elem_count > 8) {
+        IOT_ERROR("more than 8 outputs to pulse");
+        return(FAILURE);
+    }
+    jsmntok_t *end = (tokens + token_count);
+    for(int i=0; i<elem_count; ++i) {
+        jsmntok_t *elem = ++tok;
+        if((elem >= end) || (JSMN_STRING != elem->type)) {
+            IOT_ERROR("element is not a string");
+            return(FAILURE);
+        }
+
+        const int elem_len = (elem->end - elem->start);
+        if(2 != elem_len) {
+            IOT_ERROR("element is not two chars");
+            return(FAILURE);
+        }
+
+        const char op = json[elem->start];
+        if('p' != op) {
+            IOT_ERROR("operation is not 'p'");
+            return(FAILURE);
+        }
+        uint8_t bit_num = (json[elem->start + 1] - '0');
+        if(bit_num > 7) {
+            IOT_ERROR("no output %d to pulse", bit_num);
+            return(FAILURE);
+        }
+        *pulse_bits |= (1 << bit_num);
+        durations_ms[bit_num] = 0;
+
+        if(0 == elem->size) {
+            continue;
+        }
+
+        // "p0":250
+        jsmntok_t *val = ++tok;
+        if(!is_object || (val >= end) || (JSMN_PRIMITIVE != val->type)) {
+            IOT_ERROR("pulse width for output %d is not a number", bit_num);
+            return(FAILURE);
+        }
+        uint32_t ms = 0;
+        const int val_len = (val->end - val->start);
+        for(int c=0; c<val_len; ++c) {
+            const char ch = json[val->start + c];
+            if((ch < '0') || (ch > '9') || (c >= 5)) {
+                ms = 0;
+                break;
+            }
+            ms = ((ms * 10) + (ch - '0'));
+        }
+        if((0 == ms) || (ms > 0xffff)) {
+            IOT_ERROR("pulse width for output %d must be 1-65535ms", bit_num);
+            return(FAILURE);
+        }
+        durations_ms[bit_num] = (uint16_t)ms;
+    }
+
+    return(SUCCESS);
+}
@@ -0,0 +1,52 @@
+//
+// Copyright 2015-2017 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its 
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including, 
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR 
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any 
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+#ifndef __shadow_json_h__
+#define __shadow_json_h__
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <aws_iot_error.h>
+
+
+//
+// the json the bridge receives: delta "state" objects and pulse requests
+//
+// each function tries the single pass scanner in delta_scan.h first and
+// falls back to jsmn for anything it does not recognize. the *_tokens
+// versions are the jsmn path alone, the scanners are tested against them
+// (see test/delta_scan_test.c)
+//
+
+IoT_Error_t parse_json_delta(const char *json, uint32_t json_len,
+                             uint8_t *input_vals, uint8_t *input_mask,
+                             uint8_t *output_vals, uint8_t *output_mask);
+IoT_Error_t parse_json_delta_tokens(const char *json, uint32_t json_len,
+                                    uint8_t *input_vals, uint8_t *input_mask,
+                                    uint8_t *output_vals, uint8_t *output_mask);
+
+bool find_json_object(const char *json, uint32_t json_len, const char *key,
+                      const char **obj, uint32_t *obj_len);
+bool find_json_object_tokens(const char *json, uint32_t json_len, const char *key,
+                             const char **obj, uint32_t *obj_len);
+
+IoT_Error_t parse_json_pulses(const char *json, uint32_t json_len, uint8_t *pulse_bits, uint16_t *durations_ms);
+IoT_Error_t parse_json_pulses_tokens(const char *json, uint32_t json_len, uint8_t *pulse_bits, uint16_t *durations_ms);
+
+#endif // __shadow_json_h__
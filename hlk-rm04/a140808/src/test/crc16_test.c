@@ -0,0 +1,165 @@
+//
+// Copyright 2015-2017 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its 
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including, 
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR 
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any 
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "crc16.h"
+
+
+//
+// crc16.h checked bit for bit against the bitwise update_crc16 the tables
+// replaced, built once per variant: every byte from every starting crc,
+// then random buffers through crc16_update_block() at every alignment so
+// the slice4 head/tail split is covered. also prints the time per 8 char
+// frame payload on this host
+//
+
+static int s_failures = 0;
+
+#define CHECK(cond) do { if(!(cond)) { printf("FAIL: %s %d - %s\n", __FILE__, __LINE__, #cond); ++s_failures; } } while(0)
+
+
+////////////////////////////////////////
+// mb_update_crc16 as it was
+static uint16_t reference_update(const uint16_t p_crc, const uint8_t p_ch)
+{
+    uint16_t crc = (p_crc ^ (uint16_t)p_ch);
+    for(uint8_t i=0; i<8; ++i)
+    {
+        crc = ((0 == (crc & 0x0001)) ? (crc >> 1) : ((crc >> 1) ^ 0xa001));
+    }
+    return(crc);
+}
+
+////////////////////////////////////////
+static const char* variant(void)
+{
+#if defined(CRC16_USE_NIBBLE)
+    return("nibble");
+#elif defined(CRC16_USE_TABLE)
+    return("table");
+#else
+    return("slice4");
+#endif
+}
+
+////////////////////////////////////////
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(ts.tv_sec + (ts.tv_nsec / 1e9));
+}
+
+////////////////////////////////////////
+static void test_every_byte(void)
+{
+    uint32_t mismatches = 0;
+    for(uint32_t crc=0; crc<0x10000; ++crc)
+    {
+        for(uint32_t ch=0; ch<0x100; ++ch)
+        {
+            const uint16_t want = reference_update((uint16_t)crc, (uint8_t)ch);
+            const uint8_t byte = (uint8_t)ch;
+            mismatches += (want != crc16_update((uint16_t)crc, byte));
+            mismatches += (want != crc16_update_block((uint16_t)crc, &byte, 1));
+        }
+    }
+    CHECK(0 == mismatches);
+}
+
+////////////////////////////////////////
+static void test_random_buffers(void)
+{
+    uint8_t buf[1024 + 3];
+    uint32_t mismatches = 0;
+    for(uint32_t round=0; round<20000; ++round)
+    {
+        const size_t len = (size_t)(rand() % 1025);
+        const size_t offset = (size_t)(round & 3);
+        for(size_t i=0; i<len; ++i)
+        {
+            buf[offset + i] = (uint8_t)rand();
+        }
+
+        const uint16_t seed = ((0 == (round & 1)) ? 0xffff : (uint16_t)rand());
+        uint16_t want = seed;
+        uint16_t bytewise = seed;
+        for(size_t i=0; i<len; ++i)
+        {
+            want = reference_update(want, buf[offset + i]);
+            bytewise = crc16_update(bytewise, buf[offset + i]);
+        }
+        mismatches += (want != bytewise);
+        mismatches += (want != crc16_update_block(seed, &buf[offset], len));
+
+        // a block split in two must chain to the same crc
+        const size_t split = ((0 == len) ? 0 : (size_t)(rand() % (int)len));
+        const uint16_t head = crc16_update_block(seed, &buf[offset], split);
+        mismatches += (want != crc16_update_block(head, &buf[offset + split], (len - split)));
+    }
+    CHECK(0 == mismatches);
+}
+
+////////////////////////////////////////
+// the 8 payload chars of a hex frame, as mb_set_bytes() hashes them
+static void bench_frames(void)
+{
+    const uint32_t frames = 2000000;
+    uint8_t payload[8] = { '5', '1', 'a', '1', '0', '0', '0', '0' };
+    volatile uint16_t sink = 0;
+
+    double start = now_sec();
+    for(uint32_t i=0; i<frames; ++i)
+    {
+        payload[7] = (uint8_t)i;
+        uint16_t crc = 0xffff;
+        for(uint8_t j=0; j<sizeof(payload); ++j)
+        {
+            crc = reference_update(crc, payload[j]);
+        }
+        sink = (sink ^ crc);
+    }
+    const double bitwise = (now_sec() - start);
+
+    start = now_sec();
+    for(uint32_t i=0; i<frames; ++i)
+    {
+        payload[7] = (uint8_t)i;
+        sink = (sink ^ crc16_update_block(0xffff, payload, sizeof(payload)));
+    }
+    const double block = (now_sec() - start);
+
+    printf("%s: %.1f ns/frame, bitwise %.1f ns/frame (%.1fx)\n", variant(),
+        (block * 1e9 / frames), (bitwise * 1e9 / frames), (bitwise / block));
+}
+
+////////////////////////////////////////
+int main(int argc, char* argv[])
+{
+    srand(1);
+    test_every_byte();
+    test_random_buffers();
+    bench_frames();
+
+    printf("%s\n", ((0 == s_failures) ? "ok" : "FAILED"));
+    return((0 == s_failures) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
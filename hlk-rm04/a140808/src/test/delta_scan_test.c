@@ -0,0 +1,315 @@
+//
+// Copyright 2015-2017 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its 
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including, 
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR 
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any 
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "delta_scan.h"
+#include "shadow_json.h"
+
+
+//
+// delta_scan.h against the jsmn path in shadow_json.c
+//
+// a document a scanner accepts must give exactly what the *_tokens
+// function gives for it, and the public functions must accept and reject
+// the same documents as the jsmn path alone. fixed cases cover the edges
+// the scanners treat specially, then generated documents: well formed
+// deltas and pulse requests, full delta messages with version and
+// metadata, and random splices, mutations and truncations of those
+//
+
+#define FUZZ_DOCS   2000000
+#define DOC_MAX     512
+
+static int s_failures = 0;
+static uint32_t s_accepted[3] = { 0, 0, 0 };  // bits, pulses, find
+
+#define CHECK(cond) do { if(!(cond)) { printf("FAIL: %s %d - %s\n", __FILE__, __LINE__, #cond); ++s_failures; } } while(0)
+
+
+////////////////////////////////////////
+static inline uint32_t next_rand(uint32_t* p_state)
+{
+    uint32_t x = *p_state;
+    x ^= (x << 13);
+    x ^= (x >> 17);
+    x ^= (x << 5);
+    *p_state = x;
+    return(x);
+}
+
+
+////////////////////////////////////////
+// runs all three scanners on one document, returns a bit per scanner that
+// took it. anything that differs from the jsmn path is a failure
+static uint8_t check_doc(const char* p_doc, const uint32_t p_len)
+{
+    uint8_t taken = 0;
+    bool same = true;
+
+    // {"o1":1,...}
+    uint8_t sv[4];
+    uint8_t tv[4];
+    uint8_t pv[4];
+    const IoT_Error_t trc = parse_json_delta_tokens(p_doc, p_len, &tv[0], &tv[1], &tv[2], &tv[3]);
+    const IoT_Error_t prc = parse_json_delta(p_doc, p_len, &pv[0], &pv[1], &pv[2], &pv[3]);
+    if(ds_scan_bits(p_doc, p_len, &sv[0], &sv[1], &sv[2], &sv[3]))
+    {
+        taken |= 0x01;
+        ++s_accepted[0];
+        same &= ((SUCCESS == trc) && (0 == memcmp(sv, tv, sizeof(sv))));
+    }
+    same &= ((trc == prc) && ((SUCCESS != trc) || (0 == memcmp(pv, tv, sizeof(pv)))));
+
+    // {"p0":250,"p3"} / ["p0"]
+    uint8_t sbits;
+    uint8_t tbits;
+    uint8_t pbits;
+    uint16_t sms[8];
+    uint16_t tms[8];
+    uint16_t pms[8];
+    const IoT_Error_t trcp = parse_json_pulses_tokens(p_doc, p_len, &tbits, tms);
+    const IoT_Error_t prcp = parse_json_pulses(p_doc, p_len, &pbits, pms);
+    memset(sms, 0, sizeof(sms));
+    if(ds_scan_pulses(p_doc, p_len, &sbits, sms))
+    {
+        taken |= 0x02;
+        ++s_accepted[1];
+        same &= ((SUCCESS == trcp) && (sbits == tbits) && (0 == memcmp(sms, tms, sizeof(sms))));
+    }
+    same &= ((trcp == prcp) && ((SUCCESS != trcp) || ((pbits == tbits) && (0 == memcmp(pms, tms, sizeof(pms))))));
+
+    // the "state" object of a delta message
+    const char* sobj = NULL;
+    const char* tobj = NULL;
+    const char* pobj = NULL;
+    uint32_t slen = 0;
+    uint32_t tlen = 0;
+    uint32_t plen = 0;
+    const bool tfound = find_json_object_tokens(p_doc, p_len, "state", &tobj, &tlen);
+    const bool pfound = find_json_object(p_doc, p_len, "state", &pobj, &plen);
+    if(ds_find_object(p_doc, p_len, "state", &sobj, &slen))
+    {
+        taken |= 0x04;
+        ++s_accepted[2];
+        same &= (tfound && (sobj == tobj) && (slen == tlen));
+    }
+    same &= ((tfound == pfound) && (!tfound || ((pobj == tobj) && (plen == tlen))));
+
+    if(!same)
+    {
+        if(++s_failures <= 10)
+        {
+            printf("FAIL: scanner and jsmn differ on [%.*s]\n", (int)p_len, p_doc);
+        }
+    }
+    return(taken);
+}
+
+////////////////////////////////////////
+static uint8_t check_str(const char* p_doc)
+{
+    return(check_doc(p_doc, (uint32_t)strlen(p_doc)));
+}
+
+
+////////////////////////////////////////
+// the edges: what the scanners must take themselves and what they must
+// leave to jsmn
+static void test_cases(void)
+{
+    // the usual shapes never reach jsmn
+    CHECK(0x01 == (0x01 & check_str("{\"o1\":1,\"i3\":0,\"o7\":1}")));
+    CHECK(0x01 == (0x01 & check_str(" { } ")));
+    CHECK(0x02 == (0x02 & check_str("{\"p0\":250,\"p3\",\"p7\":65535}")));
+    CHECK(0x02 == (0x02 & check_str("[\"p0\",\"p3\"]")));
+    CHECK(0x04 == (0x04 & check_str("{\"version\":12,\"timestamp\":1500000000,\"state\":{\"o1\":1},"
+                                    "\"metadata\":{\"o1\":{\"timestamp\":1500000000}}}")));
+
+    // a key with no value, jsmn (non strict) takes it as a pulse with no width
+    CHECK(0x02 == (0x02 & check_str("{\"p0\"}")));
+    CHECK(0x02 == (0x02 & check_str("{\"p0\",\"p1\":10}")));
+    CHECK(0x00 == (0x01 & check_str("{\"o1\"}")));
+
+    // escaped keys and strings are left to jsmn
+    CHECK(0x00 == (0x01 & check_str("{\"o\\u0031\":1}")));
+    CHECK(0x00 == (0x01 & check_str("{\"o\\\"\":1}")));
+    CHECK(0x00 == (0x02 & check_str("{\"p\\\\\":5}")));
+    CHECK(0x00 == (0x02 & check_str("[\"\\p0\"]")));
+    CHECK(0x00 == (0x04 & check_str("{\"st\\u0061te\":{\"o1\":1}}")));
+    CHECK(0x00 == (0x04 & check_str("{\"s\\\"tate\":{},\"state\":{\"o1\":1}}")));
+    CHECK(0x00 == (0x04 & check_str("{\"state\":{\"o1\":1},\"metadata\":\"a\\\"}\"}")));
+
+    // duplicate keys: bits and pulses are merged, the first "state" wins
+    CHECK(0x01 == (0x01 & check_str("{\"o1\":1,\"o1\":0,\"i2\":0,\"i2\":1}")));
+    CHECK(0x02 == (0x02 & check_str("{\"p0\":250,\"p0\",\"p1\":5,\"p1\":6}")));
+    CHECK(0x04 == (0x04 & check_str("{\"state\":{\"o1\":1},\"state\":{\"o2\":1}}")));
+    check_str("{\"state\":1,\"state\":{\"o2\":1}}");
+
+    // nesting: 32 levels below the value are scanned, deeper goes to jsmn
+    char doc[DOC_MAX];
+    for(uint32_t levels=30; levels<=40; ++levels)
+    {
+        uint32_t len = (uint32_t)snprintf(doc, sizeof(doc), "{\"state\":{\"o1\":1},\"metadata\":");
+        for(uint32_t i=0; i<levels; ++i)
+        {
+            doc[len++] = ((i & 1) ? '[' : '{');
+            if(0 == (i & 1))
+            {
+                len += (uint32_t)snprintf(&doc[len], (sizeof(doc) - len), "\"k\":");
+            }
+        }
+        for(uint32_t i=levels; i>0; --i)
+        {
+            doc[len++] = (((i - 1) & 1) ? ']' : '}');
+        }
+        doc[len++] = '}';
+        CHECK(((levels <= 32) ? 0x04 : 0x00) == (0x04 & check_doc(doc, len)));
+    }
+
+    // malformed, truncated and trailing data
+    check_str("{\"o1\":1,}");
+    check_str("{\"o1\":1 \"o2\":0}");
+    check_str("{\"o1\":1}}");
+    check_str("{\"o1\":1} x");
+    check_str("{\"o1\":2}");
+    check_str("{\"o8\":1}");
+    check_str("{\"o1\":10}");
+    check_str("{\"p0\":0}");
+    check_str("{\"p0\":65536}");
+    check_str("{\"p0\":00250}");
+    check_str("{\"p0\":250x}");
+    check_str("[\"p0\":250]");
+    check_str("{\"p0\",\"p1\",\"p2\",\"p3\",\"p4\",\"p5\",\"p6\",\"p7\",\"p0\"}");
+    check_str("{\"state\":[1,2]}");
+    check_str("{\"state\":{\"o1\":1]}");
+    check_str("{\"state\":{\"o1\":1}");
+    check_str("");
+    check_str("   ");
+}
+
+
+////////////////////////////////////////
+// pieces spliced into the generated documents
+static const char* s_atoms[] =
+{
+    "{", "}", "[", "]", ",", ":", " ", "\n", "\"\"", "\"o\"",
+    "\"o1\"", "\"i7\"", "\"o9\"", "\"x1\"", "\"p0\"", "\"p3\"", "\"p\\\\\"", "\"a\\\"b\"", "\"o\\u0031\"",
+    "\"state\"", "\"version\"", "\"metadata\"", "\"st\\u0061te\"",
+    "0", "1", "2", "5", "250", "0250", "65535", "65536", ":1000", "true", "null", "-1.5e3",
+    "{\"o1\":1}", "\"o1\":1", "{\"o1\":{\"timestamp\":1}}", "{\"p1\":5,\"p2\"}", "[[[[[[[[[[", "]]]]]]]]]]",
+};
+
+////////////////////////////////////////
+static uint32_t gen_doc(uint32_t* p_seed, char* p_doc)
+{
+    uint32_t len = 0;
+    const uint32_t shape = (next_rand(p_seed) % 4);
+    if(0 == shape)
+    {
+        // a delta or pulse object, mostly well formed
+        const uint32_t pairs = (next_rand(p_seed) % 10);
+        const bool pulses = (next_rand(p_seed) & 1);
+        len = (uint32_t)snprintf(p_doc, DOC_MAX, "{");
+        for(uint32_t i=0; i<pairs; ++i)
+        {
+            const uint32_t r = next_rand(p_seed);
+            const char op = ((0 == (r & 0x70000)) ? "iopx"[(r >> 20) % 4] : (pulses ? 'p' : "io"[(r >> 20) & 1]));
+            const uint32_t val = (pulses ? ((r & 0x300) ? (next_rand(p_seed) % 70000) : (next_rand(p_seed) % 3))
+                                         : ((r & 0x300) ? (next_rand(p_seed) % 2) : (next_rand(p_seed) % 20)));
+            len += (uint32_t)snprintf(&p_doc[len], (DOC_MAX - len), "%s\"%c%u\"", ((i > 0) ? "," : ""),
+                                      op, ((0 == (r & 0xf)) ? ((r >> 4) % 10) : ((r >> 4) % 8)));
+            if(0 != (r & 0x1c00))
+            {
+                len += (uint32_t)snprintf(&p_doc[len], (DOC_MAX - len), "%s:%s%u", (((r >> 13) & 7) ? "" : " "),
+                                          (((r >> 24) & 15) ? "" : " "), val);
+            }
+        }
+        len += (uint32_t)snprintf(&p_doc[len], (DOC_MAX - len), "}");
+    }
+    else if(1 == shape)
+    {
+        // a whole delta message
+        const uint32_t r = next_rand(p_seed);
+        len = (uint32_t)snprintf(p_doc, DOC_MAX,
+                                 "{\"version\":%u,%s\"state\":{\"o%u\":%u},\"metadata\":{\"o1\":{\"timestamp\":1,\"x\":[1,\"a}\"]}}%s}",
+                                 (r % 100), ((r & 0x100) ? "\"timestamp\":15," : "\"s\\\"tate\":{},"),
+                                 ((r >> 9) % 8), ((r >> 12) & 1), ((r & 0x2000) ? ",\"state\":{}" : ""));
+    }
+
+    // splice in atoms
+    if((0 == len) || (next_rand(p_seed) & 1))
+    {
+        const uint32_t count = (1 + (next_rand(p_seed) % 24));
+        for(uint32_t i=0; i<count; ++i)
+        {
+            const char* atom = s_atoms[next_rand(p_seed) % (sizeof(s_atoms) / sizeof(s_atoms[0]))];
+            const uint32_t atom_len = (uint32_t)strlen(atom);
+            if((len + atom_len) >= DOC_MAX)
+            {
+                break;
+            }
+            const uint32_t at = ((len > 0) && (next_rand(p_seed) & 1)) ? (next_rand(p_seed) % len) : len;
+            memmove(&p_doc[at + atom_len], &p_doc[at], (len - at));
+            memcpy(&p_doc[at], atom, atom_len);
+            len += atom_len;
+        }
+    }
+
+    // flip a char, cut it short
+    if((len > 0) && (0 == (next_rand(p_seed) % 10)))
+    {
+        p_doc[next_rand(p_seed) % len] = (char)(' ' + (next_rand(p_seed) % 95));
+    }
+    if((len > 0) && (0 == (next_rand(p_seed) % 10)))
+    {
+        len = (next_rand(p_seed) % len);
+    }
+    return(len);
+}
+
+////////////////////////////////////////
+static void test_generated(void)
+{
+    uint32_t seed = 0x2545f491;
+    char doc[DOC_MAX];
+    for(uint32_t i=0; i<FUZZ_DOCS; ++i)
+    {
+        check_doc(doc, gen_doc(&seed, doc));
+    }
+}
+
+
+////////////////////////////////////////
+int main(int argc, char* argv[])
+{
+    test_cases();
+    test_generated();
+
+    // the generator has to reach the scanners for the run to mean anything
+    printf("scanner accepted - bits: %u  pulses: %u  find: %u\n", s_accepted[0], s_accepted[1], s_accepted[2]);
+    CHECK(s_accepted[0] > (FUZZ_DOCS / 100));
+    CHECK(s_accepted[1] > (FUZZ_DOCS / 100));
+    CHECK(s_accepted[2] > (FUZZ_DOCS / 100));
+
+    printf("%s\n", ((0 == s_failures) ? "ok" : "FAILED"));
+    return((0 == s_failures) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,374 @@
+//
+// Copyright 2015-2017 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its 
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including, 
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR 
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any 
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+#define _GNU_SOURCE  // posix_openpt() and friends
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "msg_buf.h"
+#include "msg_parser.h"
+#include "msg_proc.h"
+
+
+//
+// how many boards one bridge process keeps up with at a given command
+// rate. each simulated board is a pty driven by msg_proc.c exactly as
+// main.c drives a serial port, one serial thread per board. a single
+// fake avr thread answers every write-register with the subscription
+// change a real avr sends, and the main thread plays main.c's loop:
+// it dispatches the commands on schedule and takes the answers from
+// mp_poll(). reported per row:
+//
+//   answered   commands whose answer came back before the run ended
+//   rtt        dispatch to the mp_on_subscribe_register() callback
+//   bridge cpu main thread plus every serial thread, as % of one core,
+//              the fake avr thread is not counted
+//
+// a pty has no baud rate. a real 57,600 E71 link carries about 380 hex
+// frames a second each way (14 chars and a newline, 10 bits a char),
+// which caps the rate per board, not the board count measured here.
+//
+// gateway_bench [commands per second per board]
+//
+
+#define MAX_BOARDS    64
+#define RUN_MS        2000
+#define DRAIN_MS      500
+#define RTT_BUCKETS   10000  // 100us each, up to 1 s
+
+struct sim_board
+{
+    int fd;                         // master end, the avr side
+    struct msg_parser_data parser;  // avr side decoder
+    uint64_t next_ns;               // when the next command goes out
+    uint8_t seq;
+    uint64_t sent_ns[256];          // by command value
+};
+
+static struct mp_context s_boards[MAX_BOARDS];
+static struct sim_board s_sims[MAX_BOARDS];
+static int s_board_count = 0;
+static volatile bool s_avr_run = false;
+
+static uint32_t s_answered = 0;
+static uint64_t s_rtt_sum_us = 0;
+static uint32_t s_rtt_max_us = 0;
+static uint32_t s_rtt_hist[RTT_BUCKETS];
+
+
+////////////////////////////////////////
+static uint64_t clock_ns(const clockid_t p_clock)
+{
+    struct timespec ts;
+    clock_gettime(p_clock, &ts);
+    return(((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec);
+}
+
+
+//
+// bridge callbacks
+//
+
+void mp_on_pong(struct mp_context* p_mp, const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3)
+{
+}
+
+void mp_on_read_register(struct mp_context* p_mp, const uint8_t p_registerAddress)
+{
+}
+
+void mp_on_write_register(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_value, const uint8_t p_mask)
+{
+}
+
+void mp_on_write_register_bit(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const bool p_state)
+{
+}
+
+void mp_on_pulse_register_bit(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const uint16_t p_durationMs)
+{
+}
+
+////////////////////////////////////////
+// the avr reports the outputs a command changed
+void mp_on_subscribe_register(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_value, const bool p_cancel)
+{
+    const struct sim_board* sim = &s_sims[p_mp - s_boards];
+    const uint32_t us = (uint32_t)((mq_now_ns() - sim->sent_ns[p_value]) / 1000);
+    ++s_answered;
+    s_rtt_sum_us += us;
+    s_rtt_max_us = ((us > s_rtt_max_us) ? us : s_rtt_max_us);
+    ++s_rtt_hist[((us / 100) < RTT_BUCKETS) ? (us / 100) : (RTT_BUCKETS - 1)];
+}
+
+
+//
+// fake avrs, one thread for all of them
+//
+
+////////////////////////////////////////
+static void avr_send(const int p_fd, const uint8_t p_type, const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3)
+{
+    struct ring_buf_data rb;
+    mb_init(&rb);
+    mb_set_bytes(&rb, p_type, p_param1, p_param2, p_param3);
+    uint8_t frame[16];
+    const uint32_t len = rb_size(&rb);
+    for(uint32_t i=0; i<len; ++i)
+    {
+        frame[i] = rb_at(&rb, i);
+    }
+    mb_free(&rb);
+    if(len != (uint32_t)write(p_fd, frame, len))
+    {
+        // the bridge fell behind far enough to fill the pty, counted as unanswered
+    }
+}
+
+////////////////////////////////////////
+static void* avr_thread(void* p_arg)
+{
+    struct pollfd pfds[MAX_BOARDS];
+    for(int i=0; i<s_board_count; ++i)
+    {
+        pfds[i].fd = s_sims[i].fd;
+        pfds[i].events = POLLIN;
+    }
+
+    while(s_avr_run)
+    {
+        if(poll(pfds, (nfds_t)s_board_count, 50) <= 0)
+        {
+            continue;
+        }
+        for(int i=0; i<s_board_count; ++i)
+        {
+            if(0 == (pfds[i].revents & POLLIN))
+            {
+                continue;
+            }
+            uint8_t buf[256];
+            const ssize_t len = read(pfds[i].fd, buf, sizeof(buf));
+            for(ssize_t j=0; j<len; ++j)
+            {
+                uint8_t type;
+                uint8_t param1;
+                uint8_t param2;
+                uint8_t param3;
+                if((S_OK == pr_push(&s_sims[i].parser, buf[j])) && pr_get_bytes(&s_sims[i].parser, &type, &param1, &param2, &param3) &&
+                   (MSG_WRITE_REGISTER == type))
+                {
+                    avr_send(pfds[i].fd, MSG_SUBSCRIBE_REGISTER, param1, param2, 0x00);
+                }
+            }
+        }
+    }
+    return(NULL);
+}
+
+
+//
+// bridge side
+//
+
+////////////////////////////////////////
+// log output from msg_proc.c and serial.c goes to /dev/null while
+// p_quiet, the per board open and close lines would bury the table
+static void quiet(const bool p_quiet)
+{
+    static int s_stdout = -1;
+    fflush(stdout);
+    if(p_quiet)
+    {
+        s_stdout = dup(STDOUT_FILENO);
+        const int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    }
+    else if(s_stdout > -1)
+    {
+        dup2(s_stdout, STDOUT_FILENO);
+        close(s_stdout);
+        s_stdout = -1;
+    }
+}
+
+////////////////////////////////////////
+static uint64_t bridge_cpu_ns(void)
+{
+    uint64_t ns = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    for(int i=0; i<s_board_count; ++i)
+    {
+        clockid_t clock;
+        if(0 == pthread_getcpuclockid(s_boards[i].thread, &clock))
+        {
+            ns += clock_ns(clock);
+        }
+    }
+    return(ns);
+}
+
+////////////////////////////////////////
+// returns false if the boards could not be set up
+static bool run(const int p_boards, const uint32_t p_rate)
+{
+    quiet(true);
+    s_board_count = 0;
+    bool ok = true;
+    for(int i=0; (i<p_boards) && ok; ++i)
+    {
+        struct sim_board* sim = &s_sims[i];
+        memset(sim, 0, sizeof(*sim));
+        sim->fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+        ok = ((sim->fd > -1) && (0 == grantpt(sim->fd)) && (0 == unlockpt(sim->fd)));
+        pr_init(&sim->parser);
+        // a pty carries 8 bits whatever the parity, N81 saves the E71 errors
+        ok = (ok && mp_init(&s_boards[i], ptsname(sim->fd), 57600, false));
+        s_board_count += (ok ? 1 : 0);
+    }
+    quiet(false);
+
+    s_answered = 0;
+    s_rtt_sum_us = 0;
+    s_rtt_max_us = 0;
+    memset(s_rtt_hist, 0, sizeof(s_rtt_hist));
+
+    pthread_t avr;
+    s_avr_run = true;
+    pthread_create(&avr, NULL, avr_thread, NULL);
+
+    // boards start spread over one period, as real commands would be
+    const uint64_t period_ns = (1000000000ULL / p_rate);
+    const uint64_t start = mq_now_ns();
+    for(int i=0; i<s_board_count; ++i)
+    {
+        s_sims[i].next_ns = (start + ((period_ns * i) / s_board_count));
+    }
+
+    struct pollfd pfds[MAX_BOARDS];
+    for(int i=0; i<s_board_count; ++i)
+    {
+        pfds[i].fd = mp_get_fd(&s_boards[i]);
+        pfds[i].events = POLLIN;
+    }
+
+    const uint64_t cpu_start = bridge_cpu_ns();
+    const uint64_t send_end = (start + (RUN_MS * 1000000ULL));
+    const uint64_t end = (send_end + (DRAIN_MS * 1000000ULL));
+    uint32_t sent = 0;
+    uint64_t now;
+    uint64_t cpu_end = 0;
+    while((now = mq_now_ns()) < end)
+    {
+        uint64_t next = end;
+        if(now < send_end)
+        {
+            for(int i=0; i<s_board_count; ++i)
+            {
+                struct sim_board* sim = &s_sims[i];
+                while(sim->next_ns <= now)
+                {
+                    ++sim->seq;
+                    sim->sent_ns[sim->seq] = now;
+                    mp_dispatch_write_register(&s_boards[i], REG_OUTPUT_1, sim->seq, 0xff);
+                    sim->next_ns += period_ns;
+                    ++sent;
+                }
+                next = ((sim->next_ns < next) ? sim->next_ns : next);
+            }
+        }
+        else if(0 == cpu_end)
+        {
+            // cpu for the send window only, the drain is mostly idle
+            cpu_end = bridge_cpu_ns();
+        }
+
+        const int timeout_ms = (int)((next > now) ? (((next - now) + 999999ULL) / 1000000ULL) : 0);
+        if(poll(pfds, (nfds_t)s_board_count, timeout_ms) > 0)
+        {
+            for(int i=0; i<s_board_count; ++i)
+            {
+                if(0 != (pfds[i].revents & POLLIN))
+                {
+                    mp_poll(&s_boards[i]);
+                }
+            }
+        }
+    }
+
+    s_avr_run = false;
+    pthread_join(avr, NULL);
+    quiet(true);
+    for(int i=0; i<s_board_count; ++i)
+    {
+        mp_close(&s_boards[i]);
+        close(s_sims[i].fd);
+    }
+    quiet(false);
+
+    if(!ok)
+    {
+        printf("%6d boards: could not open them all, stopped at %d\n", p_boards, s_board_count);
+        return(false);
+    }
+
+    uint32_t p99_us = 0;
+    uint32_t seen = 0;
+    for(uint32_t i=0; i<RTT_BUCKETS; ++i)
+    {
+        seen += s_rtt_hist[i];
+        if(seen * 100ULL >= s_answered * 99ULL)
+        {
+            p99_us = ((((i + 1) * 100) < s_rtt_max_us) ? ((i + 1) * 100) : s_rtt_max_us);
+            break;
+        }
+    }
+    const double cpu = (100.0 * (double)(cpu_end - cpu_start) / (RUN_MS * 1000000.0));
+    printf("%6d  %8u  %8u  %9.2f  %8.2f  %8.2f  %9.1f%%\n", s_board_count, sent, s_answered,
+        ((0 == s_answered) ? 0.0 : (s_rtt_sum_us / 1000.0 / s_answered)), (p99_us / 1000.0), (s_rtt_max_us / 1000.0), cpu);
+    return(true);
+}
+
+////////////////////////////////////////
+int main(int argc, char* argv[])
+{
+    const uint32_t rate = ((argc > 1) ? (uint32_t)atoi(argv[1]) : 20);
+    if(0 == rate)
+    {
+        printf("usage: gateway_bench [commands per second per board]\n");
+        return(EXIT_FAILURE);
+    }
+
+    printf("%u commands/s per board, %u ms per row\n", rate, RUN_MS);
+    printf("boards      sent  answered  rtt avg ms  p99 ms    max ms  bridge cpu\n");
+    const int boards[] = { 1, 2, 4, 8, 16, 32, 64 };
+    for(uint32_t i=0; i<(sizeof(boards) / sizeof(boards[0])); ++i)
+    {
+        if(!run(boards[i], rate))
+        {
+            break;
+        }
+    }
+    return(EXIT_SUCCESS);
+}
@@ -0,0 +1,278 @@
+//
+// Copyright 2015-2017 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its 
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including, 
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR 
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any 
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "msg_buf.h"
+#include "msg_parser.h"
+
+
+//
+// msg_parser.h against frames built by msg_buf.h: every payload through
+// both framings, resync after noise, the bytes a hex request leaves
+// behind when the link switches to slip, and a peer going back to hex
+//
+
+static int s_failures = 0;
+
+#define CHECK(cond) do { if(!(cond)) { printf("FAIL: %s %d - %s\n", __FILE__, __LINE__, #cond); ++s_failures; } } while(0)
+
+
+////////////////////////////////////////
+// encode one frame into p_out, returns its length
+static uint32_t encode(const uint8_t p_framing, const uint8_t* p_val, uint8_t* p_out)
+{
+    struct ring_buf_data rb;
+    mb_init(&rb);
+    if(FRAMING_SLIP == p_framing)
+    {
+        mb_set_slip_bytes(&rb, p_val[0], p_val[1], p_val[2], p_val[3]);
+    }
+    else
+    {
+        mb_set_bytes(&rb, p_val[0], p_val[1], p_val[2], p_val[3]);
+    }
+
+    const uint32_t len = rb_size(&rb);
+    for(uint32_t i=0; i<len; ++i)
+    {
+        p_out[i] = rb_at(&rb, i);
+    }
+    mb_free(&rb);
+    return(len);
+}
+
+////////////////////////////////////////
+// feed p_len bytes, returns the number of frames decoded and checks each
+// one against p_expect (4 bytes per frame)
+static uint32_t feed(struct msg_parser_data* p_pd, const uint8_t* p_data, const uint32_t p_len, const uint8_t* p_expect)
+{
+    uint32_t frames = 0;
+    for(uint32_t i=0; i<p_len; ++i)
+    {
+        if(S_OK == pr_push(p_pd, p_data[i]))
+        {
+            uint8_t v[4];
+            CHECK(pr_get_bytes(p_pd, &v[0], &v[1], &v[2], &v[3]));
+            if(NULL != p_expect)
+            {
+                const uint8_t* e = &p_expect[frames * 4];
+                CHECK((v[0] == e[0]) && (v[1] == e[1]) && (v[2] == e[2]) && (v[3] == e[3]));
+            }
+            ++frames;
+        }
+    }
+    return(frames);
+}
+
+////////////////////////////////////////
+// even parity in bit 7, what a 7E1 char looks like read as 8N1
+static uint8_t with_parity(const uint8_t p_ch)
+{
+    return((__builtin_popcount(p_ch) & 1) ? (p_ch | 0x80) : p_ch);
+}
+
+////////////////////////////////////////
+static void test_round_trip(const uint8_t p_framing)
+{
+    struct msg_parser_data pd;
+    pr_init(&pd);
+    pr_set_framing(&pd, p_framing);
+
+    // every value of each payload byte, with escapes in every position
+    uint8_t frame[32];
+    for(uint32_t v=0; v<256; ++v)
+    {
+        for(uint32_t pos=0; pos<4; ++pos)
+        {
+            uint8_t val[4] = { 0x01, 0x02, 0x03, 0x04 };
+            val[pos] = (uint8_t)v;
+            const uint32_t len = encode(p_framing, val, frame);
+            CHECK(len <= 14);
+            CHECK(1 == feed(&pd, frame, len, val));
+        }
+    }
+
+    // random payloads back to back
+    uint8_t stream[64 * 16];
+    uint8_t expect[64 * 4];
+    for(uint32_t round=0; round<1000; ++round)
+    {
+        uint32_t len = 0;
+        for(uint32_t i=0; i<64; ++i)
+        {
+            for(uint32_t j=0; j<4; ++j)
+            {
+                expect[i * 4 + j] = (uint8_t)rand();
+            }
+            len += encode(p_framing, &expect[i * 4], &stream[len]);
+        }
+        CHECK(64 == feed(&pd, stream, len, expect));
+    }
+    CHECK(0 == pd.bad_count);
+}
+
+////////////////////////////////////////
+// the case that used to drop the link back to hex: the bridge sends
+// "[...]\n", the avr acks and switches, then the '\n' (and any other
+// stray bytes) arrive ahead of the first binary frame
+static void test_switch_leftovers(void)
+{
+    struct msg_parser_data pd;
+    pr_init(&pd);
+    pr_set_framing(&pd, FRAMING_SLIP);
+
+    const uint8_t val[8] = { 0x51, 0xa1, 0x00, 0x00, 0x51, 0xd1, 0x00, 0x00 };
+    uint8_t stream[64];
+    uint32_t len = 0;
+    stream[len++] = '\n';
+    stream[len++] = 'x';
+    stream[len++] = 0x7f;
+    len += encode(FRAMING_SLIP, &val[0], &stream[len]);
+    len += encode(FRAMING_SLIP, &val[4], &stream[len]);
+    CHECK(2 == feed(&pd, stream, len, val));
+    CHECK(0 == pd.bad_count);
+    CHECK(FRAMING_SLIP == pd.framing);
+}
+
+////////////////////////////////////////
+// noise in the middle of the binary stream costs the frame it hits and
+// counts once, not once per byte
+static void test_slip_noise(void)
+{
+    struct msg_parser_data pd;
+    pr_init(&pd);
+    pr_set_framing(&pd, FRAMING_SLIP);
+
+    const uint8_t val[8] = { 0x21, 0xd1, 0x0f, 0xff, 0x01, 0x02, 0x03, 0x04 };
+    uint8_t stream[128];
+    uint32_t len = encode(FRAMING_SLIP, &val[0], stream);
+    const uint32_t first = len;
+
+    // a frame cut short by twenty bytes of garbage with a bad escape in it
+    stream[len++] = SLIP_END;
+    stream[len++] = 0x11;
+    stream[len++] = SLIP_ESC;
+    stream[len++] = 0x42;
+    for(uint32_t i=0; i<20; ++i)
+    {
+        stream[len++] = (uint8_t)(0x30 + i);
+    }
+    len += encode(FRAMING_SLIP, &val[4], &stream[len]);
+
+    CHECK(2 == feed(&pd, stream, len, val));
+    CHECK(0 == pd.bad_count);
+
+    // only the broken frame counted
+    pr_set_framing(&pd, FRAMING_SLIP);
+    CHECK(0 == feed(&pd, &stream[first], 24, NULL));
+    CHECK(1 == pd.bad_count);
+}
+
+////////////////////////////////////////
+// the other end went back to hex (reset, or gave up on binary): its 7E1
+// chars read as 8N1 switch the parser back and the frame is not lost
+static void test_peer_back_to_hex(void)
+{
+    struct msg_parser_data pd;
+    pr_init(&pd);
+    pr_set_framing(&pd, FRAMING_SLIP);
+
+    const uint8_t val[12] = { 0x51, 0xa1, 0x3c, 0x00, 0x02, 0x01, 0x02, 0x03, 0x51, 0xd1, 0x00, 0x00 };
+    uint8_t stream[64];
+    uint32_t len = 0;
+    len += encode(FRAMING_HEX, &val[0], &stream[len]);
+    len += encode(FRAMING_HEX, &val[4], &stream[len]);
+    len += encode(FRAMING_HEX, &val[8], &stream[len]);
+    for(uint32_t i=0; i<len; ++i)
+    {
+        stream[i] = with_parity(stream[i]);
+    }
+
+    CHECK(3 == feed(&pd, stream, len, val));
+    CHECK(FRAMING_HEX == pd.framing);
+}
+
+////////////////////////////////////////
+// binary traffic never looks like a hex frame, whatever the payload
+static void test_no_false_hex(void)
+{
+    struct msg_parser_data pd;
+    pr_init(&pd);
+    pr_set_framing(&pd, FRAMING_SLIP);
+
+    uint8_t stream[64 * 16];
+    for(uint32_t round=0; round<20000; ++round)
+    {
+        uint32_t len = 0;
+        for(uint32_t i=0; i<64; ++i)
+        {
+            // payloads made of hex digits and begin chars are the worst case
+            static const uint8_t chars[] = { '0', '9', 'a', 'f', '[', ']', SLIP_ESC, 0xb0, 0xe1 };
+            uint8_t val[4];
+            for(uint32_t j=0; j<4; ++j)
+            {
+                val[j] = chars[rand() % sizeof(chars)];
+            }
+            len += encode(FRAMING_SLIP, val, &stream[len]);
+        }
+        CHECK(64 == feed(&pd, stream, len, NULL));
+        CHECK(FRAMING_SLIP == pd.framing);
+    }
+}
+
+////////////////////////////////////////
+// hex noise resync, unchanged from before the slip work
+static void test_hex_noise(void)
+{
+    struct msg_parser_data pd;
+    pr_init(&pd);
+
+    const uint8_t val[8] = { 0x01, 0x00, 0x00, 0x00, 0x11, 0xa1, 0x00, 0x00 };
+    uint8_t stream[64];
+    uint32_t len = 0;
+    stream[len++] = '[';
+    stream[len++] = '0';
+    stream[len++] = 'z';
+    len += encode(FRAMING_HEX, &val[0], &stream[len]);
+    stream[len++] = '\n';
+    stream[len++] = '[';
+    len += encode(FRAMING_HEX, &val[4], &stream[len]);
+
+    CHECK(2 == feed(&pd, stream, len, val));
+    CHECK(0 == pd.bad_count);
+}
+
+////////////////////////////////////////
+int main(int argc, char* argv[])
+{
+    srand(1);
+    test_round_trip(FRAMING_HEX);
+    test_round_trip(FRAMING_SLIP);
+    test_switch_leftovers();
+    test_slip_noise();
+    test_peer_back_to_hex();
+    test_no_false_hex();
+    test_hex_noise();
+
+    printf("%s\n", ((0 == s_failures) ? "ok" : "FAILED"));
+    return((0 == s_failures) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,398 @@
+//
+// Copyright 2015-2017 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its 
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including, 
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR 
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any 
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#define _GNU_SOURCE  // posix_openpt() and friends
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "msg_buf.h"
+#include "msg_parser.h"
+#include "msg_proc.h"
+
+
+//
+// msg_proc.c framing negotiation against a fake avr on the other end of
+// a pty. the fake avr decodes with the same parser and answers the way
+// avr/src/msg_processor.h does, so the test can also make it fall out of
+// step the way a reset or an old firmware would. a pty carries all 8
+// bits whatever the parity, and linux refuses to set one up as E71, so
+// the "failed to apply serial port settings" errors are expected here
+//
+
+static int s_failures = 0;
+
+#define CHECK(cond) do { if(!(cond)) { printf("FAIL: %s %d - %s\n", __FILE__, __LINE__, #cond); ++s_failures; } } while(0)
+
+#define AVR_LOG_SIZE  64
+
+struct fake_avr
+{
+    int fd;
+    struct msg_parser_data parser;
+    uint8_t framing;
+    bool ignore_framing;  // old firmware, never answers MSG_SET_FRAMING
+
+    // what arrived, and in which framing
+    uint32_t count;
+    uint8_t types[AVR_LOG_SIZE];
+    uint8_t framings[AVR_LOG_SIZE];
+};
+
+static struct fake_avr s_avr;
+static uint32_t s_pongs = 0;
+static uint32_t s_subscribes = 0;
+static uint8_t s_subscribe_value = 0;
+
+
+//
+// bridge callbacks
+//
+
+void mp_on_pong(struct mp_context* p_mp, const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3)
+{
+    ++s_pongs;
+}
+
+void mp_on_read_register(struct mp_context* p_mp, const uint8_t p_registerAddress)
+{
+}
+
+void mp_on_write_register(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_value, const uint8_t p_mask)
+{
+}
+
+void mp_on_write_register_bit(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const bool p_state)
+{
+}
+
+void mp_on_pulse_register_bit(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const uint16_t p_durationMs)
+{
+}
+
+void mp_on_subscribe_register(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_value, const bool p_cancel)
+{
+    ++s_subscribes;
+    s_subscribe_value = p_value;
+}
+
+
+//
+// fake avr
+//
+
+////////////////////////////////////////
+static void avr_send(struct fake_avr* p_avr, const uint8_t p_type, const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3)
+{
+    struct ring_buf_data rb;
+    mb_init(&rb);
+    if(FRAMING_SLIP == p_avr->framing)
+    {
+        mb_set_slip_bytes(&rb, p_type, p_param1, p_param2, p_param3);
+    }
+    else
+    {
+        mb_set_bytes(&rb, p_type, p_param1, p_param2, p_param3);
+    }
+
+    uint8_t frame[16];
+    const uint32_t len = rb_size(&rb);
+    for(uint32_t i=0; i<len; ++i)
+    {
+        frame[i] = rb_at(&rb, i);
+    }
+    mb_free(&rb);
+    CHECK(len == (uint32_t)write(p_avr->fd, frame, len));
+}
+
+////////////////////////////////////////
+// the avr switches without touching the bridge, like after a reset
+static void avr_set_framing(struct fake_avr* p_avr, const uint8_t p_framing)
+{
+    p_avr->framing = p_framing;
+    pr_set_framing(&p_avr->parser, p_framing);
+}
+
+////////////////////////////////////////
+static void avr_service(struct fake_avr* p_avr)
+{
+    uint8_t buf[256];
+    const ssize_t len = read(p_avr->fd, buf, sizeof(buf));
+    for(ssize_t i=0; i<len; ++i)
+    {
+        if(S_OK != pr_push(&p_avr->parser, buf[i]))
+        {
+            continue;
+        }
+
+        // the parser falls back to hex on its own when it sees a hex frame
+        p_avr->framing = p_avr->parser.framing;
+
+        uint8_t type;
+        uint8_t param1;
+        uint8_t param2;
+        uint8_t param3;
+        pr_get_bytes(&p_avr->parser, &type, &param1, &param2, &param3);
+        if(p_avr->count < AVR_LOG_SIZE)
+        {
+            p_avr->types[p_avr->count] = type;
+            p_avr->framings[p_avr->count] = p_avr->framing;
+            ++p_avr->count;
+        }
+
+        switch(type)
+        {
+            case MSG_PING:
+            {
+                avr_send(p_avr, MSG_PONG, param1, param2, param3);
+                break;
+            }
+            case MSG_SET_FRAMING:
+            {
+                if(!p_avr->ignore_framing && (FRAMING_REQUEST == param2))
+                {
+                    avr_send(p_avr, MSG_SET_FRAMING, param1, FRAMING_ACK, 0x00);
+                    avr_set_framing(p_avr, param1);
+                }
+                break;
+            }
+            case MSG_SUBSCRIBE_REGISTER:
+            {
+                avr_send(p_avr, MSG_SUBSCRIBE_REGISTER, param1, 0x5a, param3);
+                break;
+            }
+            default:
+            {
+                break;
+            }
+        }
+    }
+}
+
+////////////////////////////////////////
+// run both ends until *p_count reaches p_want or p_timeoutMs passes,
+// returns the ms it took
+static uint32_t pump(struct mp_context* p_mp, const uint32_t* p_count, const uint32_t p_want, const uint32_t p_timeoutMs)
+{
+    const uint64_t start = mq_now_ns();
+    const uint64_t end = start + ((uint64_t)p_timeoutMs * 1000000ULL);
+    while((*p_count < p_want) && (mq_now_ns() < end))
+    {
+        struct pollfd pfds[2] = {
+            { .fd = s_avr.fd,      .events = POLLIN },
+            { .fd = mp_get_fd(p_mp), .events = POLLIN },
+        };
+        poll(pfds, 2, 10);
+        if(0 != (pfds[0].revents & POLLIN))
+        {
+            avr_service(&s_avr);
+        }
+        if(0 != (pfds[1].revents & POLLIN))
+        {
+            mp_poll(p_mp);
+        }
+    }
+    return((uint32_t)((mq_now_ns() - start) / 1000000ULL));
+}
+
+////////////////////////////////////////
+static uint8_t bridge_framing(struct mp_context* p_mp)
+{
+    return(__atomic_load_n(&p_mp->framing, __ATOMIC_ACQUIRE));
+}
+
+
+//
+// tests
+//
+
+////////////////////////////////////////
+// startup as main.c does it: the subscribes queued right behind the
+// framing request must reach the avr as binary frames
+static void test_startup(struct mp_context* p_mp)
+{
+    mp_dispatch_ping(p_mp, 0, 0, 0);
+    mp_dispatch_set_framing(p_mp, FRAMING_SLIP);
+    mp_dispatch_subscribe_register(p_mp, REG_INPUT_1, 0, false);
+    mp_dispatch_subscribe_register(p_mp, REG_OUTPUT_1, 0, false);
+    pump(p_mp, &s_subscribes, 2, 2000);
+
+    CHECK(1 == s_pongs);
+    CHECK(2 == s_subscribes);
+    CHECK(4 == s_avr.count);
+    CHECK((MSG_PING == s_avr.types[0]) && (FRAMING_HEX == s_avr.framings[0]));
+    CHECK((MSG_SET_FRAMING == s_avr.types[1]) && (FRAMING_HEX == s_avr.framings[1]));
+    CHECK((MSG_SUBSCRIBE_REGISTER == s_avr.types[2]) && (FRAMING_SLIP == s_avr.framings[2]));
+    CHECK((MSG_SUBSCRIBE_REGISTER == s_avr.types[3]) && (FRAMING_SLIP == s_avr.framings[3]));
+    CHECK(0 == s_avr.parser.bad_count);
+    CHECK(FRAMING_SLIP == bridge_framing(p_mp));
+}
+
+////////////////////////////////////////
+// the avr resets and reports in hex, the bridge follows
+static void test_avr_reset(struct mp_context* p_mp)
+{
+    avr_set_framing(&s_avr, FRAMING_HEX);
+    avr_send(&s_avr, MSG_SUBSCRIBE_REGISTER, REG_INPUT_1, 0x3c, 0x00);
+    pump(p_mp, &s_subscribes, 3, 2000);
+    CHECK(3 == s_subscribes);
+    CHECK(0x3c == s_subscribe_value);
+    CHECK(FRAMING_HEX == bridge_framing(p_mp));
+
+    const uint32_t count = s_avr.count;
+    mp_dispatch_ping(p_mp, 0, 0, 0);
+    pump(p_mp, &s_pongs, 2, 2000);
+    CHECK(2 == s_pongs);
+    CHECK((count + 1 == s_avr.count) && (FRAMING_HEX == s_avr.framings[count]));
+}
+
+////////////////////////////////////////
+// the avr drops to hex without a word, the bridge notices its requests
+// going unanswered and retries in hex
+static void test_avr_silent(struct mp_context* p_mp)
+{
+    mp_dispatch_set_framing(p_mp, FRAMING_SLIP);
+    mp_dispatch_ping(p_mp, 0, 0, 0);
+    pump(p_mp, &s_pongs, 3, 2000);
+    CHECK(3 == s_pongs);
+    CHECK(FRAMING_SLIP == bridge_framing(p_mp));
+
+    avr_set_framing(&s_avr, FRAMING_HEX);
+    for(uint32_t i=0; i<=FRAMING_RETRY_COUNT; ++i)
+    {
+        mp_dispatch_ping(p_mp, 0, 0, 0);
+    }
+    pump(p_mp, &s_pongs, 4, 2000);
+    pump(p_mp, &s_pongs, 5, 100);
+    CHECK(4 == s_pongs);
+    CHECK(FRAMING_HEX == bridge_framing(p_mp));
+}
+
+////////////////////////////////////////
+// firmware without MSG_SET_FRAMING, the held commands go out in hex once
+// the ack times out
+static void test_no_ack(struct mp_context* p_mp)
+{
+    s_avr.ignore_framing = true;
+    const uint32_t count = s_avr.count;
+    mp_dispatch_set_framing(p_mp, FRAMING_SLIP);
+    mp_dispatch_subscribe_register(p_mp, REG_INPUT_1, 0, false);
+    const uint32_t ms = pump(p_mp, &s_subscribes, 4, 2000);
+    CHECK(4 == s_subscribes);
+    CHECK(ms + 20 >= FRAMING_ACK_TIMEOUT_MS);
+    CHECK((count + 2 == s_avr.count) && (FRAMING_HEX == s_avr.framings[count + 1]));
+    CHECK(FRAMING_HEX == bridge_framing(p_mp));
+    s_avr.ignore_framing = false;
+}
+
+////////////////////////////////////////
+static uint32_t count_open_fds(void)
+{
+    uint32_t count = 0;
+    for(int fd=0; fd<1024; ++fd)
+    {
+        count += (fcntl(fd, F_GETFD) > -1);
+    }
+    return(count);
+}
+
+////////////////////////////////////////
+// every way mp_init() can fail must give back what it had acquired: a
+// bad device, then the fd limit stopping it at the serial port, the
+// first eventfd and the second
+static void test_init_failure(const char* p_device)
+{
+    struct mp_context mp;
+    const uint32_t before = count_open_fds();
+    CHECK(!mp_init(&mp, "/dev/no-such-tty", 57600, true));
+    CHECK(before == count_open_fds());
+
+    struct rlimit old;
+    getrlimit(RLIMIT_NOFILE, &old);
+    int highest = 0;
+    for(int fd=0; fd<1024; ++fd)
+    {
+        highest = ((fcntl(fd, F_GETFD) > -1) ? fd : highest);
+    }
+    for(rlim_t extra=1; extra<=3; ++extra)
+    {
+        const struct rlimit limit = { (rlim_t)highest + extra, old.rlim_max };
+        setrlimit(RLIMIT_NOFILE, &limit);
+        const bool ok = mp_init(&mp, p_device, 57600, true);
+        setrlimit(RLIMIT_NOFILE, &old);
+        CHECK(!ok);
+        CHECK(before == count_open_fds());
+    }
+}
+
+////////////////////////////////////////
+// the avr end goes away, the serial thread must stop rather than spin on
+// POLLHUP, and mp_close() must still return
+static void test_hangup(struct mp_context* p_mp, const int p_master)
+{
+    close(p_master);
+
+    struct timespec start;
+    struct timespec end;
+    usleep(100000);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+    usleep(300000);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
+    const long cpu_ms = (((end.tv_sec - start.tv_sec) * 1000L) + ((end.tv_nsec - start.tv_nsec) / 1000000L));
+    printf("cpu while hung up: %ldms of 300ms\n", cpu_ms);
+    CHECK(cpu_ms < 30);
+
+    mp_close(p_mp);
+}
+
+////////////////////////////////////////
+int main(int argc, char* argv[])
+{
+    const int master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if((master < 0) || (0 != grantpt(master)) || (0 != unlockpt(master)))
+    {
+        printf("no pty\n");
+        return(EXIT_FAILURE);
+    }
+    s_avr.fd = master;
+    avr_set_framing(&s_avr, FRAMING_HEX);
+
+    test_init_failure(ptsname(master));
+
+    struct mp_context mp;
+    if(!mp_init(&mp, ptsname(master), 57600, true))
+    {
+        printf("mp_init failed\n");
+        return(EXIT_FAILURE);
+    }
+
+    test_startup(&mp);
+    test_avr_reset(&mp);
+    test_avr_silent(&mp);
+    test_no_ack(&mp);
+    test_hangup(&mp, master);
+
+    printf("%s\n", ((0 == s_failures) ? "ok" : "FAILED"));
+    return((0 == s_failures) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,290 @@
+//
+// Copyright 2015-2017 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its 
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including, 
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR 
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any 
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "ring_buf.h"
+#include "msg_queue.h"
+
+
+//
+// ring_buf.h and msg_queue.h with a real producer thread and a real
+// consumer thread: the producer pushes a numbered stream, the consumer
+// checks every item arrives once and in order. the rings are kept small
+// so both indexes wrap constantly and the full/empty edges are hit all
+// the time. the queue consumer only wakes on the eventfd, a lost wakeup
+// shows up as a poll timeout with records still missing
+//
+
+#define STREAM_BYTES    (16 * 1024 * 1024)
+#define QUEUE_RECORDS   (4 * 1024 * 1024)
+#define QUEUE_DEPTH     8
+#define WAKEUP_TIMEOUT_MS 2000
+
+static int s_failures = 0;
+
+#define CHECK(cond) do { if(!(cond)) { printf("FAIL: %s %d - %s\n", __FILE__, __LINE__, #cond); ++s_failures; } } while(0)
+
+
+////////////////////////////////////////
+// byte p_index of the test stream, not periodic in the ring capacity
+static inline uint8_t stream_byte(const uint32_t p_index)
+{
+    return((uint8_t)(p_index ^ (p_index >> 8) ^ (p_index >> 16)));
+}
+
+////////////////////////////////////////
+// small xorshift so both threads pick chunk sizes without sharing state
+static inline uint32_t next_rand(uint32_t* p_state)
+{
+    uint32_t x = *p_state;
+    x ^= (x << 13);
+    x ^= (x >> 17);
+    x ^= (x << 5);
+    *p_state = x;
+    return(x);
+}
+
+
+////////////////////////////////////////
+// ring_buf: byte stream through rb_push_back / rb_set_data, drained with
+// rb_pop_front / rb_get_data / rb_peek + rb_consume
+static struct ring_buf_data s_rb;
+
+static void* rb_producer(void* p_arg)
+{
+    uint32_t seed = 0x1234567;
+    uint8_t chunk[16];
+    uint32_t sent = 0;
+    while(sent < STREAM_BYTES)
+    {
+        const uint32_t r = next_rand(&seed);
+        if(0 == (r & 3))
+        {
+            if(rb_push_back(&s_rb, stream_byte(sent)))
+            {
+                ++sent;
+            }
+            else
+            {
+                sched_yield();
+            }
+            continue;
+        }
+
+        uint32_t len = (1 + ((r >> 2) % sizeof(chunk)));
+        if(len > (STREAM_BYTES - sent))
+        {
+            len = (STREAM_BYTES - sent);
+        }
+        for(uint32_t i=0; i<len; ++i)
+        {
+            chunk[i] = stream_byte(sent + i);
+        }
+        const uint32_t pushed = rb_set_data(&s_rb, chunk, len);
+        sent += pushed;
+        if(pushed < len)
+        {
+            sched_yield();
+        }
+    }
+    return(0);
+}
+
+static void* rb_consumer(void* p_arg)
+{
+    uint32_t seed = 0x7654321;
+    uint8_t chunk[16];
+    uint32_t received = 0;
+    uint32_t mismatches = 0;
+    while(received < STREAM_BYTES)
+    {
+        if(rb_empty(&s_rb))
+        {
+            sched_yield();
+            continue;
+        }
+
+        const uint32_t r = next_rand(&seed);
+        switch(r % 3)
+        {
+            case 0:
+            {
+                mismatches += (stream_byte(received) != rb_pop_front(&s_rb));
+                ++received;
+                break;
+            }
+            case 1:
+            {
+                const uint32_t len = rb_get_data(&s_rb, chunk, (1 + ((r >> 2) % sizeof(chunk))));
+                for(uint32_t i=0; i<len; ++i)
+                {
+                    mismatches += (stream_byte(received + i) != chunk[i]);
+                }
+                received += len;
+                break;
+            }
+            default:
+            {
+                const uint8_t* data;
+                const uint32_t len = rb_peek(&s_rb, &data);
+                for(uint32_t i=0; i<len; ++i)
+                {
+                    mismatches += (stream_byte(received + i) != data[i]);
+                }
+                rb_consume(&s_rb, len);
+                received += len;
+                break;
+            }
+        }
+    }
+    *(uint32_t*)p_arg = mismatches;
+    return(0);
+}
+
+static void test_ring_buf(void)
+{
+    CHECK(rb_init(&s_rb, 64));
+
+    uint32_t mismatches = 0xffffffff;
+    pthread_t producer, consumer;
+    CHECK(0 == pthread_create(&consumer, 0, rb_consumer, &mismatches));
+    CHECK(0 == pthread_create(&producer, 0, rb_producer, 0));
+    pthread_join(producer, 0);
+    pthread_join(consumer, 0);
+
+    printf("ring_buf: %u bytes through a %u byte ring, %u out of order\n", STREAM_BYTES, rb_capacity(&s_rb), mismatches);
+    CHECK(0 == mismatches);
+    CHECK(rb_empty(&s_rb));
+    rb_free(&s_rb);
+}
+
+
+////////////////////////////////////////
+// msg_queue: numbered records, the sequence number split over the type
+// and param bytes, the consumer woken only through the eventfd
+static struct msg_queue s_mq;
+static uint32_t s_refused = 0;
+
+static void* mq_producer(void* p_arg)
+{
+    uint32_t seed = 0x2468ace;
+    uint32_t refused = 0;
+    for(uint32_t seq=0; seq<QUEUE_RECORDS; )
+    {
+        // hold the wakeup now and then, as mp_on_* does for a batch
+        const bool signal = ((0 != (next_rand(&seed) & 3)) || ((seq + 1) == QUEUE_RECORDS));
+        if(mq_push(&s_mq, (uint8_t)(seq >> 24), (uint8_t)(seq >> 16), (uint8_t)(seq >> 8), (uint8_t)seq, signal))
+        {
+            ++seq;
+            continue;
+        }
+
+        // full, make sure the consumer is awake before backing off
+        ++refused;
+        mq_signal(&s_mq);
+        sched_yield();
+    }
+    s_refused = refused;
+    return(0);
+}
+
+static void* mq_consumer(void* p_arg)
+{
+    uint32_t expected = 0;
+    uint32_t mismatches = 0;
+    uint32_t timeouts = 0;
+    struct pollfd fds = { mq_get_fd(&s_mq), POLLIN, 0 };
+    while(expected < QUEUE_RECORDS)
+    {
+        const int rc = poll(&fds, 1, WAKEUP_TIMEOUT_MS);
+        if(0 == rc)
+        {
+            // records still missing and no wakeup, one was lost
+            ++timeouts;
+            if(timeouts > 2)
+            {
+                break;
+            }
+        }
+        else if(rc < 0)
+        {
+            break;
+        }
+
+        mq_clear_event(&s_mq);
+        struct mq_record rec;
+        while(mq_pop(&s_mq, &rec))
+        {
+            const uint32_t seq = (((uint32_t)rec.type << 24) | ((uint32_t)rec.param1 << 16) | ((uint32_t)rec.param2 << 8) | rec.param3);
+            mismatches += (seq != expected);
+            expected = (seq + 1);
+            mq_delivered(&s_mq, &rec, mq_now_ns());
+        }
+    }
+    ((uint32_t*)p_arg)[0] = mismatches;
+    ((uint32_t*)p_arg)[1] = timeouts;
+    ((uint32_t*)p_arg)[2] = expected;
+    return(0);
+}
+
+static void test_msg_queue(void)
+{
+    CHECK(mq_init(&s_mq, QUEUE_DEPTH));
+
+    uint32_t result[3] = { 0xffffffff, 0xffffffff, 0 };
+    pthread_t producer, consumer;
+    const uint64_t start = mq_now_ns();
+    CHECK(0 == pthread_create(&consumer, 0, mq_consumer, result));
+    CHECK(0 == pthread_create(&producer, 0, mq_producer, 0));
+    pthread_join(producer, 0);
+    pthread_join(consumer, 0);
+    const uint64_t elapsed = (mq_now_ns() - start);
+
+    struct mq_stats stats;
+    mq_get_stats(&s_mq, &stats);
+    printf("msg_queue: %u records, %u out of order, %u wakeup timeouts, %.0f ns/record\n",
+        result[2], result[0], result[1], ((double)elapsed / QUEUE_RECORDS));
+    printf("msg_queue: depth %u  max %u/%u  delivered %u  refused %u (counted as drops %u)\n",
+        stats.depth, stats.high_water, QUEUE_DEPTH, stats.delivered, s_refused, stats.drops);
+
+    CHECK(QUEUE_RECORDS == result[2]);
+    CHECK(0 == result[0]);
+    CHECK(0 == result[1]);
+    CHECK(0 == stats.depth);
+    CHECK(QUEUE_DEPTH >= stats.high_water);
+    CHECK(QUEUE_RECORDS == stats.delivered);
+    CHECK(s_refused == stats.drops);
+    mq_free(&s_mq);
+}
+
+////////////////////////////////////////
+int main(int argc, char* argv[])
+{
+    test_ring_buf();
+    test_msg_queue();
+
+    printf("%s\n", ((0 == s_failures) ? "ok" : "FAILED"));
+    return((0 == s_failures) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
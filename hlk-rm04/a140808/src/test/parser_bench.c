@@ -0,0 +1,261 @@
+//
+// Copyright 2015-2017 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its 
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including, 
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR 
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any 
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "msg_buf.h"
+#include "msg_parser.h"
+
+
+//
+// frames per second through the incremental parser (msg_parser.h)
+// against the path it replaced, copied below from the original
+// ring_buf.h and msg_buf.h: every byte pushed into a 14 byte ring, then
+// the whole frame validated and its crc recomputed bit by bit
+//
+// parser_bench [frames]
+//
+
+#define OLD_COUNT  14
+
+struct old_ring
+{
+    uint8_t buff[OLD_COUNT];
+    uint8_t* end;
+    uint8_t* first;
+    uint8_t* last;
+    uint8_t  size;
+};
+
+////////////////////////////////////////
+static void old_init(struct old_ring* p_pd)
+{
+    p_pd->end = (p_pd->buff + OLD_COUNT);
+    p_pd->first = p_pd->last = p_pd->buff;
+    p_pd->size = 0;
+}
+
+////////////////////////////////////////
+static inline void old_push_back(struct old_ring* p_pd, const uint8_t p_item)
+{
+    if(OLD_COUNT == p_pd->size)
+    {
+        *p_pd->last = p_item;
+        if(++p_pd->last == p_pd->end) p_pd->last = p_pd->buff;
+        p_pd->first = p_pd->last;
+    }
+    else
+    {
+        *p_pd->last = p_item;
+        if(++p_pd->last == p_pd->end) p_pd->last = p_pd->buff;
+        ++p_pd->size;
+    }
+}
+
+////////////////////////////////////////
+static inline uint8_t old_at(struct old_ring* p_pd, const uint8_t p_index)
+{
+    if(p_index >= p_pd->size)
+    {
+        return(0);
+    }
+    if(p_index < (p_pd->end - p_pd->first))
+    {
+        return(*(p_pd->first + p_index));
+    }
+    return(*(p_pd->first + (p_index - OLD_COUNT)));
+}
+
+////////////////////////////////////////
+static inline uint16_t old_update_crc16(const uint16_t p_crc, const uint8_t p_ch)
+{
+    uint16_t crc = (p_crc ^ (uint16_t)p_ch);
+    for(uint8_t i=0; i<8; ++i)
+    {
+        crc = ((0 == (crc & 0x0001)) ? (crc >> 1) : ((crc >> 1) ^ 0xa001));
+    }
+    return(crc);
+}
+
+////////////////////////////////////////
+static inline uint8_t old_validate(struct old_ring* p_pd)
+{
+    if(p_pd->size < 14)
+    {
+        return(S_INCOMPLETE_BUFFER);
+    }
+    if((MSG_BEGIN_CHAR != old_at(p_pd, 0)) || (MSG_END_CHAR != old_at(p_pd, 13)))
+    {
+        return(E_BAD_FRAME);
+    }
+
+    const uint16_t rxCrc = ((((uint16_t)HEX2DEC(old_at(p_pd,  9))) << 12) | (((uint16_t)HEX2DEC(old_at(p_pd, 10))) << 8) |
+                            (((uint16_t)HEX2DEC(old_at(p_pd, 11))) <<  4) |  ((uint16_t)HEX2DEC(old_at(p_pd, 12))));
+    uint16_t crc = 0xffff;
+    for(uint8_t i=1; i<9; ++i)
+    {
+        crc = old_update_crc16(crc, old_at(p_pd, i));
+    }
+    return((rxCrc != crc) ? E_BAD_CRC : S_OK);
+}
+
+////////////////////////////////////////
+static inline bool old_get_bytes(struct old_ring* p_pd, uint8_t* p_val)
+{
+    if(S_OK != old_validate(p_pd))
+    {
+        return(false);
+    }
+    for(uint8_t i=0; i<4; ++i)
+    {
+        p_val[i] = ((HEX2DEC(old_at(p_pd, 1 + i * 2)) << 4) | HEX2DEC(old_at(p_pd, 2 + i * 2)));
+    }
+    return(true);
+}
+
+
+////////////////////////////////////////
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(ts.tv_sec + (ts.tv_nsec / 1e9));
+}
+
+////////////////////////////////////////
+// p_frames random frames back to back, returns the stream length
+static uint32_t make_stream(const uint8_t p_framing, uint8_t* p_out, const uint32_t p_frames, uint32_t* p_sum)
+{
+    struct ring_buf_data rb;
+    mb_init(&rb);
+    uint32_t len = 0;
+    *p_sum = 0;
+    for(uint32_t i=0; i<p_frames; ++i)
+    {
+        const uint8_t v[4] = { (uint8_t)rand(), (uint8_t)rand(), (uint8_t)rand(), (uint8_t)rand() };
+        *p_sum += (v[0] + v[1] + v[2] + v[3]);
+        if(FRAMING_SLIP == p_framing)
+        {
+            mb_set_slip_bytes(&rb, v[0], v[1], v[2], v[3]);
+        }
+        else
+        {
+            mb_set_bytes(&rb, v[0], v[1], v[2], v[3]);
+        }
+        for(uint32_t j=0; j<rb_size(&rb); ++j)
+        {
+            p_out[len++] = rb_at(&rb, j);
+        }
+    }
+    mb_free(&rb);
+    return(len);
+}
+
+////////////////////////////////////////
+static void report(const char* p_name, const uint32_t p_frames, const double p_sec, const double p_base)
+{
+    printf("%-22s %10.0f frames/s  %7.1f ns/frame", p_name, (p_frames / p_sec), (p_sec * 1e9 / p_frames));
+    if(p_base > 0.0)
+    {
+        printf("  %5.1fx", (p_base / p_sec));
+    }
+    printf("\n");
+}
+
+////////////////////////////////////////
+int main(int argc, char* argv[])
+{
+    const uint32_t frames = ((argc > 1) ? (uint32_t)atoi(argv[1]) : 1000000);
+    uint8_t* hex = malloc(frames * 14);
+    uint8_t* slip = malloc(frames * 14);
+    if((NULL == hex) || (NULL == slip))
+    {
+        return(EXIT_FAILURE);
+    }
+
+    srand(1);
+    uint32_t hexSum;
+    uint32_t slipSum;
+    const uint32_t hexLen = make_stream(FRAMING_HEX, hex, frames, &hexSum);
+    const uint32_t slipLen = make_stream(FRAMING_SLIP, slip, frames, &slipSum);
+
+    // old path, hex only
+    struct old_ring old;
+    old_init(&old);
+    uint32_t count = 0;
+    uint32_t sum = 0;
+    double start = now_sec();
+    for(uint32_t i=0; i<hexLen; ++i)
+    {
+        old_push_back(&old, hex[i]);
+        uint8_t v[4];
+        if((S_OK == old_validate(&old)) && old_get_bytes(&old, v))
+        {
+            sum += (v[0] + v[1] + v[2] + v[3]);
+            ++count;
+        }
+    }
+    const double oldSec = (now_sec() - start);
+    if((frames != count) || (hexSum != sum))
+    {
+        printf("old path decoded %u of %u frames\n", count, frames);
+        return(EXIT_FAILURE);
+    }
+
+    // incremental parser, both framings
+    struct msg_parser_data pd;
+    double sec[2];
+    for(uint32_t f=0; f<2; ++f)
+    {
+        const uint8_t* stream = ((0 == f) ? hex : slip);
+        const uint32_t len = ((0 == f) ? hexLen : slipLen);
+        pr_init(&pd);
+        pr_set_framing(&pd, ((0 == f) ? FRAMING_HEX : FRAMING_SLIP));
+        count = 0;
+        sum = 0;
+        start = now_sec();
+        for(uint32_t i=0; i<len; ++i)
+        {
+            uint8_t v[4];
+            if((S_OK == pr_push(&pd, stream[i])) && pr_get_bytes(&pd, &v[0], &v[1], &v[2], &v[3]))
+            {
+                sum += (v[0] + v[1] + v[2] + v[3]);
+                ++count;
+            }
+        }
+        sec[f] = (now_sec() - start);
+        if((frames != count) || (((0 == f) ? hexSum : slipSum) != sum))
+        {
+            printf("parser decoded %u of %u frames\n", count, frames);
+            return(EXIT_FAILURE);
+        }
+    }
+
+    printf("%u frames, %.1f bytes/frame hex, %.1f bytes/frame slip\n", frames, ((double)hexLen / frames), ((double)slipLen / frames));
+    report("ring + validate (hex)", frames, oldSec, 0.0);
+    report("msg_parser (hex)", frames, sec[0], oldSec);
+    report("msg_parser (slip)", frames, sec[1], oldSec);
+
+    free(hex);
+    free(slip);
+    return(EXIT_SUCCESS);
+}
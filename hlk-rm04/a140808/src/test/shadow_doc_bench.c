@@ -0,0 +1,157 @@
+//
+// Copyright 2015-2017 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its 
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including, 
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR 
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any 
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "shadow_doc.h"
+
+
+//
+// reports per second through sd_render() against snprintf:
+//
+//   build_report_json  the original path, the sdk's client token
+//                      ("%s-%d" into its own buffer) then the document
+//                      around the echoed delta text
+//   snprintf           the document sd_render() produces, formatted with
+//                      snprintf, also the byte for byte reference
+//   sd_render          patch the changed digits and token nibbles
+//
+// the first three change a random set of bits every report, more than a
+// real input change does, the last changes one. the host numbers only
+// give the ratio, the MIPS target has not been measured.
+//
+// shadow_doc_bench [reports]
+//
+
+#define THING_NAME  "a140808-0123456789ab"
+#define DELTA_TEXT  "{\"o1\":1,\"o2\":0,\"o3\":1}"
+
+static volatile uint32_t s_sink = 0;
+
+
+////////////////////////////////////////
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(ts.tv_sec + (ts.tv_nsec / 1e9));
+}
+
+////////////////////////////////////////
+static inline uint32_t next_rand(uint32_t* p_state)
+{
+    uint32_t x = *p_state;
+    x ^= (x << 13);
+    x ^= (x >> 17);
+    x ^= (x << 5);
+    *p_state = x;
+    return(x);
+}
+
+////////////////////////////////////////
+// the document sd_render() patches, formatted from scratch
+static int snprintf_doc(char* p_buf, const size_t p_size, const uint8_t p_in, const uint8_t p_out, const uint32_t p_seq)
+{
+    return(snprintf(p_buf, p_size,
+        "{\"state\":{\"reported\":{\"i0\":%d,\"i1\":%d,\"i2\":%d,\"i3\":%d,\"i4\":%d,\"i5\":%d,\"i6\":%d,\"i7\":%d,"
+        "\"o0\":%d,\"o1\":%d,\"o2\":%d,\"o3\":%d,\"o4\":%d,\"o5\":%d,\"o6\":%d,\"o7\":%d}},\"clientToken\":\"%s-%08x\"}",
+        (p_in & 1), ((p_in >> 1) & 1), ((p_in >> 2) & 1), ((p_in >> 3) & 1), ((p_in >> 4) & 1), ((p_in >> 5) & 1), ((p_in >> 6) & 1), ((p_in >> 7) & 1),
+        (p_out & 1), ((p_out >> 1) & 1), ((p_out >> 2) & 1), ((p_out >> 3) & 1), ((p_out >> 4) & 1), ((p_out >> 5) & 1), ((p_out >> 6) & 1), ((p_out >> 7) & 1),
+        THING_NAME, p_seq));
+}
+
+////////////////////////////////////////
+int main(int argc, char* argv[])
+{
+    const uint32_t reports = ((argc > 1) ? (uint32_t)atoi(argv[1]) : 2000000);
+
+    // same bytes first, sd_render() against the snprintf reference
+    struct shadow_doc sd;
+    if(!sd_init(&sd, THING_NAME))
+    {
+        printf("sd_init failed\n");
+        return(EXIT_FAILURE);
+    }
+    uint32_t seed = 1;
+    uint32_t mismatches = 0;
+    for(uint32_t i=1; i<=100000; ++i)
+    {
+        const uint32_t r = next_rand(&seed);
+        char ref[256];
+        const int len = snprintf_doc(ref, sizeof(ref), (uint8_t)r, (uint8_t)(r >> 8), i);
+        const char* doc = sd_render(&sd, (uint8_t)r, (uint8_t)(r >> 8));
+        mismatches += ((len != sd_length(&sd)) || (0 != memcmp(ref, doc, len)) || ('\0' != doc[len]));
+    }
+    printf("sd_render against snprintf: %u mismatches in 100000 reports\n", mismatches);
+
+    // build_report_json
+    char doc[1024];
+    char token[80];
+    seed = 1;
+    uint32_t token_seq = 0;
+    double start = now_sec();
+    for(uint32_t i=0; i<reports; ++i)
+    {
+        const uint32_t r = next_rand(&seed);
+        snprintf(token, sizeof(token), "%s-%d", THING_NAME, (int)token_seq++);
+        const int len = snprintf(doc, sizeof(doc), "{\"state\":{\"reported\":%.*s}, \"clientToken\":\"%s\"}", (int)(sizeof(DELTA_TEXT) - 1), DELTA_TEXT, token);
+        s_sink ^= (uint32_t)(len + doc[(r & 0x0f)]);
+    }
+    const double original = ((now_sec() - start) / reports);
+
+    // snprintf of the full document
+    seed = 1;
+    start = now_sec();
+    for(uint32_t i=0; i<reports; ++i)
+    {
+        const uint32_t r = next_rand(&seed);
+        const int len = snprintf_doc(doc, sizeof(doc), (uint8_t)r, (uint8_t)(r >> 8), i);
+        s_sink ^= (uint32_t)(len + doc[(r & 0x0f)]);
+    }
+    const double formatted = ((now_sec() - start) / reports);
+
+    // sd_render
+    seed = 1;
+    start = now_sec();
+    for(uint32_t i=0; i<reports; ++i)
+    {
+        const uint32_t r = next_rand(&seed);
+        const char* pdoc = sd_render(&sd, (uint8_t)r, (uint8_t)(r >> 8));
+        s_sink ^= (uint32_t)(sd_length(&sd) + pdoc[(r & 0x0f)]);
+    }
+    const double patched = ((now_sec() - start) / reports);
+
+    // sd_render, one input toggling as a real input change would
+    start = now_sec();
+    for(uint32_t i=0; i<reports; ++i)
+    {
+        const char* pdoc = sd_render(&sd, (uint8_t)(i & 0x01), 0x5a);
+        s_sink ^= (uint32_t)(sd_length(&sd) + pdoc[(i & 0x0f)]);
+    }
+    const double one_bit = ((now_sec() - start) / reports);
+
+    printf("build_report_json  %7.1f ns/report\n", (original * 1e9));
+    printf("snprintf           %7.1f ns/report\n", (formatted * 1e9));
+    printf("sd_render          %7.1f ns/report  (%.0fx snprintf, %.0fx build_report_json)\n", (patched * 1e9), (formatted / patched), (original / patched));
+    printf("sd_render, 1 bit   %7.1f ns/report  (%.0fx snprintf, %.0fx build_report_json)\n", (one_bit * 1e9), (formatted / one_bit), (original / one_bit));
+    return((0 == mismatches) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,387 @@
+//
+// Copyright 2015-2017 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its 
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including, 
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR 
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any 
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+#define _GNU_SOURCE  // posix_openpt() and friends
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "msg_buf.h"
+#include "msg_parser.h"
+#include "msg_proc.h"
+#include "phase.h"
+#include "report_gate.h"
+
+
+//
+// time to the first report, with the avr sync before the connect (the
+// order main.c uses now) and after it (the order it used before). one
+// board is a pty driven by msg_proc.c as main.c drives the serial port,
+// a fake avr answers the ping and the two subscribe requests the way
+// avr_impl.cpp does, and the report goes out when report_gate.h lets
+// it, the rule aws_iot_shadow.c runs.
+//
+// this is a model of the startup, not a run of the daemon.
+//
+// the network side (ip wait, tcp, tls, mqtt and the thing subscribes)
+// is a blocking sleep of the given length, as shadow_connect() blocks
+// without servicing the boards. it is charged to the tls phase. the
+// phase lines are ph_end()'s, PH_REPORT runs to the report itself
+// rather than to main.c's first shadow_report_inputs() call.
+//
+// a pty has no baud rate, the fake avr holds each frame for its wire
+// time at 57,600 E71 (10 bits a char) in both directions.
+//
+// startup_bench [network ms ...]
+//
+
+#define RUNS          3
+#define CHAR_US       ((10 * 1000000) / SERIAL_BAUD)
+#define INPUT_VALUE   0x05
+#define OUTPUT_VALUE  0x00
+
+enum order
+{
+    SYNC_AFTER_CONNECT = 0,  // before cceb93f
+    SYNC_BEFORE_CONNECT,     // main.c now
+};
+
+static struct mp_context s_board;
+static int s_avr_fd = -1;
+static volatile bool s_avr_run = false;
+
+// the one thing's report state, as shadow_thing keeps it
+static struct report_gate s_gate;
+
+
+////////////////////////////////////////
+// aws_iot_shadow.c's clock
+static uint64_t now_ms(void)
+{
+    return(mq_now_ns() / 1000000ULL);
+}
+
+////////////////////////////////////////
+static void sleep_until_ns(const uint64_t p_ns)
+{
+    const uint64_t now = mq_now_ns();
+    if(p_ns > now)
+    {
+        const struct timespec ts = { (time_t)((p_ns - now) / 1000000000ULL), (long)((p_ns - now) % 1000000000ULL) };
+        nanosleep(&ts, NULL);
+    }
+}
+
+
+//
+// bridge callbacks
+//
+
+void mp_on_pong(struct mp_context* p_mp, const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3)
+{
+}
+
+void mp_on_read_register(struct mp_context* p_mp, const uint8_t p_registerAddress)
+{
+}
+
+void mp_on_write_register(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_value, const uint8_t p_mask)
+{
+}
+
+void mp_on_write_register_bit(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const bool p_state)
+{
+}
+
+void mp_on_pulse_register_bit(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_bit, const uint16_t p_durationMs)
+{
+}
+
+////////////////////////////////////////
+// shadow_input_changed() and shadow_output_changed()
+void mp_on_subscribe_register(struct mp_context* p_mp, const uint8_t p_registerAddress, const uint8_t p_value, const bool p_cancel)
+{
+    if(p_cancel)
+    {
+        return;
+    }
+    if(REG_INPUT_1 == p_registerAddress)
+    {
+        rg_input(&s_gate, now_ms(), INPUT_COALESCE_MS);
+    }
+    else if(REG_OUTPUT_1 == p_registerAddress)
+    {
+        rg_output(&s_gate, now_ms());
+    }
+}
+
+
+//
+// fake avr
+//
+
+////////////////////////////////////////
+// the frame is written once its last char would have left the avr
+static uint64_t avr_send(const uint64_t p_line_free_ns, const uint8_t p_type, const uint8_t p_param1, const uint8_t p_param2, const uint8_t p_param3)
+{
+    struct ring_buf_data rb;
+    mb_init(&rb);
+    mb_set_bytes(&rb, p_type, p_param1, p_param2, p_param3);
+    uint8_t frame[16];
+    const uint32_t len = rb_size(&rb);
+    for(uint32_t i=0; i<len; ++i)
+    {
+        frame[i] = rb_at(&rb, i);
+    }
+    mb_free(&rb);
+
+    const uint64_t now = mq_now_ns();
+    const uint64_t done = (((p_line_free_ns > now) ? p_line_free_ns : now) + (len * CHAR_US * 1000ULL));
+    sleep_until_ns(done);
+    if(len != (uint32_t)write(s_avr_fd, frame, len))
+    {
+        // the pty is far from full at startup
+    }
+    return(done);
+}
+
+////////////////////////////////////////
+// each char is taken once it would have arrived, the requests come
+// back to back so the answers overlap the next request on the wire
+static void* avr_thread(void* p_arg)
+{
+    struct msg_parser_data parser;
+    pr_init(&parser);
+    uint64_t rx_free_ns = 0;
+    uint64_t tx_free_ns = 0;
+
+    struct pollfd pfd = { .fd = s_avr_fd, .events = POLLIN };
+    while(s_avr_run)
+    {
+        if(poll(&pfd, 1, 20) <= 0)
+        {
+            continue;
+        }
+        uint8_t buf[256];
+        const ssize_t len = read(s_avr_fd, buf, sizeof(buf));
+        const uint64_t now = mq_now_ns();
+        for(ssize_t i=0; i<len; ++i)
+        {
+            rx_free_ns = (((rx_free_ns > now) ? rx_free_ns : now) + (CHAR_US * 1000ULL));
+            uint8_t type;
+            uint8_t param1;
+            uint8_t param2;
+            uint8_t param3;
+            if((S_OK != pr_push(&parser, buf[i])) || !pr_get_bytes(&parser, &type, &param1, &param2, &param3))
+            {
+                continue;
+            }
+            sleep_until_ns(rx_free_ns);
+            if(MSG_PING == type)
+            {
+                tx_free_ns = avr_send(tx_free_ns, MSG_PONG, param1, param2, param3);
+            }
+            else if((MSG_SUBSCRIBE_REGISTER == type) && (REG_INPUT_1 == param1))
+            {
+                tx_free_ns = avr_send(tx_free_ns, MSG_SUBSCRIBE_REGISTER, REG_INPUT_1, INPUT_VALUE, 0x00);
+            }
+            else if((MSG_SUBSCRIBE_REGISTER == type) && (REG_OUTPUT_1 == param1))
+            {
+                tx_free_ns = avr_send(tx_free_ns, MSG_SUBSCRIBE_REGISTER, REG_OUTPUT_1, OUTPUT_VALUE, 0x00);
+            }
+        }
+    }
+    return(NULL);
+}
+
+
+//
+// bridge side
+//
+
+////////////////////////////////////////
+// log output from msg_proc.c and serial.c goes to /dev/null while
+// p_quiet, the open and close lines would bury the table
+static void quiet(const bool p_quiet)
+{
+    static int s_stdout = -1;
+    fflush(stdout);
+    if(p_quiet)
+    {
+        s_stdout = dup(STDOUT_FILENO);
+        const int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    }
+    else if(s_stdout > -1)
+    {
+        dup2(s_stdout, STDOUT_FILENO);
+        close(s_stdout);
+        s_stdout = -1;
+    }
+}
+
+////////////////////////////////////////
+// main.c's board setup, the open and the sync requests
+static bool open_board(void)
+{
+    quiet(true);
+    const bool ok = mp_init(&s_board, ptsname(s_avr_fd), SERIAL_BAUD, false);
+    quiet(false);
+    if(ok)
+    {
+        mp_dispatch_ping(&s_board, 0, 0, 0);
+        mp_dispatch_subscribe_register(&s_board, REG_INPUT_1, 0, false);
+        mp_dispatch_subscribe_register(&s_board, REG_OUTPUT_1, 0, false);
+    }
+    return(ok);
+}
+
+////////////////////////////////////////
+// main.c's loop until shadow_report_inputs() would publish
+static void wait_for_report(void)
+{
+    struct pollfd pfd = { .fd = mp_get_fd(&s_board), .events = POLLIN };
+    while(true)
+    {
+        const uint64_t now = now_ms();
+        if(rg_take(&s_gate, now))
+        {
+            if(s_gate.output_known)
+            {
+                return;
+            }
+            // deferred, as shadow_report_inputs() does
+            rg_defer(&s_gate, now, ((INPUT_COALESCE_MS > SHADOW_SERVICE_MS) ? INPUT_COALESCE_MS : SHADOW_SERVICE_MS));
+        }
+        if((poll(&pfd, 1, rg_wait_ms(&s_gate, now)) > 0) && (0 != (pfd.revents & POLLIN)))
+        {
+            mp_poll(&s_board);
+        }
+    }
+}
+
+////////////////////////////////////////
+// returns the ms from start to the first report, negative on error
+static double run(const enum order p_order, const uint32_t p_network_ms, const bool p_show)
+{
+    s_avr_fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if((s_avr_fd < 0) || (0 != grantpt(s_avr_fd)) || (0 != unlockpt(s_avr_fd)))
+    {
+        return(-1.0);
+    }
+    rg_init(&s_gate);
+
+    pthread_t avr;
+    s_avr_run = true;
+    pthread_create(&avr, NULL, avr_thread, NULL);
+
+    const struct timespec network = { (time_t)(p_network_ms / 1000), (long)((p_network_ms % 1000) * 1000000L) };
+    const uint64_t start = mq_now_ns();
+    ph_begin(PH_BOOT);
+    bool ok = true;
+    if(SYNC_BEFORE_CONNECT == p_order)
+    {
+        ok = open_board();
+        ph_mark(PH_BOARDS);
+        nanosleep(&network, NULL);
+        ph_mark(PH_TLS);
+        // the answers that came in during the connect
+        mp_poll(&s_board);
+        ph_mark(PH_SUBSCRIBE);
+    }
+    else
+    {
+        nanosleep(&network, NULL);
+        ph_mark(PH_TLS);
+        ok = open_board();
+        ph_mark(PH_BOARDS);
+    }
+    if(ok)
+    {
+        wait_for_report();
+    }
+    const uint64_t end = mq_now_ns();
+    ph_mark(PH_REPORT);
+    quiet(!p_show);
+    ph_end();
+    quiet(false);
+
+    s_avr_run = false;
+    pthread_join(avr, NULL);
+    quiet(true);
+    if(ok)
+    {
+        mp_close(&s_board);
+    }
+    quiet(false);
+    close(s_avr_fd);
+    s_avr_fd = -1;
+
+    return(ok ? ((end - start) / 1000000.0) : -1.0);
+}
+
+////////////////////////////////////////
+int main(int argc, char* argv[])
+{
+    uint32_t networks[16] = { 0, 100, 500, 2000 };
+    int count = 4;
+    if(argc > 1)
+    {
+        count = 0;
+        for(int i=1; (i<argc) && (count < 16); ++i)
+        {
+            networks[count++] = (uint32_t)atoi(argv[i]);
+        }
+    }
+
+    printf("startup model, 1 board, 57600 E71 hex frames, %d runs a row, first run's phases:\n", RUNS);
+    double ms[16][2];
+    for(int i=0; i<count; ++i)
+    {
+        for(int order=0; order<2; ++order)
+        {
+            double sum = 0.0;
+            for(int r=0; r<RUNS; ++r)
+            {
+                const double t = run((enum order)order, networks[i], (0 == r));
+                if(t < 0.0)
+                {
+                    printf("could not open a pty\n");
+                    return(EXIT_FAILURE);
+                }
+                sum += t;
+            }
+            ms[i][order] = (sum / RUNS);
+        }
+    }
+
+    printf("network ms  sync after connect  sync before connect     saved\n");
+    for(int i=0; i<count; ++i)
+    {
+        printf("%10u  %15.1f ms  %16.1f ms  %6.1f ms\n", networks[i], ms[i][SYNC_AFTER_CONNECT], ms[i][SYNC_BEFORE_CONNECT],
+            (ms[i][SYNC_AFTER_CONNECT] - ms[i][SYNC_BEFORE_CONNECT]));
+    }
+    return(EXIT_SUCCESS);
+}
@@ -0,0 +1,494 @@
+//
+// Copyright 2015-2017 The REST Switch Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, Licensor provides the Work (and each Contributor provides its 
+// Contributions) on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied, including, 
+// without limitation, any warranties or conditions of TITLE, NON-INFRINGEMENT, MERCHANTABILITY, or FITNESS FOR A PARTICULAR 
+// PURPOSE. You are solely responsible for determining the appropriateness of using or redistributing the Work and assume any 
+// risks associated with Your exercise of permissions under this License.
+//
+// Author: John Clark (johnc@restswitch.com)
+//
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <network_interface.h>
+#include <mbedtls/certs.h>
+#include <mbedtls/ssl_cache.h>
+#include <mbedtls/ssl_ticket.h>
+
+#include "aws_iot_config.h"
+#include "config.h"
+#include "network_mbedtls.h"
+
+
+//
+// full against resumed tls handshakes through network_mbedtls.c, the
+// wrapper the bridge connects with. the server is a cut down mbedtls
+// ssl_server in a child process on loopback: the mbedtls test
+// certificates, a client certificate required as the aws endpoint does,
+// and a delta sized answer to each report. one round per server:
+//
+//   full      no session cache and no tickets, every handshake is full
+//   resumed   session cache and tickets, only the first one is full
+//
+// the client offers its last session in both rounds, as the bridge
+// does, so the full round also covers a server that declines it.
+// reported per connect, from iot_tls_connect() to its return:
+//
+//   wall   elapsed time
+//   cpu    this process only, the server is not counted
+//
+// and for memory, the client process only:
+//
+//   heap   the most a connect/report/delta cycle had allocated above
+//          what was in use before it, glibc's malloc is wrapped so
+//          mbedtls's allocations are counted
+//   rss    peak resident set over the round (VmHWM)
+//
+// built twice: tls_bench and tls_bench_low, the LOW_MEMORY=1 profile.
+// the sdk's mqtt buffers are static arrays, their sizes are printed.
+// mbedtls allocates its record buffers at the sizes libmbedtls was built
+// with, so the low profile only saves heap against a library built to
+// match (see network_mbedtls.c)
+//
+// the session file (TLS_SESSION_FILEPATH) is removed before and after,
+// so the bench neither resumes nor leaves behind a session of its own.
+//
+// tls_bench [connects per round]
+//
+
+#define SERVER_HOST   "localhost"
+#define TIMEOUT_MS    5000
+#define REPORT_LEN    200   // a whole state report
+#define DELTA_LEN     750   // update/accepted with metadata
+
+#ifndef MBEDTLS_SSL_IN_CONTENT_LEN  // before 2.12 both were one size
+#define MBEDTLS_SSL_IN_CONTENT_LEN  MBEDTLS_SSL_MAX_CONTENT_LEN
+#define MBEDTLS_SSL_OUT_CONTENT_LEN MBEDTLS_SSL_MAX_CONTENT_LEN
+#endif
+
+struct round_result
+{
+    uint32_t connects;
+    uint32_t full;
+    uint32_t resumed;
+    uint64_t wall_us;
+    uint64_t cpu_us;
+    size_t heap_peak;
+};
+
+static Network s_net;
+
+
+////////////////////////////////////////
+// heap in use and its high-water mark, every allocation in the process
+// goes through these
+extern void* __libc_malloc(size_t p_size);
+extern void* __libc_calloc(size_t p_count, size_t p_size);
+extern void* __libc_realloc(void* p_ptr, size_t p_size);
+extern void __libc_free(void* p_ptr);
+
+static size_t s_heap_now = 0;
+static size_t s_heap_peak = 0;
+
+static void heap_add(void* p_ptr)
+{
+    if(NULL != p_ptr)
+    {
+        s_heap_now += malloc_usable_size(p_ptr);
+        if(s_heap_now > s_heap_peak)
+        {
+            s_heap_peak = s_heap_now;
+        }
+    }
+}
+
+void* malloc(size_t p_size)
+{
+    void* ptr = __libc_malloc(p_size);
+    heap_add(ptr);
+    return(ptr);
+}
+
+void* calloc(size_t p_count, size_t p_size)
+{
+    void* ptr = __libc_calloc(p_count, p_size);
+    heap_add(ptr);
+    return(ptr);
+}
+
+void* realloc(void* p_ptr, size_t p_size)
+{
+    const size_t old = ((NULL != p_ptr) ? malloc_usable_size(p_ptr) : 0);
+    void* ptr = __libc_realloc(p_ptr, p_size);
+    if((NULL != ptr) || (0 == p_size))
+    {
+        s_heap_now -= old;
+    }
+    heap_add(ptr);
+    return(ptr);
+}
+
+void free(void* p_ptr)
+{
+    if(NULL != p_ptr)
+    {
+        s_heap_now -= malloc_usable_size(p_ptr);
+        __libc_free(p_ptr);
+    }
+}
+
+
+////////////////////////////////////////
+// VmHWM, reset by writing 5 to clear_refs
+static void rss_reset(void)
+{
+    FILE* fp = fopen("/proc/self/clear_refs", "w");
+    if(NULL != fp)
+    {
+        fputs("5", fp);
+        fclose(fp);
+    }
+}
+
+static uint32_t rss_peak_kb(void)
+{
+    uint32_t kb = 0;
+    char line[128];
+    FILE* fp = fopen("/proc/self/status", "r");
+    if(NULL == fp)
+    {
+        return(0);
+    }
+    while(NULL != fgets(line, sizeof(line), fp))
+    {
+        if(1 == sscanf(line, "VmHWM: %u kB", &kb))
+        {
+            break;
+        }
+    }
+    fclose(fp);
+    return(kb);
+}
+
+
+////////////////////////////////////////
+static uint64_t clock_us(const clockid_t p_clock)
+{
+    struct timespec ts;
+    clock_gettime(p_clock, &ts);
+    return(((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000));
+}
+
+////////////////////////////////////////
+static bool write_file(const char* p_path, const char* p_data, const size_t p_len)
+{
+    FILE* fp = fopen(p_path, "w");
+    if(NULL == fp)
+    {
+        return(false);
+    }
+    const bool ok = (fwrite(p_data, 1, p_len, fp) == p_len);
+    return((0 == fclose(fp)) && ok);
+}
+
+
+////////////////////////////////////////
+// the stand-in server, runs until the parent kills it
+static void server(const int p_notify, const bool p_resume)
+{
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context drbg;
+    mbedtls_x509_crt cacert;
+    mbedtls_x509_crt srvcert;
+    mbedtls_pk_context pkey;
+    mbedtls_ssl_cache_context cache;
+    mbedtls_ssl_ticket_context ticket;
+    mbedtls_ssl_config conf;
+    mbedtls_ssl_context ssl;
+    mbedtls_net_context listen_fd;
+    mbedtls_net_context client_fd;
+
+    mbedtls_entropy_init(&entropy);
+    mbedtls_ctr_drbg_init(&drbg);
+    mbedtls_x509_crt_init(&cacert);
+    mbedtls_x509_crt_init(&srvcert);
+    mbedtls_pk_init(&pkey);
+    mbedtls_ssl_cache_init(&cache);
+    mbedtls_ssl_ticket_init(&ticket);
+    mbedtls_ssl_config_init(&conf);
+    mbedtls_ssl_init(&ssl);
+    mbedtls_net_init(&listen_fd);
+    mbedtls_net_init(&client_fd);
+
+    uint16_t port = 0;
+    if((0 != mbedtls_ctr_drbg_seed(&drbg, mbedtls_entropy_func, &entropy, NULL, 0)) ||
+       (0 != mbedtls_x509_crt_parse(&cacert, (const unsigned char*)mbedtls_test_ca_crt, mbedtls_test_ca_crt_len)) ||
+       (0 != mbedtls_x509_crt_parse(&srvcert, (const unsigned char*)mbedtls_test_srv_crt, mbedtls_test_srv_crt_len)) ||
+       (0 != mbedtls_pk_parse_key(&pkey, (const unsigned char*)mbedtls_test_srv_key, mbedtls_test_srv_key_len, NULL, 0)) ||
+       (0 != mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_SERVER, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT)))
+    {
+        printf("server setup failed\n");
+        exit(EXIT_FAILURE);
+    }
+    mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &drbg);
+    mbedtls_ssl_conf_ca_chain(&conf, &cacert, NULL);
+    mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    if(0 != mbedtls_ssl_conf_own_cert(&conf, &srvcert, &pkey))
+    {
+        printf("server certificate not usable\n");
+        exit(EXIT_FAILURE);
+    }
+    if(p_resume)
+    {
+        mbedtls_ssl_conf_session_cache(&conf, &cache, mbedtls_ssl_cache_get, mbedtls_ssl_cache_set);
+        if(0 != mbedtls_ssl_ticket_setup(&ticket, mbedtls_ctr_drbg_random, &drbg, MBEDTLS_CIPHER_AES_256_GCM, 86400))
+        {
+            printf("server ticket setup failed\n");
+            exit(EXIT_FAILURE);
+        }
+        mbedtls_ssl_conf_session_tickets_cb(&conf, mbedtls_ssl_ticket_write, mbedtls_ssl_ticket_parse, &ticket);
+    }
+
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    if((0 != mbedtls_net_bind(&listen_fd, "127.0.0.1", "0", MBEDTLS_NET_PROTO_TCP)) ||
+       (0 != getsockname(listen_fd.fd, (struct sockaddr*)&addr, &addr_len)) ||
+       (0 != mbedtls_ssl_setup(&ssl, &conf)))
+    {
+        printf("server listen failed\n");
+        exit(EXIT_FAILURE);
+    }
+    port = ntohs(addr.sin_port);
+    if(sizeof(port) != write(p_notify, &port, sizeof(port)))
+    {
+        exit(EXIT_FAILURE);
+    }
+    close(p_notify);
+
+    unsigned char report[REPORT_LEN];
+    unsigned char delta[DELTA_LEN];
+    memset(delta, '{', sizeof(delta));
+    for(;;)
+    {
+        mbedtls_net_free(&client_fd);
+        mbedtls_ssl_session_reset(&ssl);
+        if(0 != mbedtls_net_accept(&listen_fd, &client_fd, NULL, 0, NULL))
+        {
+            continue;
+        }
+        // the server's own flights go out at once, any wait left in the
+        // wall time is the client's
+        const int nodelay = 1;
+        setsockopt(client_fd.fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+        mbedtls_ssl_set_bio(&ssl, &client_fd, mbedtls_net_send, mbedtls_net_recv, NULL);
+        if(0 != mbedtls_ssl_handshake(&ssl))
+        {
+            continue;
+        }
+
+        // one report in, one delta out, then wait for the client to close
+        size_t got = 0;
+        while(got < sizeof(report))
+        {
+            const int ret = mbedtls_ssl_read(&ssl, &report[got], sizeof(report) - got);
+            if(ret <= 0)
+            {
+                break;
+            }
+            got += ret;
+        }
+        if((got == sizeof(report)) && (sizeof(delta) == mbedtls_ssl_write(&ssl, delta, sizeof(delta))))
+        {
+            while(mbedtls_ssl_read(&ssl, report, sizeof(report)) > 0);
+        }
+        mbedtls_ssl_close_notify(&ssl);
+    }
+}
+
+////////////////////////////////////////
+static pid_t start_server(const bool p_resume, uint16_t* p_port)
+{
+    int fds[2];
+    if(0 != pipe(fds))
+    {
+        return(-1);
+    }
+    const pid_t pid = fork();
+    if(0 == pid)
+    {
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        close(fds[0]);
+        server(fds[1], p_resume);
+        _exit(EXIT_SUCCESS);
+    }
+    close(fds[1]);
+    const bool ok = ((pid > 0) && (sizeof(*p_port) == read(fds[0], p_port, sizeof(*p_port))));
+    close(fds[0]);
+    if(!ok && (pid > 0))
+    {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        return(-1);
+    }
+    return(pid);
+}
+
+
+////////////////////////////////////////
+// connect, send a report, take the delta, disconnect
+static bool cycle(struct round_result* p_result)
+{
+    const size_t heap_start = s_heap_now;
+    s_heap_peak = s_heap_now;
+    const uint64_t wall_start = clock_us(CLOCK_MONOTONIC);
+    const uint64_t cpu_start = clock_us(CLOCK_PROCESS_CPUTIME_ID);
+    IoT_Error_t rc = iot_tls_connect(&s_net, NULL);
+    p_result->wall_us += (clock_us(CLOCK_MONOTONIC) - wall_start);
+    p_result->cpu_us += (clock_us(CLOCK_PROCESS_CPUTIME_ID) - cpu_start);
+    ++p_result->connects;
+
+    if(SUCCESS == rc)
+    {
+        unsigned char report[REPORT_LEN];
+        unsigned char delta[DELTA_LEN];
+        memset(report, '{', sizeof(report));
+        size_t len = 0;
+        Timer timer;
+        init_timer(&timer);
+        countdown_ms(&timer, TIMEOUT_MS);
+        rc = iot_tls_write(&s_net, report, sizeof(report), &timer, &len);
+        if(SUCCESS == rc)
+        {
+            rc = iot_tls_read(&s_net, delta, sizeof(delta), &timer, &len);
+        }
+        iot_tls_disconnect(&s_net);
+    }
+    iot_tls_destroy(&s_net);
+    if((s_heap_peak - heap_start) > p_result->heap_peak)
+    {
+        p_result->heap_peak = (s_heap_peak - heap_start);
+    }
+    return(SUCCESS == rc);
+}
+
+////////////////////////////////////////
+static bool run(const char* p_name, const bool p_resume, const uint32_t p_connects, struct round_result* p_result)
+{
+    memset(p_result, 0, sizeof(*p_result));
+    uint16_t port = 0;
+    const pid_t pid = start_server(p_resume, &port);
+    if(pid < 0)
+    {
+        printf("%s: server did not start\n", p_name);
+        return(false);
+    }
+    s_net.tlsConnectParams.DestinationPort = port;
+
+    struct tls_stats before;
+    struct tls_stats after;
+    tls_get_stats(&before);
+    rss_reset();
+    bool ok = true;
+    for(uint32_t i=0; (i < p_connects) && ok; ++i)
+    {
+        ok = cycle(p_result);
+    }
+    tls_get_stats(&after);
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+
+    p_result->full = (after.full - before.full);
+    p_result->resumed = (after.resumed - before.resumed);
+    printf("%-8s %8u %6u %8u %11.2f %10.2f %12.1f %11u\n", p_name, p_result->connects, p_result->full, p_result->resumed,
+           ((double)p_result->wall_us / p_result->connects / 1000.0), ((double)p_result->cpu_us / p_result->connects / 1000.0),
+           (p_result->heap_peak / 1024.0), rss_peak_kb());
+    if(!ok)
+    {
+        printf("%s: connect %u failed\n", p_name, p_result->connects);
+    }
+    return(ok);
+}
+
+
+////////////////////////////////////////
+int main(int argc, char* argv[])
+{
+    const uint32_t connects = ((argc > 1) ? (uint32_t)atoi(argv[1]) : 100);
+    if(connects < 2)
+    {
+        printf("usage: tls_bench [connects per round, at least 2]\n");
+        return(EXIT_FAILURE);
+    }
+
+    // the client side credentials, from files as the bridge has them
+    char dir[] = "/tmp/tls_bench.XXXXXX";
+    if(NULL == mkdtemp(dir))
+    {
+        printf("no temp dir\n");
+        return(EXIT_FAILURE);
+    }
+    char ca_path[64];
+    char crt_path[64];
+    char key_path[64];
+    snprintf(ca_path, sizeof(ca_path), "%s/ca.pem", dir);
+    snprintf(crt_path, sizeof(crt_path), "%s/client.pem", dir);
+    snprintf(key_path, sizeof(key_path), "%s/client.key", dir);
+    const bool written = (write_file(ca_path, mbedtls_test_ca_crt, mbedtls_test_ca_crt_len - 1) &&
+                          write_file(crt_path, mbedtls_test_cli_crt, mbedtls_test_cli_crt_len - 1) &&
+                          write_file(key_path, mbedtls_test_cli_key, mbedtls_test_cli_key_len - 1));
+
+    unlink(TLS_SESSION_FILEPATH);
+    iot_tls_init(&s_net, ca_path, crt_path, key_path, SERVER_HOST, 0, TIMEOUT_MS, true);
+
+    struct round_result full;
+    struct round_result resumed;
+    printf("%u connects per round, cpu and memory are the client only\n", connects);
+    printf("asking for %d byte records (0 is the default), mbedtls record buffers %d in %d out, mqtt buffers %d tx %d rx\n",
+           TLS_MAX_FRAG_LEN, MBEDTLS_SSL_IN_CONTENT_LEN, MBEDTLS_SSL_OUT_CONTENT_LEN, AWS_IOT_MQTT_TX_BUF_LEN, AWS_IOT_MQTT_RX_BUF_LEN);
+    printf("round    connects   full  resumed  wall avg ms  cpu avg ms  heap max kb  rss max kb\n");
+    const bool ok = (written &&
+                     run("full", false, connects, &full) &&
+                     run("resumed", true, connects, &resumed));
+
+    unlink(TLS_SESSION_FILEPATH);
+    unlink(ca_path);
+    unlink(crt_path);
+    unlink(key_path);
+    rmdir(dir);
+    if(!ok)
+    {
+        return(EXIT_FAILURE);
+    }
+
+    // every handshake after the first has to have been resumed
+    if((connects != full.full) || ((connects - 1) > resumed.resumed))
+    {
+        printf("FAILED: expected %u full handshakes, then at least %u resumed\n", connects, connects - 1);
+        return(EXIT_FAILURE);
+    }
+    struct tls_stats stats;
+    tls_get_stats(&stats);
+    printf("resumed handshake: %.1fx less wall time, %.1fx less cpu, record size in use %u\n",
+           ((double)full.wall_us / resumed.wall_us), ((double)full.cpu_us / resumed.cpu_us), stats.frag_len);
+    return(EXIT_SUCCESS);
+}